@@ -217,6 +217,20 @@ public:
         );
     }
 
+    /**
+     * \brief Getter for the first address in this range.
+     */
+    const address_type& first() const {
+        return first_;
+    }
+
+    /**
+     * \brief Getter for the last address (inclusive) in this range.
+     */
+    const address_type& last() const {
+        return last_;
+    }
+
     /**
      * \brief Indicates whether an address is included in this range.
      * \param addr The address to test.
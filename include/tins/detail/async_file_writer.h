@@ -0,0 +1,137 @@
+/*
+ * Copyright (c) 2017, Matias Fontanini
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are
+ * met:
+ * 
+ * * Redistributions of source code must retain the above copyright
+ *   notice, this list of conditions and the following disclaimer.
+ * * Redistributions in binary form must reproduce the above
+ *   copyright notice, this list of conditions and the following disclaimer
+ *   in the documentation and/or other materials provided with the
+ *   distribution.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+
+#ifndef TINS_ASYNC_FILE_WRITER_H
+#define TINS_ASYNC_FILE_WRITER_H
+
+#include <tins/cxxstd.h>
+
+#if TINS_IS_CXX11 && !defined(_WIN32)
+
+#include <string>
+#include <vector>
+#include <atomic>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <stdint.h>
+
+namespace Tins {
+namespace Internals {
+/**
+ * \cond
+ */
+
+enum OverflowPolicy {
+    BLOCK_ON_OVERFLOW,
+    DROP_NEWEST_ON_OVERFLOW,
+    DROP_OLDEST_ON_OVERFLOW
+};
+
+/**
+ * Appends records to a file from a background thread.
+ *
+ * Records are copied into one of two buffers. Once it's full, it's handed 
+ * over to the writing thread and the producer carries on using the other 
+ * one, so appending a record only takes a memcpy. Locks are only taken 
+ * when handing over a buffer.
+ *
+ * Writes always end at a multiple of BLOCK_SIZE in the file. Whatever is 
+ * left after that is kept and written along with the next buffer, unless
+ * a flush was requested.
+ *
+ * There can only be a single producer.
+ */
+class AsyncFileWriter {
+public:
+    static const size_t BLOCK_SIZE;
+
+    AsyncFileWriter(const std::string& file_name, size_t buffer_size, 
+                    OverflowPolicy policy);
+    ~AsyncFileWriter();
+
+    // Returns false if the record was dropped. The record is made of two
+    // parts, so the caller doesn't need to join them
+    bool write(const uint8_t* header, size_t header_size, 
+               const uint8_t* data, size_t data_size);
+
+    // Writes everything appended so far and waits until it's done
+    void flush();
+
+    uint64_t written_bytes() const;
+    uint64_t dropped_bytes() const;
+    uint64_t dropped_records() const;
+private:
+    AsyncFileWriter(const AsyncFileWriter&);
+    AsyncFileWriter& operator=(const AsyncFileWriter&);
+
+    static const int NO_BUFFER;
+
+    struct buffer_type {
+        std::vector<uint8_t> data;
+        size_t size;
+        uint64_t records;
+    };
+
+    bool make_room(size_t size);
+    void hand_over(bool flush);
+    void wait_until_idle();
+    void check_error();
+    void run();
+    void write_buffer(const buffer_type& buffer, bool flush);
+
+    buffer_type buffers_[2];
+    int active_;
+    OverflowPolicy policy_;
+    int fd_;
+    // Bytes after the last write's aligned end, owned by the writing thread
+    std::vector<uint8_t> tail_;
+    uint64_t offset_;
+    std::atomic<int> pending_;
+    std::atomic<uint64_t> written_bytes_;
+    std::atomic<uint64_t> dropped_bytes_;
+    std::atomic<uint64_t> dropped_records_;
+    std::mutex mutex_;
+    std::condition_variable condition_;
+    bool flush_pending_;
+    bool stopping_;
+    std::atomic<int> error_;
+    std::thread thread_;
+};
+
+/**
+ * \endcond
+ */
+} // Internals
+} // Tins
+
+#endif // TINS_IS_CXX11 && !_WIN32
+
+#endif // TINS_ASYNC_FILE_WRITER_H
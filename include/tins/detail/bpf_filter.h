@@ -0,0 +1,90 @@
+/*
+ * Copyright (c) 2017, Matias Fontanini
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are
+ * met:
+ * 
+ * * Redistributions of source code must retain the above copyright
+ *   notice, this list of conditions and the following disclaimer.
+ * * Redistributions in binary form must reproduce the above
+ *   copyright notice, this list of conditions and the following disclaimer
+ *   in the documentation and/or other materials provided with the
+ *   distribution.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+
+#ifndef TINS_BPF_FILTER_H
+#define TINS_BPF_FILTER_H
+
+#include <tins/config.h>
+
+#ifdef TINS_HAVE_PCAP
+
+#include <vector>
+#include <stdint.h>
+#include <pcap.h>
+
+namespace Tins {
+namespace Internals {
+/**
+ * \cond
+ */
+
+/**
+ * Runs classic BPF programs over raw buffers.
+ *
+ * Programs are validated and translated once into a form that is cheaper 
+ * to run than the original instructions: opcodes are mapped into a dense
+ * set of operations, jumps are turned into absolute instruction indexes 
+ * and common instruction pairs, such as a load followed by a conditional 
+ * jump, are fused into a single operation.
+ */
+class BPFFilter {
+public:
+    BPFFilter();
+
+    // Translates the given program. Returns false if it's not valid
+    bool load(const bpf_program& program);
+
+    // Whether a program was successfully loaded
+    bool is_loaded() const;
+
+    // Runs the program. Returns the amount of bytes to keep, 0 if 
+    // the packet doesn't match
+    uint32_t run(const uint8_t* buffer, uint32_t total_sz, uint32_t wire_sz) const;
+private:
+    struct instruction {
+        uint32_t op;
+        uint32_t k;
+        uint32_t jump_true;
+        uint32_t jump_false;
+        uint32_t compare;
+    };
+
+    std::vector<instruction> instructions_;
+};
+
+/**
+ * \endcond
+ */
+} // Internals
+} // Tins
+
+#endif // TINS_HAVE_PCAP
+
+#endif // TINS_BPF_FILTER_H
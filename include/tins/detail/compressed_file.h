@@ -0,0 +1,142 @@
+/*
+ * Copyright (c) 2017, Matias Fontanini
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are
+ * met:
+ * 
+ * * Redistributions of source code must retain the above copyright
+ *   notice, this list of conditions and the following disclaimer.
+ * * Redistributions in binary form must reproduce the above
+ *   copyright notice, this list of conditions and the following disclaimer
+ *   in the documentation and/or other materials provided with the
+ *   distribution.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+
+#ifndef TINS_COMPRESSED_FILE_H
+#define TINS_COMPRESSED_FILE_H
+
+#include <tins/config.h>
+
+#ifdef TINS_HAVE_COMPRESSION
+
+#include <string>
+#include <thread>
+#include <atomic>
+#include <cstdio>
+
+namespace Tins {
+namespace Internals {
+/**
+ * \cond
+ */
+
+enum CompressionFormat {
+    NO_COMPRESSION,
+    GZIP_COMPRESSION,
+    ZSTD_COMPRESSION
+};
+
+// Detects the format of a file by looking at its magic number
+CompressionFormat detect_compression(const std::string& file_name);
+
+// Whether support for the given format was compiled in
+bool is_compression_supported(CompressionFormat format);
+
+/**
+ * Decompresses a file on a background thread.
+ *
+ * The decompressed contents can be read from the stream returned by 
+ * DecompressionThread::stream, which can be handed over to libpcap. The
+ * stream must still be open when this object is destroyed.
+ *
+ * If the file is corrupt or truncated, the stream just ends early. The
+ * error is stored and thrown by DecompressionThread::check_error.
+ */
+class DecompressionThread {
+public:
+    DecompressionThread(const std::string& file_name, CompressionFormat format);
+    ~DecompressionThread();
+
+    // The caller takes ownership of this stream
+    FILE* stream() const;
+
+    // Throws if the file couldn't be decompressed. Only meaningful once the
+    // end of the stream has been reached
+    void check_error() const;
+private:
+    DecompressionThread(const DecompressionThread&);
+    DecompressionThread& operator=(const DecompressionThread&);
+
+    void run(FILE* input);
+
+    std::thread thread_;
+    FILE* stream_;
+    int read_fd_;
+    int write_fd_;
+    CompressionFormat format_;
+    std::string error_;
+    std::atomic<bool> failed_;
+};
+
+/**
+ * Compresses data written to a stream into a file, on a background thread.
+ *
+ * The caller takes ownership of the stream returned by 
+ * CompressionThread::stream and must close it before this object is 
+ * destroyed; the file is finished once the stream is closed.
+ *
+ * Errors writing the file are stored and thrown by CompressionThread::finish
+ * or CompressionThread::check_error. The destructor ignores them.
+ */
+class CompressionThread {
+public:
+    CompressionThread(const std::string& file_name, CompressionFormat format, int level);
+    ~CompressionThread();
+
+    FILE* stream() const;
+
+    // Throws if writing the file has failed so far
+    void check_error() const;
+    // Waits until the file is finished. The stream must be closed already
+    void finish();
+private:
+    CompressionThread(const CompressionThread&);
+    CompressionThread& operator=(const CompressionThread&);
+
+    void run(FILE* output);
+    void set_error(const std::string& error);
+
+    std::thread thread_;
+    FILE* stream_;
+    int read_fd_;
+    CompressionFormat format_;
+    int level_;
+    std::string error_;
+    std::atomic<bool> failed_;
+};
+
+/**
+ * \endcond
+ */
+} // Internals
+} // Tins
+
+#endif // TINS_HAVE_COMPRESSION
+
+#endif // TINS_COMPRESSED_FILE_H
@@ -0,0 +1,187 @@
+/*
+ * Copyright (c) 2017, Matias Fontanini
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are
+ * met:
+ * 
+ * * Redistributions of source code must retain the above copyright
+ *   notice, this list of conditions and the following disclaimer.
+ * * Redistributions in binary form must reproduce the above
+ *   copyright notice, this list of conditions and the following disclaimer
+ *   in the documentation and/or other materials provided with the
+ *   distribution.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+
+#ifndef TINS_FRAME_QUEUE_H
+#define TINS_FRAME_QUEUE_H
+
+#include <tins/cxxstd.h>
+
+#if TINS_IS_CXX11
+
+#include <atomic>
+#include <vector>
+#include <cstring>
+#include <stdint.h>
+#include <tins/timestamp.h>
+
+namespace Tins {
+namespace Internals {
+/**
+ * \cond
+ */
+
+/**
+ * Lock-free single producer, single consumer queue of raw frames.
+ *
+ * Frames are copied into a fixed size slab which is allocated up front. 
+ * Each frame takes a header plus its size rounded up to 8 bytes, so small 
+ * frames don't waste a whole snap length sized slot. A frame that doesn't 
+ * fit at the end of the slab is placed at the beginning, leaving a marker
+ * behind so the consumer knows it has to wrap around.
+ */
+class FrameQueue {
+public:
+    struct frame {
+        const uint8_t* data;
+        uint32_t size;
+        uint32_t wire_size;
+        Timestamp timestamp;
+    };
+
+    explicit FrameQueue(size_t capacity)
+    : buffer_(align(capacity)), head_(0), tail_(0), cached_head_(0), 
+      cached_tail_(0) {
+
+    }
+
+    // Indicates whether a frame of this size can always be stored once the
+    // queue is drained. Wrapping around wastes less than a record, so 
+    // records can take up to half of the slab
+    bool fits(uint32_t size) const {
+        return 2 * (sizeof(record_header) + align(size)) <= buffer_.size();
+    }
+
+    // Producer side. Returns false if there's no room for this frame
+    bool push(const uint8_t* data, uint32_t size, uint32_t wire_size,
+              const Timestamp& timestamp) {
+        const size_t record_size = sizeof(record_header) + align(size);
+        const size_t tail = tail_.load(std::memory_order_relaxed);
+        const size_t offset = tail % buffer_.size();
+        const size_t padding = (offset + record_size > buffer_.size()) ? 
+                               buffer_.size() - offset : 0;
+        const size_t required = padding + record_size;
+        if (required > buffer_.size()) {
+            return false;
+        }
+        if (tail + required - cached_head_ > buffer_.size()) {
+            cached_head_ = head_.load(std::memory_order_acquire);
+            if (tail + required - cached_head_ > buffer_.size()) {
+                return false;
+            }
+        }
+        if (padding > 0) {
+            header_at(offset)->size = WRAP_MARKER;
+        }
+        const size_t record_offset = (offset + padding) % buffer_.size();
+        record_header* header = header_at(record_offset);
+        header->size = size;
+        header->wire_size = wire_size;
+        header->timestamp = timestamp;
+        std::memcpy(&buffer_[record_offset + sizeof(record_header)], data, size);
+        tail_.store(tail + required, std::memory_order_release);
+        return true;
+    }
+
+    // Consumer side. Returns false if the queue is empty
+    bool front(frame& output) {
+        size_t head = head_.load(std::memory_order_relaxed);
+        if (head == cached_tail_) {
+            cached_tail_ = tail_.load(std::memory_order_acquire);
+            if (head == cached_tail_) {
+                return false;
+            }
+        }
+        size_t offset = head % buffer_.size();
+        record_header* header = header_at(offset);
+        if (header->size == WRAP_MARKER) {
+            head += buffer_.size() - offset;
+            head_.store(head, std::memory_order_release);
+            offset = 0;
+            header = header_at(0);
+        }
+        output.data = &buffer_[offset + sizeof(record_header)];
+        output.size = header->size;
+        output.wire_size = header->wire_size;
+        output.timestamp = header->timestamp;
+        return true;
+    }
+
+    // Consumer side. Releases the frame returned by the last call to front
+    void pop() {
+        const size_t head = head_.load(std::memory_order_relaxed);
+        const uint32_t size = header_at(head % buffer_.size())->size;
+        head_.store(head + sizeof(record_header) + align(size), std::memory_order_release);
+    }
+
+    bool empty() const {
+        return head_.load(std::memory_order_acquire) == tail_.load(std::memory_order_acquire);
+    }
+private:
+    static const uint32_t WRAP_MARKER = 0xffffffff;
+    static const size_t CACHE_LINE_SIZE = 64;
+
+    struct record_header {
+        uint32_t size;
+        uint32_t wire_size;
+        Timestamp timestamp;
+    };
+
+    static size_t align(size_t size) {
+        return (size + 7) & ~static_cast<size_t>(7);
+    }
+
+    record_header* header_at(size_t offset) {
+        return reinterpret_cast<record_header*>(&buffer_[offset]);
+    }
+
+    // Keep the consumer and producer indexes on different cache lines. This
+    // uses padding rather than alignas so the queue can be allocated using 
+    // plain operator new
+    std::vector<uint8_t> buffer_;
+    char buffer_padding_[CACHE_LINE_SIZE];
+    std::atomic<size_t> head_;
+    char head_padding_[CACHE_LINE_SIZE - sizeof(std::atomic<size_t>)];
+    std::atomic<size_t> tail_;
+    char tail_padding_[CACHE_LINE_SIZE - sizeof(std::atomic<size_t>)];
+    // Producer's copy of head_ and consumer's copy of tail_
+    size_t cached_head_;
+    char cached_head_padding_[CACHE_LINE_SIZE - sizeof(size_t)];
+    size_t cached_tail_;
+};
+
+/**
+ * \endcond
+ */
+} // Internals
+} // Tins
+
+#endif // TINS_IS_CXX11
+
+#endif // TINS_FRAME_QUEUE_H
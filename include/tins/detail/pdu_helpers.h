@@ -50,12 +50,183 @@ PDU* pdu_from_dlt_flag(int flag, const uint8_t* buffer,
                        uint32_t size, bool rawpdu_on_no_match = true);
 #endif // TINS_HAVE_PCAP
 PDU* pdu_from_flag(PDU::PDUType type, const uint8_t* buffer, uint32_t size);
+PDU* raw_pdu_from_buffer(const uint8_t* buffer, uint32_t size);
+
+// Link layer types as defined by libpcap's LINKTYPE_ values. These are the
+// ones stored in capture files, unlike DLT_ values which are platform specific
+enum LinkType {
+    LINKTYPE_NULL = 0,
+    LINKTYPE_ETHERNET = 1,
+    LINKTYPE_RAW = 101,
+    LINKTYPE_IEEE802_11 = 105,
+    LINKTYPE_LOOP = 108,
+    LINKTYPE_LINUX_SLL = 113,
+    LINKTYPE_IEEE802_11_RADIOTAP = 127,
+    LINKTYPE_PPI = 192,
+    LINKTYPE_PKTAP = 258
+};
+
+typedef PDU* (*frame_decoder)(const uint8_t* buffer, uint32_t size);
+
+/*
+ * Returns the function that decodes frames of the given LINKTYPE_ value or
+ * 0 if it's not supported. The returned functions return 0 rather than 
+ * throwing if a frame is malformed.
+ */
+frame_decoder frame_decoder_from_link_type(uint32_t link_type);
+// Decodes a frame as a RawPDU
+PDU* decode_raw_frame(const uint8_t* buffer, uint32_t size);
+
+#ifdef TINS_HAVE_PCAP
+/*
+ * Maps a DLT_ value into the LINKTYPE_ value that represents it, following
+ * libpcap's own mapping. Returns false if the type has no mapping.
+ */
+bool dlt_to_link_type(int dlt, uint32_t& link_type);
+#endif // TINS_HAVE_PCAP
+/*
+ * Decodes a lazy placeholder. Contents that can't be decoded are returned
+ * as a RawPDU and is_valid is set to false.
+ */
+PDU* decode_lazy_pdu(const PDU& pdu, bool& is_valid);
+/*
+ * Decodes a lazy placeholder for const accessors. This is thread safe and
+ * only decodes once; the placeholder keeps the decoded PDU.
+ */
+PDU* shared_decoded_lazy_pdu(const PDU& pdu, PDU* parent);
+// Takes the PDU decoded by shared_decoded_lazy_pdu, if any
+PDU* release_decoded_lazy_pdu(PDU& pdu, bool& is_valid);
 
 Constants::Ethernet::e pdu_flag_to_ether_type(PDU::PDUType flag);
 PDU::PDUType ether_type_to_pdu_flag(Constants::Ethernet::e flag);
 Constants::IP::e pdu_flag_to_ip_type(PDU::PDUType flag);
 PDU::PDUType ip_type_to_pdu_flag(Constants::IP::e flag);
 
+// The 16 bit sum of a range of bytes, in host endian
+uint16_t sum_bytes(const uint8_t* data, uint32_t size);
+
+/*
+ * Incrementally updates an IP, TCP or UDP checksum after the data it covers
+ * went from adding up to old_sum to adding up to new_sum. For UDP, a 
+ * checksum of 0 means there's no checksum, so it's kept that way.
+ */
+uint16_t update_checksum(uint16_t checksum, uint16_t old_sum, uint16_t new_sum, 
+                         bool is_udp);
+// The same, for a checksum stored in a buffer in network byte order
+void patch_checksum(uint8_t* checksum, uint16_t old_sum, uint16_t new_sum, 
+                    bool is_udp);
+
+/*
+ * Serializes a PDU into a buffer owned by the calling thread, which is
+ * reused across calls. If that buffer is already in use further up the
+ * stack, a buffer owned by this object is used instead.
+ */
+class ScratchSerialization {
+public:
+    ScratchSerialization(PDU& pdu);
+    ~ScratchSerialization();
+
+    uint8_t* data() {
+        return buffer_->empty() ? 0 : &(*buffer_)[0];
+    }
+
+    const uint8_t* data() const {
+        return buffer_->empty() ? 0 : &(*buffer_)[0];
+    }
+
+    uint32_t size() const {
+        return static_cast<uint32_t>(buffer_->size());
+    }
+private:
+    ScratchSerialization(const ScratchSerialization&);
+    ScratchSerialization& operator=(const ScratchSerialization&);
+
+    PDU::serialization_type* buffer_;
+    PDU::serialization_type own_buffer_;
+    bool uses_scratch_;
+};
+
+/*
+ * Temporarily changes a packet so that its headers can be serialized 
+ * separately from its payload, restoring it when destroyed. 
+ *
+ * The payload is either the one provided, which is meant to follow the
+ * packet, or the packet's trailing RawPDU, which is detached from it. 
+ * This is only done if the packet is a supported stack ending in TCP or 
+ * UDP, since the headers have to be fixed afterwards to account for the 
+ * payload. Otherwise, the provided payload is attached to the packet 
+ * as a RawPDU so that everything is serialized contiguously.
+ */
+class PayloadSplitter {
+public:
+    PayloadSplitter(PDU& pdu, const uint8_t* payload, uint32_t payload_size, 
+                    bool gather);
+    ~PayloadSplitter();
+
+    bool is_split() const {
+        return is_split_;
+    }
+
+    const uint8_t* payload() const {
+        return payload_;
+    }
+
+    uint32_t payload_size() const {
+        return payload_size_;
+    }
+private:
+    PayloadSplitter(const PayloadSplitter&);
+    PayloadSplitter& operator=(const PayloadSplitter&);
+
+    PDU* parent_;
+    PDU* detached_;
+    PDU* attached_;
+    const uint8_t* payload_;
+    uint32_t payload_size_;
+    bool is_split_;
+};
+
+/*
+ * Serializes a packet and an optional payload that follows it as a list of
+ * buffers, so the payload can be sent without being copied. If gather is 
+ * false or the packet can't be split, there's a single buffer. 
+ */
+class GatherSerialization {
+public:
+    GatherSerialization(PDU& pdu, const uint8_t* payload, uint32_t payload_size, 
+                        bool gather);
+
+    const uint8_t* headers() const {
+        return headers_.data();
+    }
+
+    uint32_t headers_size() const {
+        return headers_size_;
+    }
+
+    const uint8_t* payload() const {
+        return splitter_.is_split() ? splitter_.payload() : 0;
+    }
+
+    uint32_t payload_size() const {
+        return splitter_.is_split() ? splitter_.payload_size() : 0;
+    }
+
+    uint32_t size() const {
+        return headers_size() + payload_size();
+    }
+private:
+    GatherSerialization(const GatherSerialization&);
+    GatherSerialization& operator=(const GatherSerialization&);
+
+    void account_for_payload(PDU::PDUType link_type);
+
+    // The splitter has to modify the packet before it's serialized
+    PayloadSplitter splitter_;
+    ScratchSerialization headers_;
+    uint32_t headers_size_;
+};
+
 inline bool is_dot3(const uint8_t* ptr, size_t sz) {
     return (sz >= 13 && ptr[12] < 8);
 }
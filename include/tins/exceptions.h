@@ -151,6 +151,14 @@ public:
     : exception_base(msg) { }
 };
 
+/**
+ * \brief Exception thrown when a memory mapped ring's geometry is invalid.
+ */
+class invalid_ring_configuration : public exception_base {
+public:
+    invalid_ring_configuration() : exception_base("Invalid ring geometry") { }
+};
+
 /**
  * \brief Exception thrown when an invalid socket type is provided
  * to PacketSender.
@@ -262,6 +270,16 @@ public:
     pcap_open_failed() : exception_base("Failed to create pcap handle") { }
 };
 
+/**
+ * \brief Exception thrown when a capture file can't be opened or is invalid
+ */
+class capture_file_error : public exception_base {
+public:
+    capture_file_error(const std::string& message) : exception_base(message) {
+
+    }
+};
+
 /**
  * \brief Exception thrown when a function not supported on the current OS
  * is called
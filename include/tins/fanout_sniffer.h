@@ -0,0 +1,230 @@
+/*
+ * Copyright (c) 2017, Matias Fontanini
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are
+ * met:
+ * 
+ * * Redistributions of source code must retain the above copyright
+ *   notice, this list of conditions and the following disclaimer.
+ * * Redistributions in binary form must reproduce the above
+ *   copyright notice, this list of conditions and the following disclaimer
+ *   in the documentation and/or other materials provided with the
+ *   distribution.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+
+#ifndef TINS_FANOUT_SNIFFER_H
+#define TINS_FANOUT_SNIFFER_H
+
+#include <tins/ring_sniffer.h>
+
+#if defined(TINS_HAVE_PACKET_RING) && TINS_IS_CXX11
+
+#include <string>
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <exception>
+
+namespace Tins {
+
+/**
+ * \class FanoutSniffer
+ * \brief Captures packets using several threads through a PACKET_FANOUT group.
+ *
+ * This class opens one RingSniffer per worker, all of them joined to the 
+ * same PACKET_FANOUT group on the given device. The kernel distributes the
+ * captured packets among the sockets in the group and each of them is 
+ * processed by its own thread.
+ *
+ * When using RingSnifferConfiguration::FANOUT_HASH, which is the default, 
+ * every packet in a flow is delivered to the same worker. Since the 
+ * functor provided to FanoutSniffer::sniff_loop is copied once per worker,
+ * per worker state such as a TCPIP::StreamFollower can be used without 
+ * any locking:
+ *
+ * \code
+ * struct Worker {
+ *     bool operator()(Packet& packet) {
+ *         follower.process_packet(packet);
+ *         return true;
+ *     }
+ *
+ *     TCPIP::StreamFollower follower;
+ * };
+ *
+ * FanoutSniffer sniffer("eth0", 8);
+ * sniffer.sniff_loop(Worker());
+ * \endcode
+ *
+ * This class is only available on Linux, when compiling in C++11 mode.
+ */
+class TINS_API FanoutSniffer {
+public:
+    /**
+     * The type used to indicate how packets are distributed.
+     */
+    typedef RingSnifferConfiguration::FanoutMode FanoutMode;
+
+    /**
+     * \brief Constructs a FanoutSniffer.
+     *
+     * If the configuration has a fanout group set, its identifier is used. 
+     * Otherwise, a new group is created using 
+     * RingSnifferConfiguration::set_unique_fanout.
+     *
+     * \param device The device from which to capture packets.
+     * \param worker_count The amount of sockets and worker threads to use.
+     * \param mode The mode used to distribute packets among workers.
+     * \param configuration The configuration used for every RingSniffer.
+     */
+    FanoutSniffer(const std::string& device, size_t worker_count,
+                  FanoutMode mode = RingSnifferConfiguration::FANOUT_HASH,
+                  const RingSnifferConfiguration& configuration = RingSnifferConfiguration());
+
+    /**
+     * \brief Starts a sniffing loop on every worker.
+     *
+     * The functor is copied once for each worker and every copy is only 
+     * ever called from its worker's thread. It must implement one of the
+     * operators accepted by BaseSniffer::sniff_loop. Just like 
+     * BaseSniffer::sniff_loop, malformed_packet and pdu_not_found 
+     * exceptions thrown by the functor are caught.
+     *
+     * This call blocks until every worker finishes. A worker finishes when
+     * its read timeout expires or when FanoutSniffer::stop_sniff is called.
+     * If any functor returns false or throws any other exception, every 
+     * worker is stopped. The first such exception is then rethrown from 
+     * this call.
+     *
+     * \param function The callback handler object which should process packets.
+     */
+    template <typename Functor>
+    void sniff_loop(Functor function);
+
+    /**
+     * \brief Stops every worker.
+     *
+     * This can be called from any thread.
+     */
+    void stop_sniff();
+
+    /**
+     * \brief Retrieves the kernel statistics, added up over every socket.
+     */
+    RingSniffer::statistics stats();
+
+    /**
+     * \brief Sets whether to extract RawPDUs or fully parsed packets.
+     *
+     * \sa BaseSniffer::set_extract_raw_pdus
+     * \param value Whether to extract RawPDUs or not.
+     */
+    void set_extract_raw_pdus(bool value);
+
+    /**
+     * \brief Sets whether inner PDUs should be decoded lazily.
+     *
+     * \sa BaseSniffer::set_lazy_decoding
+     * \param value Whether to decode inner PDUs lazily or not.
+     */
+    void set_lazy_decoding(bool value);
+
+    /**
+     * Retrieves the amount of workers.
+     */
+    size_t worker_count() const;
+
+    /**
+     * Retrieves the fanout group identifier.
+     */
+    uint16_t group_id() const;
+
+    /**
+     * \brief Retrieves the sniffer used by a worker.
+     *
+     * \param index The worker's index.
+     */
+    RingSniffer& sniffer(size_t index);
+private:
+    template <typename Functor>
+    void run_worker(RingSniffer& sniffer, Functor& function);
+
+    std::vector<RingSniffer> sniffers_;
+    uint16_t group_id_;
+};
+
+template <typename Functor>
+void FanoutSniffer::sniff_loop(Functor function) {
+    std::vector<std::thread> threads;
+    std::mutex error_mutex;
+    std::exception_ptr error;
+    threads.reserve(sniffers_.size());
+    try {
+        for (size_t i = 0; i < sniffers_.size(); ++i) {
+            threads.emplace_back([&, i, function]() mutable {
+                try {
+                    run_worker(sniffers_[i], function);
+                }
+                catch (...) {
+                    std::lock_guard<std::mutex> _(error_mutex);
+                    if (!error) {
+                        error = std::current_exception();
+                    }
+                    stop_sniff();
+                }
+            });
+        }
+    }
+    catch (...) {
+        // Joinable threads can't be destroyed, so stop the ones that 
+        // already started before propagating the error
+        stop_sniff();
+        for (size_t i = 0; i < threads.size(); ++i) {
+            threads[i].join();
+        }
+        throw;
+    }
+    for (size_t i = 0; i < threads.size(); ++i) {
+        threads[i].join();
+    }
+    if (error) {
+        std::rethrow_exception(error);
+    }
+}
+
+template <typename Functor>
+void FanoutSniffer::run_worker(RingSniffer& sniffer, Functor& function) {
+    for (RingSniffer::iterator it = sniffer.begin(); it != sniffer.end(); ++it) {
+        try {
+            // If the functor returns false, everyone is done
+            if (!Tins::Internals::invoke_loop_cb(function, *it)) {
+                stop_sniff();
+                return;
+            }
+        }
+        catch(malformed_packet&) { }
+        catch(pdu_not_found&) { }
+    }
+}
+
+} // Tins
+
+#endif // TINS_HAVE_PACKET_RING && TINS_IS_CXX11
+
+#endif // TINS_FANOUT_SNIFFER_H
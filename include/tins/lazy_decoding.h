@@ -0,0 +1,93 @@
+/*
+ * Copyright (c) 2017, Matias Fontanini
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are
+ * met:
+ * 
+ * * Redistributions of source code must retain the above copyright
+ *   notice, this list of conditions and the following disclaimer.
+ * * Redistributions in binary form must reproduce the above
+ *   copyright notice, this list of conditions and the following disclaimer
+ *   in the documentation and/or other materials provided with the
+ *   distribution.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+
+#ifndef TINS_LAZY_DECODING_H
+#define TINS_LAZY_DECODING_H
+
+#include <tins/macros.h>
+
+namespace Tins {
+
+/**
+ * \class LazyDecodingGuard
+ * \brief Enables lazy decoding of inner PDUs while in scope.
+ *
+ * While a guard that enables lazy decoding is alive, PDUs constructed from
+ * a buffer in the current thread will only parse their own header. Their
+ * inner PDU is stored as an undecoded placeholder, which is parsed the first
+ * time it's accessed through the non const PDU::inner_pdu overload (and 
+ * therefore through PDU::find_pdu, PDU::rfind_pdu, etc) or when PDU::decode
+ * is called. Const accessors decode as well, keeping the decoded PDU next
+ * to the placeholder; this is thread safe, so a const PDU can still be
+ * inspected from several threads.
+ *
+ * This makes constructing a PDU stack much cheaper when only the outer
+ * layers are inspected, which is usually the case when filtering or
+ * dispatching packets. Serializing or cloning a PDU keeps working as usual.
+ *
+ * Guards can be nested; the previous state is restored on destruction.
+ *
+ * \code
+ * {
+ *     LazyDecodingGuard guard;
+ *     EthernetII eth(buffer, size); // Only the ethernet header is parsed
+ *     IP& ip = eth.rfind_pdu<IP>(); // IP is decoded here
+ * }
+ * \endcode
+ */
+class TINS_API LazyDecodingGuard {
+public:
+    /**
+     * \brief Constructs a guard.
+     *
+     * \param enable Whether lazy decoding should be enabled while this 
+     * guard is alive.
+     */
+    explicit LazyDecodingGuard(bool enable = true);
+
+    /**
+     * \brief Restores the lazy decoding state prior to this guard's creation.
+     */
+    ~LazyDecodingGuard();
+
+    /**
+     * \brief Indicates whether lazy decoding is enabled in the current thread.
+     */
+    static bool is_enabled();
+private:
+    LazyDecodingGuard(const LazyDecodingGuard&);
+    LazyDecodingGuard& operator=(const LazyDecodingGuard&);
+
+    bool previous_;
+};
+
+} // Tins
+
+#endif // TINS_LAZY_DECODING_H
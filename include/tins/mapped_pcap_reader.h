@@ -0,0 +1,454 @@
+/*
+ * Copyright (c) 2017, Matias Fontanini
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are
+ * met:
+ * 
+ * * Redistributions of source code must retain the above copyright
+ *   notice, this list of conditions and the following disclaimer.
+ * * Redistributions in binary form must reproduce the above
+ *   copyright notice, this list of conditions and the following disclaimer
+ *   in the documentation and/or other materials provided with the
+ *   distribution.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+
+#ifndef TINS_MAPPED_PCAP_READER_H
+#define TINS_MAPPED_PCAP_READER_H
+
+#include <string>
+#include <iterator>
+#include <stdint.h>
+#include <tins/macros.h>
+#include <tins/cxxstd.h>
+#include <tins/packet.h>
+#include <tins/packet_view.h>
+#include <tins/timestamp.h>
+#include <tins/exceptions.h>
+#include <tins/detail/type_traits.h>
+
+#ifndef _WIN32
+
+namespace Tins {
+
+/**
+ * \class MappedPcapReader
+ * \brief Reads pcap files by mapping them into memory.
+ *
+ * This class parses classic pcap files on its own, without using libpcap.
+ * The whole file is mapped into memory and record headers are walked 
+ * directly, so reading a record doesn't copy its contents nor involve any 
+ * callback. 
+ *
+ * Records can be accessed as raw buffers, using MappedPcapReader::next_record 
+ * or iterators, as PacketView objects, using MappedPcapReader::sniff_view_loop,
+ * or decoded into PDUs, using MappedPcapReader::next_packet and 
+ * MappedPcapReader::sniff_loop.
+ *
+ * Both microsecond and nanosecond resolution files, written in either
+ * byte order, are supported.
+ *
+ * \code
+ * MappedPcapReader reader("capture.pcap");
+ * for (MappedPcapReader::const_iterator it = reader.begin(); it != reader.end(); ++it) {
+ *     // it->data points straight into the mapped file
+ *     process(it->data, it->size);
+ * }
+ * \endcode
+ */
+class TINS_API MappedPcapReader {
+public:
+    /**
+     * \brief A record in the file.
+     *
+     * The data pointer points into the mapped file, so it's only valid
+     * while the reader is alive.
+     */
+    struct record {
+        /**
+         * The captured data.
+         */
+        const uint8_t* data;
+
+        /**
+         * The amount of bytes captured.
+         */
+        uint32_t size;
+
+        /**
+         * The size of the packet on the wire.
+         */
+        uint32_t wire_size;
+
+        /**
+         * The seconds part of the timestamp.
+         */
+        uint32_t seconds;
+
+        /**
+         * The fractional part of the timestamp, in nanoseconds.
+         */
+        uint32_t nanoseconds;
+
+        /**
+         * The offset of this record's header within the file.
+         */
+        uint64_t offset;
+
+        /**
+         * Returns this record's timestamp.
+         */
+        Timestamp timestamp() const;
+    };
+
+    class const_iterator;
+
+    /**
+     * \brief Constructs a MappedPcapReader.
+     *
+     * If prefetch is true, the kernel is advised that the file will be read
+     * sequentially, so it can read ahead aggressively.
+     *
+     * \param file_name The path of the file to be read.
+     * \param prefetch Whether to advise the kernel to prefetch the file.
+     */
+    MappedPcapReader(const std::string& file_name, bool prefetch = false);
+
+    /**
+     * \brief Destructor.
+     *
+     * Unmaps the file.
+     */
+    ~MappedPcapReader();
+
+    /**
+     * \brief Reads the next record.
+     *
+     * \param output The record in which the result will be stored.
+     * \return false if the end of the file was reached. 
+     * \throw capture_file_error If the next record is truncated or invalid.
+     */
+    bool next_record(record& output);
+
+    /**
+     * \brief Reads and decodes the next packet.
+     *
+     * The link layer PDU is chosen using this file's link type. Unknown 
+     * link types are decoded as RawPDU. Malformed packets are skipped.
+     *
+     * \sa BaseSniffer::next_packet
+     * \return The next packet. If the end of the file was reached,
+     * PtrPacket::pdu will return 0.
+     * \throw capture_file_error If the next record is truncated or invalid.
+     */
+    PtrPacket next_packet();
+
+    /**
+     * \brief Starts a loop, decoding every packet in the file.
+     *
+     * This works just like BaseSniffer::sniff_loop.
+     *
+     * \param function The callback handler object which should process packets.
+     * \param max_packets The maximum amount of packets to read. 0 == infinite.
+     */
+    template <typename Functor>
+    void sniff_loop(Functor function, uint32_t max_packets = 0);
+
+    /**
+     * \brief Starts a loop which provides a PacketView for every packet.
+     *
+     * This works just like BaseSniffer::sniff_view_loop, except that the
+     * viewed buffers point into the mapped file. Only the link layer types
+     * supported by PacketView can be used. Otherwise, an unknown_link_type 
+     * exception is thrown.
+     *
+     * \param function The callback handler object which should process packets.
+     * \param max_packets The maximum amount of packets to read. 0 == infinite.
+     */
+    template <typename Functor>
+    void sniff_view_loop(Functor function, uint32_t max_packets = 0);
+
+    /**
+     * \brief Goes back to the first record in the file.
+     */
+    void rewind();
+
+    /**
+     * \brief Moves to the record at the given offset.
+     *
+     * The offset must be that of a record header, such as the one found
+     * in record::offset, or the size of the file.
+     *
+     * \param offset The offset of the record.
+     */
+    void seek(uint64_t offset);
+
+    /**
+     * \brief Retrieves the offset of the next record to be read.
+     */
+    uint64_t tell() const;
+
+    /**
+     * \brief Sets whether to extract RawPDUs or fully parsed packets.
+     *
+     * \sa BaseSniffer::set_extract_raw_pdus
+     * \param value Whether to extract RawPDUs or not.
+     */
+    void set_extract_raw_pdus(bool value);
+
+    /**
+     * \brief Sets whether inner PDUs should be decoded lazily.
+     *
+     * \sa BaseSniffer::set_lazy_decoding
+     * \param value Whether to decode inner PDUs lazily or not.
+     */
+    void set_lazy_decoding(bool value);
+
+    /**
+     * \brief Retrieves the link type (DLT) of the packets in this file.
+     */
+    uint32_t link_type() const;
+
+    /**
+     * \brief Retrieves the snapshot length of this file.
+     */
+    uint32_t snap_len() const;
+
+    /**
+     * \brief Indicates whether timestamps in this file have nanosecond
+     * resolution.
+     */
+    bool nanosecond_resolution() const;
+
+    /**
+     * \brief Indicates whether this file uses the opposite byte order than
+     * this host.
+     */
+    bool is_swapped() const;
+
+    /**
+     * \brief Retrieves the size of the file.
+     */
+    uint64_t file_size() const;
+
+    /**
+     * \brief Retrieves a pointer to the beginning of the mapped file.
+     */
+    const uint8_t* file_data() const;
+
+    /**
+     * \brief Retrieves an iterator to the first record in the file.
+     *
+     * Iterators are independent from the reader's current position.
+     */
+    const_iterator begin() const;
+
+    /**
+     * \brief Retrieves an end iterator.
+     */
+    const_iterator end() const;
+
+    /**
+     * \brief Parses the record at the given offset.
+     *
+     * \param offset The offset of the record.
+     * \param output The record in which the result will be stored.
+     * \return The offset of the next record, or 0 if the offset is the
+     * end of the file.
+     * \throw capture_file_error If the record at this offset is truncated
+     * or its captured size is invalid.
+     */
+    uint64_t record_at(uint64_t offset, record& output) const;
+
+    /**
+     * \brief Decodes a record into a PDU.
+     *
+     * This uses the same rules as MappedPcapReader::next_packet, but 
+     * doesn't modify the reader, so it can be called from several threads 
+     * at the same time.
+     *
+     * \param input The record to be decoded.
+     * \return The decoded PDU, or 0 if the packet is malformed. The caller
+     * takes ownership of it.
+     */
+    PDU* decode(const record& input) const;
+private:
+    friend class ParallelPcapReader;
+
+    typedef PDU* (*PacketDecoder)(const uint8_t*, uint32_t);
+
+    MappedPcapReader(const MappedPcapReader&);
+    MappedPcapReader& operator=(const MappedPcapReader&);
+
+    // Looks for the first offset at or after the given one from which 
+    // several consistent record headers can be parsed. Packet contents can
+    // look like records, so this is only a guess
+    uint64_t find_record(uint64_t offset) const;
+    // Like record_at, but returns 0 rather than throwing on bad records
+    uint64_t try_record_at(uint64_t offset, record& output) const;
+    PacketDecoder packet_decoder() const;
+    PDU::PDUType view_link_type() const;
+    uint32_t read_field(const uint8_t* ptr) const;
+    bool is_valid_header(uint64_t offset, uint64_t& next_offset) const;
+
+    const uint8_t* data_;
+    uint64_t size_;
+    uint64_t offset_;
+    uint32_t link_type_;
+    uint32_t snap_len_;
+    bool swapped_;
+    bool nanoseconds_;
+    bool extract_raw_;
+    bool lazy_decoding_;
+};
+
+/**
+ * \class MappedPcapReader::const_iterator
+ * \brief Iterates over the records in a MappedPcapReader.
+ */
+class MappedPcapReader::const_iterator 
+    : public std::iterator<std::forward_iterator_tag, const MappedPcapReader::record> {
+public:
+    /**
+     * Constructs a const_iterator.
+     * \param reader The reader to iterate.
+     * \param offset The offset of the record to point to.
+     */
+    const_iterator(const MappedPcapReader* reader = 0, uint64_t offset = 0)
+    : reader_(reader), next_offset_(0) {
+        if (reader_) {
+            load(offset);
+        }
+    }
+
+    /**
+     * Advances the iterator.
+     * \throw capture_file_error If the next record is truncated or invalid.
+     */
+    const_iterator& operator++() {
+        load(next_offset_);
+        return* this;
+    }
+
+    /**
+     * Advances the iterator.
+     */
+    const_iterator operator++(int) {
+        const_iterator other(*this);
+        load(next_offset_);
+        return other;
+    }
+
+    /**
+     * Dereferences the iterator.
+     */
+    const record& operator*() const {
+        return record_;
+    }
+
+    /**
+     * Dereferences the iterator.
+     */
+    const record* operator->() const {
+        return &record_;
+    }
+
+    /**
+     * Compares this iterator for equality.
+     * \param rhs The iterator to be compared to.
+     */
+    bool operator==(const const_iterator& rhs) const {
+        if (reader_ == 0 || rhs.reader_ == 0) {
+            return reader_ == rhs.reader_;
+        }
+        return record_.offset == rhs.record_.offset;
+    }
+
+    /**
+     * Compares this iterator for in-equality.
+     * \param rhs The iterator to be compared to.
+     */
+    bool operator!=(const const_iterator& rhs) const {
+        return !(*this == rhs);
+    }
+private:
+    void load(uint64_t offset) {
+        next_offset_ = reader_->record_at(offset, record_);
+        if (next_offset_ == 0) {
+            reader_ = 0;
+        }
+    }
+
+    const MappedPcapReader* reader_;
+    uint64_t next_offset_;
+    record record_;
+};
+
+template <typename Functor>
+void MappedPcapReader::sniff_loop(Functor function, uint32_t max_packets) {
+    while (true) {
+        Packet packet(next_packet());
+        if (!packet) {
+            return;
+        }
+        try {
+            // If the functor returns false, we're done
+            #if TINS_IS_CXX11 && !defined(_MSC_VER)
+            if (!Tins::Internals::invoke_loop_cb(function, packet)) {
+                return;
+            }
+            #else
+            if (!function(*packet.pdu())) {
+                return;
+            }
+            #endif
+        }
+        catch(malformed_packet&) { }
+        catch(pdu_not_found&) { }
+        if (max_packets && --max_packets == 0) {
+            return;
+        }
+    }
+}
+
+template <typename Functor>
+void MappedPcapReader::sniff_view_loop(Functor function, uint32_t max_packets) {
+    const PDU::PDUType link_type = view_link_type();
+    record current;
+    while (next_record(current)) {
+        const PacketView view(current.data, current.size, link_type, 
+                              current.timestamp(), current.wire_size);
+        try {
+            // If the functor returns false, we're done
+            if (!function(view)) {
+                return;
+            }
+        }
+        catch(malformed_packet&) { }
+        catch(pdu_not_found&) { }
+        if (max_packets && --max_packets == 0) {
+            return;
+        }
+    }
+}
+
+} // Tins
+
+#endif // _WIN32
+
+#endif // TINS_MAPPED_PCAP_READER_H
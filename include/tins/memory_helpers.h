@@ -67,6 +67,18 @@ void write_value(uint8_t* buffer, const T& value) {
     std::memcpy(buffer, &value, sizeof(value));
 }
 
+template <typename T>
+T read_be_value(const uint8_t* buffer) {
+    T value;
+    read_value(buffer, value);
+    return Endian::be_to_host(value);
+}
+
+template <typename T>
+void write_be_value(uint8_t* buffer, T value) {
+    write_value(buffer, Endian::host_to_be(value));
+}
+
 class InputMemoryStream {
 public:
     InputMemoryStream(const uint8_t* buffer, size_t total_sz)
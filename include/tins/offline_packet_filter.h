@@ -37,6 +37,7 @@
 #ifdef TINS_HAVE_PCAP
 
 #include <tins/data_link_type.h>
+#include <tins/detail/bpf_filter.h>
 
 namespace Tins {
 
@@ -47,8 +48,11 @@ class PDU;
  *
  * \brief Wraps a pcap filter and matches it against a packet or buffer.
  *
- * This is a thin wrapper over <i>pcap_offline_filter</i>. You can use
- * it to perform packet filtering outside of Sniffer instances. 
+ * Filters are compiled using <i>pcap_compile</i>. The resulting BPF 
+ * program is then translated into a faster internal representation, 
+ * which is used to match packets without going through libpcap's
+ * interpreter. You can use this class to perform packet filtering 
+ * outside of Sniffer instances. 
  *
  * A potential use case would be if you are capturing packets that are
  * sent from another host over UDP. You would recieve UDP packets, then
@@ -124,7 +128,7 @@ public:
     /**
      * \brief Applies the compiled filter on the provided buffer.
      *
-     * This method uses <i>pcap_offline_filter</i> on the provided buffer
+     * This method runs the compiled filter on the provided buffer
      * and returns a bool indicating if the packet pointed by the buffer
      * matches the filter.
      *
@@ -148,6 +152,22 @@ public:
       * \return true iff the packet matches the filter.
       */
      bool matches_filter(PDU& pdu) const;
+
+     /**
+      * \brief Applies the compiled filter on several buffers.
+      *
+      * This is equivalent to calling matches_filter on each of the 
+      * buffers, but avoids the per call overhead.
+      *
+      * \param buffers The buffers to be matched against the filter.
+      * \param sizes The size of each of the buffers.
+      * \param count The amount of buffers.
+      * \param results The array in which to store whether each buffer 
+      * matches the filter. It must be able to hold count elements.
+      * \return The amount of buffers that match the filter.
+      */
+     size_t matches_filter(const uint8_t* const* buffers, const uint32_t* sizes,
+                           size_t count, bool* results) const;
 private:
     void init(const std::string& pcap_filter, int link_type, 
         unsigned int snap_len);
@@ -155,6 +175,7 @@ private:
 
     pcap_t* handle_;
     mutable bpf_program filter_;
+    Internals::BPFFilter program_;
     std::string string_filter_;
 };
 
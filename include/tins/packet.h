@@ -107,6 +107,10 @@ public:
 private:
     friend class BaseSniffer;
     friend class SnifferIterator;
+    friend class RingSniffer;
+    friend class RingSnifferIterator;
+    friend class MappedPcapReader;
+    friend class PcapngReader;
     
     PacketWrapper(pdu_type pdu, const Timestamp& ts) 
     : pdu_(pdu), ts_(ts) {}
@@ -0,0 +1,494 @@
+/*
+ * Copyright (c) 2017, Matias Fontanini
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are
+ * met:
+ * 
+ * * Redistributions of source code must retain the above copyright
+ *   notice, this list of conditions and the following disclaimer.
+ * * Redistributions in binary form must reproduce the above
+ *   copyright notice, this list of conditions and the following disclaimer
+ *   in the documentation and/or other materials provided with the
+ *   distribution.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+
+#ifndef TINS_PACKET_CLASSIFIER_H
+#define TINS_PACKET_CLASSIFIER_H
+
+#include <tins/cxxstd.h>
+#include <tins/macros.h>
+
+#if defined(TINS_HAVE_PCAP) && TINS_IS_CXX11
+
+#include <string>
+#include <vector>
+#include <memory>
+#include <map>
+#include <mutex>
+#include <atomic>
+#include <stdint.h>
+#include <tins/data_link_type.h>
+#include <tins/offline_packet_filter.h>
+#include <tins/address_range.h>
+#include <tins/ip_address.h>
+#include <tins/ipv6_address.h>
+#include <tins/pdu.h>
+
+namespace Tins {
+namespace Internals {
+/**
+ * \cond
+ */
+
+struct classifier_ipv6_key {
+    classifier_ipv6_key() : high(0), low(0) { }
+    classifier_ipv6_key(const IPv6Address& address);
+
+    bool operator<(const classifier_ipv6_key& rhs) const {
+        return high < rhs.high || (high == rhs.high && low < rhs.low);
+    }
+
+    bool operator==(const classifier_ipv6_key& rhs) const {
+        return high == rhs.high && low == rhs.low;
+    }
+
+    uint64_t high;
+    uint64_t low;
+};
+
+// An inclusive range of values a rule matches on some field
+template <typename Key>
+struct classifier_range {
+    classifier_range() : present(false) { }
+
+    void set(const Key& range_first, const Key& range_last) {
+        present = true;
+        first = range_first;
+        last = range_last;
+    }
+
+    bool present;
+    Key first;
+    Key last;
+};
+
+/*
+ * Splits the values of a field into the intervals delimited by every rule's
+ * range, storing the set of rules that match each of these intervals. 
+ * Looking up a value is then a binary search over the interval starts.
+ * Fields with small domains, such as ports, can instead map every value 
+ * straight to its interval using a direct table.
+ */
+template <typename Key>
+class classifier_index {
+public:
+    classifier_index() : words_(0), active_(false) { }
+
+    // direct_size is the amount of values the field can take, or 0 if it's
+    // too large to use a direct table
+    void build(const std::vector<classifier_range<Key> >& ranges, size_t words,
+               size_t direct_size = 0);
+
+    // Whether any rule uses this field
+    bool is_active() const {
+        return active_;
+    }
+
+    // The rules that match the given value
+    const uint64_t* find(const Key& value) const;
+
+    // The rules that match packets that don't contain this field
+    const uint64_t* wildcard() const {
+        return &wildcard_[0];
+    }
+private:
+    std::vector<Key> starts_;
+    std::vector<uint32_t> direct_;
+    std::vector<uint64_t> sets_;
+    std::vector<uint64_t> wildcard_;
+    size_t words_;
+    bool active_;
+};
+
+/**
+ * \endcond
+ */
+} // Internals
+
+/**
+ * \class PacketClassifier
+ * \brief Matches packets against many rules at once.
+ *
+ * A PacketClassifier holds a list of rules, each of them identified by the
+ * index in which it was added. Rules constrain the values of common header
+ * fields: the ethertype, the IP protocol, source and destination addresses
+ * (either IPv4 or IPv6) and source and destination ports. A rule matches 
+ * a packet if all of the fields it constrains have the specified values.
+ *
+ * Rather than testing each rule in turn, the rules are compiled into one 
+ * lookup table per header field, which maps each possible value to the set
+ * of rules it satisfies. Classifying a packet parses it once, looks up each
+ * field and intersects the results. Addresses are looked up using a binary
+ * search, while the ethertype, protocol and ports are looked up in direct 
+ * tables indexed by their value, regardless of the amount of rules that 
+ * use them. For N rules, the intersection is a bitwise and over N / 64 
+ * words for each field in use, so classifying still takes time linear in 
+ * the amount of rules, only with a much smaller constant than testing each
+ * of them. Since every matching 
+ * rule is reported, the result itself takes N / 64 words.
+ *
+ * Each table stores a set of rules for every interval delimited by the rules'
+ * ranges, which takes O(N * N / 64) words of memory. Adding rules doesn't 
+ * touch the tables; they're built the first time a packet is classified 
+ * after rules were added.
+ *
+ * Rules can also contain a pcap filter expression, for anything that can't
+ * be expressed using header fields. These expressions are only evaluated
+ * for the rules whose header fields already matched, so it's a good idea
+ * to restrict them as much as possible using fields. Rules using the same
+ * expression share a single filter, which is evaluated once per packet.
+ *
+ * Expressions in rules that don't set any header field are turned into 
+ * header fields when they only join these primitives using "and":
+ *
+ * - ip, ip6, arp, tcp, udp, icmp, icmp6
+ * - ip proto N, ip6 proto N, ether proto N
+ * - [ip|ip6] [src|dst] host ADDRESS and [ip|ip6] [src|dst] net ADDRESS/LENGTH
+ * - [tcp|udp] [src|dst] port N and [tcp|udp] [src|dst] portrange N-M
+ *
+ * Ports have to be used along with tcp or udp and addresses along with an 
+ * IP protocol, as pcap would otherwise also check SCTP ports and ARP 
+ * addresses. Such rules are matched using the lookup tables alone. Since
+ * pcap only looks at the outer ethertype, they never match VLAN tagged 
+ * frames. Their filter is still evaluated for packets on which pcap and this
+ * class could otherwise disagree: IPv6 packets with extension headers and 
+ * packets whose headers can't be fully parsed.
+ *
+ * \code
+ * PacketClassifier classifier(DataLinkType<EthernetII>());
+ *
+ * PacketClassifier::Rule web;
+ * web.set_protocol(Constants::IP::PROTO_TCP);
+ * web.set_dport(80);
+ * PacketClassifier::rule_id web_id = classifier.add_rule(web);
+ *
+ * PacketClassifier::Rule internal;
+ * internal.set_src_addr(IPv4Address("10.0.0.0") / 8);
+ * PacketClassifier::rule_id internal_id = classifier.add_rule(internal);
+ *
+ * PacketClassifier::MatchSet matches;
+ * classifier.classify(buffer, size, matches);
+ * if (matches.test(web_id)) {
+ *     // ...
+ * }
+ * \endcode
+ *
+ * The packet is parsed using a PacketView, so the supported link layer
+ * protocols are the ones PacketView supports.
+ */
+class TINS_API PacketClassifier {
+public:
+    /**
+     * The type used to identify rules.
+     */
+    typedef uint32_t rule_id;
+
+    /**
+     * \brief A classification rule.
+     *
+     * Every field that is not set matches any value, including packets that
+     * don't contain that field at all. Setting an IPv4 address range makes 
+     * the rule only match IPv4 packets, and the same goes for IPv6 ranges.
+     */
+    class TINS_API Rule {
+    public:
+        /**
+         * \brief Sets the ethertype of the network layer.
+         *
+         * For VLAN tagged packets, this is the ethertype of the protocol
+         * encapsulated by the innermost tag.
+         */
+        void set_ether_type(uint16_t ether_type);
+
+        /**
+         * \brief Sets the IP protocol or IPv6 next header of the transport 
+         * layer.
+         */
+        void set_protocol(uint8_t protocol);
+
+        /**
+         * \brief Sets the range of IPv4 source addresses.
+         */
+        void set_src_addr(const IPv4Range& range);
+
+        /**
+         * \brief Sets the range of IPv4 destination addresses.
+         */
+        void set_dst_addr(const IPv4Range& range);
+
+        /**
+         * \brief Sets the range of IPv6 source addresses.
+         */
+        void set_src_addr(const IPv6Range& range);
+
+        /**
+         * \brief Sets the range of IPv6 destination addresses.
+         */
+        void set_dst_addr(const IPv6Range& range);
+
+        /**
+         * \brief Sets the TCP or UDP source port.
+         */
+        void set_sport(uint16_t port);
+
+        /**
+         * \brief Sets the range of TCP or UDP source ports.
+         *
+         * \param first The first port in the range.
+         * \param last The last port (inclusive) in the range.
+         */
+        void set_sport(uint16_t first, uint16_t last);
+
+        /**
+         * \brief Sets the TCP or UDP destination port.
+         */
+        void set_dport(uint16_t port);
+
+        /**
+         * \brief Sets the range of TCP or UDP destination ports.
+         *
+         * \param first The first port in the range.
+         * \param last The last port (inclusive) in the range.
+         */
+        void set_dport(uint16_t first, uint16_t last);
+
+        /**
+         * \brief Sets a pcap filter expression that packets must also match.
+         *
+         * The expression is compiled when the rule is added to a classifier.
+         */
+        void set_filter(const std::string& filter);
+    private:
+        friend class PacketClassifier;
+
+        typedef Internals::classifier_range<uint32_t> range_type;
+        typedef Internals::classifier_range<Internals::classifier_ipv6_key> ipv6_range_type;
+
+        range_type ether_type_;
+        range_type protocol_;
+        range_type src_ipv4_;
+        range_type dst_ipv4_;
+        ipv6_range_type src_ipv6_;
+        ipv6_range_type dst_ipv6_;
+        range_type sport_;
+        range_type dport_;
+        // Fields matching either the source or the destination. These are
+        // only set when translating filter expressions
+        range_type ipv4_;
+        ipv6_range_type ipv6_;
+        range_type port_;
+        std::string filter_;
+    };
+
+    /**
+     * \brief The set of rules that matched a packet.
+     */
+    class TINS_API MatchSet {
+    public:
+        /**
+         * Constructs an empty set.
+         */
+        MatchSet();
+
+        /**
+         * \brief Indicates whether the given rule matched.
+         */
+        bool test(rule_id id) const {
+            return id < size_ && (words_[id / 64] >> (id % 64)) & 1;
+        }
+
+        /**
+         * \brief Indicates whether any rule matched.
+         */
+        bool any() const;
+
+        /**
+         * \brief Returns the amount of rules that matched.
+         */
+        size_t count() const;
+
+        /**
+         * \brief Returns the identifiers of the rules that matched, in 
+         * ascending order.
+         */
+        std::vector<rule_id> ids() const;
+
+        /**
+         * \brief Getter for the bitset words, one bit per rule.
+         *
+         * Rule i is stored in bit i % 64 of word i / 64.
+         */
+        const std::vector<uint64_t>& words() const {
+            return words_;
+        }
+    private:
+        friend class PacketClassifier;
+
+        std::vector<uint64_t> words_;
+        size_t size_;
+    };
+
+    /**
+     * \brief Constructs a classifier for the given link layer type.
+     *
+     * \param lt The link layer type of the packets to be classified.
+     */
+    template <typename T>
+    PacketClassifier(const DataLinkType<T>& lt)
+    : link_type_(T::pdu_flag), filter_factory_(&make_filter<T>), has_translated_(false),
+      built_(true) {
+        (void)lt;
+    }
+
+    /**
+     * \brief Adds a rule to this classifier.
+     *
+     * \param rule The rule to be added.
+     * \return The identifier of the new rule.
+     * \throw invalid_pcap_filter If the rule's filter expression is invalid.
+     */
+    rule_id add_rule(const Rule& rule);
+
+    /**
+     * \brief Adds several rules to this classifier.
+     *
+     * The rules are assigned consecutive identifiers.
+     *
+     * \param rules The rules to be added.
+     * \return The identifier of the first added rule.
+     * \throw invalid_pcap_filter If any rule's filter expression is invalid.
+     */
+    rule_id add_rules(const std::vector<Rule>& rules);
+
+    /**
+     * \brief Returns the amount of rules in this classifier.
+     */
+    size_t rule_count() const;
+
+    /**
+     * \brief Classifies the packet in the given buffer.
+     *
+     * The provided MatchSet can be reused across calls, which avoids
+     * allocating memory on each of them. This can be called from several
+     * threads at once, as long as no rules are being added.
+     *
+     * \param buffer The buffer which contains the packet.
+     * \param total_sz The size of the buffer.
+     * \param matches The set in which to store the matching rules.
+     */
+    void classify(const uint8_t* buffer, uint32_t total_sz, MatchSet& matches) const;
+
+    /**
+     * \brief Classifies the packet in the given buffer.
+     *
+     * \param buffer The buffer which contains the packet.
+     * \param total_sz The size of the buffer.
+     * \return The set of matching rules.
+     */
+    MatchSet classify(const uint8_t* buffer, uint32_t total_sz) const;
+
+    /**
+     * \brief Classifies the given packet.
+     *
+     * The header fields are taken straight from the PDUs. The packet is only
+     * serialized if any rule with a filter expression needs to be 
+     * evaluated, or if any rule's expression was turned into header fields.
+     * In the latter case, the serialized packet is classified just like a
+     * buffer, so those rules match exactly what their filter would.
+     *
+     * \param pdu The packet to be classified.
+     * \param matches The set in which to store the matching rules.
+     */
+    void classify(PDU& pdu, MatchSet& matches) const;
+private:
+    typedef Internals::classifier_index<uint32_t> index_type;
+    typedef Internals::classifier_index<Internals::classifier_ipv6_key> ipv6_index_type;
+    typedef OfflinePacketFilter* (*filter_factory_type)(const std::string&);
+    typedef std::unique_ptr<OfflinePacketFilter> filter_ptr;
+
+    struct packet_fields;
+
+    template <typename T>
+    static OfflinePacketFilter* make_filter(const std::string& filter) {
+        return new OfflinePacketFilter(filter, DataLinkType<T>());
+    }
+
+    static bool translate_filter(const std::string& filter, Rule& rule);
+
+    void add(const Rule& rule);
+    void build() const;
+    void ensure_built() const {
+        if (!built_.load(std::memory_order_acquire)) {
+            build();
+        }
+    }
+    void match_fields(const packet_fields& fields, MatchSet& matches) const;
+    const std::vector<uint64_t>& filters_to_evaluate(const packet_fields& fields) const;
+    bool has_filter_candidates(const MatchSet& matches, 
+                               const std::vector<uint64_t>& filter_rules) const;
+    void match_filters(const uint8_t* buffer, uint32_t total_sz, 
+                       const std::vector<uint64_t>& filter_rules, 
+                       MatchSet& matches) const;
+
+    PDU::PDUType link_type_;
+    filter_factory_type filter_factory_;
+    std::vector<Rule> rules_;
+    // Distinct filter expressions, and the one used by each rule (or -1)
+    std::vector<filter_ptr> filters_;
+    std::map<std::string, int> filter_ids_;
+    std::vector<int> rule_filters_;
+    // Whether each rule's filter expression was turned into header fields
+    std::vector<bool> translated_;
+    bool has_translated_;
+    // The tables are built lazily, see ensure_built
+    mutable std::mutex build_mutex_;
+    mutable std::atomic<bool> built_;
+    mutable std::vector<uint64_t> all_rules_;
+    mutable std::vector<uint64_t> filter_rules_;
+    // The rules in filter_rules_ whose filter wasn't translated
+    mutable std::vector<uint64_t> untranslated_filter_rules_;
+    mutable std::vector<uint64_t> translated_rules_;
+    mutable index_type ether_type_index_;
+    mutable index_type protocol_index_;
+    mutable index_type src_ipv4_index_;
+    mutable index_type dst_ipv4_index_;
+    mutable ipv6_index_type src_ipv6_index_;
+    mutable ipv6_index_type dst_ipv6_index_;
+    mutable index_type sport_index_;
+    mutable index_type dport_index_;
+    mutable index_type ipv4_index_;
+    mutable ipv6_index_type ipv6_index_;
+    mutable index_type port_index_;
+};
+
+} // Tins
+
+#endif // TINS_HAVE_PCAP && TINS_IS_CXX11
+
+#endif // TINS_PACKET_CLASSIFIER_H
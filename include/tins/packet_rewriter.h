@@ -0,0 +1,174 @@
+/*
+ * Copyright (c) 2017, Matias Fontanini
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are
+ * met:
+ * 
+ * * Redistributions of source code must retain the above copyright
+ *   notice, this list of conditions and the following disclaimer.
+ * * Redistributions in binary form must reproduce the above
+ *   copyright notice, this list of conditions and the following disclaimer
+ *   in the documentation and/or other materials provided with the
+ *   distribution.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+
+#ifndef TINS_PACKET_REWRITER_H
+#define TINS_PACKET_REWRITER_H
+
+#include <stdint.h>
+#include <tins/macros.h>
+#include <tins/pdu.h>
+#include <tins/ip_address.h>
+#include <tins/ipv6_address.h>
+
+namespace Tins {
+
+class IP;
+class IPv6;
+class TCP;
+class UDP;
+
+/**
+ * \class PacketRewriter
+ * \brief Rewrites header fields while keeping checksums up to date.
+ *
+ * Changing a field covered by a checksum normally requires computing 
+ * the checksum again over all of the data it covers, which for TCP and
+ * UDP includes the whole payload. A PacketRewriter instead updates the 
+ * checksums incrementally, as described in RFC 1624, based only on the 
+ * old and new values of the rewritten fields. This includes the 
+ * contribution of addresses to the TCP and UDP pseudo header.
+ *
+ * Rewriters can work either on a raw buffer, which is modified in place,
+ * or on a PDU. In the latter case, the fields are set on the PDU objects
+ * and the updated checksums are stored in them. Since these checksums
+ * are then kept when serializing, rather than being calculated again,
+ * the rewritten PDUs must hold the checksums they were parsed with and 
+ * must not be otherwise modified.
+ *
+ * In both cases, the checksums being updated are assumed to be correct.
+ * UDP datagrams with no checksum (a value of 0) are left that way.
+ *
+ * \code
+ * // Rewrite a raw packet captured from an EthernetII interface
+ * PacketRewriter rewriter(buffer, size, PDU::ETHERNET_II);
+ * rewriter.src_addr(IPv4Address("10.0.0.1"));
+ * rewriter.sport(40000);
+ * rewriter.ttl(63);
+ * \endcode
+ */
+class TINS_API PacketRewriter {
+public:
+    /**
+     * \brief Constructs a rewriter over a raw buffer.
+     *
+     * The buffer is parsed using a PacketView, so the supported link layer
+     * types are the ones supported by PacketView.
+     *
+     * \param buffer The buffer which contains the packet.
+     * \param total_sz The size of the buffer.
+     * \param link_type The type of the first layer in the buffer.
+     */
+    PacketRewriter(uint8_t* buffer, uint32_t total_sz,
+                   PDU::PDUType link_type = PDU::ETHERNET_II);
+
+    /**
+     * \brief Constructs a rewriter over a PDU.
+     *
+     * The first IP or IPv6 PDU found in the packet, along with the TCP or
+     * UDP PDU found in it, will be rewritten.
+     *
+     * \param pdu The packet to be rewritten.
+     */
+    PacketRewriter(PDU& pdu);
+
+    /**
+     * \brief Rewrites the IP TTL or IPv6 hop limit field.
+     *
+     * \throw pdu_not_found If the packet contains no network layer.
+     */
+    void ttl(uint8_t new_ttl);
+
+    /**
+     * \brief Rewrites the IP source address.
+     *
+     * \throw pdu_not_found If the packet contains no IP layer.
+     */
+    void src_addr(IPv4Address address);
+
+    /**
+     * \brief Rewrites the IP destination address.
+     *
+     * \throw pdu_not_found If the packet contains no IP layer.
+     */
+    void dst_addr(IPv4Address address);
+
+    /**
+     * \brief Rewrites the IPv6 source address.
+     *
+     * \throw pdu_not_found If the packet contains no IPv6 layer.
+     */
+    void src_addr(const IPv6Address& address);
+
+    /**
+     * \brief Rewrites the IPv6 destination address.
+     *
+     * \throw pdu_not_found If the packet contains no IPv6 layer.
+     */
+    void dst_addr(const IPv6Address& address);
+
+    /**
+     * \brief Rewrites the TCP or UDP source port.
+     *
+     * \throw pdu_not_found If the packet contains no TCP or UDP layer.
+     */
+    void sport(uint16_t port);
+
+    /**
+     * \brief Rewrites the TCP or UDP destination port.
+     *
+     * \throw pdu_not_found If the packet contains no TCP or UDP layer.
+     */
+    void dport(uint16_t port);
+private:
+    enum field_scope {
+        NETWORK_CHECKSUM = 1,
+        TRANSPORT_CHECKSUM = 2
+    };
+
+    void rewrite_buffer(uint8_t* field, const uint8_t* value, uint32_t size, int scope);
+    void update_pdu_checksums(const uint8_t* old_value, const uint8_t* new_value, 
+                              uint32_t size, int scope);
+
+    // Raw buffers
+    uint8_t* network_;
+    uint8_t* transport_;
+    uint8_t* transport_checksum_;
+    // PDUs
+    IP* ip_;
+    IPv6* ipv6_;
+    TCP* tcp_;
+    UDP* udp_;
+    bool is_ipv6_;
+    bool is_udp_;
+};
+
+} // Tins
+
+#endif // TINS_PACKET_REWRITER_H
@@ -39,9 +39,14 @@
 #ifdef TINS_HAVE_PACKET_SENDER_PCAP_SENDPACKET
     #include <pcap.h>
 #endif // TINS_HAVE_PACKET_SENDER_PCAP_SENDPACKET
+#ifdef TINS_HAVE_SENDMMSG
+    #include <sys/socket.h>
+    #include <sys/uio.h>
+#endif // TINS_HAVE_SENDMMSG
 #include <tins/network_interface.h>
 #include <tins/macros.h>
 #include <tins/cxxstd.h>
+#include <tins/utils/pdu_utils.h>
 
 struct timeval;
 struct sockaddr;
@@ -50,6 +55,103 @@ namespace Tins {
 
 class PDU;
 
+#ifdef TINS_HAVE_PACKET_RING
+
+/**
+ * \cond
+ */
+namespace Internals {
+    class TxRing;
+} // Internals
+/**
+ * \endcond
+ */
+
+/**
+ * \class TxRingConfiguration
+ * \brief Represents the configuration of the TX rings used by a 
+ * PacketSender.
+ *
+ * A TX ring is made of frame_count frames, each of which can hold one
+ * packet of up to frame_size bytes, including a small header used by 
+ * the kernel.
+ *
+ * The flush mode indicates what happens when the ring is full and when
+ * the kernel is told to send the packets written to it. In 
+ * FLUSH_BLOCKING mode, both wait until the kernel has sent the packets. 
+ * In FLUSH_NON_BLOCKING mode, packets that don't fit in the ring fail to 
+ * be sent and the kernel sends the packets asynchronously.
+ *
+ * \sa PacketSender::enable_tx_ring
+ */
+class TINS_API TxRingConfiguration {
+public:
+    /**
+     * \brief The flush modes.
+     */
+    enum FlushMode {
+        FLUSH_BLOCKING,
+        FLUSH_NON_BLOCKING
+    };
+
+    /**
+     * \brief The default frame size.
+     */
+    static const unsigned DEFAULT_FRAME_SIZE;
+
+    /**
+     * \brief The default amount of frames in the ring.
+     */
+    static const unsigned DEFAULT_FRAME_COUNT;
+
+    /**
+     * Default constructs a TxRingConfiguration.
+     */
+    TxRingConfiguration();
+
+    /**
+     * \brief Sets the size of each frame in the ring.
+     *
+     * This must be a multiple of 16.
+     *
+     * \param size The frame size, in bytes.
+     */
+    void set_frame_size(unsigned size);
+
+    /**
+     * Sets the amount of frames in the ring.
+     * \param count The amount of frames.
+     */
+    void set_frame_count(unsigned count);
+
+    /**
+     * Sets the flush mode.
+     * \param mode The flush mode.
+     */
+    void set_flush_mode(FlushMode mode);
+
+    /**
+     * Retrieves the frame size.
+     */
+    unsigned frame_size() const;
+
+    /**
+     * Retrieves the amount of frames.
+     */
+    unsigned frame_count() const;
+
+    /**
+     * Retrieves the flush mode.
+     */
+    FlushMode flush_mode() const;
+private:
+    unsigned frame_size_;
+    unsigned frame_count_;
+    FlushMode flush_mode_;
+};
+
+#endif // TINS_HAVE_PACKET_RING
+
 /**
  * \class PacketSender
  * \brief Sends packets through a network interface.
@@ -173,6 +275,24 @@ public:
             _timeout = rhs._timeout;
             timeout_usec_ = rhs.timeout_usec_;
             default_iface_ = rhs.default_iface_;
+            gather_payloads_ = rhs.gather_payloads_;
+            payload_ = 0;
+            payload_size_ = 0;
+            batch_packets_ = 0;
+            batching_ = false;
+            #ifdef TINS_HAVE_PACKET_RING
+                // Our own rings and epoll sets would leak otherwise
+                close_tx_rings();
+                tx_rings_ = std::move(rhs.tx_rings_);
+                rhs.tx_rings_.clear();
+                tx_ring_configuration_ = rhs.tx_ring_configuration_;
+                tx_ring_enabled_ = rhs.tx_ring_enabled_;
+            #endif // TINS_HAVE_PACKET_RING
+            #ifdef TINS_HAVE_EPOLL
+                close_epoll_sets(INVALID_RAW_SOCKET);
+                epoll_sets_ = std::move(rhs.epoll_sets_);
+                rhs.epoll_sets_.clear();
+            #endif // TINS_HAVE_EPOLL
             return* this;
         }
     #endif
@@ -193,6 +313,42 @@ public:
     void open_l2_socket(const NetworkInterface& iface = NetworkInterface());
     #endif // !_WIN32 || defined(TINS_HAVE_PACKET_SENDER_PCAP_SENDPACKET)
 
+    #ifdef TINS_HAVE_PACKET_RING
+    /**
+     * \brief Sends layer 2 packets through memory mapped TX rings.
+     *
+     * Once enabled, open_l2_socket sets up a PACKET_TX_RING for each 
+     * interface packets are sent through. Layer 2 packets are then 
+     * serialized straight into the ring's frames and the kernel is told 
+     * to send them using a single system call per packet or, when using
+     * PacketSender::send_batch, per batch.
+     *
+     * Packets that don't fit in a frame or exceed the interface's MTU
+     * are reported as failed with EMSGSIZE. Any other packet the kernel
+     * rejects once it's in the ring is silently dropped.
+     *
+     * Any rings previously set up are closed. This has no effect if 
+     * layer 2 packets are sent using pcap_sendpacket.
+     *
+     * \param configuration The configuration of the rings.
+     * \throw invalid_ring_configuration If the frame size isn't a multiple
+     * of 16 or is too small to hold the kernel's header, or if the frame 
+     * count is 0.
+     */
+    void enable_tx_ring(const TxRingConfiguration& configuration = TxRingConfiguration());
+
+    /**
+     * \brief Closes all TX rings and goes back to sending layer 2 packets
+     * through a raw socket.
+     */
+    void disable_tx_ring();
+
+    /**
+     * \brief Indicates whether layer 2 packets are sent through TX rings.
+     */
+    bool tx_ring_enabled() const;
+    #endif // TINS_HAVE_PACKET_RING
+
     /** 
      * \brief Opens a layer 3 socket, using the corresponding protocol
      * for the given flag.
@@ -234,6 +390,29 @@ public:
      */
     const NetworkInterface& default_interface() const;
 
+    /**
+     * \brief Sets whether payloads are sent without being copied.
+     *
+     * When enabled, packets made of TCP or UDP over IP or IPv6 (optionally
+     * inside EthernetII and Dot1Q) that carry a large RawPDU only have 
+     * their headers serialized. The RawPDU's contents are handed to the 
+     * kernel as a separate buffer using sendmsg, rather than being copied
+     * after the headers.
+     *
+     * This is disabled by default and has no effect when packets are sent
+     * using pcap_sendpacket.
+     *
+     * \param value Whether to enable this mode.
+     */
+    void gather_payloads(bool value);
+
+    /**
+     * \brief Indicates whether payloads are sent without being copied.
+     *
+     * \sa PacketSender::gather_payloads(bool)
+     */
+    bool gather_payloads() const;
+
     /** 
      * \brief Sends a PDU. 
      * 
@@ -268,6 +447,82 @@ public:
      */
     void send(PDU& pdu, const NetworkInterface& iface);
 
+    /** 
+     * \brief Sends a PDU followed by a payload stored in a separate buffer.
+     *
+     * The packet sent is the same as if the payload was added as a RawPDU
+     * at the end of the PDU. If gathering payloads is enabled and the PDU
+     * is a supported stack ending in TCP or UDP (see 
+     * PacketSender::gather_payloads), the payload is sent straight from the
+     * provided buffer. Otherwise, it's copied after the headers.
+     * 
+     * \param pdu The PDU to be sent.
+     * \param payload The payload to be sent after the PDU.
+     * \param payload_size The size of the payload.
+     */
+    void send(PDU& pdu, const uint8_t* payload, uint32_t payload_size);
+
+    /** 
+     * \brief Sends a PDU followed by a payload stored in a separate buffer.
+     *
+     * \sa PacketSender::send(PDU&, const uint8_t*, uint32_t)
+     * 
+     * \param pdu The PDU to be sent.
+     * \param payload The payload to be sent after the PDU.
+     * \param payload_size The size of the payload.
+     * \param iface The network interface to use.
+     */
+    void send(PDU& pdu, const uint8_t* payload, uint32_t payload_size, 
+              const NetworkInterface& iface);
+
+    /**
+     * \brief Sends all the PDUs in the range [start, end).
+     *
+     * The PDUs are serialized into a buffer that is reused across batches
+     * and are then sent using as few system calls as possible. On Linux,
+     * consecutive packets which go through the same socket are submitted
+     * using a single sendmmsg call. Elsewhere, each packet is still sent
+     * using its own system call.
+     *
+     * Every PDU is sent through the default interface. Packets sent using
+     * pcap_sendpacket are not batched.
+     *
+     * Unlike PacketSender::send, failing to send a batched packet doesn't throw.
+     * The remaining packets are still sent. This includes packets that 
+     * can't be serialized or routed, e.g. those for which PDU::send throws; 
+     * their error code is EINVAL.
+     *
+     * \param start A forward iterator pointing to the first PDU to be sent.
+     * \param end A forward iterator pointing to one past the last PDU in 
+     * the range.
+     * \return The number of packets that were sent successfully.
+     */
+    template <typename ForwardIterator>
+    uint32_t send_batch(ForwardIterator start, ForwardIterator end) {
+        return send_batch_impl(start, end, 0);
+    }
+
+    /**
+     * \brief Sends all the PDUs in the range [start, end), reporting 
+     * errors per packet.
+     *
+     * \sa PacketSender::send_batch(ForwardIterator, ForwardIterator)
+     *
+     * \param start A forward iterator pointing to the first PDU to be sent.
+     * \param end A forward iterator pointing to one past the last PDU in 
+     * the range.
+     * \param errors The vector in which to store the outcome of sending 
+     * each packet. After this call, it contains one element per PDU in 
+     * the range, which is either 0 if the packet was sent or the error 
+     * code it failed with.
+     * \return The number of packets that were sent successfully.
+     */
+    template <typename ForwardIterator>
+    uint32_t send_batch(ForwardIterator start, ForwardIterator end, 
+                        std::vector<int>& errors) {
+        return send_batch_impl(start, end, &errors);
+    }
+
     /** 
      * \brief Sends a PDU and waits for its response. 
      * 
@@ -396,11 +651,62 @@ private:
         pcap_t* make_pcap_handle(const NetworkInterface& iface) const;
     #endif // TINS_HAVE_PACKET_SENDER_PCAP_SENDPACKET
     
+    // A packet serialized into batch_buffer_, waiting to be sent
+    struct batch_message {
+        int socket;
+        uint32_t packet_index;
+        uint32_t address_offset;
+        uint32_t address_size;
+        uint32_t data_offset;
+        uint32_t data_size;
+        // The error this packet failed with while being queued, if any
+        int error;
+        // Whether the packet was written into a TX ring rather than the buffer
+        bool tx_ring;
+    };
+
+    template <typename ForwardIterator>
+    uint32_t send_batch_impl(ForwardIterator start, ForwardIterator end, 
+                             std::vector<int>* errors) {
+        begin_batch();
+        try {
+            while (start != end) {
+                queue_batch_packet(Utils::dereference_until_pdu(*start++));
+            }
+        }
+        catch (...) {
+            // Frames already handed to a TX ring can't be taken back, so 
+            // whatever was queued is sent before rethrowing
+            flush_batch(0);
+            throw;
+        }
+        return flush_batch(errors);
+    }
+
+    void begin_batch();
+    void queue_batch_packet(PDU& pdu);
+    void queue_batch_message(int sock, PDU& pdu, struct sockaddr* link_addr, 
+                             uint32_t len_addr);
+    uint32_t flush_batch(std::vector<int>* errors);
+    uint32_t send_batch_messages(size_t first, size_t last, std::vector<int>* errors);
+    void end_batch();
+    #ifdef TINS_HAVE_PACKET_RING
+        Internals::TxRing& get_tx_ring(const NetworkInterface& iface);
+        Internals::TxRing* find_tx_ring(int sock) const;
+        void send_tx_ring(PDU& pdu, const NetworkInterface& iface);
+        void close_tx_rings();
+    #endif // TINS_HAVE_PACKET_RING
+
     PDU* recv_match_loop(const std::vector<int>& sockets, 
                          PDU& pdu,
                          struct sockaddr* link_addr, 
                          uint32_t addrlen,
                          bool is_layer_3);
+    #ifdef TINS_HAVE_EPOLL
+        int get_epoll_set(const std::vector<int>& sockets);
+        void close_epoll_sets(int sock);
+        PDU* recv_match_epoll(int epoll_fd, PDU& pdu);
+    #endif // TINS_HAVE_EPOLL
 
     std::vector<int> sockets_;
     #ifndef _WIN32
@@ -414,6 +720,32 @@ private:
     SocketTypeMap types_;
     uint32_t _timeout, timeout_usec_;
     NetworkInterface default_iface_;
+    // The external payload of the packet being sent, if any
+    const uint8_t* payload_;
+    uint32_t payload_size_;
+    bool gather_payloads_;
+    // Packets queued while sending a batch
+    std::vector<uint8_t> batch_buffer_;
+    std::vector<batch_message> batch_messages_;
+    uint32_t batch_packets_;
+    bool batching_;
+    #ifdef TINS_HAVE_SENDMMSG
+        // Reused by each sendmmsg call
+        std::vector<struct mmsghdr> batch_headers_;
+        std::vector<struct iovec> batch_iovecs_;
+    #endif // TINS_HAVE_SENDMMSG
+    #ifdef TINS_HAVE_PACKET_RING
+        typedef std::map<uint32_t, Internals::TxRing*> TxRings;
+        TxRings tx_rings_;
+        TxRingConfiguration tx_ring_configuration_;
+        bool tx_ring_enabled_;
+    #endif // TINS_HAVE_PACKET_RING
+    #ifdef TINS_HAVE_EPOLL
+        // Epoll instances used to wait for responses, one per set of sockets
+        typedef std::map<std::vector<int>, int> EpollSets;
+        EpollSets epoll_sets_;
+        std::vector<uint8_t> recv_buffer_;
+    #endif // TINS_HAVE_EPOLL
     // In BSD we need to store the buffer size, retrieved using BIOCGBLEN
     #if defined(BSD) || defined(__FreeBSD_kernel__)
     int buffer_size_;
@@ -0,0 +1,233 @@
+/*
+ * Copyright (c) 2017, Matias Fontanini
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are
+ * met:
+ * 
+ * * Redistributions of source code must retain the above copyright
+ *   notice, this list of conditions and the following disclaimer.
+ * * Redistributions in binary form must reproduce the above
+ *   copyright notice, this list of conditions and the following disclaimer
+ *   in the documentation and/or other materials provided with the
+ *   distribution.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+
+#ifndef TINS_PACKET_TEMPLATE_H
+#define TINS_PACKET_TEMPLATE_H
+
+#include <vector>
+#include <stdint.h>
+#include <tins/macros.h>
+#include <tins/pdu.h>
+#include <tins/ip_address.h>
+#include <tins/ipv6_address.h>
+
+namespace Tins {
+
+/**
+ * \class PacketTemplate
+ * \brief Generates packets by patching a few fields of a serialized PDU.
+ *
+ * Just like PDUCacher, a PacketTemplate serializes a PDU once and 
+ * keeps the result. Unlike PDUCacher, some fields of the packet can then
+ * be changed: the fields that will vary are registered once, which 
+ * records their offsets within the serialized packet, and setting one of
+ * them only rewrites its bytes.
+ *
+ * The IP header checksum and the TCP or UDP checksum are updated 
+ * incrementally, as described in RFC 1624, so the cost of setting a
+ * field doesn't depend on the size of the packet. This makes it possible
+ * to generate large amounts of similar packets without constructing and
+ * serializing PDUs for each of them.
+ *
+ * The packet is parsed using a PacketView, so the supported link layers
+ * are the ones PacketView supports. UDP datagrams with no checksum
+ * (a value of 0) are left that way.
+ *
+ * \code
+ * EthernetII eth = EthernetII() / IP("10.0.0.1") / UDP(53, 1337) / RawPDU(payload);
+ * PacketTemplate packet_template(eth);
+ * const PacketTemplate::field_id dst_addr = packet_template.add_field(PacketTemplate::DST_ADDR);
+ * const PacketTemplate::field_id sport = packet_template.add_field(PacketTemplate::SPORT);
+ * for (size_t i = 0; i < addresses.size(); ++i) {
+ *     packet_template.set(dst_addr, addresses[i]);
+ *     packet_template.set(sport, 1024 + i);
+ *     // Write packet_template.data() somewhere
+ * }
+ * \endcode
+ */
+class TINS_API PacketTemplate {
+public:
+    /**
+     * The type used to identify the fields registered in a template.
+     */
+    typedef uint32_t field_id;
+
+    /**
+     * \brief The header fields that can be registered.
+     */
+    enum Field {
+        SRC_ADDR,
+        DST_ADDR,
+        IP_ID,
+        SPORT,
+        DPORT,
+        SEQ,
+        ACK_SEQ
+    };
+
+    /**
+     * \brief Constructs a template out of a PDU.
+     *
+     * The PDU is serialized once. It's not referenced after this
+     * constructor returns.
+     *
+     * \param pdu The packet to be used as a template.
+     */
+    PacketTemplate(PDU& pdu);
+
+    /**
+     * \brief Registers one of the packet's header fields.
+     *
+     * \param field The field to be registered.
+     * \return The identifier to be used when setting this field.
+     * \throw pdu_not_found If the packet doesn't have the layer this
+     * field belongs to.
+     */
+    field_id add_field(Field field);
+
+    /**
+     * \brief Registers a slice of the TCP or UDP payload.
+     *
+     * \param offset The offset of the slice, relative to the start of 
+     * the payload.
+     * \param size The size of the slice.
+     * \return The identifier to be used when setting this slice.
+     * \throw pdu_not_found If the packet has no TCP or UDP layer.
+     * \throw std::runtime_error If the slice doesn't fit in the payload.
+     */
+    field_id add_payload_field(uint32_t offset, uint32_t size);
+
+    /**
+     * \brief Sets an integer field, such as a port or a sequence number.
+     *
+     * \param id The field's identifier.
+     * \param value The value to be set, in host byte order.
+     * \throw std::runtime_error If the field isn't a 2 or 4 bytes long
+     * integer field.
+     */
+    void set(field_id id, uint32_t value);
+
+    /**
+     * \brief Sets an IPv4 address field.
+     *
+     * \param id The field's identifier.
+     * \param address The address to be set.
+     * \throw std::runtime_error If the field isn't an IPv4 address.
+     */
+    void set(field_id id, IPv4Address address);
+
+    /**
+     * \brief Sets an IPv6 address field.
+     *
+     * \param id The field's identifier.
+     * \param address The address to be set.
+     * \throw std::runtime_error If the field isn't an IPv6 address.
+     */
+    void set(field_id id, const IPv6Address& address);
+
+    /**
+     * \brief Sets a field's raw contents.
+     *
+     * This can be used with any field, although it's mostly meant for
+     * payload slices.
+     *
+     * \param id The field's identifier.
+     * \param data The data to be set. This must hold as many bytes as 
+     * the field.
+     */
+    void set(field_id id, const uint8_t* data);
+
+    /**
+     * \brief Getter for the current contents of the packet.
+     */
+    const uint8_t* data() const {
+        return buffer_.empty() ? 0 : &buffer_[0];
+    }
+
+    /**
+     * \brief Getter for the size of the packet.
+     */
+    uint32_t size() const {
+        return static_cast<uint32_t>(buffer_.size());
+    }
+
+    /**
+     * \brief Getter for the size of a field.
+     *
+     * \param id The field's identifier.
+     */
+    uint32_t field_size(field_id id) const;
+private:
+    enum field_kind {
+        INTEGER_FIELD,
+        IPV4_FIELD,
+        IPV6_FIELD,
+        PAYLOAD_FIELD
+    };
+
+    enum field_scope {
+        NETWORK_CHECKSUM = 1,
+        TRANSPORT_CHECKSUM = 2
+    };
+
+    struct field_info {
+        field_info(uint32_t offset, uint32_t size, field_kind kind, int scope)
+        : offset(offset), size(size), kind(kind), scope(scope) { }
+
+        uint32_t offset;
+        uint32_t size;
+        field_kind kind;
+        int scope;
+    };
+
+    field_id add_field(uint32_t offset, uint32_t size, field_kind kind, int scope);
+    const field_info& get_field(field_id id) const;
+    const field_info& get_field(field_id id, field_kind kind) const;
+    void patch(const field_info& field, const uint8_t* data);
+    uint16_t window_sum(uint32_t offset, uint32_t size, uint32_t origin, 
+                        uint32_t end) const;
+
+    PDU::serialization_type buffer_;
+    std::vector<field_info> fields_;
+    uint32_t network_offset_;
+    uint32_t network_header_end_;
+    uint32_t transport_offset_;
+    uint32_t transport_end_;
+    uint32_t payload_offset_;
+    uint32_t transport_checksum_;
+    bool has_ip_;
+    bool has_ipv6_;
+    bool has_tcp_;
+    bool has_udp_;
+};
+
+} // Tins
+
+#endif // TINS_PACKET_TEMPLATE_H
@@ -0,0 +1,706 @@
+/*
+ * Copyright (c) 2017, Matias Fontanini
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are
+ * met:
+ * 
+ * * Redistributions of source code must retain the above copyright
+ *   notice, this list of conditions and the following disclaimer.
+ * * Redistributions in binary form must reproduce the above
+ *   copyright notice, this list of conditions and the following disclaimer
+ *   in the documentation and/or other materials provided with the
+ *   distribution.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+
+#ifndef TINS_PACKET_VIEW_H
+#define TINS_PACKET_VIEW_H
+
+#include <cstring>
+#include <stdint.h>
+#include <tins/pdu.h>
+#include <tins/macros.h>
+#include <tins/endianness.h>
+#include <tins/small_uint.h>
+#include <tins/timestamp.h>
+#include <tins/hw_address.h>
+#include <tins/ip_address.h>
+#include <tins/ipv6_address.h>
+#include <tins/exceptions.h>
+
+namespace Tins {
+
+/**
+ * \class PacketView
+ * \brief Non-owning, allocation free view over a raw packet.
+ *
+ * A PacketView doesn't copy nor decode the packet into a PDU chain. 
+ * Instead, it performs a single pass over the provided buffer, recording
+ * the offset at which each of the supported layers starts. Header fields
+ * are then read straight out of the buffer by the typed header accessors.
+ *
+ * The supported layers are EthernetII, Dot1Q (including stacked tags),
+ * IP, IPv6 (skipping over extension headers), TCP and UDP. Link layer
+ * buffers can also start with a Loopback or SLL header.
+ *
+ * Parsing never throws: whenever a header doesn't fit in the buffer, 
+ * parsing stops and only the layers found up to that point are reported.
+ * Calling the accessor of a layer that is not present throws 
+ * pdu_not_found.
+ *
+ * Since the view doesn't own the buffer, it's only valid while the 
+ * buffer it points to is alive. When used through 
+ * BaseSniffer::sniff_view_loop, this means the view must not be stored
+ * after the callback returns.
+ *
+ * \code
+ * bool callback(const PacketView& view) {
+ *     if (view.has_ip() && view.has_tcp()) {
+ *         IPv4Address src = view.ip().src_addr();
+ *         uint16_t sport = view.tcp().sport();
+ *         // ...
+ *     }
+ *     return true;
+ * }
+ * \endcode
+ */
+class TINS_API PacketView {
+public:
+    /**
+     * \brief View over an EthernetII header.
+     */
+    class EthernetHeader {
+    public:
+        /**
+         * The type used to store hardware addresses.
+         */
+        typedef HWAddress<6> address_type;
+
+        EthernetHeader(const uint8_t* ptr) : ptr_(ptr) { }
+
+        /**
+         * \brief Getter for the destination address field.
+         */
+        address_type dst_addr() const {
+            return address_type(ptr_);
+        }
+
+        /**
+         * \brief Getter for the source address field.
+         */
+        address_type src_addr() const {
+            return address_type(ptr_ + address_type::address_size);
+        }
+
+        /**
+         * \brief Getter for the payload type field.
+         */
+        uint16_t payload_type() const {
+            return read_be<uint16_t>(ptr_ + 12);
+        }
+    private:
+        const uint8_t* ptr_;
+    };
+
+    /**
+     * \brief View over a Dot1Q header.
+     */
+    class Dot1QHeader {
+    public:
+        Dot1QHeader(const uint8_t* ptr) : ptr_(ptr) { }
+
+        /**
+         * \brief Getter for the priority field.
+         */
+        small_uint<3> priority() const {
+            return ptr_[0] >> 5;
+        }
+
+        /**
+         * \brief Getter for the Canonical Format Identifier field.
+         */
+        small_uint<1> cfi() const {
+            return (ptr_[0] >> 4) & 1;
+        }
+
+        /**
+         * \brief Getter for the VLAN ID field.
+         */
+        small_uint<12> id() const {
+            return read_be<uint16_t>(ptr_) & 0xfff;
+        }
+
+        /**
+         * \brief Getter for the payload type field.
+         */
+        uint16_t payload_type() const {
+            return read_be<uint16_t>(ptr_ + 2);
+        }
+    private:
+        const uint8_t* ptr_;
+    };
+
+    /**
+     * \brief View over an IP header.
+     */
+    class IPHeader {
+    public:
+        IPHeader(const uint8_t* ptr) : ptr_(ptr) { }
+
+        /**
+         * \brief Getter for the header length field, in 32 bit words.
+         */
+        small_uint<4> head_len() const {
+            return ptr_[0] & 0x0f;
+        }
+
+        /**
+         * \brief Getter for the type of service field.
+         */
+        uint8_t tos() const {
+            return ptr_[1];
+        }
+
+        /**
+         * \brief Getter for the total length field.
+         */
+        uint16_t tot_len() const {
+            return read_be<uint16_t>(ptr_ + 2);
+        }
+
+        /**
+         * \brief Getter for the id field.
+         */
+        uint16_t id() const {
+            return read_be<uint16_t>(ptr_ + 4);
+        }
+
+        /**
+         * \brief Getter for the fragment offset field, in 8 byte units.
+         */
+        small_uint<13> fragment_offset() const {
+            return read_be<uint16_t>(ptr_ + 6) & 0x1fff;
+        }
+
+        /**
+         * \brief Getter for the flags field.
+         */
+        small_uint<3> flags() const {
+            return ptr_[6] >> 5;
+        }
+
+        /**
+         * \brief Getter for the time to live field.
+         */
+        uint8_t ttl() const {
+            return ptr_[8];
+        }
+
+        /**
+         * \brief Getter for the protocol field.
+         */
+        uint8_t protocol() const {
+            return ptr_[9];
+        }
+
+        /**
+         * \brief Getter for the checksum field.
+         */
+        uint16_t checksum() const {
+            return read_be<uint16_t>(ptr_ + 10);
+        }
+
+        /**
+         * \brief Getter for the source address field.
+         */
+        IPv4Address src_addr() const {
+            return IPv4Address(read_raw<uint32_t>(ptr_ + 12));
+        }
+
+        /**
+         * \brief Getter for the destination address field.
+         */
+        IPv4Address dst_addr() const {
+            return IPv4Address(read_raw<uint32_t>(ptr_ + 16));
+        }
+    private:
+        const uint8_t* ptr_;
+    };
+
+    /**
+     * \brief View over an IPv6 header.
+     */
+    class IPv6Header {
+    public:
+        IPv6Header(const uint8_t* ptr) : ptr_(ptr) { }
+
+        /**
+         * \brief Getter for the traffic class field.
+         */
+        uint8_t traffic_class() const {
+            return static_cast<uint8_t>((read_be<uint16_t>(ptr_) >> 4) & 0xff);
+        }
+
+        /**
+         * \brief Getter for the flow label field.
+         */
+        small_uint<20> flow_label() const {
+            return read_be<uint32_t>(ptr_) & 0xfffff;
+        }
+
+        /**
+         * \brief Getter for the payload length field.
+         */
+        uint16_t payload_length() const {
+            return read_be<uint16_t>(ptr_ + 4);
+        }
+
+        /**
+         * \brief Getter for the next header field.
+         *
+         * Note that this is the next header field in the fixed IPv6 header.
+         * Use PacketView::transport_protocol to get the protocol found after
+         * all extension headers.
+         */
+        uint8_t next_header() const {
+            return ptr_[6];
+        }
+
+        /**
+         * \brief Getter for the hop limit field.
+         */
+        uint8_t hop_limit() const {
+            return ptr_[7];
+        }
+
+        /**
+         * \brief Getter for the source address field.
+         */
+        IPv6Address src_addr() const {
+            return IPv6Address(ptr_ + 8);
+        }
+
+        /**
+         * \brief Getter for the destination address field.
+         */
+        IPv6Address dst_addr() const {
+            return IPv6Address(ptr_ + 24);
+        }
+    private:
+        const uint8_t* ptr_;
+    };
+
+    /**
+     * \brief View over a TCP header.
+     */
+    class TCPHeader {
+    public:
+        TCPHeader(const uint8_t* ptr) : ptr_(ptr) { }
+
+        /**
+         * \brief Getter for the source port field.
+         */
+        uint16_t sport() const {
+            return read_be<uint16_t>(ptr_);
+        }
+
+        /**
+         * \brief Getter for the destination port field.
+         */
+        uint16_t dport() const {
+            return read_be<uint16_t>(ptr_ + 2);
+        }
+
+        /**
+         * \brief Getter for the sequence number field.
+         */
+        uint32_t seq() const {
+            return read_be<uint32_t>(ptr_ + 4);
+        }
+
+        /**
+         * \brief Getter for the acknowledge number field.
+         */
+        uint32_t ack_seq() const {
+            return read_be<uint32_t>(ptr_ + 8);
+        }
+
+        /**
+         * \brief Getter for the data offset field, in 32 bit words.
+         */
+        small_uint<4> data_offset() const {
+            return ptr_[12] >> 4;
+        }
+
+        /**
+         * \brief Getter for the flags field.
+         *
+         * The returned value can be tested against the TCP::Flags values.
+         */
+        small_uint<12> flags() const {
+            return read_be<uint16_t>(ptr_ + 12) & 0xfff;
+        }
+
+        /**
+         * \brief Getter for the window size field.
+         */
+        uint16_t window() const {
+            return read_be<uint16_t>(ptr_ + 14);
+        }
+
+        /**
+         * \brief Getter for the checksum field.
+         */
+        uint16_t checksum() const {
+            return read_be<uint16_t>(ptr_ + 16);
+        }
+
+        /**
+         * \brief Getter for the urgent pointer field.
+         */
+        uint16_t urg_ptr() const {
+            return read_be<uint16_t>(ptr_ + 18);
+        }
+    private:
+        const uint8_t* ptr_;
+    };
+
+    /**
+     * \brief View over a UDP header.
+     */
+    class UDPHeader {
+    public:
+        UDPHeader(const uint8_t* ptr) : ptr_(ptr) { }
+
+        /**
+         * \brief Getter for the source port field.
+         */
+        uint16_t sport() const {
+            return read_be<uint16_t>(ptr_);
+        }
+
+        /**
+         * \brief Getter for the destination port field.
+         */
+        uint16_t dport() const {
+            return read_be<uint16_t>(ptr_ + 2);
+        }
+
+        /**
+         * \brief Getter for the length field.
+         */
+        uint16_t length() const {
+            return read_be<uint16_t>(ptr_ + 4);
+        }
+
+        /**
+         * \brief Getter for the checksum field.
+         */
+        uint16_t checksum() const {
+            return read_be<uint16_t>(ptr_ + 6);
+        }
+    private:
+        const uint8_t* ptr_;
+    };
+
+    /**
+     * \brief Default constructs an empty PacketView.
+     */
+    PacketView();
+
+    /**
+     * \brief Constructs a PacketView over the given buffer.
+     *
+     * The buffer will be parsed starting from the provided link layer
+     * type. The supported types are PDU::ETHERNET_II, PDU::IP, PDU::IPv6,
+     * PDU::LOOPBACK and PDU::SLL. Using PDU::IP or PDU::IPv6 is equivalent,
+     * since the IP version is taken from the packet itself.
+     *
+     * \param buffer The buffer to be viewed.
+     * \param total_sz The size of the buffer.
+     * \param link_type The type of the first layer in the buffer.
+     */
+    PacketView(const uint8_t* buffer, uint32_t total_sz,
+               PDU::PDUType link_type = PDU::ETHERNET_II);
+
+    /**
+     * \brief Constructs a PacketView over a captured packet.
+     *
+     * \param buffer The buffer to be viewed.
+     * \param total_sz The size of the buffer.
+     * \param link_type The type of the first layer in the buffer.
+     * \param ts The packet's timestamp.
+     * \param wire_size The packet's size on the wire. This can be larger than
+     * total_sz if the packet was truncated when captured.
+     */
+    PacketView(const uint8_t* buffer, uint32_t total_sz, PDU::PDUType link_type,
+               const Timestamp& ts, uint32_t wire_size);
+
+    /**
+     * \brief Getter for the viewed buffer.
+     */
+    const uint8_t* data() const {
+        return buffer_;
+    }
+
+    /**
+     * \brief Getter for the viewed buffer's size.
+     */
+    uint32_t size() const {
+        return size_;
+    }
+
+    /**
+     * \brief Getter for the packet's size on the wire.
+     */
+    uint32_t wire_size() const {
+        return wire_size_;
+    }
+
+    /**
+     * \brief Getter for the packet's timestamp.
+     */
+    const Timestamp& timestamp() const {
+        return ts_;
+    }
+
+    /**
+     * \brief Getter for the link layer type used to parse this packet.
+     */
+    PDU::PDUType link_type() const {
+        return link_type_;
+    }
+
+    /**
+     * \brief Indicates whether an EthernetII header was found.
+     */
+    bool has_ethernet() const {
+        return (layers_ & ETHERNET_LAYER) != 0;
+    }
+
+    /**
+     * \brief Indicates whether at least one Dot1Q header was found.
+     */
+    bool has_dot1q() const {
+        return (layers_ & DOT1Q_LAYER) != 0;
+    }
+
+    /**
+     * \brief Indicates whether an IP header was found.
+     */
+    bool has_ip() const {
+        return (layers_ & IP_LAYER) != 0;
+    }
+
+    /**
+     * \brief Indicates whether an IPv6 header was found.
+     */
+    bool has_ipv6() const {
+        return (layers_ & IPV6_LAYER) != 0;
+    }
+
+    /**
+     * \brief Indicates whether a TCP header was found.
+     */
+    bool has_tcp() const {
+        return (layers_ & TCP_LAYER) != 0;
+    }
+
+    /**
+     * \brief Indicates whether a UDP header was found.
+     */
+    bool has_udp() const {
+        return (layers_ & UDP_LAYER) != 0;
+    }
+
+    /**
+     * \brief Getter for the amount of Dot1Q tags found.
+     */
+    uint32_t vlan_count() const {
+        return vlan_count_;
+    }
+
+    /**
+     * \brief Getter for the offset of the EthernetII header.
+     */
+    uint32_t ethernet_offset() const {
+        return offset_of(ETHERNET_LAYER, ethernet_offset_);
+    }
+
+    /**
+     * \brief Getter for the offset of the outermost Dot1Q header.
+     */
+    uint32_t dot1q_offset() const {
+        return offset_of(DOT1Q_LAYER, dot1q_offset_);
+    }
+
+    /**
+     * \brief Getter for the offset of the IP or IPv6 header.
+     */
+    uint32_t network_offset() const {
+        return offset_of(IP_LAYER | IPV6_LAYER, network_offset_);
+    }
+
+    /**
+     * \brief Getter for the offset of the TCP or UDP header.
+     */
+    uint32_t transport_offset() const {
+        return offset_of(TCP_LAYER | UDP_LAYER, transport_offset_);
+    }
+
+    /**
+     * \brief Getter for the EthernetII header.
+     */
+    EthernetHeader ethernet() const {
+        return EthernetHeader(buffer_ + ethernet_offset());
+    }
+
+    /**
+     * \brief Getter for the outermost Dot1Q header.
+     */
+    Dot1QHeader dot1q() const {
+        return Dot1QHeader(buffer_ + dot1q_offset());
+    }
+
+    /**
+     * \brief Getter for the IP header.
+     */
+    IPHeader ip() const {
+        return IPHeader(buffer_ + offset_of(IP_LAYER, network_offset_));
+    }
+
+    /**
+     * \brief Getter for the IPv6 header.
+     */
+    IPv6Header ipv6() const {
+        return IPv6Header(buffer_ + offset_of(IPV6_LAYER, network_offset_));
+    }
+
+    /**
+     * \brief Getter for the TCP header.
+     */
+    TCPHeader tcp() const {
+        return TCPHeader(buffer_ + offset_of(TCP_LAYER, transport_offset_));
+    }
+
+    /**
+     * \brief Getter for the UDP header.
+     */
+    UDPHeader udp() const {
+        return UDPHeader(buffer_ + offset_of(UDP_LAYER, transport_offset_));
+    }
+
+    /**
+     * \brief Getter for the transport protocol number.
+     *
+     * This is the IP protocol field or, for IPv6, the next header value
+     * found after skipping all extension headers. If no network layer
+     * was found, this returns 0.
+     */
+    uint8_t transport_protocol() const {
+        return transport_protocol_;
+    }
+
+    /**
+     * \brief Indicates whether this packet is an IP fragment.
+     */
+    bool is_fragment() const {
+        return is_fragment_;
+    }
+
+    /**
+     * \brief Getter for the network layer's length.
+     *
+     * This is the IP total length or IPv6 header plus payload length, 
+     * bounded by the amount of captured bytes. Link layer padding is
+     * therefore not taken into account.
+     */
+    uint32_t network_size() const {
+        return network_end_ - network_offset();
+    }
+
+    /**
+     * \brief Getter for the payload carried by the innermost parsed layer.
+     */
+    const uint8_t* payload() const {
+        return buffer_ + payload_offset_;
+    }
+
+    /**
+     * \brief Getter for the size of the payload carried by the innermost
+     * parsed layer.
+     */
+    uint32_t payload_size() const {
+        return network_end_ - payload_offset_;
+    }
+private:
+    enum Layer {
+        ETHERNET_LAYER = 1,
+        DOT1Q_LAYER = 2,
+        IP_LAYER = 4,
+        IPV6_LAYER = 8,
+        TCP_LAYER = 16,
+        UDP_LAYER = 32
+    };
+
+    template <typename T>
+    static T read_raw(const uint8_t* ptr) {
+        T value;
+        std::memcpy(&value, ptr, sizeof(value));
+        return value;
+    }
+
+    template <typename T>
+    static T read_be(const uint8_t* ptr) {
+        return Endian::be_to_host(read_raw<T>(ptr));
+    }
+
+    uint32_t offset_of(uint32_t layer, uint32_t offset) const {
+        if (TINS_UNLIKELY((layers_ & layer) == 0)) {
+            throw pdu_not_found();
+        }
+        return offset;
+    }
+
+    void parse();
+    void parse_ethertype(uint16_t ether_type, uint32_t offset);
+    void parse_network(uint32_t offset);
+    void parse_ip(uint32_t offset);
+    void parse_ipv6(uint32_t offset);
+    void parse_transport(uint8_t protocol, uint32_t offset);
+
+    const uint8_t* buffer_;
+    uint32_t size_;
+    uint32_t wire_size_;
+    Timestamp ts_;
+    PDU::PDUType link_type_;
+    uint32_t layers_;
+    uint32_t vlan_count_;
+    uint32_t ethernet_offset_;
+    uint32_t dot1q_offset_;
+    uint32_t network_offset_;
+    uint32_t transport_offset_;
+    uint32_t payload_offset_;
+    uint32_t network_end_;
+    uint8_t transport_protocol_;
+    bool is_fragment_;
+};
+
+} // Tins
+
+#endif // TINS_PACKET_VIEW_H
@@ -31,6 +31,7 @@
 #define TINS_PACKET_WRITER_H
 
 #include <string>
+#include <stdint.h>
 #include <tins/macros.h>
 #include <tins/cxxstd.h>
 #include <tins/utils/pdu_utils.h>
@@ -45,6 +46,70 @@ namespace Tins {
 class PDU;
 class Packet;
 
+namespace Internals {
+class CompressionThread;
+class AsyncFileWriter;
+} // Internals
+
+/**
+ * \class AsyncWriterConfiguration
+ * \brief Configures a PacketWriter that writes packets asynchronously.
+ *
+ * \sa PacketWriter
+ */
+class TINS_API AsyncWriterConfiguration {
+public:
+    /**
+     * \brief What to do when packets are written faster than the disk 
+     * can keep up with.
+     */
+    enum BackpressurePolicy {
+        BLOCK,       ///< Wait until there's room for the packet.
+        DROP_NEWEST, ///< Drop the packet being written.
+        DROP_OLDEST  ///< Drop the packets buffered but not yet being written.
+    };
+
+    /**
+     * \brief The default size of each buffer.
+     */
+    static const size_t DEFAULT_BUFFER_SIZE;
+
+    /**
+     * Default constructs an AsyncWriterConfiguration.
+     */
+    AsyncWriterConfiguration();
+
+    /**
+     * \brief Sets the size of each of the two buffers packets are 
+     * written into.
+     *
+     * This bounds the memory used by the writer. It must be large 
+     * enough to hold a full sized packet.
+     *
+     * \param size The buffer size, in bytes.
+     */
+    void set_buffer_size(size_t size);
+
+    /**
+     * Sets the backpressure policy.
+     * \param policy The backpressure policy.
+     */
+    void set_backpressure_policy(BackpressurePolicy policy);
+
+    /**
+     * Retrieves the buffer size.
+     */
+    size_t buffer_size() const;
+
+    /**
+     * Retrieves the backpressure policy.
+     */
+    BackpressurePolicy backpressure_policy() const;
+private:
+    size_t buffer_size_;
+    BackpressurePolicy backpressure_policy_;
+};
+
 /**
  * \class PacketWriter
  * \brief Writes PDUs to a pcap format file.
@@ -94,6 +159,15 @@ public:
         SLL = DLT_LINUX_SLL
     };
 
+    /**
+     * \brief The compression applied to the written file.
+     */
+    enum Compression {
+        NO_COMPRESSION,
+        GZIP,
+        ZSTD
+    };
+
     /**
      * \brief Constructs a PacketWriter.
      *
@@ -120,6 +194,72 @@ public:
         init(file_name, lt.get_type());
     }
 
+    /**
+     * \brief Constructs a PacketWriter which compresses the written file.
+     *
+     * Packets are compressed on a background thread, so compression 
+     * overlaps with whatever the writing thread does. The file is only
+     * complete once this PacketWriter is destroyed or PacketWriter::close
+     * is called. Use the latter to find out whether writing the file 
+     * failed.
+     *
+     * \code
+     * PacketWriter writer("/tmp/test.pcap.gz", DataLinkType<EthernetII>(),
+     *                     PacketWriter::GZIP);
+     * \endcode
+     *
+     * If support for the given compression format wasn't compiled in, 
+     * a feature_disabled exception is thrown.
+     * 
+     * \param file_name The file in which to store the written PDUs.
+     * \param lt A DataLinkType that represents the link layer
+     * protocol to use.
+     * \param compression The compression format to use.
+     * \param level The compression level to use, or -1 to use the format's
+     * default one.
+     */
+    template<typename T>
+    PacketWriter(const std::string& file_name, const DataLinkType<T>& lt,
+                 Compression compression, int level = -1) {
+        init(file_name, lt.get_type(), compression, level);
+    }
+
+    /**
+     * \brief Constructs a PacketWriter which writes packets asynchronously.
+     *
+     * Packets are serialized into a memory buffer and written to the 
+     * file by a background thread using large, block aligned writes, so
+     * the calling thread never waits on the disk unless the 
+     * AsyncWriterConfiguration::BLOCK policy is used and the disk can't
+     * keep up. 
+     *
+     * \code
+     * AsyncWriterConfiguration config;
+     * config.set_backpressure_policy(AsyncWriterConfiguration::DROP_NEWEST);
+     * PacketWriter writer("/tmp/test.pcap", DataLinkType<EthernetII>(), config);
+     * \endcode
+     *
+     * Packets are only guaranteed to be in the file after calling 
+     * PacketWriter::flush or once this PacketWriter is destroyed. Write 
+     * errors are reported by the next call to PacketWriter::write or 
+     * PacketWriter::flush.
+     *
+     * This requires C++11 and is not supported on Windows. Otherwise, 
+     * a feature_disabled exception is thrown.
+     *
+     * \param file_name The file in which to store the written PDUs.
+     * \param lt A DataLinkType that represents the link layer
+     * protocol to use.
+     * \param configuration The configuration to use.
+     * \throw unknown_link_type If the link layer type has no LINKTYPE_ 
+     * value.
+     */
+    template<typename T>
+    PacketWriter(const std::string& file_name, const DataLinkType<T>& lt,
+                 const AsyncWriterConfiguration& configuration) {
+        init(file_name, lt.get_type(), configuration);
+    }
+
     /**
      * \brief Constructs a PacketWriter.
      * 
@@ -156,8 +296,12 @@ public:
         PacketWriter& operator=(PacketWriter &&rhs) TINS_NOEXCEPT {
             handle_ = 0;
             dumper_ = 0;
+            compressor_ = 0;
+            async_writer_ = 0;
             std::swap(handle_, rhs.handle_);
             std::swap(dumper_, rhs.dumper_);
+            std::swap(compressor_, rhs.compressor_);
+            std::swap(async_writer_, rhs.async_writer_);
             return* this;
         }
     #endif
@@ -210,16 +354,67 @@ public:
             write(Utils::dereference_until_pdu(*start++));
         }
     }
+
+    /**
+     * \brief Flushes the packets written so far to the file.
+     *
+     * When writing asynchronously, this waits until they're written.
+     * 
+     * \throw pcap_error If writing to the file failed.
+     */
+    void flush();
+
+    /**
+     * \brief Closes the output file.
+     *
+     * This finishes the file just like the destructor does, but reports
+     * errors writing the file, which the destructor has to ignore. When
+     * compressing the file, this waits until it's been fully compressed.
+     *
+     * No packets can be written after calling this method.
+     *
+     * \throw pcap_error If writing to the file failed.
+     */
+    void close();
+
+    /**
+     * \brief Retrieves the amount of bytes written to the file.
+     *
+     * This is only tracked when writing asynchronously.
+     */
+    uint64_t written_bytes() const;
+
+    /**
+     * \brief Retrieves the amount of bytes dropped because of the 
+     * backpressure policy.
+     *
+     * This is only tracked when writing asynchronously.
+     */
+    uint64_t dropped_bytes() const;
+
+    /**
+     * \brief Retrieves the amount of packets dropped because of the 
+     * backpressure policy.
+     *
+     * This is only tracked when writing asynchronously.
+     */
+    uint64_t dropped_packets() const;
 private:
     // You shall not copy
     PacketWriter(const PacketWriter&);
     PacketWriter& operator=(const PacketWriter&);
 
     void init(const std::string& file_name, int link_type);
+    void init(const std::string& file_name, int link_type, Compression compression,
+              int level);
+    void init(const std::string& file_name, int link_type, 
+              const AsyncWriterConfiguration& configuration);
     void write(PDU& pdu, const struct timeval& tv);
 
     pcap_t* handle_;
     pcap_dumper_t* dumper_; 
+    Internals::CompressionThread* compressor_;
+    Internals::AsyncFileWriter* async_writer_;
 };
 
 } // Tins
@@ -0,0 +1,544 @@
+/*
+ * Copyright (c) 2017, Matias Fontanini
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are
+ * met:
+ * 
+ * * Redistributions of source code must retain the above copyright
+ *   notice, this list of conditions and the following disclaimer.
+ * * Redistributions in binary form must reproduce the above
+ *   copyright notice, this list of conditions and the following disclaimer
+ *   in the documentation and/or other materials provided with the
+ *   distribution.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+
+#ifndef TINS_PARALLEL_PCAP_READER_H
+#define TINS_PARALLEL_PCAP_READER_H
+
+#include <tins/cxxstd.h>
+
+#if TINS_IS_CXX11 && !defined(_WIN32)
+
+#include <string>
+#include <vector>
+#include <memory>
+#include <atomic>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <queue>
+#include <exception>
+#include <stdint.h>
+#include <tins/macros.h>
+#include <tins/packet.h>
+#include <tins/exceptions.h>
+#include <tins/lazy_decoding.h>
+#include <tins/mapped_pcap_reader.h>
+#include <tins/detail/type_traits.h>
+
+namespace Tins {
+
+/**
+ * \class ParallelPcapReader
+ * \brief Decodes and processes one or more pcap files using several threads.
+ *
+ * Files are mapped into memory using MappedPcapReader and split into 
+ * chunks covering the same amount of bytes. Chunks are then decoded by a 
+ * pool of worker threads, which pick them up as they become idle.
+ *
+ * Each chunk's first record is guessed in parallel, by looking for a run of
+ * consistent record headers. Since packet contents can look like records,
+ * every worker also follows the record headers of its chunk from its guess
+ * and hands the offset at which it ends up over to the next chunk's worker.
+ * A chunk whose guess doesn't match is read from that offset instead, so 
+ * only records that can be reached from the start of the file are decoded.
+ * Reaching a truncated or invalid record that way stops every worker and 
+ * throws capture_file_error.
+ *
+ * Packets can be processed in three ways:
+ *
+ * - ParallelPcapReader::sniff_loop calls a copy of the functor on each 
+ * worker thread. Packets within a chunk are processed in order, but there's
+ * no ordering between chunks.
+ * - ParallelPcapReader::map_reduce accumulates every chunk into a partial 
+ * result, and then reduces these results in file order on the calling 
+ * thread.
+ * - ParallelPcapReader::sniff_ordered decodes packets in the workers but 
+ * calls the functor on the calling thread, merging every file in 
+ * timestamp order.
+ *
+ * \code
+ * std::vector<std::string> files = { "first.pcap", "second.pcap" };
+ * ParallelPcapReader reader(files, 4);
+ * size_t tcp_packets = reader.map_reduce(
+ *     size_t(0),
+ *     [](size_t& count, Packet& packet) {
+ *         if (packet.pdu()->find_pdu<TCP>()) {
+ *             count++;
+ *         }
+ *     },
+ *     [](size_t& total, const size_t& count) {
+ *         total += count;
+ *     }
+ * );
+ * \endcode
+ *
+ * This class is only available when compiling in C++11 mode.
+ */
+class TINS_API ParallelPcapReader {
+public:
+    /**
+     * \brief The default size of each chunk.
+     *
+     * This is 16MB.
+     */
+    static const uint64_t DEFAULT_CHUNK_SIZE;
+
+    /**
+     * \brief Constructs a ParallelPcapReader for a single file.
+     *
+     * \param file_name The pcap file to be read.
+     * \param thread_count The amount of worker threads to use.
+     */
+    ParallelPcapReader(const std::string& file_name, size_t thread_count);
+
+    /**
+     * \brief Constructs a ParallelPcapReader for several files.
+     *
+     * \param file_names The pcap files to be read.
+     * \param thread_count The amount of worker threads to use.
+     */
+    ParallelPcapReader(const std::vector<std::string>& file_names, size_t thread_count);
+
+    /**
+     * \brief Sets the size of each chunk.
+     *
+     * Smaller chunks balance the work better, while larger ones reduce the
+     * synchronization overhead. Files are split when they're first 
+     * processed, so this should be called before that.
+     *
+     * \param size The size of each chunk, in bytes.
+     */
+    void set_chunk_size(uint64_t size);
+
+    /**
+     * \brief Sets whether to extract RawPDUs or fully parsed packets.
+     *
+     * \param value Whether to extract RawPDUs or fully parsed packets.
+     * \sa MappedPcapReader::set_extract_raw_pdus
+     */
+    void set_extract_raw_pdus(bool value);
+
+    /**
+     * \brief Sets whether inner PDUs are decoded lazily.
+     *
+     * \param value Whether to decode lazily.
+     * \sa LazyDecodingGuard
+     */
+    void set_lazy_decoding(bool value);
+
+    /**
+     * \brief Processes every packet using a copy of the functor per worker.
+     *
+     * The functor is copied once for each worker thread, and every copy is 
+     * only ever called from its worker's thread. The functor must implement 
+     * one of the operators accepted by BaseSniffer::sniff_loop. Just like 
+     * BaseSniffer::sniff_loop, malformed_packet and pdu_not_found exceptions 
+     * thrown by the functor are caught.
+     *
+     * If any functor returns false or throws any other exception, every 
+     * worker stops. The first such exception is rethrown from this call.
+     *
+     * \param function The callback handler object which should process packets.
+     */
+    template <typename Functor>
+    void sniff_loop(Functor function);
+
+    /**
+     * \brief Processes every chunk into a partial result and reduces them.
+     *
+     * Each chunk gets its own, value initialized, partial result, which is 
+     * passed to the mapper along with each of the chunk's packets:
+     *
+     * \code
+     * void mapper(T& partial, Packet& packet);
+     * \endcode
+     *
+     * The mapper is copied once for each worker thread. Once every chunk
+     * is processed, partial results are reduced into the initial value on 
+     * the calling thread, in file order:
+     *
+     * \code
+     * void reducer(T& total, const T& partial);
+     * \endcode
+     *
+     * Since chunks are always reduced in the same order, the result doesn't
+     * depend on how chunks were scheduled. malformed_packet and 
+     * pdu_not_found exceptions thrown by the mapper are caught; any other
+     * exception stops every worker and is rethrown from this call.
+     *
+     * \param initial The value into which partial results are reduced.
+     * \param mapper The functor which accumulates packets.
+     * \param reducer The functor which reduces partial results.
+     * \return The reduced result.
+     */
+    template <typename T, typename Mapper, typename Reducer>
+    T map_reduce(const T& initial, Mapper mapper, Reducer reducer);
+
+    /**
+     * \brief Processes every packet, in timestamp order, on the calling 
+     * thread.
+     *
+     * Workers decode chunks ahead of time, while the calling thread merges 
+     * them and calls the functor on each packet. Each file is assumed to 
+     * be sorted by timestamp; packets in different files are interleaved 
+     * by timestamp, breaking ties using the order in which files were 
+     * provided. Only a few chunks per worker are kept decoded at any time.
+     *
+     * The functor must implement one of the operators accepted by 
+     * BaseSniffer::sniff_loop. If it returns false, processing stops.
+     *
+     * \param function The callback handler object which should process packets.
+     */
+    template <typename Functor>
+    void sniff_ordered(Functor function);
+
+    /**
+     * Retrieves the amount of chunks the files are split into.
+     */
+    size_t chunk_count() const;
+
+    /**
+     * Retrieves the amount of worker threads.
+     */
+    size_t thread_count() const;
+private:
+    typedef std::unique_ptr<MappedPcapReader> reader_ptr;
+
+    struct chunk {
+        size_t file;
+        // Records starting before this offset belong to this chunk
+        uint64_t limit;
+        // The guessed offset of the first record
+        uint64_t begin;
+        uint64_t first_timestamp;
+        bool first_in_file;
+    };
+
+    struct decoded_packet {
+        decoded_packet(Packet&& input, uint64_t input_timestamp)
+        : packet(std::move(input)), timestamp(input_timestamp) { }
+
+        Packet packet;
+        uint64_t timestamp;
+    };
+
+    typedef std::vector<decoded_packet> decoded_chunk;
+
+    class ErrorHandler {
+    public:
+        ErrorHandler(std::atomic<bool>& stopped);
+
+        void set_current_exception();
+        void rethrow();
+    private:
+        std::atomic<bool>& stopped_;
+        std::mutex mutex_;
+        std::exception_ptr error_;
+    };
+
+    // Keeps track of the actual offset at which each chunk starts
+    class BoundaryTracker {
+    public:
+        void reset(const std::vector<chunk>& chunks);
+        uint64_t wait(size_t index);
+        void set(size_t index, uint64_t offset);
+    private:
+        std::mutex mutex_;
+        std::condition_variable condition_;
+        std::vector<uint64_t> starts_;
+        std::vector<bool> known_;
+    };
+
+    ParallelPcapReader(const ParallelPcapReader&);
+    ParallelPcapReader& operator=(const ParallelPcapReader&);
+
+    void initialize(const std::vector<std::string>& file_names);
+    void split();
+    void guess_begin(chunk& output) const;
+    std::vector<size_t> timestamp_order() const;
+    void locate_chunk(size_t index, uint64_t& begin, uint64_t& end);
+    // Follows the record headers from offset until one starts at or after 
+    // limit. Returns false if a truncated or invalid record was found first
+    static bool walk_records(const MappedPcapReader& reader, uint64_t offset,
+                             uint64_t limit, uint64_t& end);
+    // Same as walk_records, but throws capture_file_error on bad records
+    static void strict_walk_records(const MappedPcapReader& reader, 
+                                    uint64_t limit, uint64_t& offset);
+    void decode_chunk(size_t index, uint64_t begin, uint64_t end,
+                      decoded_chunk& output) const;
+
+    template <typename Callback>
+    void run_workers(Callback callback);
+
+    template <typename Callback>
+    bool process_chunk(size_t index, Callback& callback);
+
+    std::vector<reader_ptr> readers_;
+    std::vector<chunk> chunks_;
+    BoundaryTracker boundaries_;
+    std::atomic<bool> stopped_;
+    uint64_t chunk_size_;
+    size_t thread_count_;
+    bool lazy_decoding_;
+};
+
+template <typename Callback>
+void ParallelPcapReader::run_workers(Callback callback) {
+    std::vector<std::thread> threads;
+    std::atomic<size_t> next_chunk(0);
+    ErrorHandler error_handler(stopped_);
+    boundaries_.reset(chunks_);
+    for (size_t i = 0; i < thread_count_; ++i) {
+        threads.emplace_back([&, callback]() mutable {
+            try {
+                LazyDecodingGuard lazy_guard(lazy_decoding_);
+                while (!stopped_.load(std::memory_order_relaxed)) {
+                    const size_t index = next_chunk.fetch_add(1);
+                    if (index >= chunks_.size() || !callback(index)) {
+                        return;
+                    }
+                }
+            }
+            catch (...) {
+                error_handler.set_current_exception();
+            }
+        });
+    }
+    for (size_t i = 0; i < threads.size(); ++i) {
+        threads[i].join();
+    }
+    error_handler.rethrow();
+}
+
+template <typename Callback>
+bool ParallelPcapReader::process_chunk(size_t index, Callback& callback) {
+    const MappedPcapReader& reader = *readers_[chunks_[index].file];
+    MappedPcapReader::record current;
+    uint64_t offset;
+    uint64_t end;
+    locate_chunk(index, offset, end);
+    while (offset < end && !stopped_.load(std::memory_order_relaxed)) {
+        offset = reader.record_at(offset, current);
+        if (offset == 0) {
+            break;
+        }
+        if (PDU* pdu = reader.decode(current)) {
+            Packet packet(pdu, current.timestamp(), Packet::own_pdu());
+            try {
+                if (!callback(packet)) {
+                    return false;
+                }
+            }
+            catch(malformed_packet&) { }
+            catch(pdu_not_found&) { }
+        }
+    }
+    return true;
+}
+
+template <typename Functor>
+void ParallelPcapReader::sniff_loop(Functor function) {
+    split();
+    stopped_ = false;
+    run_workers([&, function](size_t index) mutable {
+        auto callback = [&](Packet& packet) {
+            return Tins::Internals::invoke_loop_cb(function, packet);
+        };
+        if (!process_chunk(index, callback)) {
+            // If the functor returns false, everyone is done
+            stopped_ = true;
+            return false;
+        }
+        return true;
+    });
+}
+
+template <typename T, typename Mapper, typename Reducer>
+T ParallelPcapReader::map_reduce(const T& initial, Mapper mapper, Reducer reducer) {
+    split();
+    std::vector<T> partials(chunks_.size());
+    stopped_ = false;
+    run_workers([&, mapper](size_t index) mutable {
+        T& partial = partials[index];
+        auto callback = [&](Packet& packet) {
+            mapper(partial, packet);
+            return true;
+        };
+        process_chunk(index, callback);
+        return true;
+    });
+    T output = initial;
+    for (size_t i = 0; i < partials.size(); ++i) {
+        reducer(output, static_cast<const T&>(partials[i]));
+    }
+    return output;
+}
+
+template <typename Functor>
+void ParallelPcapReader::sniff_ordered(Functor function) {
+    split();
+    // Chunks are decoded in the same order they're needed by the merge below
+    const std::vector<size_t> order = timestamp_order();
+    const size_t window = thread_count_ * 2;
+    std::vector<decoded_chunk> decoded(chunks_.size());
+    std::vector<bool> ready(chunks_.size(), false);
+    std::mutex mutex;
+    std::condition_variable condition;
+    size_t decode_limit = window;
+    std::exception_ptr error;
+    auto stop = [&]() {
+        std::lock_guard<std::mutex> _(mutex);
+        stopped_ = true;
+        condition.notify_all();
+    };
+
+    stopped_ = false;
+    std::thread runner([&]() {
+        try {
+            run_workers([&](size_t index) {
+                // This has to be done even if we stop, as the worker of the
+                // next chunk may be waiting for it
+                uint64_t begin;
+                uint64_t end;
+                decoded_chunk output;
+                try {
+                    locate_chunk(order[index], begin, end);
+                    {
+                        // Don't get too far ahead of the merge
+                        std::unique_lock<std::mutex> lock(mutex);
+                        condition.wait(lock, [&]() { 
+                            return index < decode_limit || stopped_; 
+                        });
+                        if (stopped_) {
+                            return false;
+                        }
+                    }
+                    decode_chunk(order[index], begin, end, output);
+                }
+                catch (...) {
+                    // Wake up anyone waiting for this chunk
+                    stop();
+                    throw;
+                }
+                std::lock_guard<std::mutex> _(mutex);
+                decoded[index] = std::move(output);
+                ready[index] = true;
+                condition.notify_all();
+                return true;
+            });
+        }
+        catch (...) {
+            error = std::current_exception();
+        }
+        // Either everything was decoded or something went wrong
+        stop();
+    });
+
+    // A position within a decoded chunk
+    typedef std::pair<size_t, size_t> cursor;
+    auto later = [&](const cursor& lhs, const cursor& rhs) {
+        const uint64_t lhs_timestamp = decoded[lhs.first][lhs.second].timestamp;
+        const uint64_t rhs_timestamp = decoded[rhs.first][rhs.second].timestamp;
+        if (lhs_timestamp != rhs_timestamp) {
+            return lhs_timestamp > rhs_timestamp;
+        }
+        return lhs > rhs;
+    };
+    std::priority_queue<cursor, std::vector<cursor>, decltype(later)> heap(later);
+    size_t opened = 0;
+    // Waits until the next chunk is decoded and adds it to the merge
+    auto open_chunk = [&]() {
+        std::unique_lock<std::mutex> lock(mutex);
+        condition.wait(lock, [&]() { return ready[opened] || stopped_; });
+        if (!ready[opened]) {
+            return false;
+        }
+        if (!decoded[opened].empty()) {
+            heap.push(cursor(opened, 0));
+        }
+        opened++;
+        decode_limit = opened + window;
+        condition.notify_all();
+        return true;
+    };
+    try {
+        while (true) {
+            if (heap.empty()) {
+                if (opened == chunks_.size() || !open_chunk()) {
+                    break;
+                }
+                continue;
+            }
+            // Any chunk starting before the next packet has to be merged first
+            if (opened < chunks_.size() && 
+                chunks_[order[opened]].first_timestamp <= decoded[heap.top().first][heap.top().second].timestamp) {
+                if (!open_chunk()) {
+                    break;
+                }
+                continue;
+            }
+            cursor current = heap.top();
+            heap.pop();
+            decoded_chunk& current_chunk = decoded[current.first];
+            Packet packet(std::move(current_chunk[current.second].packet));
+            if (current.second + 1 < current_chunk.size()) {
+                heap.push(cursor(current.first, current.second + 1));
+            }
+            else {
+                // Release the chunk's memory as soon as it's done
+                decoded_chunk().swap(current_chunk);
+            }
+            try {
+                // If the functor returns false, we're done
+                if (!Tins::Internals::invoke_loop_cb(function, packet)) {
+                    break;
+                }
+            }
+            catch(malformed_packet&) { }
+            catch(pdu_not_found&) { }
+        }
+    }
+    catch (...) {
+        stop();
+        runner.join();
+        throw;
+    }
+    stop();
+    runner.join();
+    if (error) {
+        std::rethrow_exception(error);
+    }
+}
+
+} // Tins
+
+#endif // TINS_IS_CXX11 && !_WIN32
+
+#endif // TINS_PARALLEL_PCAP_READER_H
@@ -0,0 +1,300 @@
+/*
+ * Copyright (c) 2017, Matias Fontanini
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are
+ * met:
+ * 
+ * * Redistributions of source code must retain the above copyright
+ *   notice, this list of conditions and the following disclaimer.
+ * * Redistributions in binary form must reproduce the above
+ *   copyright notice, this list of conditions and the following disclaimer
+ *   in the documentation and/or other materials provided with the
+ *   distribution.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+
+#ifndef TINS_PARALLEL_SNIFFER_H
+#define TINS_PARALLEL_SNIFFER_H
+
+#include <tins/sniffer.h>
+
+#if defined(TINS_HAVE_PCAP) && TINS_IS_CXX11
+
+#include <vector>
+#include <memory>
+#include <atomic>
+#include <thread>
+#include <mutex>
+#include <exception>
+#include <tins/lazy_decoding.h>
+#include <tins/detail/frame_queue.h>
+
+namespace Tins {
+
+/**
+ * \class ParallelSniffer
+ * \brief Decouples packet capture from packet decoding and processing.
+ *
+ * A ParallelSniffer reads packets from a BaseSniffer in a single capture
+ * thread, which does nothing but copy each raw frame into the queue of one
+ * of several worker threads. Workers decode the frames into PDUs and call 
+ * the user provided functor on them.
+ *
+ * Each worker has its own lock-free single producer, single consumer queue,
+ * whose memory is allocated when the ParallelSniffer is constructed. Since 
+ * the capture thread never decodes packets nor runs user code, slow 
+ * handlers don't prevent it from draining the kernel's capture buffer; 
+ * bursts are absorbed by the queues instead.
+ *
+ * By default frames are distributed in a round robin fashion. If flow 
+ * affinity is enabled, every packet in the same flow (regardless of its 
+ * direction) is processed by the same worker, which allows using per 
+ * worker state such as a TCPIP::StreamFollower without locking.
+ *
+ * \code
+ * Sniffer sniffer("eth0");
+ * ParallelSniffer parallel_sniffer(sniffer, 4);
+ * parallel_sniffer.set_flow_affinity(true);
+ * parallel_sniffer.sniff_loop([](Packet& packet) {
+ *     // Called from one of the worker threads
+ *     return true;
+ * });
+ * \endcode
+ *
+ * This class is only available when compiling in C++11 mode.
+ */
+class TINS_API ParallelSniffer {
+public:
+    /**
+     * \brief The default size of each worker's queue.
+     *
+     * This is 8MB.
+     */
+    static const size_t DEFAULT_QUEUE_SIZE;
+
+    /**
+     * \brief Constructs a ParallelSniffer.
+     *
+     * The sniffer must outlive this object. Its settings, such as whether
+     * to extract RawPDUs or to decode lazily, are used when decoding 
+     * packets in the workers.
+     *
+     * Each frame can take up to half of a worker's queue. Larger frames 
+     * are dropped and counted in ParallelSniffer::packets_dropped.
+     *
+     * \param sniffer The sniffer from which packets will be captured.
+     * \param worker_count The amount of worker threads to use.
+     * \param queue_size The size, in bytes, of each worker's queue.
+     */
+    ParallelSniffer(BaseSniffer& sniffer, size_t worker_count,
+                    size_t queue_size = DEFAULT_QUEUE_SIZE);
+
+    /**
+     * \brief Sets whether packets in the same flow should be processed by
+     * the same worker.
+     *
+     * Flows are identified using the IP addresses, ports and transport 
+     * protocol of each packet. IP fragments are identified without their
+     * ports, so every fragment of a datagram reaches the same worker, 
+     * though not necessarily the one handling the rest of its flow.
+     *
+     * This only works on link layer types supported by PacketView. Other
+     * packets, as well as frames which aren't IP or IPv6 (e.g. ARP), are
+     * distributed using round robin.
+     *
+     * \param enabled Whether to use flow affinity.
+     */
+    void set_flow_affinity(bool enabled);
+
+    /**
+     * \brief Sets whether frames are dropped when a worker's queue is full.
+     *
+     * By default, the capture thread waits until there's room in the queue,
+     * so no packet is lost when reading from a file. When capturing from 
+     * a network interface, you might want to drop frames instead and 
+     * keep draining the kernel's buffer. Dropped frames are counted in
+     * ParallelSniffer::packets_dropped.
+     *
+     * \param enabled Whether to drop frames when a queue is full.
+     */
+    void set_drop_when_full(bool enabled);
+
+    /**
+     * \brief Starts a sniffing loop.
+     *
+     * The calling thread becomes the capture thread, while the functor
+     * is copied once for each worker. Every copy is only ever called from 
+     * its worker's thread. The functor must implement one of the operators 
+     * accepted by BaseSniffer::sniff_loop. Just like BaseSniffer::sniff_loop,
+     * malformed_packet and pdu_not_found exceptions thrown by the functor 
+     * are caught.
+     *
+     * This call returns once every captured packet has been processed. 
+     * Capture ends when max_packets are captured (if it is != 0), the end 
+     * of the capture is reached or ParallelSniffer::stop_sniff is called. 
+     * If any functor returns false or throws any other exception, sniffing 
+     * is stopped and queued packets are discarded. The first such exception
+     * is then rethrown from this call.
+     *
+     * \param function The callback handler object which should process packets.
+     * \param max_packets The maximum amount of packets to capture. 0 == infinite.
+     */
+    template <typename Functor>
+    void sniff_loop(Functor function, uint32_t max_packets = 0);
+
+    /**
+     * \brief Stops sniffing.
+     *
+     * This can be called from any thread. Packets that are still queued 
+     * are discarded.
+     */
+    void stop_sniff();
+
+    /**
+     * \brief Retrieves the amount of packets captured in the last sniffing
+     * loop, including dropped ones.
+     */
+    uint64_t packets_captured() const;
+
+    /**
+     * \brief Retrieves the amount of packets dropped in the last sniffing
+     * loop because a worker's queue was full or the frame didn't fit in it.
+     */
+    uint64_t packets_dropped() const;
+
+    /**
+     * Retrieves the amount of workers.
+     */
+    size_t worker_count() const;
+private:
+    typedef PDU* (*PacketDecoder)(const uint8_t*, uint32_t);
+    typedef std::unique_ptr<Internals::FrameQueue> queue_ptr;
+
+    static void capture_handler(u_char* user, const struct pcap_pkthdr* h,
+                                const u_char* bytes);
+    static void wait_for_frames(unsigned& idle_rounds);
+
+    void prepare();
+    void run_capture(uint32_t max_packets);
+    void dispatch(const struct pcap_pkthdr* h, const uint8_t* bytes);
+    static const size_t NO_FLOW;
+
+    // Returns NO_FLOW if the packet doesn't belong to an IP flow
+    size_t flow_worker(const uint8_t* bytes, uint32_t size) const;
+
+    template <typename Functor>
+    void run_worker(size_t index, Functor& function);
+
+    BaseSniffer& sniffer_;
+    std::vector<queue_ptr> queues_;
+    std::atomic<bool> stopped_;
+    std::atomic<bool> capture_done_;
+    std::atomic<uint64_t> packets_captured_;
+    std::atomic<uint64_t> packets_dropped_;
+    PacketDecoder decoder_;
+    PDU::PDUType link_type_;
+    size_t next_worker_;
+    bool flow_affinity_;
+    bool drop_when_full_;
+    bool lazy_decoding_;
+};
+
+template <typename Functor>
+void ParallelSniffer::sniff_loop(Functor function, uint32_t max_packets) {
+    prepare();
+    std::vector<std::thread> threads;
+    std::mutex error_mutex;
+    std::exception_ptr error;
+    for (size_t i = 0; i < queues_.size(); ++i) {
+        threads.emplace_back([&, i, function]() mutable {
+            try {
+                run_worker(i, function);
+            }
+            catch (...) {
+                std::lock_guard<std::mutex> _(error_mutex);
+                if (!error) {
+                    error = std::current_exception();
+                }
+                stop_sniff();
+            }
+        });
+    }
+    try {
+        run_capture(max_packets);
+    }
+    catch (...) {
+        std::lock_guard<std::mutex> _(error_mutex);
+        if (!error) {
+            error = std::current_exception();
+        }
+        stopped_ = true;
+    }
+    capture_done_.store(true, std::memory_order_release);
+    for (size_t i = 0; i < threads.size(); ++i) {
+        threads[i].join();
+    }
+    if (error) {
+        std::rethrow_exception(error);
+    }
+}
+
+template <typename Functor>
+void ParallelSniffer::run_worker(size_t index, Functor& function) {
+    Internals::FrameQueue& queue = *queues_[index];
+    Internals::FrameQueue::frame frame;
+    LazyDecodingGuard lazy_guard(lazy_decoding_);
+    unsigned idle_rounds = 0;
+    while (!stopped_.load(std::memory_order_relaxed)) {
+        if (!queue.front(frame)) {
+            // Only quit once the capture is done and the queue is drained
+            if (capture_done_.load(std::memory_order_acquire)) {
+                if (!queue.front(frame)) {
+                    return;
+                }
+            }
+            else {
+                wait_for_frames(idle_rounds);
+                continue;
+            }
+        }
+        idle_rounds = 0;
+        PDU* pdu = decoder_(frame.data, frame.size);
+        const Timestamp timestamp = frame.timestamp;
+        // The PDU has its own copy of the data
+        queue.pop();
+        if (!pdu) {
+            continue;
+        }
+        Packet packet(pdu, timestamp, Packet::own_pdu());
+        try {
+            // If the functor returns false, everyone is done
+            if (!Tins::Internals::invoke_loop_cb(function, packet)) {
+                stop_sniff();
+                return;
+            }
+        }
+        catch(malformed_packet&) { }
+        catch(pdu_not_found&) { }
+    }
+}
+
+} // Tins
+
+#endif // TINS_HAVE_PCAP && TINS_IS_CXX11
+
+#endif // TINS_PARALLEL_SNIFFER_H
@@ -0,0 +1,317 @@
+/*
+ * Copyright (c) 2017, Matias Fontanini
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are
+ * met:
+ * 
+ * * Redistributions of source code must retain the above copyright
+ *   notice, this list of conditions and the following disclaimer.
+ * * Redistributions in binary form must reproduce the above
+ *   copyright notice, this list of conditions and the following disclaimer
+ *   in the documentation and/or other materials provided with the
+ *   distribution.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+
+#ifndef TINS_PCAPNG_READER_H
+#define TINS_PCAPNG_READER_H
+
+#include <string>
+#include <vector>
+#include <cstdio>
+#include <stdint.h>
+#include <tins/macros.h>
+#include <tins/cxxstd.h>
+#include <tins/packet.h>
+#include <tins/timestamp.h>
+#include <tins/exceptions.h>
+#include <tins/detail/type_traits.h>
+
+namespace Tins {
+
+/**
+ * \class PcapngReader
+ * \brief Reads pcapng files.
+ *
+ * This class parses pcapng files on its own, without using libpcap, so 
+ * it doesn't depend on the version of libpcap that's installed. Files are
+ * read in large chunks and blocks are parsed in place.
+ *
+ * Section header, interface description, enhanced packet, simple packet
+ * and interface statistics blocks are supported; any other block is 
+ * skipped. Each interface has its own link layer type and timestamp 
+ * resolution, which are used when decoding and timestamping the packets 
+ * captured on it. Files can contain several sections, written in either 
+ * byte order.
+ *
+ * \code
+ * PcapngReader reader("capture.pcapng");
+ * PcapngReader::record record;
+ * while (reader.next_record(record)) {
+ *     const PcapngReader::interface_info& interface = reader.interface(record.interface_id);
+ *     // ...
+ * }
+ * \endcode
+ */
+class TINS_API PcapngReader {
+public:
+    /**
+     * \brief A packet in the file.
+     *
+     * The data pointer points into the reader's internal buffer, so it's 
+     * only valid until the next record is read.
+     */
+    struct record {
+        /**
+         * The captured data.
+         */
+        const uint8_t* data;
+
+        /**
+         * The amount of bytes captured.
+         */
+        uint32_t size;
+
+        /**
+         * The size of the packet on the wire.
+         */
+        uint32_t wire_size;
+
+        /**
+         * The interface in which this packet was captured.
+         */
+        uint32_t interface_id;
+
+        /**
+         * The seconds part of the timestamp. 
+         *
+         * Packets in simple packet blocks have no timestamp, so this is 
+         * 0 for them.
+         */
+        uint64_t seconds;
+
+        /**
+         * The fractional part of the timestamp, in nanoseconds.
+         */
+        uint32_t nanoseconds;
+
+        /**
+         * Returns this record's timestamp.
+         */
+        Timestamp timestamp() const;
+    };
+
+    /**
+     * \brief Describes an interface in the current section.
+     */
+    struct interface_info {
+        /**
+         * The interface's link layer type, as defined by libpcap's LINKTYPE_ 
+         * values.
+         */
+        uint16_t link_type;
+
+        /**
+         * The maximum amount of bytes captured per packet, 0 meaning there's
+         * no limit.
+         */
+        uint32_t snap_len;
+
+        /**
+         * The interface's name, if present.
+         */
+        std::string name;
+
+        /**
+         * The amount of timestamp units per second.
+         */
+        uint64_t units_per_second;
+
+        /**
+         * The amount of seconds to be added to each timestamp.
+         */
+        int64_t timestamp_offset;
+
+        /**
+         * The amount of packets received, as found in the last interface 
+         * statistics block for this interface.
+         */
+        uint64_t packets_received;
+
+        /**
+         * The amount of packets dropped, as found in the last interface 
+         * statistics block for this interface.
+         */
+        uint64_t packets_dropped;
+    };
+
+    /**
+     * \brief The default size of the internal buffer.
+     *
+     * This is 1MB.
+     */
+    static const size_t DEFAULT_BUFFER_SIZE;
+
+    /**
+     * \brief Constructs a PcapngReader.
+     *
+     * The section header block at the beginning of the file is read.
+     *
+     * \param file_name The path of the file to be read.
+     * \param buffer_size The size of the internal buffer.
+     */
+    PcapngReader(const std::string& file_name, size_t buffer_size = DEFAULT_BUFFER_SIZE);
+
+    /**
+     * \brief Destructor.
+     *
+     * Closes the file.
+     */
+    ~PcapngReader();
+
+    /**
+     * \brief Reads the next packet.
+     *
+     * Non packet blocks found along the way are processed and skipped.
+     *
+     * \param output The record in which to store the packet.
+     * \return true if a packet was read, false if the end of the file
+     * was reached.
+     * \throw capture_file_error If a block is truncated, invalid or larger
+     * than 16MB.
+     */
+    bool next_record(record& output);
+
+    /**
+     * \brief Reads and decodes the next packet.
+     *
+     * Each packet is decoded using its interface's link layer type. Packets
+     * which are malformed are skipped.
+     *
+     * \return The packet read, or an empty one if the end of the file
+     * was reached.
+     */
+    PtrPacket next_packet();
+
+    /**
+     * \brief Starts a sniffing loop.
+     *
+     * The functor must implement one of the operators accepted by 
+     * BaseSniffer::sniff_loop. The loop ends when the functor returns
+     * false, max_packets are read (if it is != 0) or the end of the file is
+     * reached. Just like BaseSniffer::sniff_loop, malformed_packet and 
+     * pdu_not_found exceptions thrown by the functor are caught.
+     *
+     * \param function The callback handler object which should process packets.
+     * \param max_packets The maximum amount of packets to read. 0 == infinite.
+     */
+    template <typename Functor>
+    void sniff_loop(Functor function, uint32_t max_packets = 0);
+
+    /**
+     * \brief Sets whether to extract RawPDUs or fully parsed packets.
+     *
+     * \param value Whether to extract RawPDUs or fully parsed packets.
+     */
+    void set_extract_raw_pdus(bool value);
+
+    /**
+     * \brief Sets whether inner PDUs are decoded lazily.
+     *
+     * \param value Whether to decode lazily.
+     * \sa LazyDecodingGuard
+     */
+    void set_lazy_decoding(bool value);
+
+    /**
+     * \brief Retrieves the amount of interfaces in the current section.
+     */
+    uint32_t interface_count() const;
+
+    /**
+     * \brief Retrieves an interface in the current section.
+     *
+     * Statistics blocks found so far are reflected on the returned object.
+     *
+     * \param interface_id The interface's identifier.
+     */
+    const interface_info& interface(uint32_t interface_id) const;
+
+    /**
+     * \brief Retrieves the amount of sections read so far.
+     */
+    uint32_t section_count() const;
+private:
+    typedef PDU* (*PacketDecoder)(const uint8_t*, uint32_t);
+
+    PcapngReader(const PcapngReader&);
+    PcapngReader& operator=(const PcapngReader&);
+
+    bool ensure(size_t size);
+    bool next_block(uint32_t& type, const uint8_t*& body, uint32_t& body_size);
+    void read_section_header(const uint8_t* body, uint32_t body_size);
+    void read_interface(const uint8_t* body, uint32_t body_size);
+    void read_statistics(const uint8_t* body, uint32_t body_size);
+    void convert_timestamp(const uint8_t* ptr, const interface_info& interface,
+                           record& output) const;
+    PacketDecoder packet_decoder(uint16_t link_type) const;
+    uint16_t read16(const uint8_t* ptr) const;
+    uint32_t read32(const uint8_t* ptr) const;
+    uint64_t read64(const uint8_t* ptr) const;
+
+    FILE* file_;
+    std::vector<uint8_t> buffer_;
+    size_t buffer_begin_;
+    size_t buffer_end_;
+    std::vector<interface_info> interfaces_;
+    uint32_t section_count_;
+    bool swapped_;
+    bool extract_raw_;
+    bool lazy_decoding_;
+};
+
+template <typename Functor>
+void PcapngReader::sniff_loop(Functor function, uint32_t max_packets) {
+    while (true) {
+        Packet packet(next_packet());
+        if (!packet) {
+            return;
+        }
+        try {
+            // If the functor returns false, we're done
+            #if TINS_IS_CXX11 && !defined(_MSC_VER)
+            if (!Tins::Internals::invoke_loop_cb(function, packet)) {
+                return;
+            }
+            #else
+            if (!function(*packet.pdu())) {
+                return;
+            }
+            #endif
+        }
+        catch(malformed_packet&) { }
+        catch(pdu_not_found&) { }
+        if (max_packets && --max_packets == 0) {
+            return;
+        }
+    }
+}
+
+} // Tins
+
+#endif // TINS_PCAPNG_READER_H
@@ -0,0 +1,242 @@
+/*
+ * Copyright (c) 2017, Matias Fontanini
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are
+ * met:
+ * 
+ * * Redistributions of source code must retain the above copyright
+ *   notice, this list of conditions and the following disclaimer.
+ * * Redistributions in binary form must reproduce the above
+ *   copyright notice, this list of conditions and the following disclaimer
+ *   in the documentation and/or other materials provided with the
+ *   distribution.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+
+#ifndef TINS_PCAPNG_WRITER_H
+#define TINS_PCAPNG_WRITER_H
+
+#include <string>
+#include <vector>
+#include <cstdio>
+#include <stdint.h>
+#include <tins/macros.h>
+#include <tins/cxxstd.h>
+#include <tins/timestamp.h>
+
+namespace Tins {
+
+class PDU;
+class Packet;
+
+template<typename T>
+struct DataLinkType;
+
+/**
+ * \class PcapngWriter
+ * \brief Writes packets to pcapng files.
+ *
+ * This class writes pcapng files on its own, without using libpcap. 
+ * Unlike PacketWriter, a single file can contain packets captured on 
+ * several interfaces, each of them having its own link layer type and 
+ * timestamp resolution.
+ *
+ * Blocks are built in a large internal buffer, which is only written to 
+ * the file when full. PDUs are serialized into a buffer that is reused 
+ * across calls, so writing a packet doesn't usually allocate memory.
+ *
+ * The section header is written when the file is opened. Interfaces have 
+ * to be added, using PcapngWriter::add_interface, before writing any 
+ * packet captured on them:
+ *
+ * \code
+ * PcapngWriter writer("capture.pcapng");
+ * uint32_t eth0 = writer.add_interface(DataLinkType<EthernetII>(), "eth0");
+ * uint32_t wlan0 = writer.add_interface(DataLinkType<RadioTap>(), "wlan0");
+ * writer.write(ethernet_packet, eth0);
+ * writer.write(radiotap_packet, wlan0);
+ * \endcode
+ */
+class TINS_API PcapngWriter {
+public:
+    /**
+     * The resolution of the timestamps written for an interface.
+     */
+    enum Resolution {
+        MICROSECONDS,
+        NANOSECONDS
+    };
+
+    /**
+     * \brief The default size of the internal buffer.
+     *
+     * This is 1MB.
+     */
+    static const size_t DEFAULT_BUFFER_SIZE;
+
+    /**
+     * \brief Constructs a PcapngWriter.
+     *
+     * The file is created (or truncated) and the section header block 
+     * is written.
+     *
+     * \param file_name The file in which to store the written packets.
+     * \param buffer_size The size of the internal buffer.
+     */
+    PcapngWriter(const std::string& file_name, size_t buffer_size = DEFAULT_BUFFER_SIZE);
+
+    /**
+     * \brief Destructor.
+     *
+     * Flushes any buffered data and closes the file.
+     */
+    ~PcapngWriter();
+
+    /**
+     * \brief Adds an interface to the file.
+     *
+     * \param link_type The link layer type of the packets captured on this
+     * interface, as defined by libpcap's LINKTYPE_ values.
+     * \param name The name of the interface. If empty, no name is written.
+     * \param snap_len The maximum amount of bytes captured per packet, 0
+     * meaning there's no limit.
+     * \param resolution The resolution of this interface's timestamps.
+     * \return The identifier of the added interface.
+     * \throw option_payload_too_large If the name is longer than 65535 bytes.
+     */
+    uint32_t add_interface(uint16_t link_type, const std::string& name = "",
+                           uint32_t snap_len = 0, Resolution resolution = NANOSECONDS);
+
+    /**
+     * \brief Adds an interface to the file.
+     *
+     * \code
+     * uint32_t id = writer.add_interface(DataLinkType<EthernetII>(), "eth0");
+     * \endcode
+     *
+     * \param link_type A DataLinkType that represents the link layer
+     * protocol of this interface.
+     * \param name The name of the interface. If empty, no name is written.
+     * \param snap_len The maximum amount of bytes captured per packet, 0
+     * meaning there's no limit.
+     * \param resolution The resolution of this interface's timestamps.
+     * \return The identifier of the added interface.
+     * \throw unknown_link_type If the link layer type has no LINKTYPE_ 
+     * value.
+     * \throw option_payload_too_large If the name is longer than 65535 bytes.
+     */
+    template <typename T>
+    uint32_t add_interface(const DataLinkType<T>& link_type, const std::string& name = "",
+                           uint32_t snap_len = 0, Resolution resolution = NANOSECONDS) {
+        return add_dlt_interface(link_type.get_type(), name, snap_len, resolution);
+    }
+
+    /**
+     * \brief Writes a PDU using the current time as its timestamp.
+     *
+     * \param pdu The PDU to be written.
+     * \param interface_id The interface in which the PDU was captured.
+     */
+    void write(PDU& pdu, uint32_t interface_id = 0);
+
+    /**
+     * \brief Writes a Packet.
+     *
+     * The timestamp used on the entry for this packet will be the Timestamp
+     * object associated with this packet.
+     *
+     * \param packet The packet to be written.
+     * \param interface_id The interface in which the packet was captured.
+     */
+    void write(Packet& packet, uint32_t interface_id = 0);
+
+    /**
+     * \brief Writes a PDU using the given timestamp.
+     *
+     * \param pdu The PDU to be written.
+     * \param timestamp The packet's timestamp.
+     * \param interface_id The interface in which the PDU was captured.
+     */
+    void write(PDU& pdu, const Timestamp& timestamp, uint32_t interface_id = 0);
+
+    /**
+     * \brief Writes an already serialized packet.
+     *
+     * This allows writing nanosecond resolution timestamps.
+     *
+     * \param data The packet's contents.
+     * \param size The amount of bytes captured.
+     * \param wire_size The size of the packet on the wire.
+     * \param seconds The seconds part of the timestamp.
+     * \param nanoseconds The fractional part of the timestamp, in nanoseconds.
+     * \param interface_id The interface in which the packet was captured.
+     */
+    void write(const uint8_t* data, uint32_t size, uint32_t wire_size, 
+               uint64_t seconds, uint32_t nanoseconds, uint32_t interface_id = 0);
+
+    /**
+     * \brief Writes a packet using a simple packet block.
+     *
+     * Simple packet blocks have no timestamp and always refer to the first
+     * interface, but they're smaller than enhanced packet blocks.
+     *
+     * \param pdu The PDU to be written.
+     */
+    void write_simple(PDU& pdu);
+
+    /**
+     * \brief Writes the statistics of an interface.
+     *
+     * \param interface_id The interface the statistics belong to.
+     * \param timestamp The time at which the statistics were taken.
+     * \param packets_received The amount of packets received on the interface.
+     * \param packets_dropped The amount of packets dropped on the interface.
+     */
+    void write_statistics(uint32_t interface_id, const Timestamp& timestamp,
+                          uint64_t packets_received, uint64_t packets_dropped);
+
+    /**
+     * \brief Writes any buffered data to the file.
+     */
+    void flush();
+
+    /**
+     * Retrieves the amount of interfaces added.
+     */
+    uint32_t interface_count() const;
+private:
+    PcapngWriter(const PcapngWriter&);
+    PcapngWriter& operator=(const PcapngWriter&);
+
+    uint8_t* start_block(uint32_t type, uint32_t body_size);
+    void write_timestamp(uint8_t* buffer, uint32_t interface_id, uint64_t seconds,
+                         uint32_t nanoseconds) const;
+    uint32_t add_dlt_interface(int dlt, const std::string& name, uint32_t snap_len,
+                               Resolution resolution);
+    void check_interface(uint32_t interface_id) const;
+    void write_header();
+
+    FILE* file_;
+    std::vector<uint8_t> buffer_;
+    size_t buffer_used_;
+    std::vector<Resolution> resolutions_;
+};
+
+} // Tins
+
+#endif // TINS_PCAPNG_WRITER_H
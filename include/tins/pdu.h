@@ -44,6 +44,10 @@ namespace Tins {
 class PacketSender;
 class NetworkInterface;
 
+namespace Internals {
+class LazyPDU;
+} // Internals
+
 /**
  * The type used to store several PDU option values.
  */
@@ -82,6 +86,11 @@ typedef std::vector<uint8_t> byte_array;
  * const TCP& tcp = packet.rfind_pdu<TCP>();
  * \endcode
  *
+ * Each PDU keeps track of which protocol flags are matched by the layers
+ * in its inner PDU chain, which is updated whenever an inner PDU changes.
+ * This lets find_pdu stop looking as soon as no layer below can match, so
+ * lookups that find nothing don't need to walk the whole chain.
+ *
  * PDU objects can be serialized. Serialization converts the entire PDU
  * stack into a vector of bytes. This process might modify some parameters
  * on packets depending on which protocols are used in it. For example:
@@ -103,6 +112,18 @@ typedef std::vector<uint8_t> byte_array;
  * // Now serialize it. This is a std::vector<uint8_t>.
  * PDU::serialization_type buffer = packet.serialize();
  * \endcode
+ *
+ * When serializing many packets, use PDU::serialize_into instead. This
+ * reuses the memory held by the provided buffer rather than allocating
+ * a new one each time:
+ *
+ * \code
+ * PDU::serialization_type buffer;
+ * for (size_t i = 0; i < packets.size(); ++i) {
+ *     packets[i].serialize_into(buffer);
+ *     // use buffer...
+ * }
+ * \endcode
  */
 class TINS_API PDU {
 public:
@@ -231,11 +252,14 @@ public:
          * \param rhs The PDU to be moved.
          */
         PDU(PDU &&rhs) TINS_NOEXCEPT 
-        : inner_pdu_(0), parent_pdu_(0) {
+        : inner_pdu_(0), parent_pdu_(0), inner_flags_(0), layer_depths_(),
+          malformed_(rhs.malformed_), lazy_placeholder_(false), lazy_inner_(false) {
             std::swap(inner_pdu_, rhs.inner_pdu_);
             if (inner_pdu_) {
                 inner_pdu_->parent_pdu(this);
             }
+            update_inner_flags();
+            rhs.update_inner_flags();
         }
         
         /**
@@ -250,6 +274,8 @@ public:
             if (inner_pdu_) {
                 inner_pdu_->parent_pdu(this);
             }
+            update_inner_flags();
+            rhs.update_inner_flags();
             return* this;
         }
     #endif
@@ -282,12 +308,51 @@ public:
 
     /**
      * \brief Getter for the inner PDU.
+     *
+     * If this PDU was constructed while lazy decoding was enabled, the 
+     * inner PDU is decoded the first time this method is called. If it
+     * can't be decoded, it's replaced by a RawPDU holding its contents.
+     *
+     * \sa LazyDecodingGuard
+     * \return The current inner PDU. Might be a null pointer.
+     */
+    PDU* inner_pdu() {
+        if (TINS_UNLIKELY(inner_pdu_ != 0 && inner_pdu_->lazy_placeholder_)) {
+            decode_inner_pdu();
+        }
+        return inner_pdu_;
+    }
+
+    /**
+     * \brief Getter for the inner PDU.
+     *
+     * If the inner PDU hasn't been decoded yet, it's decoded the first 
+     * time this method is called. Since this PDU can't be modified, the 
+     * decoded PDU is kept aside until the non const overload or 
+     * PDU::decode moves it into the chain. This is thread safe, so const 
+     * PDUs can still be inspected from several threads.
+     *
+     * \sa LazyDecodingGuard
      * \return The current inner PDU. Might be a null pointer.
      */
     PDU* inner_pdu() const {
+        if (TINS_UNLIKELY(inner_pdu_ != 0 && inner_pdu_->lazy_placeholder_)) {
+            return decoded_inner_pdu();
+        }
         return inner_pdu_;
     }
 
+    /**
+     * \brief Decodes every lazily decoded PDU in this chain.
+     *
+     * Inner PDUs that can't be decoded are replaced by a RawPDU holding 
+     * their contents.
+     *
+     * \sa LazyDecodingGuard
+     * \throw malformed_packet If any of the inner PDUs was malformed.
+     */
+    void decode();
+
     /**
      * Getter for the parent PDU
      * \return The current parent PDU. Might be a null pointer.
@@ -382,34 +447,73 @@ public:
      */
     serialization_type serialize();
 
+    /** 
+     * \brief Serializes the whole chain of PDU's into the given buffer.
+     *
+     * The buffer is resized to size() and filled with the serialization
+     * of this PDU and all of the inner ones'. Its memory is reused, so
+     * no allocation takes place as long as its capacity is large enough.
+     *
+     * \param buffer The buffer in which to store the serialization.
+     */
+    void serialize_into(serialization_type& buffer);
+
+    /** 
+     * \brief Serializes the whole chain of PDU's into the given buffer.
+     *
+     * \param buffer The buffer in which to store the serialization.
+     * \param total_sz The size of the buffer.
+     * \return The amount of bytes written, which is equal to size().
+     * \throw serialization_error If the buffer is smaller than size().
+     */
+    uint32_t serialize_into(uint8_t* buffer, uint32_t total_sz);
+
     /** 
      * \brief Finds and returns the first PDU that matches the given flag.
      *
      * This method searches for the first PDU which has the same type flag as
      * the given one. If the first PDU matches that flag, it is returned.
      * If no PDU matches, 0 is returned.
+     *
+     * Every PDU keeps an index of how deep below it the first layer 
+     * matching each protocol is, which is updated whenever the chain is 
+     * modified. Lookups follow the inner PDUs straight to that layer, 
+     * without testing the ones in between. The chain is only searched 
+     * layer by layer for user defined PDU types and for layers that still
+     * have to be decoded, which are decoded while searching.
      * \param flag The flag which being searched.
      */
     template<typename T> 
     T* find_pdu(PDUType type = T::pdu_flag) {
-        PDU* pdu = this;
-        while (pdu) {
-            if (pdu->matches_flag(type)) {
-                return static_cast<T*>(pdu);
-            }
-            pdu = pdu->inner_pdu();
-        }
-        return 0;
+        return static_cast<T*>(find_layer(type));
     }
     
     /**
      * \brief Finds and returns the first PDU that matches the given flag.
      *
+     * Lazily decoded inner PDUs are decoded while searching, as done by
+     * the const PDU::inner_pdu overload.
+     *
      * \param flag The flag which being searched.
      */
     template<typename T> 
     const T* find_pdu(PDUType type = T::pdu_flag) const {
-        return const_cast<PDU*>(this)->find_pdu<T>(type);
+        return static_cast<const T*>(find_layer(type));
+    }
+
+    /**
+     * \brief Indicates whether this PDU or any PDU below it matches the 
+     * given flag.
+     *
+     * This only checks the flags kept by this PDU, unless some of the 
+     * layers below still have to be decoded. In that case, they're decoded
+     * just like PDU::find_pdu does.
+     *
+     * \param flag The flag which being searched.
+     */
+    template<typename T>
+    bool has_pdu(PDUType type = T::pdu_flag) const {
+        return has_layer(type);
     }
 
     /**
@@ -437,7 +541,11 @@ public:
      */
     template<typename T> 
     const T& rfind_pdu(PDUType type = T::pdu_flag) const {
-        return const_cast<PDU*>(this)->rfind_pdu<T>(type);
+        const T* ptr = find_pdu<T>(type);
+        if (!ptr) {
+            throw pdu_not_found();
+        }
+        return* ptr;
     }
 
     /**
@@ -557,11 +665,27 @@ protected:
      */
     virtual void write_serialization(uint8_t* buffer, uint32_t total_sz) = 0;
 private:
+    friend class Internals::LazyPDU;
+
     void parent_pdu(PDU* parent);
+    bool decode_inner_pdu();
+    PDU* decoded_inner_pdu() const;
+    PDU* find_layer(PDUType type);
+    const PDU* find_layer(PDUType type) const;
+    bool has_layer(PDUType type) const;
+    void update_inner_flags();
 
     PDU* inner_pdu_;
     PDU* parent_pdu_;
+    // The flags matched by the decoded layers below this one
+    uint64_t inner_flags_;
+    // For each flag in inner_flags_, how many layers below this one the 
+    // first decoded layer matching it is. 0 if there's none or it's too deep
+    uint8_t layer_depths_[64];
     bool malformed_;
+    bool lazy_placeholder_;
+    // Whether any layer below this one hasn't been decoded yet
+    bool lazy_inner_;
 };
 
 /**
@@ -30,8 +30,13 @@
 #ifndef TINS_PDU_ALLOCATOR_H
 #define TINS_PDU_ALLOCATOR_H
 
-#include <map>
 #include <tuple>
+#include <vector>
+#include <memory>
+#include <atomic>
+#include <mutex>
+#include <utility>
+#include <algorithm>
 #include <tins/pdu.h>
 
 namespace Tins {
@@ -64,6 +69,41 @@ PDU* default_allocator(const uint8_t* buffer, uint32_t size) {
     return new PDUType(buffer, size);
 }
 
+/*
+ * Maps identifiers into dense indexes used by PDUAllocator's tables.
+ */
+template<typename IDType>
+struct allocator_index;
+
+template<>
+struct allocator_index<uint8_t> {
+    static const size_t size = 256;
+
+    static size_t index(uint8_t identifier) {
+        return identifier;
+    }
+};
+
+template<>
+struct allocator_index<uint16_t> {
+    static const size_t size = 65536;
+
+    static size_t index(uint16_t identifier) {
+        return identifier;
+    }
+};
+
+/*
+ * Allocators for a group of PDUs sharing the same kind of identifier.
+ *
+ * Allocators are stored in immutable two level tables indexed by the 
+ * identifier: a directory of pages, each of them holding 256 allocators. 
+ * Registering an allocator copies the directory and the modified page and
+ * publishes the new table atomically, so looking up an allocator never 
+ * takes a lock and costs two loads. Pages that didn't change are shared 
+ * between tables. Since registrations are rare and readers may still be 
+ * using an old table, replaced tables are kept around.
+ */
 template<typename Tag>
 class PDUAllocator {
 public:
@@ -72,36 +112,118 @@ public:
 
     template<typename PDUType>
     static void register_allocator(id_type identifier) {
-        allocators[identifier] = &default_allocator<PDUType>;
-        pdu_types[PDUType::pdu_flag] = identifier;
+        update(identifier, &default_allocator<PDUType>, true, PDUType::pdu_flag);
+    }
+
+    static void register_decoder(id_type identifier, allocator_type decoder) {
+        update(identifier, decoder, false, PDU::UNKNOWN);
     }
 
     static PDU* allocate(id_type identifier, const uint8_t* buffer, uint32_t size) {
-        typename allocators_type::const_iterator it = allocators.find(identifier);
-        return (it == allocators.end()) ? 0 : (*it->second)(buffer, size);
+        const table* current = table_.load(std::memory_order_acquire);
+        if (!current) {
+            return 0;
+        }
+        const size_t index = index_type::index(identifier);
+        const page* current_page = current->pages[index / ENTRIES_PER_PAGE];
+        if (!current_page) {
+            return 0;
+        }
+        const allocator_type allocator = current_page->allocators[index % ENTRIES_PER_PAGE];
+        return allocator ? (*allocator)(buffer, size) : 0;
     }
 
     static bool pdu_type_registered(PDU::PDUType type) {
-        return pdu_types.count(type) != 0;
+        const table* current = table_.load(std::memory_order_acquire);
+        return current && find_type(*current, type) != current->pdu_types.end();
     }
 
     static id_type pdu_type_to_id(PDU::PDUType type) {
-        typename pdu_map_types::const_iterator it = pdu_types.find(type);
-        return it->second;
+        const table* current = table_.load(std::memory_order_acquire);
+        return find_type(*current, type)->second;
     }
 private:
-    typedef std::map<id_type, allocator_type> allocators_type;
-    typedef std::map<PDU::PDUType, id_type> pdu_map_types;
+    typedef allocator_index<id_type> index_type;
+    typedef std::vector<std::pair<PDU::PDUType, id_type> > pdu_types_type;
 
-    static allocators_type allocators;
-    static pdu_map_types pdu_types;
-};
+    static const size_t ENTRIES_PER_PAGE = 256;
+    static const size_t PAGE_COUNT = (index_type::size + ENTRIES_PER_PAGE - 1) / ENTRIES_PER_PAGE;
 
-template<typename Tag>
-typename PDUAllocator<Tag>::allocators_type PDUAllocator<Tag>::allocators;
+    struct page {
+        allocator_type allocators[ENTRIES_PER_PAGE];
+    };
+
+    struct table {
+        const page* pages[PAGE_COUNT];
+        // Sorted by PDU type
+        pdu_types_type pdu_types;
+    };
+
+    // Everything ever allocated, so old tables can still be read
+    struct storage {
+        std::vector<std::unique_ptr<table> > tables;
+        std::vector<std::unique_ptr<page> > pages;
+    };
+
+    static bool type_less(const std::pair<PDU::PDUType, id_type>& lhs, PDU::PDUType rhs) {
+        return lhs.first < rhs;
+    }
+
+    static typename pdu_types_type::const_iterator find_type(const table& input,
+                                                             PDU::PDUType type) {
+        typename pdu_types_type::const_iterator it = std::lower_bound(
+            input.pdu_types.begin(),
+            input.pdu_types.end(),
+            type,
+            &type_less
+        );
+        return (it != input.pdu_types.end() && it->first == type) ? it : input.pdu_types.end();
+    }
+
+    static void update(id_type identifier, allocator_type allocator, bool map_type,
+                       PDU::PDUType type) {
+        // Function local so registering from static initializers works
+        static std::mutex mutex;
+        static storage allocated;
+        std::lock_guard<std::mutex> _(mutex);
+
+        const table* current = table_.load(std::memory_order_relaxed);
+        std::unique_ptr<table> new_table(new table());
+        if (current) {
+            *new_table = *current;
+        }
+        const size_t index = index_type::index(identifier);
+        std::unique_ptr<page> new_page(new page());
+        if (const page* current_page = new_table->pages[index / ENTRIES_PER_PAGE]) {
+            *new_page = *current_page;
+        }
+        new_page->allocators[index % ENTRIES_PER_PAGE] = allocator;
+        new_table->pages[index / ENTRIES_PER_PAGE] = new_page.get();
+        if (map_type) {
+            pdu_types_type& pdu_types = new_table->pdu_types;
+            typename pdu_types_type::iterator it = std::lower_bound(
+                pdu_types.begin(),
+                pdu_types.end(),
+                type,
+                &type_less
+            );
+            if (it != pdu_types.end() && it->first == type) {
+                it->second = identifier;
+            }
+            else {
+                pdu_types.insert(it, std::make_pair(type, identifier));
+            }
+        }
+        table_.store(new_table.get(), std::memory_order_release);
+        allocated.pages.push_back(std::move(new_page));
+        allocated.tables.push_back(std::move(new_table));
+    }
+
+    static std::atomic<const table*> table_;
+};
 
 template<typename Tag>
-typename PDUAllocator<Tag>::pdu_map_types PDUAllocator<Tag>::pdu_types;
+std::atomic<const typename PDUAllocator<Tag>::table*> PDUAllocator<Tag>::table_(0);
 
 template<typename IDType>
 struct pdu_tag {
@@ -122,6 +244,15 @@ bool operator<(DirAndPort<PortType> const& lhs, DirAndPort<PortType> const& rhs)
     return std::tie(lhs.dir, lhs.port) < std::tie(rhs.dir, rhs.port);
 }
 
+template<>
+struct allocator_index<DirAndPort<uint16_t> > {
+    static const size_t size = 2 * 65536;
+
+    static size_t index(const DirAndPort<uint16_t>& identifier) {
+        return identifier.dir * 65536 + identifier.port;
+    }
+};
+
 #define TINS_GENERATE_TAG_MAPPER(pdu, id_type) \
 template<> \
 struct pdu_tag_mapper<pdu> { \
@@ -195,6 +326,39 @@ void register_allocator(typename Internals::pdu_tag_mapper<PDUType>::type::ident
     >::template register_allocator<AllocatedType>(id);
 }
 
+/**
+ * \brief Registers a decoder function for the provided PDU type.
+ *
+ * This works like register_allocator, but the given function is called 
+ * to decode the inner PDU, rather than constructing a PDU of a fixed
+ * type. The function must return 0 if the buffer can't be decoded, in 
+ * which case the inner PDU is a RawPDU.
+ *
+ * Since there's no PDU type associated with a decoder, this only affects
+ * how packets are parsed, not how they're serialized.
+ *
+ * Allocators and decoders can be registered while other threads are 
+ * parsing packets. Looking them up never takes a lock.
+ *
+ * \code
+ * PDU* decode_my_protocol(const uint8_t* buffer, uint32_t size) {
+ *     if (size < 4) {
+ *         return 0;
+ *     }
+ *     return new MyProtocol(buffer, size);
+ * }
+ *
+ * Allocators::register_decoder<IP>(253, &decode_my_protocol);
+ * \endcode
+ */
+template<typename PDUType>
+void register_decoder(typename Internals::pdu_tag_mapper<PDUType>::type::identifier_type id,
+                      PDU* (*decoder)(const uint8_t*, uint32_t)) {
+    Internals::PDUAllocator<
+        typename Internals::pdu_tag_mapper<PDUType>::type
+    >::register_decoder(id, decoder);
+}
+
 } // Allocators
 } // Tins
 
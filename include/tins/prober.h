@@ -0,0 +1,322 @@
+/*
+ * Copyright (c) 2017, Matias Fontanini
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are
+ * met:
+ * 
+ * * Redistributions of source code must retain the above copyright
+ *   notice, this list of conditions and the following disclaimer.
+ * * Redistributions in binary form must reproduce the above
+ *   copyright notice, this list of conditions and the following disclaimer
+ *   in the documentation and/or other materials provided with the
+ *   distribution.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+
+#ifndef TINS_PROBER_H
+#define TINS_PROBER_H
+
+#include <tins/cxxstd.h>
+
+#if TINS_IS_CXX11
+
+#include <vector>
+#include <memory>
+#include <mutex>
+#include <chrono>
+#include <future>
+#include <functional>
+#include <unordered_map>
+#include <stdint.h>
+#include <tins/macros.h>
+#include <tins/config.h>
+
+namespace Tins {
+
+class PDU;
+class PacketSender;
+class NetworkInterface;
+#ifdef TINS_HAVE_PCAP
+class BaseSniffer;
+#endif // TINS_HAVE_PCAP
+
+/**
+ * \class Prober
+ * \brief Keeps track of many outstanding probes and matches their responses.
+ *
+ * PacketSender::send_recv sends a single packet and then waits until a 
+ * response arrives, which means only one probe can be in flight at a 
+ * time. A Prober instead sends probes without waiting and keeps them in 
+ * a hash table, indexed by a key that can be computed both from a probe
+ * and from its response. This way, each received packet is matched 
+ * against every outstanding probe with a single lookup.
+ *
+ * The following probes are supported:
+ *
+ * - ICMP and ICMPv6 echo requests, keyed by destination address, 
+ * identifier and sequence number.
+ * - TCP segments, keyed by destination address, ports and sequence
+ * number. Responses must acknowledge the probe's sequence number, like
+ * a SYN/ACK or a RST sent in response to a SYN.
+ * - DNS queries over UDP to port 53, keyed by destination address, 
+ * ports and DNS identifier.
+ * - Any other UDP datagram, keyed by destination address and ports.
+ * - ARP requests, keyed by the target IP address.
+ *
+ * ICMP and ICMPv6 errors, such as "time exceeded" or "port unreachable",
+ * are matched using the packet they quote. This makes it possible to
+ * use a Prober to implement traceroute or port scans.
+ *
+ * Each probe has a timeout. Timeouts are tracked using a timer wheel, so
+ * expiring probes costs the same regardless of how many of them are 
+ * outstanding. Completions are delivered through a callback, which is 
+ * called with the response or with a null pointer if the probe timed
+ * out, or through a future.
+ *
+ * Prober doesn't capture packets by itself: every received packet has 
+ * to be handed to Prober::process and Prober::expire must be called 
+ * periodically. Prober::run does both using a sniffer.
+ *
+ * \code
+ * PacketSender sender;
+ * Prober prober(sender);
+ * for (size_t i = 0; i < addresses.size(); ++i) {
+ *     IP probe = IP(addresses[i]) / ICMP();
+ *     probe.rfind_pdu<ICMP>().id(1234);
+ *     prober.send(probe, [](const PDU* response) {
+ *         // response is null if the probe timed out
+ *     });
+ * }
+ * SnifferConfiguration config;
+ * config.set_filter("icmp");
+ * config.set_immediate_mode(true);
+ * Sniffer sniffer("eth0", config);
+ * prober.run(sniffer);
+ * \endcode
+ *
+ * Prober::process and Prober::expire can be called from a different 
+ * thread than the one sending probes. Callbacks are executed on the 
+ * thread that calls those methods.
+ */
+class TINS_API Prober {
+public:
+    /**
+     * The clock used for timeouts.
+     */
+    typedef std::chrono::steady_clock clock_type;
+
+    /**
+     * The type used for timeouts.
+     */
+    typedef std::chrono::milliseconds duration_type;
+
+    /**
+     * \brief The type of the completion callbacks.
+     *
+     * The argument is the response, or a null pointer if the probe timed
+     * out. The response is only valid during the call.
+     */
+    typedef std::function<void(const PDU*)> callback_type;
+
+    /**
+     * The type of the futures returned by Prober::send.
+     */
+    typedef std::future<std::unique_ptr<PDU>> future_type;
+
+    /**
+     * \brief The default timeout.
+     */
+    static const duration_type DEFAULT_TIMEOUT;
+
+    /**
+     * \brief The default resolution of the timer wheel.
+     */
+    static const duration_type DEFAULT_RESOLUTION;
+
+    /**
+     * \brief Constructs a Prober.
+     *
+     * \param sender The sender used to send probes. It must outlive the
+     * Prober.
+     * \param timeout The timeout used by probes sent without one.
+     * \param resolution The granularity of timeouts.
+     */
+    Prober(PacketSender& sender, duration_type timeout = DEFAULT_TIMEOUT,
+           duration_type resolution = DEFAULT_RESOLUTION);
+
+    /**
+     * \brief Sends a probe and registers a callback for its completion.
+     *
+     * \param probe The probe to be sent.
+     * \param callback The callback executed once a response arrives or 
+     * the probe times out.
+     * \throw std::runtime_error If the probe is not supported or a probe
+     * with the same key is already outstanding.
+     */
+    void send(PDU& probe, callback_type callback);
+
+    /**
+     * \brief Sends a probe with a specific timeout.
+     *
+     * \sa Prober::send(PDU&, callback_type)
+     */
+    void send(PDU& probe, callback_type callback, duration_type timeout);
+
+    /**
+     * \brief Sends a probe through a specific interface.
+     *
+     * \sa Prober::send(PDU&, callback_type)
+     */
+    void send(PDU& probe, const NetworkInterface& iface, callback_type callback, 
+              duration_type timeout);
+
+    /**
+     * \brief Sends a probe and returns a future for its response.
+     *
+     * The future holds the response, or a null pointer if the probe 
+     * timed out.
+     *
+     * \param probe The probe to be sent.
+     * \throw std::runtime_error If the probe is not supported or a probe
+     * with the same key is already outstanding.
+     */
+    future_type send(PDU& probe);
+
+    /**
+     * \brief Sends a probe with a specific timeout and returns a future 
+     * for its response.
+     *
+     * \sa Prober::send(PDU&)
+     */
+    future_type send(PDU& probe, duration_type timeout);
+
+    /**
+     * \brief Registers a probe without sending it.
+     *
+     * This can be used when probes are sent in some other way, for 
+     * example using PacketSender::send_batch.
+     *
+     * \sa Prober::send(PDU&, callback_type, duration_type)
+     */
+    void add(const PDU& probe, callback_type callback, duration_type timeout);
+
+    /**
+     * \brief Registers a probe without sending it and returns a future 
+     * for its response.
+     *
+     * \sa Prober::send(PDU&, duration_type)
+     */
+    future_type add(const PDU& probe, duration_type timeout);
+
+    /**
+     * \brief Matches a received packet against the outstanding probes.
+     *
+     * If the packet is the response to a probe, that probe's callback is
+     * executed and the probe is removed.
+     *
+     * \param packet The received packet.
+     * \return true iff the packet matched a probe.
+     */
+    bool process(const PDU& packet);
+
+    /**
+     * \brief Times out every probe whose timeout has expired.
+     *
+     * \return The amount of probes that timed out.
+     */
+    size_t expire();
+
+    /**
+     * \brief Times out every probe whose timeout expired before the given
+     * time point.
+     *
+     * \param now The current time.
+     * \return The amount of probes that timed out.
+     */
+    size_t expire(clock_type::time_point now);
+
+    /**
+     * \brief Getter for the amount of outstanding probes.
+     */
+    size_t pending() const;
+
+    #ifdef TINS_HAVE_PCAP
+    /**
+     * \brief Processes the packets read from a sniffer until there are no
+     * outstanding probes.
+     *
+     * The sniffer's descriptor is polled until the next probe times out,
+     * so timeouts are handled even if no packets are received. The 
+     * sniffer is switched to use pcap_dispatch, as pcap_loop doesn't
+     * return until a packet is read.
+     *
+     * \param sniffer The sniffer to read packets from.
+     */
+    void run(BaseSniffer& sniffer);
+    #endif // TINS_HAVE_PCAP
+private:
+    static const size_t WHEEL_SIZE;
+
+    struct key_type {
+        bool operator==(const key_type& rhs) const;
+
+        uint8_t kind;
+        uint8_t size;
+        uint8_t data[40];
+    };
+
+    struct key_hash {
+        size_t operator()(const key_type& key) const;
+    };
+
+    struct probe_entry {
+        callback_type callback;
+        uint64_t id;
+    };
+
+    struct timer_entry {
+        key_type key;
+        uint64_t id;
+        uint64_t deadline;
+    };
+
+    typedef std::unordered_map<key_type, probe_entry, key_hash> probes_type;
+    typedef std::vector<std::vector<timer_entry>> wheel_type;
+
+    void send_probe(PDU& probe, const NetworkInterface* iface, callback_type callback,
+                    duration_type timeout);
+    void add_probe(const key_type& key, callback_type callback, duration_type timeout);
+    int poll_timeout(clock_type::time_point now) const;
+    uint64_t tick(clock_type::time_point time_point) const;
+
+    PacketSender& sender_;
+    duration_type timeout_;
+    duration_type resolution_;
+    clock_type::time_point start_;
+    probes_type probes_;
+    wheel_type wheel_;
+    uint64_t current_tick_;
+    uint64_t next_id_;
+    mutable std::mutex mutex_;
+};
+
+} // Tins
+
+#endif // TINS_IS_CXX11
+
+#endif // TINS_PROBER_H
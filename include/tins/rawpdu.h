@@ -94,7 +94,7 @@ public:
      */
     template<typename ForwardIterator>
     RawPDU(ForwardIterator start, ForwardIterator end) 
-    : payload_(start, end) { }
+    : payload_(start, end), payload_sum_(0) { }
 
     /**
      * \brief Creates an instance of RawPDU from a payload_type.
@@ -104,7 +104,7 @@ public:
      * \param data The payload to use.
      */
     RawPDU(const payload_type & data)
-            : payload_(data) { }
+            : payload_(data), payload_sum_(0) { }
 
     #if TINS_IS_CXX11
         /** 
@@ -115,7 +115,7 @@ public:
          * \param data The payload to use.
          */
         RawPDU(payload_type&& data)
-        : payload_(move(data)) { }
+        : payload_(move(data)), payload_sum_(0) { }
     #endif // TINS_IS_CXX11
 
     /** 
@@ -211,9 +211,14 @@ public:
         return new RawPDU(*this);
     }
 private:
+    friend class TCP;
+    friend class UDP;
+
     void write_serialization(uint8_t* buffer, uint32_t total_sz);
 
     payload_type payload_;
+    // The 16 bit sum of the payload, computed while serializing it
+    uint16_t payload_sum_;
 };
 
 } // Tins
@@ -0,0 +1,616 @@
+/*
+ * Copyright (c) 2017, Matias Fontanini
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are
+ * met:
+ * 
+ * * Redistributions of source code must retain the above copyright
+ *   notice, this list of conditions and the following disclaimer.
+ * * Redistributions in binary form must reproduce the above
+ *   copyright notice, this list of conditions and the following disclaimer
+ *   in the documentation and/or other materials provided with the
+ *   distribution.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+
+#ifndef TINS_RING_SNIFFER_H
+#define TINS_RING_SNIFFER_H
+
+#include <tins/config.h>
+
+#ifdef TINS_HAVE_PACKET_RING
+
+#include <string>
+#include <vector>
+#include <iterator>
+#include <stdint.h>
+#include <tins/packet.h>
+#include <tins/cxxstd.h>
+#include <tins/macros.h>
+#include <tins/exceptions.h>
+#include <tins/detail/type_traits.h>
+
+namespace Tins {
+class RingSnifferIterator;
+
+/**
+ * \class RingSnifferConfiguration
+ * \brief Represents the configuration of a RingSniffer object.
+ *
+ * This class holds the geometry of the memory mapped ring used by a 
+ * RingSniffer, as well as some socket options.
+ *
+ * The ring is made of block_count blocks of block_size bytes each. The
+ * kernel fills a whole block with as many packets as fit on it and then
+ * hands it to user space. A block is also handed to user space once the 
+ * block timeout expires, even if it isn't full.
+ *
+ * \sa RingSniffer
+ */
+class TINS_API RingSnifferConfiguration {
+public:
+    /**
+     * \brief The algorithms used to distribute packets in a fanout group.
+     */
+    enum FanoutMode {
+        FANOUT_HASH,         ///< Same flow hash, same socket. IP fragments are defragmented
+        FANOUT_LOAD_BALANCE, ///< Round robin
+        FANOUT_CPU,          ///< Socket chosen by the CPU the packet arrived on
+        FANOUT_QUEUE_MAPPING ///< Socket chosen by the recorded RX queue
+    };
+
+    /**
+     * \brief The default block size.
+     *
+     * This is 1MB.
+     */
+    static const unsigned DEFAULT_BLOCK_SIZE;
+
+    /**
+     * \brief The default amount of blocks in the ring.
+     */
+    static const unsigned DEFAULT_BLOCK_COUNT;
+
+    /**
+     * \brief The default frame size.
+     */
+    static const unsigned DEFAULT_FRAME_SIZE;
+
+    /**
+     * \brief The default block timeout, in milliseconds.
+     */
+    static const unsigned DEFAULT_BLOCK_TIMEOUT;
+
+    /**
+     * Default constructs a RingSnifferConfiguration.
+     */
+    RingSnifferConfiguration();
+
+    /**
+     * \brief Sets the size of each block in the ring.
+     *
+     * This must be a multiple of the page size.
+     *
+     * \param size The block size, in bytes.
+     */
+    void set_block_size(unsigned size);
+
+    /**
+     * Sets the amount of blocks in the ring.
+     * \param count The amount of blocks.
+     */
+    void set_block_count(unsigned count);
+
+    /**
+     * \brief Sets the frame size.
+     *
+     * Packets in a block are variable length, so this is only used by the
+     * kernel to validate the ring's geometry. It must be a multiple of 16
+     * and the block size must be a multiple of it.
+     *
+     * \param size The frame size, in bytes.
+     */
+    void set_frame_size(unsigned size);
+
+    /**
+     * \brief Sets the block timeout.
+     *
+     * A block that's partially filled is handed to user space after this 
+     * amount of milliseconds.
+     *
+     * \param timeout The timeout, in milliseconds.
+     */
+    void set_block_timeout(unsigned timeout);
+
+    /**
+     * \brief Sets the read timeout.
+     *
+     * If no block is received after this amount of milliseconds,
+     * RingSniffer::next_packet returns an empty packet. A value of 0
+     * (the default) means that reads will block until a packet is received.
+     *
+     * \param timeout The timeout, in milliseconds.
+     */
+    void set_timeout(unsigned timeout);
+
+    /**
+     * Sets the promiscuous mode option.
+     * \param enabled The promiscuous mode value.
+     */
+    void set_promisc_mode(bool enabled);
+
+    /**
+     * \brief Joins the sniffer to a PACKET_FANOUT group.
+     *
+     * Every socket that joins the same group on the same device shares
+     * the captured traffic, which is distributed among them using the 
+     * given mode.
+     *
+     * \param group_id The fanout group identifier.
+     * \param mode The mode used to distribute packets.
+     * \sa FanoutSniffer
+     */
+    void set_fanout(uint16_t group_id, FanoutMode mode = FANOUT_HASH);
+
+    /**
+     * \brief Creates a new PACKET_FANOUT group and joins the sniffer to it.
+     *
+     * The kernel picks an identifier that isn't used by any other group.
+     * Kernels older than 4.20 can't do this, so random identifiers are 
+     * tried instead until one of them can be used. Use 
+     * RingSniffer::fanout_group_id to retrieve the group's identifier.
+     *
+     * \param mode The mode used to distribute packets.
+     * \sa FanoutSniffer
+     */
+    void set_unique_fanout(FanoutMode mode = FANOUT_HASH);
+
+    /**
+     * Retrieves the block size.
+     */
+    unsigned block_size() const;
+
+    /**
+     * Retrieves the amount of blocks.
+     */
+    unsigned block_count() const;
+
+    /**
+     * Retrieves the frame size.
+     */
+    unsigned frame_size() const;
+
+    /**
+     * Retrieves the block timeout.
+     */
+    unsigned block_timeout() const;
+
+    /**
+     * Retrieves the read timeout.
+     */
+    unsigned timeout() const;
+
+    /**
+     * Retrieves the promiscuous mode option.
+     */
+    bool promisc_mode() const;
+
+    /**
+     * Indicates whether the fanout option was set.
+     */
+    bool has_fanout() const;
+
+    /**
+     * Retrieves the fanout group identifier.
+     */
+    uint16_t fanout_group_id() const;
+
+    /**
+     * Indicates whether a new fanout group with a unique identifier 
+     * should be created.
+     */
+    bool unique_fanout() const;
+
+    /**
+     * Retrieves the fanout mode.
+     */
+    FanoutMode fanout_mode() const;
+private:
+    unsigned block_size_;
+    unsigned block_count_;
+    unsigned frame_size_;
+    unsigned block_timeout_;
+    unsigned timeout_;
+    FanoutMode fanout_mode_;
+    uint16_t fanout_group_id_;
+    bool promisc_;
+    bool has_fanout_;
+    bool unique_fanout_;
+};
+
+/**
+ * \class RingSniffer
+ * \brief Sniffs packets using a Linux TPACKET_V3 memory mapped ring.
+ *
+ * This sniffer captures packets from an AF_PACKET socket which shares a
+ * ring buffer with the kernel. Packets are written by the kernel into 
+ * blocks of this ring and read directly from them, so no system call 
+ * nor copy is required for each captured packet. 
+ *
+ * This class provides the same sniffing interface as BaseSniffer: 
+ * RingSniffer::next_packet, RingSniffer::sniff_loop and iterators, 
+ * as well as RingSniffer::next_block, which decodes every packet in the 
+ * next block of the ring at once.
+ *
+ * Link layer decoding depends on the device's hardware type: EthernetII 
+ * (or Dot3) is used for ethernet and loopback devices, IP or IPv6 for 
+ * devices with no link layer header and RawPDU otherwise.
+ *
+ * This class is only available on Linux and requires the CAP_NET_RAW 
+ * capability.
+ *
+ * \code
+ * RingSnifferConfiguration config;
+ * config.set_block_count(128);
+ * RingSniffer sniffer("eth0", config);
+ * sniffer.sniff_loop([&](PDU& pdu) {
+ *     // process the packet
+ *     return true;
+ * });
+ * \endcode
+ */
+class TINS_API RingSniffer {
+public:
+    /**
+     * The iterator type.
+     */
+    typedef RingSnifferIterator iterator;
+
+    /**
+     * \brief Kernel capture statistics.
+     */
+    struct statistics {
+        /**
+         * The amount of packets received by the socket.
+         */
+        uint64_t packets;
+
+        /**
+         * The amount of packets dropped because the ring was full.
+         */
+        uint64_t drops;
+
+        /**
+         * The amount of times the ring was frozen because it was full.
+         */
+        uint64_t freeze_count;
+
+        statistics() : packets(0), drops(0), freeze_count(0) { }
+    };
+
+    /**
+     * \brief Constructs a RingSniffer.
+     *
+     * \param device The device from which to capture packets.
+     * \param configuration The configuration to use.
+     */
+    RingSniffer(const std::string& device,
+                const RingSnifferConfiguration& configuration = RingSnifferConfiguration());
+
+    #if TINS_IS_CXX11
+        /**
+         * \brief Move constructor.
+         * This constructor is available only in C++11.
+         */
+        RingSniffer(RingSniffer&& rhs) TINS_NOEXCEPT;
+
+        /**
+         * \brief Move assignment operator.
+         * This operator is available only in C++11.
+         */
+        RingSniffer& operator=(RingSniffer&& rhs) TINS_NOEXCEPT;
+    #endif
+
+    /**
+     * \brief Destructor.
+     *
+     * Unmaps the ring and closes the socket.
+     */
+    ~RingSniffer();
+
+    /**
+     * \brief Captures one packet.
+     *
+     * \sa BaseSniffer::next_packet
+     *
+     * \return A captured packet. If an error occurred, the read timeout
+     * expired or the sniffer was stopped, PtrPacket::pdu will return 0. 
+     * Caller takes ownership of the PDU pointer stored in the PtrPacket.
+     */
+    PtrPacket next_packet();
+
+    /**
+     * \brief Captures every packet in the next block of the ring.
+     *
+     * If packets from the current block were already read using 
+     * RingSniffer::next_packet, only the remaining ones are returned.
+     *
+     * The packets vector is cleared before any packet is added to it, so 
+     * the same container can be reused across calls. Malformed packets are
+     * skipped, so the amount of packets stored might be lower than the 
+     * amount of packets read.
+     *
+     * \param packets The container in which captured packets will be stored.
+     * \return The amount of packets read, including malformed ones. A value
+     * of 0 indicates that an error occurred, the read timeout expired or 
+     * the sniffer was stopped.
+     */
+    uint32_t next_block(std::vector<Packet>& packets);
+
+    /**
+     * \brief Starts a sniffing loop, using a callback functor for every
+     * sniffed packet.
+     *
+     * This works exactly like BaseSniffer::sniff_loop.
+     *
+     * \param function The callback handler object which should process packets.
+     * \param max_packets The maximum amount of packets to sniff. 0 == infinite.
+     */
+    template <typename Functor>
+    void sniff_loop(Functor function, uint32_t max_packets = 0);
+
+    /**
+     * \brief Starts a sniffing loop, using a callback functor for every
+     * block of sniffed packets.
+     *
+     * The functor must implement an operator with the following signature:
+     *
+     * \code
+     * bool(std::vector<Packet>&);
+     * \endcode
+     *
+     * Packets are captured using RingSniffer::next_block. The same container
+     * is reused for every block. Sniffing will stop when either at least 
+     * max_packets are sniffed(if it is != 0), when RingSniffer::next_block
+     * returns 0 or when the functor returns false.
+     *
+     * \param function The callback handler object which should process blocks.
+     * \param max_packets The maximum amount of packets to sniff. 0 == infinite.
+     */
+    template <typename Functor>
+    void sniff_block_loop(Functor function, uint32_t max_packets = 0);
+
+    /**
+     * \brief Stops sniffing.
+     *
+     * Any call blocked waiting for packets will return as if the read 
+     * timeout had expired. This can be called from any thread.
+     */
+    void stop_sniff();
+
+    /**
+     * \brief Retrieves the kernel capture statistics.
+     *
+     * The returned values are accumulated since this sniffer was created.
+     */
+    statistics stats();
+
+    /**
+     * \brief Sets whether to extract RawPDUs or fully parsed packets.
+     *
+     * \sa BaseSniffer::set_extract_raw_pdus
+     * \param value Whether to extract RawPDUs or not.
+     */
+    void set_extract_raw_pdus(bool value);
+
+    /**
+     * \brief Sets whether inner PDUs should be decoded lazily.
+     *
+     * \sa BaseSniffer::set_lazy_decoding
+     * \param value Whether to decode inner PDUs lazily or not.
+     */
+    void set_lazy_decoding(bool value);
+
+    /**
+     * \brief Gets the file descriptor of the underlying socket.
+     */
+    int get_fd() const;
+
+    /**
+     * \brief Retrieves the identifier of the fanout group this sniffer
+     * belongs to.
+     *
+     * This is the only way to find out the identifier assigned to a group 
+     * created through RingSnifferConfiguration::set_unique_fanout.
+     */
+    uint16_t fanout_group_id() const;
+
+    /**
+     * Retrieves an iterator to the next packet in this sniffer.
+     */
+    iterator begin();
+
+    /**
+     * Retrieves an end iterator.
+     */
+    iterator end();
+private:
+    typedef PDU* (*PacketDecoder)(const uint8_t*, uint32_t);
+
+    RingSniffer(const RingSniffer&);
+    RingSniffer& operator=(const RingSniffer&);
+
+    void cleanup();
+    void join_fanout(const RingSnifferConfiguration& configuration);
+    bool wait_for_block();
+    bool consume_stop_request();
+    const uint8_t* block_at(unsigned index) const;
+    bool current_block_ready() const;
+    void release_current_block();
+    PDU* decode_current_packet(Timestamp& timestamp);
+    void advance_packet();
+    PacketDecoder packet_decoder(uint16_t hardware_type);
+
+    uint8_t* ring_;
+    uint32_t ring_size_;
+    int fd_;
+    int stop_fd_;
+    int stop_requested_;
+    unsigned block_size_;
+    unsigned block_count_;
+    unsigned current_block_;
+    const uint8_t* current_packet_;
+    uint32_t packets_left_;
+    int timeout_;
+    statistics stats_;
+    bool extract_raw_;
+    bool lazy_decoding_;
+};
+
+/**
+ * \class RingSnifferIterator
+ * \brief Iterates over packets sniffed by a RingSniffer.
+ */
+class RingSnifferIterator : public std::iterator<std::forward_iterator_tag, Packet> {
+public:
+    /**
+     * Constructs a RingSnifferIterator.
+     * \param sniffer The sniffer to iterate.
+     */
+    RingSnifferIterator(RingSniffer* sniffer = 0)
+    : sniffer_(sniffer) {
+        if (sniffer_) {
+            advance();
+        }
+    }
+
+    /**
+     * Advances the iterator.
+     */
+    RingSnifferIterator& operator++() {
+        advance();
+        return* this;
+    }
+
+    /**
+     * Advances the iterator.
+     */
+    RingSnifferIterator operator++(int) {
+        RingSnifferIterator other(*this);
+        advance();
+        return other;
+    }
+
+    /**
+     * Dereferences the iterator.
+     * \return reference to the current packet.
+     */
+    Packet& operator*() {
+        return pkt_;
+    }
+
+    /**
+     * Dereferences the iterator.
+     * \return pointer to the current packet.
+     */
+    Packet* operator->() {
+        return &(**this);
+    }
+
+    /**
+     * Compares this iterator for equality.
+     * \param rhs The iterator to be compared to.
+     */
+    bool operator==(const RingSnifferIterator& rhs) const {
+        return sniffer_ == rhs.sniffer_;
+    }
+
+    /**
+     * Compares this iterator for in-equality.
+     * \param rhs The iterator to be compared to.
+     */
+    bool operator!=(const RingSnifferIterator& rhs) const {
+        return !(*this == rhs);
+    }
+private:
+    void advance() {
+        pkt_ = sniffer_->next_packet();
+        if (!pkt_) {
+            sniffer_ = 0;
+        }
+    }
+
+    RingSniffer* sniffer_;
+    Packet pkt_;
+};
+
+template <typename Functor>
+void RingSniffer::sniff_loop(Functor function, uint32_t max_packets) {
+    for (iterator it = begin(); it != end(); ++it) {
+        try {
+            // If the functor returns false, we're done
+            #if TINS_IS_CXX11 && !defined(_MSC_VER)
+            if (!Tins::Internals::invoke_loop_cb(function, *it)) {
+                return;
+            }
+            #else
+            if (!function(*it->pdu())) {
+                return;
+            }
+            #endif
+        }
+        catch(malformed_packet&) { }
+        catch(pdu_not_found&) { }
+        if (max_packets && --max_packets == 0) {
+            return;
+        }
+    }
+}
+
+template <typename Functor>
+void RingSniffer::sniff_block_loop(Functor function, uint32_t max_packets) {
+    std::vector<Packet> packets;
+    while (true) {
+        const uint32_t packets_read = next_block(packets);
+        if (packets_read == 0) {
+            return;
+        }
+        if (!packets.empty()) {
+            try {
+                // If the functor returns false, we're done
+                if (!function(packets)) {
+                    return;
+                }
+            }
+            catch(malformed_packet&) { }
+            catch(pdu_not_found&) { }
+        }
+        if (max_packets) {
+            if (max_packets <= packets_read) {
+                return;
+            }
+            max_packets -= packets_read;
+        }
+    }
+}
+
+} // Tins
+
+#endif // TINS_HAVE_PACKET_RING
+
+#endif // TINS_RING_SNIFFER_H
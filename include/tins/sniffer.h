@@ -34,8 +34,10 @@
 #include <string>
 #include <memory>
 #include <iterator>
+#include <vector>
 #include <tins/pdu.h>
 #include <tins/packet.h>
+#include <tins/packet_view.h>
 #include <tins/cxxstd.h>
 #include <tins/macros.h>
 #include <tins/exceptions.h>
@@ -44,12 +46,19 @@
 #ifdef TINS_HAVE_PCAP
 
 #include <pcap.h>
+#if TINS_IS_CXX11
+    #include <exception>
+#endif // TINS_IS_CXX11
 
 
 namespace Tins {
 class SnifferIterator;
 class SnifferConfiguration;
 
+namespace Internals {
+class DecompressionThread;
+} // Internals
+
 /**
  * \class BaseSniffer
  * \brief Base class for sniffers.
@@ -73,8 +82,8 @@ public:
          * This constructor is available only in C++11.
          */
         BaseSniffer(BaseSniffer &&rhs) TINS_NOEXCEPT
-        : handle_(0), mask_(), extract_raw_(false),
-          pcap_sniffing_method_(pcap_loop) {
+        : handle_(0), mask_(), extract_raw_(false), lazy_decoding_(false),
+          pcap_sniffing_method_(pcap_loop), packet_decoder_(0) {
             *this = std::move(rhs);
         }
 
@@ -87,7 +96,9 @@ public:
             swap(handle_, rhs.handle_);
             swap(mask_, rhs.mask_);
             swap(extract_raw_, rhs.extract_raw_);
+            swap(lazy_decoding_, rhs.lazy_decoding_);
             swap(pcap_sniffing_method_, rhs.pcap_sniffing_method_);
+            swap(packet_decoder_, rhs.packet_decoder_);
             return* this;
         }
     #endif
@@ -133,6 +144,35 @@ public:
      */
     PtrPacket next_packet();
 
+    /**
+     * \brief Captures up to max_packets packets in a single sniffing call.
+     *
+     * The link layer decoder is resolved only once for this sniffer, and
+     * all packets are pulled using a single call to the configured pcap 
+     * sniffing method. This amortizes the libpcap dispatch overhead over
+     * the whole batch.
+     *
+     * The packets vector is cleared before any packet is added to it, so 
+     * the same container can be reused across calls to avoid reallocating
+     * its storage. Malformed packets are skipped, so the amount of packets
+     * stored might be lower than the amount of packets read.
+     *
+     * When using the default `pcap_loop` sniffing method, this call will 
+     * block until max_packets are read, an error occurs or the loop is 
+     * broken. Use `pcap_dispatch` as the sniffing method in order to only 
+     * process the packets that are available in a single buffer.
+     *
+     * \sa set_pcap_sniffing_method
+     *
+     * \param packets The container in which captured packets will be stored.
+     * \param max_packets The maximum amount of packets to capture.
+     * \return The amount of packets read, including malformed ones. A value
+     * of 0 indicates that the end of the capture was reached or the loop
+     * was broken.
+     * \throw pcap_error If reading failed before any packet was read.
+     */
+    uint32_t next_packets(std::vector<Packet>& packets, uint32_t max_packets);
+
     /**
      * \brief Starts a sniffing loop, using a callback functor for every
      * sniffed packet.
@@ -188,6 +228,67 @@ public:
     template <typename Functor>
     void sniff_loop(Functor function, uint32_t max_packets = 0);
 
+    /**
+     * \brief Starts a sniffing loop, using a callback functor for every
+     * batch of sniffed packets.
+     *
+     * The functor must implement an operator with the following signature:
+     *
+     * \code
+     * bool(std::vector<Packet>&);
+     * \endcode
+     *
+     * Packets are captured using BaseSniffer::next_packets, using up to
+     * batch_size packets per call. The same container is reused for every
+     * batch, so if you want to keep any of the packets after the functor 
+     * returns, you should move or swap them out of it.
+     *
+     * Sniffing will stop when either max_packets are sniffed(if it is != 0),
+     * when the end of the capture is reached or when the functor returns false.
+     *
+     * Just like BaseSniffer::sniff_loop, this method catches both 
+     * malformed_packet and pdu_not_found exceptions thrown by the functor.
+     *
+     * \param function The callback handler object which should process batches.
+     * \param batch_size The maximum amount of packets in each batch.
+     * \param max_packets The maximum amount of packets to sniff. 0 == infinite.
+     */
+    template <typename Functor>
+    void sniff_batch(Functor function, uint32_t batch_size, uint32_t max_packets = 0);
+
+    /**
+     * \brief Starts a sniffing loop which provides a PacketView for every
+     * sniffed packet.
+     *
+     * Unlike BaseSniffer::sniff_loop, packets are not decoded into a PDU 
+     * chain. Instead, the functor is called directly from within the pcap
+     * callback using a PacketView over libpcap's buffer, so no memory is 
+     * allocated nor copied for each packet.
+     *
+     * The functor must implement an operator with the following signature:
+     *
+     * \code
+     * bool(const PacketView&);
+     * \endcode
+     *
+     * The PacketView, as well as the buffer it points to, is only valid 
+     * during the functor's execution.
+     *
+     * Only the link layer types supported by PacketView (EthernetII, raw 
+     * IP, Loopback and SLL) can be used. Otherwise, an unknown_link_type 
+     * exception is thrown.
+     *
+     * Sniffing will stop when either max_packets are sniffed(if it is != 0),
+     * or when the functor returns false. Just like sniff_loop, 
+     * malformed_packet and pdu_not_found exceptions thrown by the functor
+     * are caught.
+     *
+     * \param function The callback handler object which should process packets.
+     * \param max_packets The maximum amount of packets to sniff. 0 == infinite.
+     */
+    template <typename Functor>
+    void sniff_view_loop(Functor function, uint32_t max_packets = 0);
+
     /**
      * \brief Sets a filter on this sniffer.
      * \param filter The filter to be set.
@@ -240,6 +341,19 @@ public:
      */
     void set_extract_raw_pdus(bool value);
 
+    /**
+     * \brief Sets whether inner PDUs should be decoded lazily.
+     *
+     * When enabled, packets taken from this BaseSniffer will only have 
+     * their outermost layers parsed. Each inner PDU is decoded the first
+     * time it's accessed, so packets which are only partially inspected
+     * are cheaper to process.
+     *
+     * \param value Whether to decode inner PDUs lazily or not.
+     * \sa LazyDecodingGuard
+     */
+    void set_lazy_decoding(bool value);
+
     /**
      * \brief function pointer for the sniffing method
      *
@@ -307,14 +421,31 @@ protected:
     void set_if_mask(bpf_u_int32 if_mask);
 
     bpf_u_int32 get_if_mask() const;
+
+    /**
+     * \brief Called when reading stops before a packet is found.
+     *
+     * Subclasses can throw from here to report errors that libpcap only
+     * sees as the end of the capture. This does nothing by default.
+     */
+    virtual void check_read_error();
 private:
+    friend class ParallelSniffer;
+
+    typedef PDU* (*PacketDecoder)(const uint8_t*, uint32_t);
+
     BaseSniffer(const BaseSniffer&);
     BaseSniffer& operator=(const BaseSniffer&);
 
+    PacketDecoder packet_decoder();
+    PDU::PDUType view_link_type() const;
+
     pcap_t* handle_;
     bpf_u_int32 mask_;
     bool extract_raw_;
+    bool lazy_decoding_;
     PcapSniffingMethod pcap_sniffing_method_;
+    PacketDecoder packet_decoder_;
 };
 
 /**
@@ -403,6 +534,11 @@ private:
  *
  * This class acts exactly in the same way that Sniffer, but reads
  * packets from a pcap file instead of an interface.
+ *
+ * Files compressed using gzip or zstd are detected automatically when
+ * libtins is built with compression support. These are decompressed 
+ * on a background thread while packets are being read, so there's no 
+ * need to decompress them beforehand.
  */
 class TINS_API FileSniffer : public BaseSniffer {
 public:
@@ -421,6 +557,42 @@ public:
      * \param filter A capture filter to be used on the file.(optional);
      */
     FileSniffer(const std::string& file_name, const std::string& filter = "");
+
+    #if TINS_IS_CXX11
+        /**
+         * \brief Move constructor.
+         *
+         * \param rhs The FileSniffer to be moved.
+         */
+        FileSniffer(FileSniffer &&rhs) TINS_NOEXCEPT 
+        : decompressor_(0) {
+            *this = std::move(rhs);
+        }
+
+        /**
+         * \brief Move assignment operator.
+         *
+         * \param rhs The FileSniffer to be moved.
+         */
+        FileSniffer& operator=(FileSniffer &&rhs) TINS_NOEXCEPT {
+            BaseSniffer::operator=(std::move(rhs));
+            std::swap(decompressor_, rhs.decompressor_);
+            return* this;
+        }
+    #endif
+
+    /**
+     * \brief Destructor.
+     *
+     * Stops decompressing the file, if it's compressed.
+     */
+    ~FileSniffer();
+private:
+    void open_file(const std::string& file_name);
+    void close_decompressor();
+    void check_read_error();
+
+    Internals::DecompressionThread* decompressor_;
 };
 
 template <typename T>
@@ -635,6 +807,12 @@ public:
      * \param value The timestamp option value.
      */
     void set_timestamp_precision(int value);
+
+    /**
+     * Sets the lazy decoding option.
+     * \param enabled The lazy decoding option value.
+     */
+    void set_lazy_decoding(bool enabled);
 protected:
     friend class Sniffer;
     friend class FileSniffer;
@@ -648,6 +826,7 @@ protected:
         DIRECTION = 32,
         TIMESTAMP_PRECISION = 64,
         PCAP_SNIFFING_METHOD = 128,
+        LAZY_DECODING = 256,
     };
 
     void configure_sniffer_pre_activation(Sniffer& sniffer) const;
@@ -664,6 +843,7 @@ protected:
     bool promisc_;
     bool rfmon_;
     bool immediate_mode_;
+    bool lazy_decoding_;
     pcap_direction_t direction_;
     int timestamp_precision_;
 };
@@ -691,6 +871,128 @@ void Tins::BaseSniffer::sniff_loop(Functor function, uint32_t max_packets) {
     }
 }
 
+/**
+ * \cond
+ */
+namespace Internals {
+
+template <typename Functor>
+struct sniff_view_data {
+    sniff_view_data(Functor& function, pcap_t* handle, PDU::PDUType link_type)
+    : function(function), handle(handle), link_type(link_type),
+      packets_processed(0), stopped(false) {
+
+    }
+
+    Functor& function;
+    pcap_t* handle;
+    PDU::PDUType link_type;
+    uint32_t packets_processed;
+    bool stopped;
+    #if TINS_IS_CXX11
+    std::exception_ptr error;
+    #endif // TINS_IS_CXX11
+};
+
+template <typename Functor>
+void sniff_view_handler(u_char* user, const struct pcap_pkthdr* h, const u_char* bytes) {
+    sniff_view_data<Functor>* data = (sniff_view_data<Functor>*)user;
+    // Packets might still be delivered after pcap_breakloop is called
+    if (data->stopped) {
+        return;
+    }
+    data->packets_processed++;
+    const PacketView view(bytes, h->caplen, data->link_type, h->ts, h->len);
+    try {
+        // If the functor returns false, we're done
+        if (!data->function(view)) {
+            data->stopped = true;
+            pcap_breakloop(data->handle);
+        }
+    }
+    catch(malformed_packet&) { }
+    catch(pdu_not_found&) { }
+    #if TINS_IS_CXX11
+    // Exceptions can't go through libpcap, so keep it and rethrow it later
+    catch(...) {
+        data->error = std::current_exception();
+        data->stopped = true;
+        pcap_breakloop(data->handle);
+    }
+    #endif // TINS_IS_CXX11
+}
+
+} // Internals
+/**
+ * \endcond
+ */
+
+template <typename Functor>
+void Tins::BaseSniffer::sniff_view_loop(Functor function, uint32_t max_packets) {
+    Internals::sniff_view_data<Functor> data(function, handle_, view_link_type());
+    while (!data.stopped) {
+        const int count = max_packets ? 
+                          static_cast<int>(max_packets - data.packets_processed) : -1;
+        const int result = pcap_sniffing_method_(
+            handle_,
+            count,
+            &Internals::sniff_view_handler<Functor>,
+            (u_char*)&data
+        );
+        if (result <= 0) {
+            #if TINS_IS_CXX11
+            if (!data.error) {
+                check_read_error();
+            }
+            #else
+            check_read_error();
+            #endif // TINS_IS_CXX11
+            break;
+        }
+        if (max_packets && data.packets_processed >= max_packets) {
+            break;
+        }
+    }
+    #if TINS_IS_CXX11
+    if (data.error) {
+        std::rethrow_exception(data.error);
+    }
+    #endif // TINS_IS_CXX11
+}
+
+template <typename Functor>
+void Tins::BaseSniffer::sniff_batch(Functor function, uint32_t batch_size,
+                                    uint32_t max_packets) {
+    std::vector<Packet> packets;
+    packets.reserve(batch_size);
+    while (true) {
+        uint32_t to_read = batch_size;
+        if (max_packets && max_packets < to_read) {
+            to_read = max_packets;
+        }
+        const uint32_t packets_read = next_packets(packets, to_read);
+        if (packets_read == 0) {
+            return;
+        }
+        if (!packets.empty()) {
+            try {
+                // If the functor returns false, we're done
+                if (!function(packets)) {
+                    return;
+                }
+            }
+            catch(malformed_packet&) { }
+            catch(pdu_not_found&) { }
+        }
+        if (max_packets) {
+            max_packets -= packets_read;
+            if (max_packets == 0) {
+                return;
+            }
+        }
+    }
+}
+
 } // Tins
 
 #endif // TINS_HAVE_PCAP
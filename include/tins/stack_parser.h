@@ -0,0 +1,579 @@
+/*
+ * Copyright (c) 2017, Matias Fontanini
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are
+ * met:
+ * 
+ * * Redistributions of source code must retain the above copyright
+ *   notice, this list of conditions and the following disclaimer.
+ * * Redistributions in binary form must reproduce the above
+ *   copyright notice, this list of conditions and the following disclaimer
+ *   in the documentation and/or other materials provided with the
+ *   distribution.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+
+#ifndef TINS_STACK_PARSER_H
+#define TINS_STACK_PARSER_H
+
+#include <tins/cxxstd.h>
+
+#if TINS_IS_CXX11
+
+#include <tuple>
+#include <stdint.h>
+#include <tins/macros.h>
+#include <tins/endianness.h>
+#include <tins/memory_helpers.h>
+#include <tins/constants.h>
+#include <tins/exceptions.h>
+#include <tins/packet_view.h>
+#include <tins/ethernetII.h>
+#include <tins/dot1q.h>
+#include <tins/arp.h>
+#include <tins/ip.h>
+#include <tins/ipv6.h>
+#include <tins/tcp.h>
+#include <tins/udp.h>
+#include <tins/icmp.h>
+#include <tins/icmpv6.h>
+#include <tins/rawpdu.h>
+
+namespace Tins {
+namespace Internals {
+
+/**
+ * \cond
+ */
+
+/*
+ * The kind of identifier a layer uses to tell which protocol follows it.
+ */
+enum stack_family {
+    NO_FAMILY,
+    ETHERTYPE_FAMILY,
+    IP_PROTOCOL_FAMILY
+};
+
+enum stack_status {
+    STACK_OK,
+    STACK_MALFORMED,
+    STACK_MISMATCH
+};
+
+// Identifier that no layer matches. Used for non initial IP fragments
+const uint32_t STACK_NO_ID = 0xffffffff;
+
+struct stack_header {
+    uint32_t header_size;
+    uint32_t payload_size;
+    uint32_t next_id;
+};
+
+struct stack_bounds {
+    const uint8_t* buffer;
+    uint32_t size;
+};
+
+/*
+ * Protocol traits. Each of them knows how to find its header's size and the 
+ * identifier of the next protocol straight from the buffer, which family 
+ * that identifier belongs to and, if its parent identifies it, which values
+ * identify it.
+ *
+ * Terminal layers consume the whole buffer, so they can only be used as the
+ * last layer in a stack.
+ */
+struct payload_stack_layer {
+    static const bool terminal = true;
+    static const stack_family family = NO_FAMILY;
+    static const stack_family next_family = NO_FAMILY;
+
+    static bool matches(uint32_t) {
+        return true;
+    }
+
+    static bool parse(const uint8_t*, uint32_t total_sz, stack_header& header) {
+        header.header_size = total_sz;
+        header.payload_size = 0;
+        header.next_id = STACK_NO_ID;
+        return true;
+    }
+};
+
+struct ethernet_stack_layer {
+    static const bool terminal = false;
+    static const stack_family family = NO_FAMILY;
+    static const stack_family next_family = ETHERTYPE_FAMILY;
+
+    static bool matches(uint32_t) {
+        return true;
+    }
+
+    static bool parse(const uint8_t* buffer, uint32_t total_sz, stack_header& header) {
+        if (TINS_UNLIKELY(total_sz < 14)) {
+            return false;
+        }
+        header.header_size = 14;
+        header.payload_size = total_sz - 14;
+        header.next_id = Memory::read_be_value<uint16_t>(buffer + 12);
+        return true;
+    }
+};
+
+struct dot1q_stack_layer {
+    static const bool terminal = false;
+    static const stack_family family = ETHERTYPE_FAMILY;
+    static const stack_family next_family = ETHERTYPE_FAMILY;
+
+    static bool matches(uint32_t id) {
+        return id == Constants::Ethernet::VLAN || id == Constants::Ethernet::QINQ ||
+               id == Constants::Ethernet::OLD_QINQ;
+    }
+
+    static bool parse(const uint8_t* buffer, uint32_t total_sz, stack_header& header) {
+        if (TINS_UNLIKELY(total_sz < 4)) {
+            return false;
+        }
+        header.header_size = 4;
+        header.payload_size = total_sz - 4;
+        header.next_id = Memory::read_be_value<uint16_t>(buffer + 2);
+        return true;
+    }
+};
+
+struct arp_stack_layer {
+    static const bool terminal = false;
+    static const stack_family family = ETHERTYPE_FAMILY;
+    static const stack_family next_family = NO_FAMILY;
+
+    static bool matches(uint32_t id) {
+        return id == Constants::Ethernet::ARP;
+    }
+
+    static bool parse(const uint8_t*, uint32_t total_sz, stack_header& header) {
+        if (TINS_UNLIKELY(total_sz < 28)) {
+            return false;
+        }
+        header.header_size = 28;
+        header.payload_size = total_sz - 28;
+        header.next_id = STACK_NO_ID;
+        return true;
+    }
+};
+
+struct ip_stack_layer {
+    static const bool terminal = false;
+    static const stack_family family = ETHERTYPE_FAMILY;
+    static const stack_family next_family = IP_PROTOCOL_FAMILY;
+
+    static bool matches(uint32_t id) {
+        return id == Constants::Ethernet::IP;
+    }
+
+    static bool parse(const uint8_t* buffer, uint32_t total_sz, stack_header& header) {
+        if (TINS_UNLIKELY(total_sz < 20 || (buffer[0] >> 4) != 4)) {
+            return false;
+        }
+        const uint32_t header_size = (buffer[0] & 0x0f) * sizeof(uint32_t);
+        if (TINS_UNLIKELY(header_size < 20 || header_size > total_sz)) {
+            return false;
+        }
+        header.header_size = header_size;
+        header.payload_size = total_sz - header_size;
+        // Trim any link layer padding, unless the packet was truncated
+        const uint32_t total_length = Memory::read_be_value<uint16_t>(buffer + 2);
+        if (total_length >= header_size && total_length < total_sz) {
+            header.payload_size = total_length - header_size;
+        }
+        // Only the first fragment contains the next protocol's header
+        if ((Memory::read_be_value<uint16_t>(buffer + 6) & 0x1fff) == 0) {
+            header.next_id = buffer[9];
+        }
+        else {
+            header.next_id = STACK_NO_ID;
+        }
+        return true;
+    }
+};
+
+struct ipv6_stack_layer {
+    static const bool terminal = false;
+    static const stack_family family = ETHERTYPE_FAMILY;
+    static const stack_family next_family = IP_PROTOCOL_FAMILY;
+
+    static bool matches(uint32_t id) {
+        return id == Constants::Ethernet::IPV6;
+    }
+
+    // The extension headers are considered to be part of this layer's header
+    static bool parse(const uint8_t* buffer, uint32_t total_sz, stack_header& header) {
+        if (TINS_UNLIKELY(total_sz < 40 || (buffer[0] >> 4) != 6)) {
+            return false;
+        }
+        uint32_t end = total_sz;
+        const uint32_t total_length = Memory::read_be_value<uint16_t>(buffer + 4) + 40;
+        if (total_length < total_sz) {
+            end = total_length;
+        }
+        uint32_t offset = 40;
+        uint32_t next_header = buffer[6];
+        bool first_fragment = true;
+        while (true) {
+            uint32_t extension_size;
+            switch (next_header) {
+                case Constants::IP::PROTO_HOPOPTS:
+                case Constants::IP::PROTO_ROUTING:
+                case Constants::IP::PROTO_DSTOPTS:
+                    if (TINS_UNLIKELY(end - offset < 2)) {
+                        return false;
+                    }
+                    extension_size = (buffer[offset + 1] + 1) * 8;
+                    break;
+                case Constants::IP::PROTO_FRAGMENT:
+                    if (TINS_UNLIKELY(end - offset < 8)) {
+                        return false;
+                    }
+                    first_fragment = (Memory::read_be_value<uint16_t>(buffer + offset + 2) & 0xfff8) == 0;
+                    extension_size = 8;
+                    break;
+                case Constants::IP::PROTO_AH:
+                    if (TINS_UNLIKELY(end - offset < 2)) {
+                        return false;
+                    }
+                    extension_size = (buffer[offset + 1] + 2) * 4;
+                    break;
+                default:
+                    header.header_size = offset;
+                    header.payload_size = end - offset;
+                    header.next_id = first_fragment ? next_header : STACK_NO_ID;
+                    return true;
+            }
+            if (TINS_UNLIKELY(end - offset < extension_size)) {
+                return false;
+            }
+            next_header = buffer[offset];
+            offset += extension_size;
+        }
+    }
+};
+
+struct tcp_stack_layer {
+    static const bool terminal = false;
+    static const stack_family family = IP_PROTOCOL_FAMILY;
+    static const stack_family next_family = NO_FAMILY;
+
+    static bool matches(uint32_t id) {
+        return id == Constants::IP::PROTO_TCP;
+    }
+
+    static bool parse(const uint8_t* buffer, uint32_t total_sz, stack_header& header) {
+        if (TINS_UNLIKELY(total_sz < 20)) {
+            return false;
+        }
+        const uint32_t header_size = (buffer[12] >> 4) * sizeof(uint32_t);
+        if (TINS_UNLIKELY(header_size < 20 || header_size > total_sz)) {
+            return false;
+        }
+        header.header_size = header_size;
+        header.payload_size = total_sz - header_size;
+        header.next_id = STACK_NO_ID;
+        return true;
+    }
+};
+
+struct udp_stack_layer {
+    static const bool terminal = false;
+    static const stack_family family = IP_PROTOCOL_FAMILY;
+    static const stack_family next_family = NO_FAMILY;
+
+    static bool matches(uint32_t id) {
+        return id == Constants::IP::PROTO_UDP;
+    }
+
+    static bool parse(const uint8_t*, uint32_t total_sz, stack_header& header) {
+        if (TINS_UNLIKELY(total_sz < 8)) {
+            return false;
+        }
+        header.header_size = 8;
+        header.payload_size = total_sz - 8;
+        header.next_id = STACK_NO_ID;
+        return true;
+    }
+};
+
+// ICMP headers have a type dependent size, so these consume the whole buffer
+struct icmp_stack_layer : payload_stack_layer {
+    static const stack_family family = IP_PROTOCOL_FAMILY;
+
+    static bool matches(uint32_t id) {
+        return id == Constants::IP::PROTO_ICMP;
+    }
+};
+
+struct icmpv6_stack_layer : payload_stack_layer {
+    static const stack_family family = IP_PROTOCOL_FAMILY;
+
+    static bool matches(uint32_t id) {
+        return id == Constants::IP::PROTO_ICMPV6;
+    }
+};
+
+/*
+ * Binds a type to its protocol traits. PDUs are constructed using only
+ * their own header, so they never allocate inner PDUs. Terminal PDUs
+ * get the whole remaining buffer and decode it as usual.
+ */
+template <typename T, typename Protocol>
+struct pdu_stack_layer : Protocol {
+    static T construct(const uint8_t* buffer, uint32_t total_sz) {
+        return T(buffer, total_sz);
+    }
+};
+
+template <typename T, typename Protocol>
+struct view_stack_layer : Protocol {
+    static T construct(const uint8_t* buffer, uint32_t) {
+        return T(buffer);
+    }
+};
+
+template <typename T>
+struct stack_layer : pdu_stack_layer<T, payload_stack_layer> { };
+
+template <>
+struct stack_layer<EthernetII> : pdu_stack_layer<EthernetII, ethernet_stack_layer> { };
+
+template <>
+struct stack_layer<Dot1Q> : pdu_stack_layer<Dot1Q, dot1q_stack_layer> { };
+
+template <>
+struct stack_layer<ARP> : pdu_stack_layer<ARP, arp_stack_layer> { };
+
+template <>
+struct stack_layer<IP> : pdu_stack_layer<IP, ip_stack_layer> { };
+
+template <>
+struct stack_layer<IPv6> : pdu_stack_layer<IPv6, ipv6_stack_layer> { };
+
+template <>
+struct stack_layer<TCP> : pdu_stack_layer<TCP, tcp_stack_layer> { };
+
+template <>
+struct stack_layer<UDP> : pdu_stack_layer<UDP, udp_stack_layer> { };
+
+template <>
+struct stack_layer<ICMP> : pdu_stack_layer<ICMP, icmp_stack_layer> { };
+
+template <>
+struct stack_layer<ICMPv6> : pdu_stack_layer<ICMPv6, icmpv6_stack_layer> { };
+
+template <>
+struct stack_layer<PacketView::EthernetHeader> 
+: view_stack_layer<PacketView::EthernetHeader, ethernet_stack_layer> { };
+
+template <>
+struct stack_layer<PacketView::Dot1QHeader> 
+: view_stack_layer<PacketView::Dot1QHeader, dot1q_stack_layer> { };
+
+template <>
+struct stack_layer<PacketView::IPHeader> 
+: view_stack_layer<PacketView::IPHeader, ip_stack_layer> { };
+
+template <>
+struct stack_layer<PacketView::IPv6Header> 
+: view_stack_layer<PacketView::IPv6Header, ipv6_stack_layer> { };
+
+template <>
+struct stack_layer<PacketView::TCPHeader> 
+: view_stack_layer<PacketView::TCPHeader, tcp_stack_layer> { };
+
+template <>
+struct stack_layer<PacketView::UDPHeader> 
+: view_stack_layer<PacketView::UDPHeader, udp_stack_layer> { };
+
+/*
+ * Walks the buffer, storing each layer's bounds. The checks on each 
+ * layer's family are constant, so the only branches left are the ones
+ * that validate the packet itself.
+ */
+template <size_t Index, typename... Layers>
+struct stack_walker;
+
+template <size_t Index, typename Layer>
+struct stack_walker<Index, Layer> {
+    static stack_status walk(const uint8_t* buffer, uint32_t total_sz, 
+                             stack_bounds* bounds) {
+        stack_header header;
+        if (!stack_layer<Layer>::parse(buffer, total_sz, header)) {
+            return STACK_MALFORMED;
+        }
+        bounds[Index].buffer = buffer;
+        bounds[Index].size = header.header_size;
+        return STACK_OK;
+    }
+};
+
+template <size_t Index, typename Layer, typename Next, typename... Rest>
+struct stack_walker<Index, Layer, Next, Rest...> {
+    typedef stack_layer<Layer> layer_type;
+    typedef stack_layer<Next> next_type;
+
+    static_assert(!layer_type::terminal, 
+                  "Only the last layer in a stack can consume the rest of the buffer");
+    // e.g. EthernetII followed by TCP could never match a packet
+    static_assert(next_type::family == NO_FAMILY || 
+                  next_type::family == layer_type::next_family,
+                  "Layers can only be followed by protocols they can identify");
+
+    static stack_status walk(const uint8_t* buffer, uint32_t total_sz, 
+                             stack_bounds* bounds) {
+        stack_header header;
+        if (!layer_type::parse(buffer, total_sz, header)) {
+            return STACK_MALFORMED;
+        }
+        if (next_type::family != NO_FAMILY && !next_type::matches(header.next_id)) {
+            return STACK_MISMATCH;
+        }
+        bounds[Index].buffer = buffer;
+        bounds[Index].size = header.header_size;
+        return stack_walker<Index + 1, Next, Rest...>::walk(
+            buffer + header.header_size,
+            header.payload_size,
+            bounds
+        );
+    }
+};
+
+template <size_t... Indexes>
+struct stack_indexes { };
+
+template <size_t Size, size_t... Indexes>
+struct make_stack_indexes : make_stack_indexes<Size - 1, Size - 1, Indexes...> { };
+
+template <size_t... Indexes>
+struct make_stack_indexes<0, Indexes...> {
+    typedef stack_indexes<Indexes...> type;
+};
+
+template <typename... Layers>
+struct stack_builder {
+    template <size_t... Indexes>
+    static std::tuple<Layers...> build(const stack_bounds* bounds, 
+                                       stack_indexes<Indexes...>) {
+        return std::tuple<Layers...>(
+            stack_layer<Layers>::construct(bounds[Indexes].buffer, bounds[Indexes].size)...
+        );
+    }
+};
+
+/**
+ * \endcond
+ */
+
+} // Internals
+
+/**
+ * \brief Indicates whether a buffer contains the given sequence of layers.
+ *
+ * This performs the same validation as parse_stack, but doesn't construct
+ * any of the layers nor throw when they are not found. It can be used 
+ * to cheaply discard packets before parsing them.
+ *
+ * \code
+ * if (matches_stack<EthernetII, IP, UDP>(buffer, size)) {
+ *     // ...
+ * }
+ * \endcode
+ *
+ * \param buffer The buffer to be checked.
+ * \param total_sz The size of the buffer.
+ * \sa parse_stack
+ */
+template <typename... Layers>
+bool matches_stack(const uint8_t* buffer, uint32_t total_sz) {
+    static_assert(sizeof...(Layers) > 0, "At least one layer must be provided");
+    Internals::stack_bounds bounds[sizeof...(Layers)];
+    return Internals::stack_walker<0, Layers...>::walk(buffer, total_sz, bounds) == 
+           Internals::STACK_OK;
+}
+
+/**
+ * \brief Parses a known sequence of layers out of a buffer.
+ *
+ * The layers to be parsed are given as template parameters, so each of 
+ * them is decoded without virtual calls nor having to look up which 
+ * protocol comes next. The identifier of the next protocol on each layer
+ * (e.g. the ethertype or the IP protocol field) is still checked against
+ * the layer that was requested after it. Sequences that can never match, 
+ * like EthernetII followed by TCP, fail to compile.
+ *
+ * Each layer can either be a PDU or one of PacketView's header views. PDUs
+ * are constructed using only their own header, so they won't contain any
+ * inner PDUs. Use RawPDU as the last layer in order to get the payload.
+ * The supported layers are EthernetII, Dot1Q, ARP, IP, IPv6 (including 
+ * extension headers), TCP and UDP, plus their PacketView counterparts.
+ * Any other PDU can only be used as the last layer. In that case, it will
+ * be constructed using the rest of the buffer, decoding it as usual.
+ *
+ * The layers are returned by value, so views are only valid while the 
+ * buffer is alive.
+ *
+ * \code
+ * EthernetII eth;
+ * IP ip;
+ * TCP tcp;
+ * std::tie(eth, ip, tcp) = parse_stack<EthernetII, IP, TCP>(buffer, size);
+ *
+ * // Same thing, without constructing any PDUs
+ * auto headers = parse_stack<PacketView::EthernetHeader, PacketView::IPHeader, 
+ *                            PacketView::TCPHeader>(buffer, size);
+ * uint16_t dport = std::get<2>(headers).dport();
+ * \endcode
+ *
+ * \param buffer The buffer to be parsed.
+ * \param total_sz The size of the buffer.
+ * \return A tuple containing one object per requested layer.
+ * \throw malformed_packet If any of the layers doesn't fit in the buffer.
+ * \throw pdu_not_found If a layer's next protocol doesn't match the next 
+ * requested layer.
+ * \sa matches_stack
+ */
+template <typename... Layers>
+std::tuple<Layers...> parse_stack(const uint8_t* buffer, uint32_t total_sz) {
+    static_assert(sizeof...(Layers) > 0, "At least one layer must be provided");
+    Internals::stack_bounds bounds[sizeof...(Layers)];
+    switch (Internals::stack_walker<0, Layers...>::walk(buffer, total_sz, bounds)) {
+        case Internals::STACK_MALFORMED:
+            throw malformed_packet();
+        case Internals::STACK_MISMATCH:
+            throw pdu_not_found();
+        default:
+            break;
+    }
+    return Internals::stack_builder<Layers...>::build(
+        bounds,
+        typename Internals::make_stack_indexes<sizeof...(Layers)>::type()
+    );
+}
+
+} // Tins
+
+#endif // TINS_IS_CXX11
+
+#endif // TINS_STACK_PARSER_H
@@ -52,7 +52,8 @@ class OutputMemoryStream;
  * This class represents a TCP PDU. 
  *
  * When sending TCP PDUs, the checksum is calculated automatically
- * every time you send the packet.
+ * every time you send the packet, unless it was set using 
+ * TCP::checksum(uint16_t).
  * 
  * While sniffing, the payload sent in each packet will be wrapped
  * in a RawPDU, which is set as the TCP object's inner_pdu. Therefore,
@@ -340,6 +341,14 @@ public:
      */
     void window(uint16_t new_window);
 
+    /**
+     * \brief Set checksum value and disable automatic calculation
+     * of checksum during write serialization.
+     *
+     * \param new_check The new checksum value.
+     */
+    void checksum(uint16_t new_check);
+
     /**
      * \brief Setter for the urgent pointer field.
      *
@@ -613,11 +622,10 @@ private:
         return opt->to<T>();
     }
     
-    uint16_t calculate_checksum(const uint8_t *buffer,
-                                const uint32_t total_sz,
-                                const uint16_t old_checksum) const;
+    uint16_t calculate_checksum(uint32_t segment_sum, uint32_t segment_size,
+                                uint16_t old_checksum) const;
+    uint32_t sum_serialization(const uint8_t* buffer, uint32_t total_sz);
     void write_serialization(uint8_t* buffer, uint32_t total_sz);
-    void checksum(uint16_t new_check);
     uint32_t calculate_options_size() const;
     uint32_t pad_options_size(uint32_t size) const;
     options_type::const_iterator search_option_iterator(OptionTypes type) const;
@@ -628,6 +636,7 @@ private:
 
     options_type options_;
     tcp_header header_;
+    bool auto_set_checksum_;
 };
 
 } // Tins
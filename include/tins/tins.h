@@ -50,11 +50,18 @@
 #include <tins/mpls.h>
 #include <tins/packet_sender.h>
 #include <tins/packet_writer.h>
+#include <tins/pcapng_writer.h>
+#include <tins/pcapng_reader.h>
 #include <tins/pdu.h>
 #include <tins/radiotap.h>
 #include <tins/rawpdu.h>
 #include <tins/snap.h>
 #include <tins/sniffer.h>
+#include <tins/ring_sniffer.h>
+#include <tins/fanout_sniffer.h>
+#include <tins/parallel_sniffer.h>
+#include <tins/mapped_pcap_reader.h>
+#include <tins/parallel_pcap_reader.h>
 #include <tins/tcp.h>
 #include <tins/udp.h>
 #include <tins/utils.h>
@@ -65,6 +72,13 @@
 #include <tins/ipv6_address.h>
 #include <tins/ip_address.h>
 #include <tins/packet.h>
+#include <tins/packet_view.h>
+#include <tins/packet_rewriter.h>
+#include <tins/packet_template.h>
+#include <tins/prober.h>
+#include <tins/stack_parser.h>
+#include <tins/packet_classifier.h>
+#include <tins/lazy_decoding.h>
 #include <tins/timestamp.h>
 #include <tins/sll.h>
 #include <tins/dhcpv6.h>
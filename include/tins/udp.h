@@ -199,6 +199,7 @@ private:
     } TINS_END_PACK;
 
     void write_serialization(uint8_t* buffer, uint32_t total_sz);
+    uint32_t sum_serialization(const uint8_t* buffer, uint32_t total_sz);
 
     udp_header header_;
     bool auto_set_checksum_;
@@ -64,6 +64,22 @@ TINS_API uint32_t do_checksum(const uint8_t* start, const uint8_t* end);
  */
 TINS_API uint16_t sum_range(const uint8_t* start, const uint8_t* end);
 
+/** 
+ * \brief Copies the input buffer while computing its 16 bit sum.
+ *
+ * This is equivalent to copying the buffer and then calling sum_range on
+ * it, but only reads the input once.
+ *
+ * \param start The pointer to the start of the buffer.
+ * \param end The pointer to the end of the buffer(excluding the last element).
+ * \param output The buffer in which to copy the input. It must be able to
+ * hold end - start bytes.
+ * \return Returns the checksum between start and end (non inclusive) 
+ * in network endian
+ */
+TINS_API uint16_t copy_and_sum_range(const uint8_t* start, const uint8_t* end,
+                                     uint8_t* output);
+
 /** 
  * \brief Fold 32 bit sum to produce 16 bit sum.
  *
@@ -103,6 +119,37 @@ TINS_API uint32_t pseudoheader_checksum(IPv6Address source_ip,
                                         uint16_t len,
                                         uint16_t flag);
 
+/**
+ * \brief Updates a checksum after a 16 bit word it covers changes.
+ *
+ * This performs the incremental update described in RFC 1624, which 
+ * avoids summing the whole checksummed data again. This can be used on
+ * the IP, TCP and UDP checksums.
+ *
+ * \param checksum The current checksum, in host endian.
+ * \param old_value The word's old value, in host endian.
+ * \param new_value The word's new value, in host endian.
+ * \return The updated checksum, in host endian.
+ */
+TINS_API uint16_t update_checksum(uint16_t checksum, uint16_t old_value, uint16_t new_value);
+
+/**
+ * \brief Updates a checksum after a range of bytes it covers changes.
+ *
+ * This is the same as the overload that takes a single word, applied
+ * to every 16 bit word in the range. The range must start at an even
+ * offset from the start of the checksummed data and its size must be
+ * even, which is the case for IPv4 and IPv6 addresses and ports.
+ *
+ * \param checksum The current checksum, in host endian.
+ * \param old_data The bytes' old values.
+ * \param new_data The bytes' new values.
+ * \param data_size The amount of bytes that changed.
+ * \return The updated checksum, in host endian.
+ */
+TINS_API uint16_t update_checksum(uint16_t checksum, const uint8_t* old_data,
+                                  const uint8_t* new_data, uint32_t data_size);
+
 /**
  * \brief Returns the 32 bit crc of the given buffer.
  *
@@ -0,0 +1,267 @@
+/*
+ * Copyright (c) 2017, Matias Fontanini
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are
+ * met:
+ * 
+ * * Redistributions of source code must retain the above copyright
+ *   notice, this list of conditions and the following disclaimer.
+ * * Redistributions in binary form must reproduce the above
+ *   copyright notice, this list of conditions and the following disclaimer
+ *   in the documentation and/or other materials provided with the
+ *   distribution.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+
+#include <tins/detail/async_file_writer.h>
+
+#if TINS_IS_CXX11 && !defined(_WIN32)
+
+#include <cstring>
+#include <algorithm>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/uio.h>
+#include <tins/exceptions.h>
+
+using std::string;
+using std::lock_guard;
+using std::unique_lock;
+using std::mutex;
+
+namespace Tins {
+namespace Internals {
+
+namespace {
+
+// Writes all the given buffers, retrying on short writes
+bool write_all(int fd, struct iovec* iov, int count) {
+    while (count > 0) {
+        const ssize_t result = ::writev(fd, iov, count);
+        if (result == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return false;
+        }
+        size_t written = static_cast<size_t>(result);
+        while (count > 0 && written >= iov->iov_len) {
+            written -= iov->iov_len;
+            ++iov;
+            --count;
+        }
+        if (count > 0) {
+            iov->iov_base = static_cast<uint8_t*>(iov->iov_base) + written;
+            iov->iov_len -= written;
+        }
+    }
+    return true;
+}
+
+} // anonymous namespace
+
+const size_t AsyncFileWriter::BLOCK_SIZE = 4096;
+const int AsyncFileWriter::NO_BUFFER = -1;
+
+AsyncFileWriter::AsyncFileWriter(const string& file_name, size_t buffer_size, 
+                                 OverflowPolicy policy)
+: active_(0), policy_(policy), fd_(-1), offset_(0), pending_(NO_BUFFER), 
+  written_bytes_(0), dropped_bytes_(0), dropped_records_(0), flush_pending_(false), 
+  stopping_(false), error_(0) {
+    fd_ = ::open(file_name.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd_ == -1) {
+        throw pcap_error(file_name + ": " + strerror(errno));
+    }
+    for (size_t i = 0; i < 2; ++i) {
+        buffers_[i].data.resize(buffer_size);
+        buffers_[i].size = 0;
+        buffers_[i].records = 0;
+    }
+    thread_ = std::thread(&AsyncFileWriter::run, this);
+}
+
+AsyncFileWriter::~AsyncFileWriter() {
+    // Whatever is left is written regardless of the overflow policy
+    wait_until_idle();
+    hand_over(true);
+    wait_until_idle();
+    {
+        lock_guard<mutex> _(mutex_);
+        stopping_ = true;
+    }
+    condition_.notify_all();
+    thread_.join();
+    ::close(fd_);
+}
+
+bool AsyncFileWriter::write(const uint8_t* header, size_t header_size, 
+                            const uint8_t* data, size_t data_size) {
+    check_error();
+    const size_t size = header_size + data_size;
+    if (buffers_[active_].size + size > buffers_[active_].data.size() && !make_room(size)) {
+        dropped_bytes_ += size;
+        ++dropped_records_;
+        return false;
+    }
+    buffer_type& buffer = buffers_[active_];
+    uint8_t* output = &buffer.data[buffer.size];
+    memcpy(output, header, header_size);
+    if (data_size > 0) {
+        memcpy(output + header_size, data, data_size);
+    }
+    buffer.size += size;
+    ++buffer.records;
+    return true;
+}
+
+void AsyncFileWriter::flush() {
+    check_error();
+    wait_until_idle();
+    hand_over(true);
+    wait_until_idle();
+    check_error();
+}
+
+uint64_t AsyncFileWriter::written_bytes() const {
+    return written_bytes_.load();
+}
+
+uint64_t AsyncFileWriter::dropped_bytes() const {
+    return dropped_bytes_.load();
+}
+
+uint64_t AsyncFileWriter::dropped_records() const {
+    return dropped_records_.load();
+}
+
+bool AsyncFileWriter::make_room(size_t size) {
+    if (size > buffers_[active_].data.size()) {
+        return false;
+    }
+    if (pending_.load(std::memory_order_acquire) != NO_BUFFER) {
+        // The other buffer is still being written
+        switch (policy_) {
+            case BLOCK_ON_OVERFLOW:
+                wait_until_idle();
+                break;
+            case DROP_NEWEST_ON_OVERFLOW:
+                return false;
+            case DROP_OLDEST_ON_OVERFLOW:
+                {
+                    // The buffer being written can't be touched, so the 
+                    // oldest data that can be dropped is the active one's
+                    buffer_type& buffer = buffers_[active_];
+                    dropped_bytes_ += buffer.size;
+                    dropped_records_ += buffer.records;
+                    buffer.size = 0;
+                    buffer.records = 0;
+                }
+                return true;
+        }
+    }
+    hand_over(false);
+    return true;
+}
+
+void AsyncFileWriter::hand_over(bool flush) {
+    {
+        lock_guard<mutex> _(mutex_);
+        pending_.store(active_, std::memory_order_release);
+        flush_pending_ = flush;
+    }
+    condition_.notify_all();
+    active_ ^= 1;
+    buffers_[active_].size = 0;
+    buffers_[active_].records = 0;
+}
+
+void AsyncFileWriter::wait_until_idle() {
+    unique_lock<mutex> lock(mutex_);
+    while (pending_.load(std::memory_order_acquire) != NO_BUFFER) {
+        condition_.wait(lock);
+    }
+}
+
+void AsyncFileWriter::check_error() {
+    const int error = error_.load(std::memory_order_relaxed);
+    if (error != 0) {
+        throw pcap_error(string("Failed to write to file: ") + strerror(error));
+    }
+}
+
+void AsyncFileWriter::run() {
+    while (true) {
+        int index;
+        bool flush;
+        {
+            unique_lock<mutex> lock(mutex_);
+            while (pending_.load(std::memory_order_relaxed) == NO_BUFFER && !stopping_) {
+                condition_.wait(lock);
+            }
+            index = pending_.load(std::memory_order_relaxed);
+            if (index == NO_BUFFER) {
+                return;
+            }
+            flush = flush_pending_;
+        }
+        write_buffer(buffers_[index], flush);
+        {
+            lock_guard<mutex> _(mutex_);
+            pending_.store(NO_BUFFER, std::memory_order_release);
+        }
+        condition_.notify_all();
+    }
+}
+
+void AsyncFileWriter::write_buffer(const buffer_type& buffer, bool flush) {
+    if (error_.load(std::memory_order_relaxed) != 0) {
+        return;
+    }
+    const uint8_t* data = buffer.data.empty() ? 0 : &buffer.data[0];
+    const uint64_t total = tail_.size() + buffer.size;
+    uint64_t to_write = total;
+    if (!flush) {
+        // Only write up to the last block boundary
+        const uint64_t end = (offset_ + total) & ~static_cast<uint64_t>(BLOCK_SIZE - 1);
+        to_write = end > offset_ ? end - offset_ : 0;
+    }
+    const size_t from_tail = static_cast<size_t>(std::min<uint64_t>(tail_.size(), to_write));
+    const size_t from_buffer = static_cast<size_t>(to_write - from_tail);
+    if (to_write > 0) {
+        struct iovec iov[2];
+        iov[0].iov_base = tail_.empty() ? 0 : &tail_[0];
+        iov[0].iov_len = from_tail;
+        iov[1].iov_base = const_cast<uint8_t*>(data);
+        iov[1].iov_len = from_buffer;
+        if (!write_all(fd_, iov, 2)) {
+            error_.store(errno);
+            return;
+        }
+        offset_ += to_write;
+        written_bytes_ += to_write;
+    }
+    // Keep whatever wasn't written
+    tail_.erase(tail_.begin(), tail_.begin() + from_tail);
+    tail_.insert(tail_.end(), data + from_buffer, data + buffer.size);
+}
+
+} // Internals
+} // Tins
+
+#endif // TINS_IS_CXX11 && !_WIN32
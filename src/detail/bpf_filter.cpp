@@ -0,0 +1,616 @@
+/*
+ * Copyright (c) 2017, Matias Fontanini
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are
+ * met:
+ * 
+ * * Redistributions of source code must retain the above copyright
+ *   notice, this list of conditions and the following disclaimer.
+ * * Redistributions in binary form must reproduce the above
+ *   copyright notice, this list of conditions and the following disclaimer
+ *   in the documentation and/or other materials provided with the
+ *   distribution.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+
+#include <tins/detail/bpf_filter.h>
+
+#ifdef TINS_HAVE_PCAP
+
+using std::vector;
+
+namespace Tins {
+namespace Internals {
+
+namespace {
+
+// Old versions of pcap/bpf.h don't define these
+#ifndef BPF_MOD
+    #define BPF_MOD 0x90
+#endif // BPF_MOD
+#ifndef BPF_XOR
+    #define BPF_XOR 0xa0
+#endif // BPF_XOR
+
+enum operation {
+    RET_K,
+    RET_A,
+    LD_W_ABS,
+    LD_H_ABS,
+    LD_B_ABS,
+    LD_W_IND,
+    LD_H_IND,
+    LD_B_IND,
+    LD_LEN,
+    LD_IMM,
+    LD_MEM,
+    LDX_LEN,
+    LDX_IMM,
+    LDX_MEM,
+    LDX_MSH,
+    ST,
+    STX,
+    ALU_ADD_K,
+    ALU_SUB_K,
+    ALU_MUL_K,
+    ALU_DIV_K,
+    ALU_MOD_K,
+    ALU_AND_K,
+    ALU_OR_K,
+    ALU_XOR_K,
+    ALU_LSH_K,
+    ALU_RSH_K,
+    ALU_ADD_X,
+    ALU_SUB_X,
+    ALU_MUL_X,
+    ALU_DIV_X,
+    ALU_MOD_X,
+    ALU_AND_X,
+    ALU_OR_X,
+    ALU_XOR_X,
+    ALU_LSH_X,
+    ALU_RSH_X,
+    ALU_NEG,
+    JA,
+    JEQ_K,
+    JGT_K,
+    JGE_K,
+    JSET_K,
+    JEQ_X,
+    JGT_X,
+    JGE_X,
+    JSET_X,
+    TAX,
+    TXA,
+    // A load followed by a conditional jump on the loaded value
+    LD_W_ABS_JEQ,
+    LD_H_ABS_JEQ,
+    LD_B_ABS_JEQ,
+    LD_H_ABS_JSET,
+    LD_B_ABS_JSET,
+    LD_H_IND_JEQ,
+    INVALID_OPERATION
+};
+
+uint32_t load_operation(uint16_t code, uint32_t k) {
+    switch (BPF_MODE(code)) {
+        case BPF_ABS:
+        case BPF_IND:
+            {
+                const bool absolute = BPF_MODE(code) == BPF_ABS;
+                switch (BPF_SIZE(code)) {
+                    case BPF_W:
+                        return absolute ? LD_W_ABS : LD_W_IND;
+                    case BPF_H:
+                        return absolute ? LD_H_ABS : LD_H_IND;
+                    case BPF_B:
+                        return absolute ? LD_B_ABS : LD_B_IND;
+                    default:
+                        return INVALID_OPERATION;
+                }
+            }
+        case BPF_LEN:
+            return LD_LEN;
+        case BPF_IMM:
+            return LD_IMM;
+        case BPF_MEM:
+            return k < BPF_MEMWORDS ? LD_MEM : INVALID_OPERATION;
+        default:
+            return INVALID_OPERATION;
+    }
+}
+
+uint32_t load_x_operation(uint16_t code, uint32_t k) {
+    switch (BPF_MODE(code)) {
+        case BPF_LEN:
+            return LDX_LEN;
+        case BPF_IMM:
+            return LDX_IMM;
+        case BPF_MEM:
+            return k < BPF_MEMWORDS ? LDX_MEM : INVALID_OPERATION;
+        case BPF_MSH:
+            return BPF_SIZE(code) == BPF_B ? LDX_MSH : INVALID_OPERATION;
+        default:
+            return INVALID_OPERATION;
+    }
+}
+
+uint32_t alu_operation(uint16_t code, uint32_t k) {
+    const bool use_x = BPF_SRC(code) == BPF_X;
+    switch (BPF_OP(code)) {
+        case BPF_ADD:
+            return use_x ? ALU_ADD_X : ALU_ADD_K;
+        case BPF_SUB:
+            return use_x ? ALU_SUB_X : ALU_SUB_K;
+        case BPF_MUL:
+            return use_x ? ALU_MUL_X : ALU_MUL_K;
+        case BPF_DIV:
+            if (use_x) {
+                return ALU_DIV_X;
+            }
+            return k != 0 ? ALU_DIV_K : INVALID_OPERATION;
+        case BPF_MOD:
+            if (use_x) {
+                return ALU_MOD_X;
+            }
+            return k != 0 ? ALU_MOD_K : INVALID_OPERATION;
+        case BPF_AND:
+            return use_x ? ALU_AND_X : ALU_AND_K;
+        case BPF_OR:
+            return use_x ? ALU_OR_X : ALU_OR_K;
+        case BPF_XOR:
+            return use_x ? ALU_XOR_X : ALU_XOR_K;
+        case BPF_LSH:
+            if (use_x) {
+                return ALU_LSH_X;
+            }
+            return k < 32 ? ALU_LSH_K : INVALID_OPERATION;
+        case BPF_RSH:
+            if (use_x) {
+                return ALU_RSH_X;
+            }
+            return k < 32 ? ALU_RSH_K : INVALID_OPERATION;
+        case BPF_NEG:
+            return ALU_NEG;
+        default:
+            return INVALID_OPERATION;
+    }
+}
+
+uint32_t jump_operation(uint16_t code) {
+    const bool use_x = BPF_SRC(code) == BPF_X;
+    switch (BPF_OP(code)) {
+        case BPF_JA:
+            return use_x ? INVALID_OPERATION : JA;
+        case BPF_JEQ:
+            return use_x ? JEQ_X : JEQ_K;
+        case BPF_JGT:
+            return use_x ? JGT_X : JGT_K;
+        case BPF_JGE:
+            return use_x ? JGE_X : JGE_K;
+        case BPF_JSET:
+            return use_x ? JSET_X : JSET_K;
+        default:
+            return INVALID_OPERATION;
+    }
+}
+
+uint32_t operation_for(uint16_t code, uint32_t k) {
+    switch (BPF_CLASS(code)) {
+        case BPF_LD:
+            return load_operation(code, k);
+        case BPF_LDX:
+            return load_x_operation(code, k);
+        case BPF_ST:
+            return k < BPF_MEMWORDS ? ST : INVALID_OPERATION;
+        case BPF_STX:
+            return k < BPF_MEMWORDS ? STX : INVALID_OPERATION;
+        case BPF_ALU:
+            return alu_operation(code, k);
+        case BPF_JMP:
+            return jump_operation(code);
+        case BPF_RET:
+            switch (BPF_RVAL(code)) {
+                case BPF_K:
+                    return RET_K;
+                case BPF_A:
+                    return RET_A;
+                default:
+                    return INVALID_OPERATION;
+            }
+        case BPF_MISC:
+            switch (BPF_MISCOP(code)) {
+                case BPF_TAX:
+                    return TAX;
+                case BPF_TXA:
+                    return TXA;
+                default:
+                    return INVALID_OPERATION;
+            }
+        default:
+            return INVALID_OPERATION;
+    }
+}
+
+// Returns the operation resulting from fusing a load and a jump, 
+// or INVALID_OPERATION if they can't be fused
+uint32_t fused_operation(uint32_t load, uint32_t jump) {
+    if (jump == JEQ_K) {
+        switch (load) {
+            case LD_W_ABS:
+                return LD_W_ABS_JEQ;
+            case LD_H_ABS:
+                return LD_H_ABS_JEQ;
+            case LD_B_ABS:
+                return LD_B_ABS_JEQ;
+            case LD_H_IND:
+                return LD_H_IND_JEQ;
+            default:
+                break;
+        }
+    }
+    else if (jump == JSET_K) {
+        switch (load) {
+            case LD_H_ABS:
+                return LD_H_ABS_JSET;
+            case LD_B_ABS:
+                return LD_B_ABS_JSET;
+            default:
+                break;
+        }
+    }
+    return INVALID_OPERATION;
+}
+
+uint32_t load_size(uint32_t op) {
+    switch (op) {
+        case LD_W_ABS:
+        case LD_W_IND:
+            return 4;
+        case LD_H_ABS:
+        case LD_H_IND:
+            return 2;
+        case LD_B_ABS:
+        case LD_B_IND:
+            return 1;
+        default:
+            return 0;
+    }
+}
+
+inline uint32_t read_word(const uint8_t* ptr) {
+    return (static_cast<uint32_t>(ptr[0]) << 24) | (static_cast<uint32_t>(ptr[1]) << 16) |
+           (static_cast<uint32_t>(ptr[2]) << 8) | ptr[3];
+}
+
+inline uint32_t read_half_word(const uint8_t* ptr) {
+    return (static_cast<uint32_t>(ptr[0]) << 8) | ptr[1];
+}
+
+// Whether size bytes starting at offset + index fit in the buffer
+inline bool fits(uint32_t index, uint32_t offset, uint32_t size, uint32_t total_sz) {
+    return static_cast<uint64_t>(index) + offset + size <= total_sz;
+}
+
+} // anonymous namespace
+
+BPFFilter::BPFFilter() {
+
+}
+
+bool BPFFilter::load(const bpf_program& program) {
+    instructions_.clear();
+    // An empty program accepts every packet
+    if (program.bf_len == 0) {
+        instruction ret = { RET_K, 0xffffffff, 0, 0, 0 };
+        instructions_.push_back(ret);
+        return true;
+    }
+    const uint32_t count = program.bf_len;
+    vector<instruction> instructions(count);
+    for (uint32_t i = 0; i < count; ++i) {
+        const bpf_insn& insn = program.bf_insns[i];
+        instruction& output = instructions[i];
+        output.op = operation_for(insn.code, insn.k);
+        output.k = insn.k;
+        output.compare = 0;
+        output.jump_true = output.jump_false = i + 1;
+        if (output.op == INVALID_OPERATION) {
+            return false;
+        }
+        if (output.op == JA) {
+            // Jumps can only go forward and must land inside the program
+            if (insn.k >= count - i - 1) {
+                return false;
+            }
+            output.jump_true = output.jump_false = i + 1 + insn.k;
+        }
+        else if (BPF_CLASS(insn.code) == BPF_JMP) {
+            if (insn.jt >= count - i - 1 || insn.jf >= count - i - 1) {
+                return false;
+            }
+            output.jump_true = i + 1 + insn.jt;
+            output.jump_false = i + 1 + insn.jf;
+        }
+        // An absolute load that can never fit always makes the program
+        // return 0
+        else if ((output.op == LD_W_ABS || output.op == LD_H_ABS || output.op == LD_B_ABS) &&
+                 insn.k > 0xffffffff - load_size(output.op)) {
+            output.op = RET_K;
+            output.k = 0;
+        }
+    }
+    // Make sure we never run past the last instruction
+    const uint32_t last_op = instructions.back().op;
+    if (last_op != RET_K && last_op != RET_A) {
+        return false;
+    }
+    // Fuse loads with the jumps that follow them. The jump is kept in place,
+    // since other instructions can still jump to it
+    for (uint32_t i = 0; i + 1 < count; ++i) {
+        const instruction& jump = instructions[i + 1];
+        const uint32_t op = fused_operation(instructions[i].op, jump.op);
+        if (op != INVALID_OPERATION) {
+            instructions[i].op = op;
+            instructions[i].compare = jump.k;
+            instructions[i].jump_true = jump.jump_true;
+            instructions[i].jump_false = jump.jump_false;
+        }
+    }
+    instructions_.swap(instructions);
+    return true;
+}
+
+bool BPFFilter::is_loaded() const {
+    return !instructions_.empty();
+}
+
+uint32_t BPFFilter::run(const uint8_t* buffer, uint32_t total_sz, uint32_t wire_sz) const {
+    const instruction* instructions = &instructions_[0];
+    uint32_t a = 0;
+    uint32_t x = 0;
+    uint32_t memory[BPF_MEMWORDS] = { 0 };
+    uint32_t pc = 0;
+    while (true) {
+        const instruction& insn = instructions[pc];
+        switch (insn.op) {
+            case RET_K:
+                return insn.k;
+            case RET_A:
+                return a;
+            case LD_W_ABS:
+                if (!fits(0, insn.k, 4, total_sz)) {
+                    return 0;
+                }
+                a = read_word(buffer + insn.k);
+                break;
+            case LD_H_ABS:
+                if (!fits(0, insn.k, 2, total_sz)) {
+                    return 0;
+                }
+                a = read_half_word(buffer + insn.k);
+                break;
+            case LD_B_ABS:
+                if (!fits(0, insn.k, 1, total_sz)) {
+                    return 0;
+                }
+                a = buffer[insn.k];
+                break;
+            case LD_W_IND:
+                if (!fits(x, insn.k, 4, total_sz)) {
+                    return 0;
+                }
+                a = read_word(buffer + x + insn.k);
+                break;
+            case LD_H_IND:
+                if (!fits(x, insn.k, 2, total_sz)) {
+                    return 0;
+                }
+                a = read_half_word(buffer + x + insn.k);
+                break;
+            case LD_B_IND:
+                if (!fits(x, insn.k, 1, total_sz)) {
+                    return 0;
+                }
+                a = buffer[x + insn.k];
+                break;
+            case LD_LEN:
+                a = wire_sz;
+                break;
+            case LD_IMM:
+                a = insn.k;
+                break;
+            case LD_MEM:
+                a = memory[insn.k];
+                break;
+            case LDX_LEN:
+                x = wire_sz;
+                break;
+            case LDX_IMM:
+                x = insn.k;
+                break;
+            case LDX_MEM:
+                x = memory[insn.k];
+                break;
+            case LDX_MSH:
+                if (!fits(0, insn.k, 1, total_sz)) {
+                    return 0;
+                }
+                x = (buffer[insn.k] & 0x0f) << 2;
+                break;
+            case ST:
+                memory[insn.k] = a;
+                break;
+            case STX:
+                memory[insn.k] = x;
+                break;
+            case ALU_ADD_K:
+                a += insn.k;
+                break;
+            case ALU_SUB_K:
+                a -= insn.k;
+                break;
+            case ALU_MUL_K:
+                a *= insn.k;
+                break;
+            case ALU_DIV_K:
+                a /= insn.k;
+                break;
+            case ALU_MOD_K:
+                a %= insn.k;
+                break;
+            case ALU_AND_K:
+                a &= insn.k;
+                break;
+            case ALU_OR_K:
+                a |= insn.k;
+                break;
+            case ALU_XOR_K:
+                a ^= insn.k;
+                break;
+            case ALU_LSH_K:
+                a <<= insn.k;
+                break;
+            case ALU_RSH_K:
+                a >>= insn.k;
+                break;
+            case ALU_ADD_X:
+                a += x;
+                break;
+            case ALU_SUB_X:
+                a -= x;
+                break;
+            case ALU_MUL_X:
+                a *= x;
+                break;
+            case ALU_DIV_X:
+                if (x == 0) {
+                    return 0;
+                }
+                a /= x;
+                break;
+            case ALU_MOD_X:
+                if (x == 0) {
+                    return 0;
+                }
+                a %= x;
+                break;
+            case ALU_AND_X:
+                a &= x;
+                break;
+            case ALU_OR_X:
+                a |= x;
+                break;
+            case ALU_XOR_X:
+                a ^= x;
+                break;
+            case ALU_LSH_X:
+                a = x < 32 ? a << x : 0;
+                break;
+            case ALU_RSH_X:
+                a = x < 32 ? a >> x : 0;
+                break;
+            case ALU_NEG:
+                a = 0u - a;
+                break;
+            case JA:
+                pc = insn.jump_true;
+                continue;
+            case JEQ_K:
+                pc = a == insn.k ? insn.jump_true : insn.jump_false;
+                continue;
+            case JGT_K:
+                pc = a > insn.k ? insn.jump_true : insn.jump_false;
+                continue;
+            case JGE_K:
+                pc = a >= insn.k ? insn.jump_true : insn.jump_false;
+                continue;
+            case JSET_K:
+                pc = (a & insn.k) ? insn.jump_true : insn.jump_false;
+                continue;
+            case JEQ_X:
+                pc = a == x ? insn.jump_true : insn.jump_false;
+                continue;
+            case JGT_X:
+                pc = a > x ? insn.jump_true : insn.jump_false;
+                continue;
+            case JGE_X:
+                pc = a >= x ? insn.jump_true : insn.jump_false;
+                continue;
+            case JSET_X:
+                pc = (a & x) ? insn.jump_true : insn.jump_false;
+                continue;
+            case TAX:
+                x = a;
+                break;
+            case TXA:
+                a = x;
+                break;
+            case LD_W_ABS_JEQ:
+                if (!fits(0, insn.k, 4, total_sz)) {
+                    return 0;
+                }
+                a = read_word(buffer + insn.k);
+                pc = a == insn.compare ? insn.jump_true : insn.jump_false;
+                continue;
+            case LD_H_ABS_JEQ:
+                if (!fits(0, insn.k, 2, total_sz)) {
+                    return 0;
+                }
+                a = read_half_word(buffer + insn.k);
+                pc = a == insn.compare ? insn.jump_true : insn.jump_false;
+                continue;
+            case LD_B_ABS_JEQ:
+                if (!fits(0, insn.k, 1, total_sz)) {
+                    return 0;
+                }
+                a = buffer[insn.k];
+                pc = a == insn.compare ? insn.jump_true : insn.jump_false;
+                continue;
+            case LD_H_ABS_JSET:
+                if (!fits(0, insn.k, 2, total_sz)) {
+                    return 0;
+                }
+                a = read_half_word(buffer + insn.k);
+                pc = (a & insn.compare) ? insn.jump_true : insn.jump_false;
+                continue;
+            case LD_B_ABS_JSET:
+                if (!fits(0, insn.k, 1, total_sz)) {
+                    return 0;
+                }
+                a = buffer[insn.k];
+                pc = (a & insn.compare) ? insn.jump_true : insn.jump_false;
+                continue;
+            case LD_H_IND_JEQ:
+                if (!fits(x, insn.k, 2, total_sz)) {
+                    return 0;
+                }
+                a = read_half_word(buffer + x + insn.k);
+                pc = a == insn.compare ? insn.jump_true : insn.jump_false;
+                continue;
+            default:
+                return 0;
+        }
+        ++pc;
+    }
+}
+
+} // Internals
+} // Tins
+
+#endif // TINS_HAVE_PCAP
@@ -0,0 +1,464 @@
+/*
+ * Copyright (c) 2017, Matias Fontanini
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are
+ * met:
+ * 
+ * * Redistributions of source code must retain the above copyright
+ *   notice, this list of conditions and the following disclaimer.
+ * * Redistributions in binary form must reproduce the above
+ *   copyright notice, this list of conditions and the following disclaimer
+ *   in the documentation and/or other materials provided with the
+ *   distribution.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+
+#include <tins/detail/compressed_file.h>
+
+#ifdef TINS_HAVE_COMPRESSION
+
+#include <vector>
+#include <cstring>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#ifdef TINS_HAVE_ZLIB
+    #include <zlib.h>
+#endif // TINS_HAVE_ZLIB
+#ifdef TINS_HAVE_ZSTD
+    #include <zstd.h>
+#endif // TINS_HAVE_ZSTD
+#include <tins/exceptions.h>
+
+using std::string;
+using std::vector;
+
+namespace Tins {
+namespace Internals {
+
+namespace {
+
+const size_t CHUNK_SIZE = 256 * 1024;
+
+// A socket pair is used rather than a pipe so that writing after the 
+// other end is closed fails with EPIPE rather than raising SIGPIPE
+void make_socket_pair(int (&fds)[2]) {
+    if (socketpair(AF_UNIX, SOCK_STREAM, 0, fds) != 0) {
+        throw pcap_error(string("Failed to create socket pair: ") + strerror(errno));
+    }
+}
+
+bool send_all(int fd, const uint8_t* data, size_t size) {
+    while (size > 0) {
+        const ssize_t sent = send(fd, data, size, MSG_NOSIGNAL);
+        if (sent < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return false;
+        }
+        data += sent;
+        size -= sent;
+    }
+    return true;
+}
+
+ssize_t receive(int fd, uint8_t* data, size_t size) {
+    while (true) {
+        const ssize_t received = recv(fd, data, size, 0);
+        if (received >= 0 || errno != EINTR) {
+            return received;
+        }
+    }
+}
+
+#ifdef TINS_HAVE_ZLIB
+
+// Returns false and sets error if the file couldn't be decompressed. If the
+// reader stopped reading, this just returns true
+bool gzip_decompress(FILE* input, int fd, string& error) {
+    vector<uint8_t> input_buffer(CHUNK_SIZE);
+    vector<uint8_t> output_buffer(CHUNK_SIZE);
+    z_stream stream;
+    std::memset(&stream, 0, sizeof(stream));
+    // Automatically detect the gzip header
+    if (inflateInit2(&stream, 15 + 32) != Z_OK) {
+        error = "failed to initialize zlib";
+        return false;
+    }
+    size_t read;
+    while ((read = fread(&input_buffer[0], 1, input_buffer.size(), input)) > 0) {
+        stream.next_in = &input_buffer[0];
+        stream.avail_in = static_cast<uInt>(read);
+        // A full output buffer means zlib may still be holding some output
+        do {
+            stream.next_out = &output_buffer[0];
+            stream.avail_out = static_cast<uInt>(output_buffer.size());
+            const int result = inflate(&stream, Z_NO_FLUSH);
+            if (result != Z_OK && result != Z_STREAM_END && result != Z_BUF_ERROR) {
+                error = stream.msg ? stream.msg : "invalid gzip stream";
+                inflateEnd(&stream);
+                return false;
+            }
+            const size_t produced = output_buffer.size() - stream.avail_out;
+            if (!send_all(fd, &output_buffer[0], produced)) {
+                inflateEnd(&stream);
+                return true;
+            }
+            // Files may contain several concatenated gzip members
+            if (result == Z_STREAM_END) {
+                inflateReset(&stream);
+            }
+        } while (stream.avail_in > 0 || stream.avail_out == 0);
+    }
+    // The input counter is reset at the end of every member, so anything
+    // here belongs to a member that was cut short
+    const bool truncated = stream.total_in > 0;
+    inflateEnd(&stream);
+    if (ferror(input)) {
+        error = strerror(errno);
+        return false;
+    }
+    if (truncated) {
+        error = "unexpected end of file";
+        return false;
+    }
+    return true;
+}
+
+bool gzip_compress(int fd, FILE* output, int level) {
+    vector<uint8_t> input_buffer(CHUNK_SIZE);
+    vector<uint8_t> output_buffer(CHUNK_SIZE);
+    z_stream stream;
+    std::memset(&stream, 0, sizeof(stream));
+    if (level < 0) {
+        level = Z_DEFAULT_COMPRESSION;
+    }
+    // Write a gzip header
+    if (deflateInit2(&stream, level, Z_DEFLATED, 15 + 16, 8, Z_DEFAULT_STRATEGY) != Z_OK) {
+        return false;
+    }
+    int flush = Z_NO_FLUSH;
+    while (flush != Z_FINISH) {
+        const ssize_t received = receive(fd, &input_buffer[0], input_buffer.size());
+        if (received <= 0) {
+            flush = Z_FINISH;
+        }
+        stream.next_in = &input_buffer[0];
+        stream.avail_in = received > 0 ? static_cast<uInt>(received) : 0;
+        do {
+            stream.next_out = &output_buffer[0];
+            stream.avail_out = static_cast<uInt>(output_buffer.size());
+            deflate(&stream, flush);
+            const size_t produced = output_buffer.size() - stream.avail_out;
+            if (fwrite(&output_buffer[0], 1, produced, output) != produced) {
+                deflateEnd(&stream);
+                return false;
+            }
+        } while (stream.avail_out == 0);
+    }
+    deflateEnd(&stream);
+    return true;
+}
+
+#endif // TINS_HAVE_ZLIB
+
+#ifdef TINS_HAVE_ZSTD
+
+// Same as gzip_decompress
+bool zstd_decompress(FILE* input, int fd, string& error) {
+    vector<uint8_t> input_buffer(CHUNK_SIZE);
+    vector<uint8_t> output_buffer(CHUNK_SIZE);
+    ZSTD_DCtx* context = ZSTD_createDCtx();
+    if (!context) {
+        error = "failed to initialize zstd";
+        return false;
+    }
+    // This is 0 once a frame has been fully decoded and flushed
+    size_t result = 0;
+    size_t read;
+    while ((read = fread(&input_buffer[0], 1, input_buffer.size(), input)) > 0) {
+        ZSTD_inBuffer in = { &input_buffer[0], read, 0 };
+        ZSTD_outBuffer out;
+        // A full output buffer means zstd may still be holding some output
+        do {
+            out.dst = &output_buffer[0];
+            out.size = output_buffer.size();
+            out.pos = 0;
+            result = ZSTD_decompressStream(context, &out, &in);
+            if (ZSTD_isError(result)) {
+                error = ZSTD_getErrorName(result);
+                ZSTD_freeDCtx(context);
+                return false;
+            }
+            if (!send_all(fd, &output_buffer[0], out.pos)) {
+                ZSTD_freeDCtx(context);
+                return true;
+            }
+        } while (in.pos < in.size || out.pos == out.size);
+    }
+    ZSTD_freeDCtx(context);
+    if (ferror(input)) {
+        error = strerror(errno);
+        return false;
+    }
+    if (result != 0) {
+        error = "unexpected end of file";
+        return false;
+    }
+    return true;
+}
+
+bool zstd_compress(int fd, FILE* output, int level) {
+    vector<uint8_t> input_buffer(CHUNK_SIZE);
+    vector<uint8_t> output_buffer(CHUNK_SIZE);
+    ZSTD_CCtx* context = ZSTD_createCCtx();
+    if (!context) {
+        return false;
+    }
+    if (level >= 0) {
+        ZSTD_CCtx_setParameter(context, ZSTD_c_compressionLevel, level);
+    }
+    bool finished = false;
+    while (!finished) {
+        const ssize_t received = receive(fd, &input_buffer[0], input_buffer.size());
+        const ZSTD_EndDirective mode = received > 0 ? ZSTD_e_continue : ZSTD_e_end;
+        ZSTD_inBuffer in = { &input_buffer[0], received > 0 ? static_cast<size_t>(received) : 0, 0 };
+        size_t remaining;
+        do {
+            ZSTD_outBuffer out = { &output_buffer[0], output_buffer.size(), 0 };
+            remaining = ZSTD_compressStream2(context, &out, &in, mode);
+            if (ZSTD_isError(remaining) || 
+                fwrite(&output_buffer[0], 1, out.pos, output) != out.pos) {
+                ZSTD_freeCCtx(context);
+                return false;
+            }
+        } while (mode == ZSTD_e_end ? remaining != 0 : in.pos < in.size);
+        finished = mode == ZSTD_e_end;
+    }
+    ZSTD_freeCCtx(context);
+    return true;
+}
+
+#endif // TINS_HAVE_ZSTD
+
+} // anonymous namespace
+
+CompressionFormat detect_compression(const string& file_name) {
+    FILE* file = fopen(file_name.c_str(), "rb");
+    if (!file) {
+        return NO_COMPRESSION;
+    }
+    uint8_t magic[4];
+    const size_t read = fread(magic, 1, sizeof(magic), file);
+    fclose(file);
+    if (read >= 2 && magic[0] == 0x1f && magic[1] == 0x8b) {
+        return GZIP_COMPRESSION;
+    }
+    if (read == 4 && magic[0] == 0x28 && magic[1] == 0xb5 && magic[2] == 0x2f && 
+        magic[3] == 0xfd) {
+        return ZSTD_COMPRESSION;
+    }
+    return NO_COMPRESSION;
+}
+
+bool is_compression_supported(CompressionFormat format) {
+    switch (format) {
+        #ifdef TINS_HAVE_ZLIB
+        case GZIP_COMPRESSION:
+            return true;
+        #endif // TINS_HAVE_ZLIB
+        #ifdef TINS_HAVE_ZSTD
+        case ZSTD_COMPRESSION:
+            return true;
+        #endif // TINS_HAVE_ZSTD
+        default:
+            return false;
+    }
+}
+
+// DecompressionThread
+
+DecompressionThread::DecompressionThread(const string& file_name, CompressionFormat format)
+: stream_(0), read_fd_(-1), write_fd_(-1), format_(format), failed_(false) {
+    if (!is_compression_supported(format)) {
+        throw feature_disabled();
+    }
+    FILE* input = fopen(file_name.c_str(), "rb");
+    if (!input) {
+        throw pcap_error(file_name + ": " + strerror(errno));
+    }
+    int fds[2];
+    try {
+        make_socket_pair(fds);
+    }
+    catch (...) {
+        fclose(input);
+        throw;
+    }
+    read_fd_ = fds[0];
+    write_fd_ = fds[1];
+    stream_ = fdopen(read_fd_, "rb");
+    if (!stream_) {
+        fclose(input);
+        close(read_fd_);
+        close(write_fd_);
+        throw pcap_error("Failed to open decompression stream");
+    }
+    thread_ = std::thread(&DecompressionThread::run, this, input);
+}
+
+DecompressionThread::~DecompressionThread() {
+    // Make the thread stop if the stream wasn't fully read
+    shutdown(read_fd_, SHUT_RDWR);
+    thread_.join();
+}
+
+FILE* DecompressionThread::stream() const {
+    return stream_;
+}
+
+void DecompressionThread::check_error() const {
+    if (failed_.load(std::memory_order_acquire)) {
+        throw pcap_error(error_);
+    }
+}
+
+void DecompressionThread::run(FILE* input) {
+    bool success = false;
+    string error;
+    switch (format_) {
+        #ifdef TINS_HAVE_ZLIB
+        case GZIP_COMPRESSION:
+            success = gzip_decompress(input, write_fd_, error);
+            break;
+        #endif // TINS_HAVE_ZLIB
+        #ifdef TINS_HAVE_ZSTD
+        case ZSTD_COMPRESSION:
+            success = zstd_decompress(input, write_fd_, error);
+            break;
+        #endif // TINS_HAVE_ZSTD
+        default:
+            break;
+    }
+    fclose(input);
+    // This has to be stored before the reader sees the end of the file
+    if (!success) {
+        error_ = "Failed to decompress file: " + error;
+        failed_.store(true, std::memory_order_release);
+    }
+    // The reader sees the end of the file once this is closed
+    close(write_fd_);
+}
+
+// CompressionThread
+
+CompressionThread::CompressionThread(const string& file_name, CompressionFormat format,
+                                     int level)
+: stream_(0), read_fd_(-1), format_(format), level_(level), failed_(false) {
+    if (!is_compression_supported(format)) {
+        throw feature_disabled();
+    }
+    FILE* output = fopen(file_name.c_str(), "wb");
+    if (!output) {
+        throw pcap_error(file_name + ": " + strerror(errno));
+    }
+    int fds[2];
+    try {
+        make_socket_pair(fds);
+    }
+    catch (...) {
+        fclose(output);
+        throw;
+    }
+    read_fd_ = fds[0];
+    stream_ = fdopen(fds[1], "wb");
+    if (!stream_) {
+        fclose(output);
+        close(fds[0]);
+        close(fds[1]);
+        throw pcap_error("Failed to open compression stream");
+    }
+    thread_ = std::thread(&CompressionThread::run, this, output);
+}
+
+CompressionThread::~CompressionThread() {
+    if (thread_.joinable()) {
+        thread_.join();
+    }
+}
+
+FILE* CompressionThread::stream() const {
+    return stream_;
+}
+
+void CompressionThread::check_error() const {
+    if (failed_.load(std::memory_order_acquire)) {
+        throw pcap_error(error_);
+    }
+}
+
+void CompressionThread::finish() {
+    if (thread_.joinable()) {
+        thread_.join();
+    }
+    check_error();
+}
+
+void CompressionThread::run(FILE* output) {
+    bool success = false;
+    switch (format_) {
+        #ifdef TINS_HAVE_ZLIB
+        case GZIP_COMPRESSION:
+            success = gzip_compress(read_fd_, output, level_);
+            break;
+        #endif // TINS_HAVE_ZLIB
+        #ifdef TINS_HAVE_ZSTD
+        case ZSTD_COMPRESSION:
+            success = zstd_compress(read_fd_, output, level_);
+            break;
+        #endif // TINS_HAVE_ZSTD
+        default:
+            break;
+    }
+    if (!success) {
+        set_error(string("Failed to write compressed file: ") + strerror(errno));
+    }
+    // If compression failed, keep draining the stream so writers don't 
+    // get a SIGPIPE
+    uint8_t buffer[4096];
+    while (receive(read_fd_, buffer, sizeof(buffer)) > 0) {
+
+    }
+    // Buffered data is written here, so this can fail as well
+    if (fclose(output) != 0 && success) {
+        set_error(string("Failed to write compressed file: ") + strerror(errno));
+    }
+    close(read_fd_);
+}
+
+void CompressionThread::set_error(const string& error) {
+    error_ = error;
+    failed_.store(true, std::memory_order_release);
+}
+
+} // Internals
+} // Tins
+
+#endif // TINS_HAVE_COMPRESSION
@@ -44,6 +44,7 @@
 #include <tins/loopback.h>
 #include <tins/sll.h>
 #include <tins/ppi.h>
+#include <tins/pktap.h>
 #include <tins/icmpv6.h>
 #include <tins/mpls.h>
 #include <tins/arp.h>
@@ -52,14 +53,179 @@
 #include <tins/dot1q.h>
 #include <tins/pppoe.h>
 #include <tins/pdu_allocator.h>
+#include <tins/lazy_decoding.h>
+#include <tins/packet_view.h>
+#include <tins/exceptions.h>
+#include <tins/utils/checksum_utils.h>
+#include <tins/endianness.h>
+#include <tins/memory_helpers.h>
+#include <atomic>
+#include <cstring>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+using std::vector;
+using std::shared_ptr;
 
 namespace Tins {
 namespace Internals {
 
-Tins::PDU* pdu_from_flag(Constants::Ethernet::e flag,
-                         const uint8_t* buffer,
-                         uint32_t size,
-                         bool rawpdu_on_no_match) {
+/**
+ * Placeholder for a PDU whose decoding has been deferred.
+ *
+ * This keeps the type of the PDU to be decoded along with its contents.
+ * The contents are stored in a buffer which is shared by every placeholder
+ * created while decoding the same packet, so the packet is only copied once.
+ *
+ * Const accessors can't replace the placeholder in its chain, so the PDU
+ * they decode is kept here until the non const ones take it.
+ */
+class LazyPDU : public PDU {
+public:
+    enum Kind {
+        ETHER_TYPE,
+        IP_PROTOCOL,
+        RAW_PAYLOAD
+    };
+
+    typedef shared_ptr<const vector<uint8_t> > storage_type;
+
+    LazyPDU(Kind kind, uint32_t flag, const storage_type& storage, 
+            uint32_t offset, uint32_t size)
+    : storage_(storage), offset_(offset), size_(size), flag_(flag), kind_(kind),
+      decoded_(0), decoded_valid_(true) {
+        lazy_placeholder_ = true;
+    }
+
+    LazyPDU(const LazyPDU& rhs)
+    : PDU(rhs), storage_(rhs.storage_), offset_(rhs.offset_), size_(rhs.size_),
+      flag_(rhs.flag_), kind_(rhs.kind_), decoded_(0), decoded_valid_(true) {
+        lazy_placeholder_ = true;
+    }
+
+    ~LazyPDU() {
+        delete decoded_.load(std::memory_order_relaxed);
+    }
+
+    uint32_t header_size() const {
+        return size_;
+    }
+
+    LazyPDU* clone() const {
+        return new LazyPDU(*this);
+    }
+
+    PDUType pdu_type() const {
+        return PDU::UNKNOWN;
+    }
+
+    const uint8_t* data() const {
+        return &(*storage_)[0] + offset_;
+    }
+
+    uint32_t size() const {
+        return size_;
+    }
+
+    uint32_t flag() const {
+        return flag_;
+    }
+
+    Kind kind() const {
+        return kind_;
+    }
+
+    const storage_type& storage() const {
+        return storage_;
+    }
+
+    PDU* shared_decoding(PDU* parent) const;
+    PDU* release_decoding(bool& is_valid);
+private:
+    void write_serialization(uint8_t* buffer, uint32_t /*total_sz*/) {
+        std::memcpy(buffer, data(), size_);
+    }
+
+    storage_type storage_;
+    uint32_t offset_;
+    uint32_t size_;
+    uint32_t flag_;
+    Kind kind_;
+    mutable std::atomic<PDU*> decoded_;
+    mutable bool decoded_valid_;
+};
+
+// The storage being decoded in this thread, if any
+thread_local const LazyPDU::storage_type* current_lazy_storage = 0;
+
+class LazyStorageScope {
+public:
+    LazyStorageScope(const LazyPDU::storage_type* storage)
+    : previous_(current_lazy_storage) {
+        current_lazy_storage = storage;
+    }
+
+    ~LazyStorageScope() {
+        current_lazy_storage = previous_;
+    }
+private:
+    const LazyPDU::storage_type* previous_;
+};
+
+PDU* make_lazy_pdu(LazyPDU::Kind kind, uint32_t flag, const uint8_t* buffer, uint32_t size) {
+    // If this buffer is part of the one being decoded, share it
+    if (current_lazy_storage) {
+        const LazyPDU::storage_type& storage = *current_lazy_storage;
+        const uintptr_t begin = reinterpret_cast<uintptr_t>(&(*storage)[0]);
+        const uintptr_t ptr = reinterpret_cast<uintptr_t>(buffer);
+        if (ptr >= begin && ptr + size <= begin + storage->size()) {
+            return new LazyPDU(kind, flag, storage, static_cast<uint32_t>(ptr - begin), size);
+        }
+    }
+    LazyPDU::storage_type storage = std::make_shared<const vector<uint8_t> >(buffer, buffer + size);
+    return new LazyPDU(kind, flag, storage, 0, size);
+}
+
+PDU* lazy_pdu_from_flag(Constants::Ethernet::e flag, const uint8_t* buffer, uint32_t size) {
+    switch (flag) {
+        case Constants::Ethernet::IP:
+        case Constants::Ethernet::IPV6:
+        case Constants::Ethernet::ARP:
+        case Constants::Ethernet::PPPOED:
+        case Constants::Ethernet::PPPOES:
+        case Constants::Ethernet::VLAN:
+        case Constants::Ethernet::QINQ:
+        case Constants::Ethernet::OLD_QINQ:
+        case Constants::Ethernet::MPLS:
+            return make_lazy_pdu(LazyPDU::ETHER_TYPE, flag, buffer, size);
+        default:
+            // EAPOL can fail to produce a PDU, and user defined PDUs 
+            // are looked up in the allocators, so decode these right away
+            return 0;
+    }
+}
+
+PDU* lazy_pdu_from_flag(Constants::IP::e flag, const uint8_t* buffer, uint32_t size) {
+    switch (flag) {
+        case Constants::IP::PROTO_IPIP:
+        case Constants::IP::PROTO_TCP:
+        case Constants::IP::PROTO_UDP:
+        case Constants::IP::PROTO_ICMP:
+        case Constants::IP::PROTO_ICMPV6:
+        case Constants::IP::PROTO_IPV6:
+        case Constants::IP::PROTO_AH:
+        case Constants::IP::PROTO_ESP:
+            return make_lazy_pdu(LazyPDU::IP_PROTOCOL, flag, buffer, size);
+        default:
+            return 0;
+    }
+}
+
+Tins::PDU* eager_pdu_from_flag(Constants::Ethernet::e flag,
+                               const uint8_t* buffer,
+                               uint32_t size,
+                               bool rawpdu_on_no_match) {
     switch (flag) {
         case Constants::Ethernet::IP:
             return new IP(buffer, size);
@@ -94,10 +260,10 @@ Tins::PDU* pdu_from_flag(Constants::Ethernet::e flag,
     return rawpdu_on_no_match ? new RawPDU(buffer, size) : 0;
 }
 
-Tins::PDU* pdu_from_flag(Constants::IP::e flag,
-                         const uint8_t* buffer,
-                         uint32_t size,
-                         bool rawpdu_on_no_match) {
+Tins::PDU* eager_pdu_from_flag(Constants::IP::e flag,
+                               const uint8_t* buffer,
+                               uint32_t size,
+                               bool rawpdu_on_no_match) {
     switch (flag) {
         case Constants::IP::PROTO_IPIP:
             return new Tins::IP(buffer, size);
@@ -122,6 +288,289 @@ Tins::PDU* pdu_from_flag(Constants::IP::e flag,
     return rawpdu_on_no_match ? new Tins::RawPDU(buffer, size) : 0;
 }
 
+Tins::PDU* pdu_from_flag(Constants::Ethernet::e flag,
+                         const uint8_t* buffer,
+                         uint32_t size,
+                         bool rawpdu_on_no_match) {
+    if (TINS_UNLIKELY(LazyDecodingGuard::is_enabled())) {
+        if (PDU* pdu = lazy_pdu_from_flag(flag, buffer, size)) {
+            return pdu;
+        }
+    }
+    return eager_pdu_from_flag(flag, buffer, size, rawpdu_on_no_match);
+}
+
+Tins::PDU* pdu_from_flag(Constants::IP::e flag,
+                         const uint8_t* buffer,
+                         uint32_t size,
+                         bool rawpdu_on_no_match) {
+    if (TINS_UNLIKELY(LazyDecodingGuard::is_enabled())) {
+        if (PDU* pdu = lazy_pdu_from_flag(flag, buffer, size)) {
+            return pdu;
+        }
+    }
+    return eager_pdu_from_flag(flag, buffer, size, rawpdu_on_no_match);
+}
+
+PDU* raw_pdu_from_buffer(const uint8_t* buffer, uint32_t size) {
+    if (TINS_UNLIKELY(LazyDecodingGuard::is_enabled())) {
+        return make_lazy_pdu(LazyPDU::RAW_PAYLOAD, 0, buffer, size);
+    }
+    return new RawPDU(buffer, size);
+}
+
+namespace {
+
+PDU* decode_lazy_layer(const LazyPDU& lazy_pdu) {
+    // Decode the next layer lazily as well, sharing the same storage
+    LazyDecodingGuard guard(true);
+    LazyStorageScope storage_scope(&lazy_pdu.storage());
+    switch (lazy_pdu.kind()) {
+        case LazyPDU::ETHER_TYPE:
+            return eager_pdu_from_flag(
+                static_cast<Constants::Ethernet::e>(lazy_pdu.flag()),
+                lazy_pdu.data(),
+                lazy_pdu.size(),
+                true
+            );
+        case LazyPDU::IP_PROTOCOL:
+            return eager_pdu_from_flag(
+                static_cast<Constants::IP::e>(lazy_pdu.flag()),
+                lazy_pdu.data(),
+                lazy_pdu.size(),
+                true
+            );
+        default:
+            return new RawPDU(lazy_pdu.data(), lazy_pdu.size());
+    }
+}
+
+// Serializes decoding done through const accessors
+std::mutex shared_decoding_mutex;
+
+} // anonymous namespace
+
+PDU* LazyPDU::shared_decoding(PDU* parent) const {
+    PDU* decoded = decoded_.load(std::memory_order_acquire);
+    if (!decoded) {
+        std::lock_guard<std::mutex> lock(shared_decoding_mutex);
+        decoded = decoded_.load(std::memory_order_relaxed);
+        if (!decoded) {
+            decoded = decode_lazy_pdu(*this, decoded_valid_);
+            decoded->parent_pdu(parent);
+            decoded_.store(decoded, std::memory_order_release);
+        }
+    }
+    return decoded;
+}
+
+PDU* LazyPDU::release_decoding(bool& is_valid) {
+    PDU* decoded = decoded_.exchange(0, std::memory_order_relaxed);
+    is_valid = decoded_valid_;
+    return decoded;
+}
+
+PDU* decode_lazy_pdu(const PDU& pdu, bool& is_valid) {
+    const LazyPDU& lazy_pdu = static_cast<const LazyPDU&>(pdu);
+    is_valid = true;
+    try {
+        return decode_lazy_layer(lazy_pdu);
+    }
+    catch (malformed_packet&) {
+        // Keep the chain usable by storing the contents as a RawPDU
+        is_valid = false;
+        return new RawPDU(lazy_pdu.data(), lazy_pdu.size());
+    }
+}
+
+PDU* shared_decoded_lazy_pdu(const PDU& pdu, PDU* parent) {
+    return static_cast<const LazyPDU&>(pdu).shared_decoding(parent);
+}
+
+PDU* release_decoded_lazy_pdu(PDU& pdu, bool& is_valid) {
+    return static_cast<LazyPDU&>(pdu).release_decoding(is_valid);
+}
+
+// The buffer used to serialize packets in this thread, and whether it's taken
+thread_local PDU::serialization_type scratch_buffer;
+thread_local bool scratch_buffer_in_use = false;
+
+ScratchSerialization::ScratchSerialization(PDU& pdu)
+: buffer_(&own_buffer_), uses_scratch_(!scratch_buffer_in_use) {
+    if (uses_scratch_) {
+        buffer_ = &scratch_buffer;
+        scratch_buffer_in_use = true;
+    }
+    try {
+        pdu.serialize_into(*buffer_);
+    }
+    catch (...) {
+        if (uses_scratch_) {
+            scratch_buffer_in_use = false;
+        }
+        throw;
+    }
+}
+
+ScratchSerialization::~ScratchSerialization() {
+    if (uses_scratch_) {
+        scratch_buffer_in_use = false;
+    }
+}
+
+// Payloads smaller than this are cheaper to copy than to send separately
+const uint32_t min_gather_payload_size = 128;
+
+uint16_t sum_bytes(const uint8_t* data, uint32_t size) {
+    return Endian::be_to_host(Utils::sum_range(data, data + size));
+}
+
+uint16_t update_checksum(uint16_t checksum, uint16_t old_sum, uint16_t new_sum, 
+                         bool is_udp) {
+    if (is_udp && checksum == 0) {
+        return 0;
+    }
+    checksum = Utils::update_checksum(checksum, old_sum, new_sum);
+    // 0 is reserved for UDP datagrams without a checksum
+    if (is_udp && checksum == 0) {
+        checksum = 0xffff;
+    }
+    return checksum;
+}
+
+void patch_checksum(uint8_t* checksum, uint16_t old_sum, uint16_t new_sum, 
+                    bool is_udp) {
+    const uint16_t value = Memory::read_be_value<uint16_t>(checksum);
+    Memory::write_be_value(checksum, update_checksum(value, old_sum, new_sum, is_udp));
+}
+
+// Adds to a 16 bit field, updating the checksum that covers it, if any
+static void add_to_field(uint8_t* field, uint16_t added, uint8_t* checksum) {
+    const uint16_t old_value = Memory::read_be_value<uint16_t>(field);
+    const uint16_t new_value = old_value + added;
+    Memory::write_be_value(field, new_value);
+    if (checksum) {
+        patch_checksum(checksum, old_value, new_value, false);
+    }
+}
+
+// Whether the headers up to this TCP or UDP PDU can be located and fixed 
+// after being serialized
+static bool is_splittable(const PDU& pdu, const PDU& transport) {
+    if (transport.pdu_type() != PDU::TCP && transport.pdu_type() != PDU::UDP) {
+        return false;
+    }
+    const PDU* network = transport.parent_pdu();
+    if (!network) {
+        return false;
+    }
+    if (network->pdu_type() == PDU::IP) {
+        const IP* ip = static_cast<const IP*>(network);
+        if (ip->fragment_offset() != 0 || (ip->flags() & IP::MORE_FRAGMENTS) != 0) {
+            return false;
+        }
+    }
+    else if (network->pdu_type() != PDU::IPv6) {
+        return false;
+    }
+    // Only link layers that PacketView can parse are allowed
+    for (const PDU* ptr = network->parent_pdu(); ptr; ptr = ptr->parent_pdu()) {
+        if (ptr->pdu_type() != PDU::ETHERNET_II && ptr->pdu_type() != PDU::DOT1Q) {
+            return false;
+        }
+    }
+    return pdu.pdu_type() == PDU::ETHERNET_II || pdu.pdu_type() == PDU::IP ||
+           pdu.pdu_type() == PDU::IPv6;
+}
+
+PayloadSplitter::PayloadSplitter(PDU& pdu, const uint8_t* payload, 
+                                 uint32_t payload_size, bool gather)
+: parent_(), detached_(), attached_(), payload_(payload), payload_size_(payload_size),
+  is_split_(false) {
+    PDU* last = &pdu;
+    while (last->inner_pdu()) {
+        last = last->inner_pdu();
+    }
+    if (!payload) {
+        RawPDU* raw = tins_cast<RawPDU*>(last);
+        if (gather && raw && last->parent_pdu()) {
+            payload_ = raw->payload().empty() ? 0 : &raw->payload()[0];
+            payload_size_ = raw->payload_size();
+            parent_ = last->parent_pdu();
+        }
+    }
+    else {
+        parent_ = last;
+    }
+    if (!parent_) {
+        return;
+    }
+    const uint32_t headers_size = pdu.size() - (payload ? 0 : payload_size_);
+    is_split_ = gather && payload_size_ >= min_gather_payload_size && 
+                headers_size + payload_size_ <= 0xffff &&
+                is_splittable(pdu, *parent_);
+    if (is_split_ && !payload) {
+        detached_ = parent_->release_inner_pdu();
+    }
+    else if (!is_split_ && payload) {
+        attached_ = new RawPDU(payload, payload_size);
+        parent_->inner_pdu(attached_);
+    }
+}
+
+PayloadSplitter::~PayloadSplitter() {
+    if (detached_) {
+        parent_->inner_pdu(detached_);
+    }
+    else if (attached_) {
+        parent_->inner_pdu(static_cast<PDU*>(0));
+    }
+}
+
+GatherSerialization::GatherSerialization(PDU& pdu, const uint8_t* payload, 
+                                         uint32_t payload_size, bool gather)
+: splitter_(pdu, payload, payload_size, gather), headers_(pdu), 
+  headers_size_(headers_.size()) {
+    if (splitter_.is_split()) {
+        account_for_payload(pdu.pdu_type());
+    }
+}
+
+void GatherSerialization::account_for_payload(PDU::PDUType link_type) {
+    uint8_t* data = headers_.data();
+    const PacketView view(data, headers_.size(), link_type);
+    if (!view.has_tcp() && !view.has_udp()) {
+        throw serialization_error();
+    }
+    const uint16_t added = static_cast<uint16_t>(splitter_.payload_size());
+    uint8_t* network = data + view.network_offset();
+    uint8_t* transport = data + view.transport_offset();
+    // This leaves out any link layer padding added to the headers
+    headers_size_ = static_cast<uint32_t>(view.payload() - data);
+    if (view.has_ip()) {
+        add_to_field(network + 2, added, network + 10);
+    }
+    else {
+        add_to_field(network + 4, added, 0);
+    }
+
+    // The checksum covers the pseudo header's length and the payload itself.
+    // Payloads always start at an even offset within the segment
+    const bool is_udp = view.has_udp();
+    const uint8_t* payload = splitter_.payload();
+    uint32_t added_sum = added + sum_bytes(payload, splitter_.payload_size());
+    if (is_udp) {
+        // UDP's own length field is covered as well
+        add_to_field(transport + 4, added, 0);
+        added_sum += added;
+    }
+    while (added_sum >> 16) {
+        added_sum = (added_sum & 0xffff) + (added_sum >> 16);
+    }
+    patch_checksum(transport + (is_udp ? 6 : 16), 0, static_cast<uint16_t>(added_sum), 
+                   is_udp);
+}
+
 #ifdef TINS_HAVE_PCAP
 PDU* pdu_from_dlt_flag(int flag,
                        const uint8_t* buffer,
@@ -152,8 +601,122 @@ PDU* pdu_from_dlt_flag(int flag,
             return rawpdu_on_no_match ? new RawPDU(buffer, size) : 0;
     };
 }
+
+bool dlt_to_link_type(int dlt, uint32_t& link_type) {
+    // These are the DLT_ values that differ between platforms
+    switch (dlt) {
+        case DLT_RAW:
+            link_type = LINKTYPE_RAW;
+            return true;
+        #ifdef DLT_LOOP
+        case DLT_LOOP:
+            link_type = LINKTYPE_LOOP;
+            return true;
+        #endif // DLT_LOOP
+        #ifdef DLT_PKTAP
+        case DLT_PKTAP:
+            link_type = LINKTYPE_PKTAP;
+            return true;
+        #endif // DLT_PKTAP
+        default:
+            break;
+    }
+    // Values up to DLT_FDDI (10) are the same everywhere, as are the ones 
+    // starting at 104, which were assigned once libpcap started doing so
+    if ((dlt >= 0 && dlt <= 10) || dlt >= 104) {
+        link_type = static_cast<uint32_t>(dlt);
+        return true;
+    }
+    return false;
+}
 #endif // TINS_HAVE_PCAP
 
+namespace {
+
+template<typename T>
+PDU* safe_alloc(const uint8_t* buffer, uint32_t size) {
+    try {
+        return new T(buffer, size);
+    }
+    catch (malformed_packet&) {
+        return 0;
+    }
+}
+
+PDU* decode_eth_frame(const uint8_t* buffer, uint32_t size) {
+    if (is_dot3(buffer, size)) {
+        return safe_alloc<Dot3>(buffer, size);
+    }
+    else {
+        return safe_alloc<EthernetII>(buffer, size);
+    }
+}
+
+PDU* decode_ip_frame(const uint8_t* buffer, uint32_t size) {
+    if (size == 0) {
+        return 0;
+    }
+    switch (buffer[0] >> 4) {
+        case 4:
+            return safe_alloc<IP>(buffer, size);
+        case 6:
+            return safe_alloc<IPv6>(buffer, size);
+        default:
+            return 0;
+    };
+}
+
+#ifdef TINS_HAVE_DOT11
+PDU* decode_dot11_frame(const uint8_t* buffer, uint32_t size) {
+    try {
+        return Dot11::from_bytes(buffer, size);
+    }
+    catch (malformed_packet&) {
+        return 0;
+    }
+}
+#endif // TINS_HAVE_DOT11
+
+} // anonymous namespace
+
+frame_decoder frame_decoder_from_link_type(uint32_t link_type) {
+    switch (link_type) {
+        case LINKTYPE_ETHERNET:
+            return &decode_eth_frame;
+        case LINKTYPE_RAW:
+            return &decode_ip_frame;
+        case LINKTYPE_NULL:
+        case LINKTYPE_LOOP:
+            return &safe_alloc<Loopback>;
+        case LINKTYPE_LINUX_SLL:
+            return &safe_alloc<SLL>;
+        #ifdef TINS_HAVE_PCAP
+        case LINKTYPE_PPI:
+            return &safe_alloc<PPI>;
+        case LINKTYPE_PKTAP:
+            return &safe_alloc<PKTAP>;
+        #endif // TINS_HAVE_PCAP
+
+        #ifdef TINS_HAVE_DOT11
+        case LINKTYPE_IEEE802_11_RADIOTAP:
+            return &safe_alloc<RadioTap>;
+        case LINKTYPE_IEEE802_11:
+            return &decode_dot11_frame;
+        #else // TINS_HAVE_DOT11
+        case LINKTYPE_IEEE802_11_RADIOTAP:
+        case LINKTYPE_IEEE802_11:
+            throw protocol_disabled();
+        #endif // TINS_HAVE_DOT11
+
+        default:
+            return 0;
+    }
+}
+
+PDU* decode_raw_frame(const uint8_t* buffer, uint32_t size) {
+    return safe_alloc<RawPDU>(buffer, size);
+}
+
 Tins::PDU* pdu_from_flag(PDU::PDUType type, const uint8_t* buffer, uint32_t size) {
     switch(type) {
         case Tins::PDU::ETHERNET_II:
@@ -230,8 +230,7 @@ Dot11* Dot11::from_bytes(const uint8_t* buffer, uint32_t total_sz) {
     
     // This should be sizeof(dot11_header::control), but gcc 4.2 complains
     if (total_sz < 2) {
-        malformed(true);
-        return;
+        throw malformed_packet();
     }
     const dot11_header* hdr = (const dot11_header*)buffer;
     if (hdr->control.type == MANAGEMENT) {
@@ -0,0 +1,106 @@
+/*
+ * Copyright (c) 2017, Matias Fontanini
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are
+ * met:
+ * 
+ * * Redistributions of source code must retain the above copyright
+ *   notice, this list of conditions and the following disclaimer.
+ * * Redistributions in binary form must reproduce the above
+ *   copyright notice, this list of conditions and the following disclaimer
+ *   in the documentation and/or other materials provided with the
+ *   distribution.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+
+#include <tins/fanout_sniffer.h>
+
+#if defined(TINS_HAVE_PACKET_RING) && TINS_IS_CXX11
+
+using std::string;
+
+namespace Tins {
+
+FanoutSniffer::FanoutSniffer(const string& device, size_t worker_count,
+                             FanoutMode mode,
+                             const RingSnifferConfiguration& configuration)
+: group_id_(0) {
+    if (worker_count == 0) {
+        throw std::runtime_error("At least one worker is required");
+    }
+    RingSnifferConfiguration worker_configuration = configuration;
+    if (configuration.has_fanout() && !configuration.unique_fanout()) {
+        worker_configuration.set_fanout(configuration.fanout_group_id(), mode);
+    }
+    else {
+        worker_configuration.set_unique_fanout(mode);
+    }
+    sniffers_.reserve(worker_count);
+    sniffers_.emplace_back(device, worker_configuration);
+    // The rest of the workers join the group the first one ended up in
+    group_id_ = sniffers_[0].fanout_group_id();
+    worker_configuration.set_fanout(group_id_, mode);
+    for (size_t i = 1; i < worker_count; ++i) {
+        sniffers_.emplace_back(device, worker_configuration);
+    }
+}
+
+void FanoutSniffer::stop_sniff() {
+    for (size_t i = 0; i < sniffers_.size(); ++i) {
+        sniffers_[i].stop_sniff();
+    }
+}
+
+RingSniffer::statistics FanoutSniffer::stats() {
+    RingSniffer::statistics output;
+    for (size_t i = 0; i < sniffers_.size(); ++i) {
+        const RingSniffer::statistics worker_stats = sniffers_[i].stats();
+        output.packets += worker_stats.packets;
+        output.drops += worker_stats.drops;
+        output.freeze_count += worker_stats.freeze_count;
+    }
+    return output;
+}
+
+void FanoutSniffer::set_extract_raw_pdus(bool value) {
+    for (size_t i = 0; i < sniffers_.size(); ++i) {
+        sniffers_[i].set_extract_raw_pdus(value);
+    }
+}
+
+void FanoutSniffer::set_lazy_decoding(bool value) {
+    for (size_t i = 0; i < sniffers_.size(); ++i) {
+        sniffers_[i].set_lazy_decoding(value);
+    }
+}
+
+size_t FanoutSniffer::worker_count() const {
+    return sniffers_.size();
+}
+
+uint16_t FanoutSniffer::group_id() const {
+    return group_id_;
+}
+
+RingSniffer& FanoutSniffer::sniffer(size_t index) {
+    return sniffers_.at(index);
+}
+
+} // Tins
+
+#endif // TINS_HAVE_PACKET_RING && TINS_IS_CXX11
@@ -140,26 +140,23 @@ IP::IP(const uint8_t* buffer, uint32_t total_sz) :
 
         // Don't try to decode it if it's fragmented
         if (!is_fragmented()) {
-            inner_pdu(
-                Internals::pdu_from_flag(
-                    static_cast<Constants::IP::e>(header_.protocol),
-                    stream.pointer(), 
-                    total_sz,
-                    false
-                )
+            PDU* next_pdu = Internals::pdu_from_flag(
+                static_cast<Constants::IP::e>(header_.protocol),
+                stream.pointer(), 
+                total_sz,
+                false
             );
-            if (!inner_pdu()) {
-                inner_pdu(
-                    Internals::allocate<IP>(
-                        header_.protocol,
-                        stream.pointer(), 
-                        total_sz
-                    )
+            if (!next_pdu) {
+                next_pdu = Internals::allocate<IP>(
+                    header_.protocol,
+                    stream.pointer(), 
+                    total_sz
                 );
-                if (!inner_pdu()) {
-                    inner_pdu(new RawPDU(stream.pointer(), total_sz));
+                if (!next_pdu) {
+                    next_pdu = new RawPDU(stream.pointer(), total_sz);
                 }
             }
+            inner_pdu(next_pdu);
         }
         else {
             // It's fragmented, just use RawPDU
@@ -499,7 +496,8 @@ uint16_t IP::calculate_checksum(const uint8_t* buffer,
                                 const uint32_t total_sz,
                                 const uint16_t old_checksum) const {
     uint32_t check = Utils::sum_range(buffer, buffer + total_sz);
-    check -= old_checksum;
+    // One's complement subtraction, so it holds even if the sum wrapped around
+    check += static_cast<uint16_t>(~old_checksum);
     return Endian::host_to_be<uint16_t>(~Utils::fold_sum(check));
 }
 
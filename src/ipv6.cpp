@@ -177,26 +177,23 @@ IPv6::IPv6(const uint8_t* buffer, uint32_t total_sz) {
                 inner_pdu(new Tins::RawPDU(stream.pointer(), actual_payload_length));
             }
             else {
-                inner_pdu(
-                    Internals::pdu_from_flag(
-                        static_cast<Constants::IP::e>(current_header),
-                        stream.pointer(), 
-                        actual_payload_length,
-                        false
-                    )
+                PDU* next_pdu = Internals::pdu_from_flag(
+                    static_cast<Constants::IP::e>(current_header),
+                    stream.pointer(), 
+                    actual_payload_length,
+                    false
                 );
-                if (!inner_pdu()) {
-                    inner_pdu(
-                        Internals::allocate<IPv6>(
-                            current_header,
-                            stream.pointer(), 
-                            actual_payload_length
-                        )
+                if (!next_pdu) {
+                    next_pdu = Internals::allocate<IPv6>(
+                        current_header,
+                        stream.pointer(), 
+                        actual_payload_length
                     );
-                    if (!inner_pdu()) {
-                        inner_pdu(new Tins::RawPDU(stream.pointer(), actual_payload_length));
+                    if (!next_pdu) {
+                        next_pdu = new Tins::RawPDU(stream.pointer(), actual_payload_length);
                     }
                 }
+                inner_pdu(next_pdu);
             }
             // We got to an actual PDU, we're done
             break;
@@ -0,0 +1,328 @@
+/*
+ * Copyright (c) 2017, Matias Fontanini
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are
+ * met:
+ * 
+ * * Redistributions of source code must retain the above copyright
+ *   notice, this list of conditions and the following disclaimer.
+ * * Redistributions in binary form must reproduce the above
+ *   copyright notice, this list of conditions and the following disclaimer
+ *   in the documentation and/or other materials provided with the
+ *   distribution.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+
+#include <tins/mapped_pcap_reader.h>
+
+#ifndef _WIN32
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <cstring>
+#include <algorithm>
+#include <tins/rawpdu.h>
+#include <tins/lazy_decoding.h>
+#include <tins/endianness.h>
+#include <tins/detail/pdu_helpers.h>
+
+using std::string;
+
+namespace Tins {
+
+namespace {
+
+const uint32_t MICROSECOND_MAGIC = 0xa1b2c3d4;
+const uint32_t NANOSECOND_MAGIC = 0xa1b23c4d;
+const uint32_t FILE_HEADER_SIZE = 24;
+const uint32_t RECORD_HEADER_SIZE = 16;
+// The largest packet size we'll consider valid when looking for records
+const uint32_t MAX_WIRE_SIZE = 262144;
+// The amount of consecutive valid headers required to consider an offset
+// to be the beginning of a record
+const unsigned SYNC_HEADER_COUNT = 8;
+// The largest time difference, in seconds, between consecutive records 
+// we'll consider valid when looking for records
+const uint32_t MAX_SYNC_TIME_GAP = 86400;
+
+uint32_t read_uint32(const uint8_t* ptr) {
+    uint32_t value;
+    std::memcpy(&value, ptr, sizeof(value));
+    return value;
+}
+
+} // anonymous namespace
+
+Timestamp MappedPcapReader::record::timestamp() const {
+    timeval tv;
+    tv.tv_sec = seconds;
+    tv.tv_usec = nanoseconds / 1000;
+    return tv;
+}
+
+MappedPcapReader::MappedPcapReader(const string& file_name, bool prefetch)
+: data_(0), size_(0), offset_(FILE_HEADER_SIZE), link_type_(0), snap_len_(0),
+  swapped_(false), nanoseconds_(false), extract_raw_(false), lazy_decoding_(false) {
+    const int fd = ::open(file_name.c_str(), O_RDONLY);
+    if (fd < 0) {
+        throw capture_file_error(strerror(errno));
+    }
+    struct stat file_stat;
+    if (fstat(fd, &file_stat) < 0) {
+        const string error = strerror(errno);
+        ::close(fd);
+        throw capture_file_error(error);
+    }
+    if (file_stat.st_size < static_cast<off_t>(FILE_HEADER_SIZE)) {
+        ::close(fd);
+        throw capture_file_error("File is too short to be a pcap file");
+    }
+    size_ = file_stat.st_size;
+    void* data = mmap(0, size_, PROT_READ, MAP_PRIVATE, fd, 0);
+    // The mapping keeps its own reference to the file
+    ::close(fd);
+    if (data == MAP_FAILED) {
+        throw capture_file_error(strerror(errno));
+    }
+    data_ = static_cast<const uint8_t*>(data);
+    if (prefetch) {
+        // The advice values aren't flags, so each one needs its own call
+        madvise(data, size_, MADV_SEQUENTIAL);
+        madvise(data, size_, MADV_WILLNEED);
+    }
+
+    const uint32_t magic = read_uint32(data_);
+    if (magic == MICROSECOND_MAGIC || magic == NANOSECOND_MAGIC) {
+        nanoseconds_ = magic == NANOSECOND_MAGIC;
+    }
+    else if (magic == Endian::change_endian(MICROSECOND_MAGIC) || 
+             magic == Endian::change_endian(NANOSECOND_MAGIC)) {
+        swapped_ = true;
+        nanoseconds_ = magic == Endian::change_endian(NANOSECOND_MAGIC);
+    }
+    else {
+        munmap(data, size_);
+        throw capture_file_error("Invalid pcap file magic number");
+    }
+    snap_len_ = read_field(data_ + 16);
+    link_type_ = read_field(data_ + 20);
+}
+
+MappedPcapReader::~MappedPcapReader() {
+    munmap(const_cast<uint8_t*>(data_), size_);
+}
+
+uint32_t MappedPcapReader::read_field(const uint8_t* ptr) const {
+    const uint32_t value = read_uint32(ptr);
+    return swapped_ ? Endian::change_endian(value) : value;
+}
+
+uint64_t MappedPcapReader::record_at(uint64_t offset, record& output) const {
+    const uint64_t next_offset = try_record_at(offset, output);
+    if (next_offset == 0 && offset != size_) {
+        throw capture_file_error("Truncated or invalid record");
+    }
+    return next_offset;
+}
+
+uint64_t MappedPcapReader::try_record_at(uint64_t offset, record& output) const {
+    if (offset + RECORD_HEADER_SIZE > size_) {
+        return 0;
+    }
+    const uint8_t* header = data_ + offset;
+    const uint32_t captured_size = read_field(header + 8);
+    const uint64_t next_offset = offset + RECORD_HEADER_SIZE + captured_size;
+    // libpcap rejects records larger than both the snapshot length and
+    // the largest snapshot length it supports
+    if (captured_size > std::max(snap_len_, MAX_WIRE_SIZE) || next_offset > size_) {
+        return 0;
+    }
+    output.data = header + RECORD_HEADER_SIZE;
+    output.size = captured_size;
+    output.wire_size = read_field(header + 12);
+    output.seconds = read_field(header);
+    output.nanoseconds = read_field(header + 4);
+    if (!nanoseconds_) {
+        output.nanoseconds *= 1000;
+    }
+    output.offset = offset;
+    return next_offset;
+}
+
+bool MappedPcapReader::is_valid_header(uint64_t offset, uint64_t& next_offset) const {
+    if (offset + RECORD_HEADER_SIZE > size_) {
+        return false;
+    }
+    const uint8_t* header = data_ + offset;
+    const uint32_t fraction = read_field(header + 4);
+    const uint32_t captured_size = read_field(header + 8);
+    const uint32_t wire_size = read_field(header + 12);
+    // Empty records are valid, but they're too easy to find within packets
+    if (fraction >= (nanoseconds_ ? 1000000000U : 1000000U) || captured_size == 0 ||
+        captured_size > snap_len_ || captured_size > wire_size ||
+        wire_size > MAX_WIRE_SIZE) {
+        return false;
+    }
+    next_offset = offset + RECORD_HEADER_SIZE + captured_size;
+    return next_offset <= size_;
+}
+
+uint64_t MappedPcapReader::find_record(uint64_t offset) const {
+    if (offset <= FILE_HEADER_SIZE) {
+        return FILE_HEADER_SIZE;
+    }
+    for (; offset < size_; ++offset) {
+        uint64_t current = offset;
+        uint32_t previous_seconds = 0;
+        unsigned valid_headers = 0;
+        while (valid_headers < SYNC_HEADER_COUNT && current < size_) {
+            uint64_t next_offset;
+            if (!is_valid_header(current, next_offset)) {
+                break;
+            }
+            // Bytes within a packet rarely look like a timestamp close to
+            // the next record's
+            const uint32_t seconds = read_field(data_ + current);
+            if (valid_headers > 0) {
+                const uint32_t gap = seconds > previous_seconds ? 
+                                     seconds - previous_seconds : 
+                                     previous_seconds - seconds;
+                if (gap > MAX_SYNC_TIME_GAP) {
+                    break;
+                }
+            }
+            previous_seconds = seconds;
+            current = next_offset;
+            valid_headers++;
+        }
+        if (valid_headers == SYNC_HEADER_COUNT || (valid_headers > 0 && current == size_)) {
+            return offset;
+        }
+    }
+    return size_;
+}
+
+PDU* MappedPcapReader::decode(const record& input) const {
+    return packet_decoder()(input.data, input.size);
+}
+
+bool MappedPcapReader::next_record(record& output) {
+    const uint64_t next_offset = record_at(offset_, output);
+    if (next_offset == 0) {
+        return false;
+    }
+    offset_ = next_offset;
+    return true;
+}
+
+PtrPacket MappedPcapReader::next_packet() {
+    LazyDecodingGuard lazy_guard(lazy_decoding_);
+    record current;
+    while (next_record(current)) {
+        if (PDU* pdu = decode(current)) {
+            return PtrPacket(pdu, current.timestamp());
+        }
+    }
+    return PtrPacket(0, Timestamp());
+}
+
+MappedPcapReader::PacketDecoder MappedPcapReader::packet_decoder() const {
+    Internals::frame_decoder decoder = 0;
+    if (!extract_raw_) {
+        decoder = Internals::frame_decoder_from_link_type(link_type_);
+    }
+    return decoder ? decoder : &Internals::decode_raw_frame;
+}
+
+PDU::PDUType MappedPcapReader::view_link_type() const {
+    switch (link_type_) {
+        case Internals::LINKTYPE_ETHERNET:
+            return PDU::ETHERNET_II;
+        case Internals::LINKTYPE_RAW:
+            return PDU::IP;
+        case Internals::LINKTYPE_NULL:
+        case Internals::LINKTYPE_LOOP:
+            return PDU::LOOPBACK;
+        case Internals::LINKTYPE_LINUX_SLL:
+            return PDU::SLL;
+        default:
+            throw unknown_link_type();
+    }
+}
+
+void MappedPcapReader::rewind() {
+    offset_ = FILE_HEADER_SIZE;
+}
+
+void MappedPcapReader::seek(uint64_t offset) {
+    if (offset < FILE_HEADER_SIZE || offset > size_) {
+        throw capture_file_error("Invalid record offset");
+    }
+    offset_ = offset;
+}
+
+uint64_t MappedPcapReader::tell() const {
+    return offset_;
+}
+
+void MappedPcapReader::set_extract_raw_pdus(bool value) {
+    extract_raw_ = value;
+}
+
+void MappedPcapReader::set_lazy_decoding(bool value) {
+    lazy_decoding_ = value;
+}
+
+uint32_t MappedPcapReader::link_type() const {
+    return link_type_;
+}
+
+uint32_t MappedPcapReader::snap_len() const {
+    return snap_len_;
+}
+
+bool MappedPcapReader::nanosecond_resolution() const {
+    return nanoseconds_;
+}
+
+bool MappedPcapReader::is_swapped() const {
+    return swapped_;
+}
+
+uint64_t MappedPcapReader::file_size() const {
+    return size_;
+}
+
+const uint8_t* MappedPcapReader::file_data() const {
+    return data_;
+}
+
+MappedPcapReader::const_iterator MappedPcapReader::begin() const {
+    return const_iterator(this, FILE_HEADER_SIZE);
+}
+
+MappedPcapReader::const_iterator MappedPcapReader::end() const {
+    return const_iterator();
+}
+
+} // Tins
+
+#endif // _WIN32
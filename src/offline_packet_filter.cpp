@@ -31,6 +31,7 @@
 #include <tins/offline_packet_filter.h>
 #include <tins/pdu.h>
 #include <tins/exceptions.h>
+#include <tins/detail/pdu_helpers.h>
 
 using std::string;
 
@@ -61,9 +62,14 @@ void OfflinePacketFilter::init(const string& pcap_filter,
     if (pcap_compile(handle_, &filter_, pcap_filter.c_str(), 1, 0xffffffff) == -1) {
         throw invalid_pcap_filter(pcap_geterr(handle_));
     }
+    // If the program can't be translated, pcap_offline_filter is used instead
+    program_.load(filter_);
 }
 
 bool OfflinePacketFilter::matches_filter(const uint8_t* buffer, uint32_t total_sz) const {
+    if (TINS_LIKELY(program_.is_loaded())) {
+        return program_.run(buffer, total_sz, total_sz) != 0;
+    }
     pcap_pkthdr header;
     memset(&header, 0, sizeof(header));
     header.len = total_sz;
@@ -72,8 +78,28 @@ bool OfflinePacketFilter::matches_filter(const uint8_t* buffer, uint32_t total_s
 }
 
 bool OfflinePacketFilter::matches_filter(PDU& pdu) const {
-    PDU::serialization_type buffer = pdu.serialize();
-    return matches_filter(&buffer[0], static_cast<uint32_t>(buffer.size()));
+    Internals::ScratchSerialization buffer(pdu);
+    return matches_filter(buffer.data(), buffer.size());
+}
+
+size_t OfflinePacketFilter::matches_filter(const uint8_t* const* buffers, 
+                                           const uint32_t* sizes,
+                                           size_t count, 
+                                           bool* results) const {
+    size_t matches = 0;
+    if (TINS_LIKELY(program_.is_loaded())) {
+        for (size_t i = 0; i < count; ++i) {
+            results[i] = program_.run(buffers[i], sizes[i], sizes[i]) != 0;
+            matches += results[i];
+        }
+    }
+    else {
+        for (size_t i = 0; i < count; ++i) {
+            results[i] = matches_filter(buffers[i], sizes[i]);
+            matches += results[i];
+        }
+    }
+    return matches;
 }
 
 } // Tins
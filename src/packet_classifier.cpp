@@ -0,0 +1,1049 @@
+/*
+ * Copyright (c) 2017, Matias Fontanini
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are
+ * met:
+ * 
+ * * Redistributions of source code must retain the above copyright
+ *   notice, this list of conditions and the following disclaimer.
+ * * Redistributions in binary form must reproduce the above
+ *   copyright notice, this list of conditions and the following disclaimer
+ *   in the documentation and/or other materials provided with the
+ *   distribution.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+
+#include <tins/packet_classifier.h>
+
+#if defined(TINS_HAVE_PCAP) && TINS_IS_CXX11
+
+#include <algorithm>
+#include <sstream>
+#include <cstdlib>
+#include <tins/packet_view.h>
+#include <tins/ethernetII.h>
+#include <tins/dot1q.h>
+#include <tins/ip.h>
+#include <tins/ipv6.h>
+#include <tins/tcp.h>
+#include <tins/udp.h>
+#include <tins/constants.h>
+#include <tins/exceptions.h>
+#include <tins/endianness.h>
+#include <tins/detail/pdu_helpers.h>
+
+using std::string;
+using std::vector;
+using std::sort;
+using std::unique;
+using std::upper_bound;
+using std::lower_bound;
+
+namespace Tins {
+namespace Internals {
+
+classifier_ipv6_key::classifier_ipv6_key(const IPv6Address& address)
+: high(0), low(0) {
+    IPv6Address::const_iterator iter = address.begin();
+    for (size_t i = 0; i < 8; ++i, ++iter) {
+        high = (high << 8) | *iter;
+    }
+    for (size_t i = 0; i < 8; ++i, ++iter) {
+        low = (low << 8) | *iter;
+    }
+}
+
+namespace {
+
+// The smallest value of a key, and the one following a key
+uint32_t minimum_key(uint32_t) {
+    return 0;
+}
+
+bool next_key(uint32_t key, uint32_t& next) {
+    if (key == 0xffffffff) {
+        return false;
+    }
+    next = key + 1;
+    return true;
+}
+
+classifier_ipv6_key minimum_key(const classifier_ipv6_key&) {
+    return classifier_ipv6_key();
+}
+
+bool next_key(const classifier_ipv6_key& key, classifier_ipv6_key& next) {
+    next = key;
+    if (++next.low == 0 && ++next.high == 0) {
+        return false;
+    }
+    return true;
+}
+
+// IPv4 keys are the numeric value of the address, so that ranges are contiguous
+uint32_t ipv4_key(const IPv4Address& address) {
+    return Endian::be_to_host<uint32_t>(address);
+}
+
+void set_bit(uint64_t* words, size_t index) {
+    words[index / 64] |= static_cast<uint64_t>(1) << (index % 64);
+}
+
+// Binary searches over fewer intervals are as fast as a direct table
+const size_t MIN_DIRECT_INTERVALS = 8;
+
+// The position of a key within a direct table
+bool direct_position(uint32_t key, size_t& position) {
+    position = key;
+    return true;
+}
+
+bool direct_position(const classifier_ipv6_key&, size_t&) {
+    return false;
+}
+
+} // anonymous namespace
+
+template <typename Key>
+void classifier_index<Key>::build(const vector<classifier_range<Key> >& ranges, 
+                                  size_t words, size_t direct_size) {
+    words_ = words;
+    starts_.clear();
+    direct_.clear();
+    sets_.clear();
+    wildcard_.assign(words, 0);
+    active_ = false;
+    vector<Key> points(1, minimum_key(Key()));
+    Key next;
+    for (size_t i = 0; i < ranges.size(); ++i) {
+        if (!ranges[i].present) {
+            set_bit(&wildcard_[0], i);
+            continue;
+        }
+        active_ = true;
+        points.push_back(ranges[i].first);
+        if (next_key(ranges[i].last, next)) {
+            points.push_back(next);
+        }
+    }
+    if (!active_) {
+        return;
+    }
+    sort(points.begin(), points.end());
+    points.erase(unique(points.begin(), points.end()), points.end());
+    starts_.swap(points);
+
+    // Mark where each rule starts and stops matching, then sweep over 
+    // the intervals keeping track of the rules that currently match
+    const size_t interval_count = starts_.size();
+    vector<uint64_t> added(interval_count * words);
+    vector<uint64_t> removed(interval_count * words);
+    for (size_t i = 0; i < ranges.size(); ++i) {
+        if (!ranges[i].present) {
+            continue;
+        }
+        const size_t start = lower_bound(starts_.begin(), starts_.end(), ranges[i].first) - 
+                             starts_.begin();
+        set_bit(&added[start * words], i);
+        if (next_key(ranges[i].last, next)) {
+            const size_t end = lower_bound(starts_.begin(), starts_.end(), next) - 
+                               starts_.begin();
+            set_bit(&removed[end * words], i);
+        }
+    }
+    sets_.resize(interval_count * words);
+    vector<uint64_t> current(wildcard_);
+    for (size_t i = 0; i < interval_count; ++i) {
+        for (size_t j = 0; j < words; ++j) {
+            current[j] = (current[j] | added[i * words + j]) & ~removed[i * words + j];
+            sets_[i * words + j] = current[j];
+        }
+    }
+
+    if (direct_size > 0 && interval_count > MIN_DIRECT_INTERVALS) {
+        // Map every value to the last interval starting at or before it
+        direct_.resize(direct_size);
+        size_t interval = 0;
+        size_t next_start;
+        for (size_t value = 0; value < direct_size; ++value) {
+            while (interval + 1 < interval_count && 
+                   direct_position(starts_[interval + 1], next_start) &&
+                   next_start <= value) {
+                ++interval;
+            }
+            direct_[value] = static_cast<uint32_t>(interval);
+        }
+    }
+}
+
+template <typename Key>
+const uint64_t* classifier_index<Key>::find(const Key& value) const {
+    size_t position;
+    if (!direct_.empty() && direct_position(value, position) && 
+        position < direct_.size()) {
+        return &sets_[direct_[position] * words_];
+    }
+    // The first start is always the minimum key, so this is never begin()
+    const size_t index = (upper_bound(starts_.begin(), starts_.end(), value) - 
+                          starts_.begin()) - 1;
+    return &sets_[index * words_];
+}
+
+} // Internals
+
+namespace {
+
+typedef Internals::classifier_range<uint32_t> range_type;
+typedef Internals::classifier_range<Internals::classifier_ipv6_key> ipv6_range_type;
+
+// The header fields a pcap filter expression is translated to
+struct filter_terms {
+    filter_terms() 
+    : has_ip(false), has_transport(false), needs_ip(false), needs_transport(false) {
+
+    }
+
+    range_type ether_type;
+    range_type protocol;
+    range_type src_ipv4;
+    range_type dst_ipv4;
+    range_type ipv4;
+    ipv6_range_type src_ipv6;
+    ipv6_range_type dst_ipv6;
+    ipv6_range_type ipv6;
+    range_type sport;
+    range_type dport;
+    range_type port;
+    // Whether the expression only matches IP packets, or TCP and UDP ones
+    bool has_ip;
+    bool has_transport;
+    // Whether address or port primitives were used
+    bool needs_ip;
+    bool needs_transport;
+};
+
+// Narrows a field down to the given range. Fails if nothing would match
+template <typename Key>
+bool restrict_range(Internals::classifier_range<Key>& field, const Key& first, 
+                    const Key& last) {
+    if (field.present) {
+        const Key new_first = std::max(field.first, first);
+        const Key new_last = std::min(field.last, last);
+        if (new_last < new_first) {
+            return false;
+        }
+        field.set(new_first, new_last);
+    }
+    else {
+        field.set(first, last);
+    }
+    return true;
+}
+
+// Fields matching either direction can't be narrowed down this way, as
+// each primitive may match a different direction
+template <typename Key>
+bool set_either(Internals::classifier_range<Key>& field, const Key& first, 
+                const Key& last) {
+    if (field.present) {
+        return false;
+    }
+    field.set(first, last);
+    return true;
+}
+
+bool parse_number(const string& token, uint32_t max_value, uint32_t& output) {
+    if (token.empty() || token[0] < '0' || token[0] > '9') {
+        return false;
+    }
+    // Decimal, octal or hexadecimal, just like pcap
+    char* end;
+    const unsigned long value = strtoul(token.c_str(), &end, 0);
+    if (*end != 0 || value > max_value) {
+        return false;
+    }
+    output = static_cast<uint32_t>(value);
+    return true;
+}
+
+template <typename Address>
+bool parse_address(const string& token, Address& output) {
+    try {
+        output = Address(token);
+        return true;
+    }
+    catch (invalid_address&) {
+        // Host names are left to pcap
+        return false;
+    }
+}
+
+bool is_conjunction(const string& token) {
+    return token == "and" || token == "&&";
+}
+
+bool apply_protocol(const string& name, filter_terms& terms) {
+    uint32_t ether_type = 0;
+    uint32_t protocol = 0;
+    if (name == "ip") {
+        ether_type = Constants::Ethernet::IP;
+    }
+    else if (name == "ip6") {
+        ether_type = Constants::Ethernet::IPV6;
+    }
+    else if (name == "arp") {
+        ether_type = Constants::Ethernet::ARP;
+    }
+    else if (name == "icmp") {
+        ether_type = Constants::Ethernet::IP;
+        protocol = Constants::IP::PROTO_ICMP;
+    }
+    else if (name == "icmp6") {
+        ether_type = Constants::Ethernet::IPV6;
+        protocol = Constants::IP::PROTO_ICMPV6;
+    }
+    else if (name == "tcp") {
+        protocol = Constants::IP::PROTO_TCP;
+    }
+    else if (name == "udp") {
+        protocol = Constants::IP::PROTO_UDP;
+    }
+    else {
+        return false;
+    }
+    terms.has_ip = terms.has_ip || name != "arp";
+    terms.has_transport = terms.has_transport || name == "tcp" || name == "udp";
+    return (ether_type == 0 || restrict_range(terms.ether_type, ether_type, ether_type)) &&
+           (protocol == 0 || restrict_range(terms.protocol, protocol, protocol));
+}
+
+// Applies a [src|dst] host/net/port/portrange primitive
+bool apply_field(const string& qualifier, const string& direction, const string& type,
+                 const string& value, filter_terms& terms) {
+    const bool is_src = direction == "src";
+    const bool is_dst = direction == "dst";
+    if (type == "port" || type == "portrange") {
+        if (!qualifier.empty() && qualifier != "tcp" && qualifier != "udp") {
+            return false;
+        }
+        uint32_t first;
+        uint32_t last;
+        if (type == "port") {
+            if (!parse_number(value, 0xffff, first)) {
+                return false;
+            }
+            last = first;
+        }
+        else {
+            const size_t separator = value.find('-');
+            if (separator == string::npos ||
+                !parse_number(value.substr(0, separator), 0xffff, first) ||
+                !parse_number(value.substr(separator + 1), 0xffff, last) ||
+                last < first) {
+                return false;
+            }
+        }
+        terms.needs_transport = true;
+        if (is_src) {
+            return restrict_range(terms.sport, first, last);
+        }
+        if (is_dst) {
+            return restrict_range(terms.dport, first, last);
+        }
+        return set_either(terms.port, first, last);
+    }
+    if (type != "host" && type != "net") {
+        return false;
+    }
+    if (!qualifier.empty() && qualifier != "ip" && qualifier != "ip6") {
+        return false;
+    }
+    string address = value;
+    uint32_t length = 0;
+    if (type == "net") {
+        // Only the ADDRESS/LENGTH notation is translated
+        const size_t separator = value.find('/');
+        if (separator == string::npos || 
+            !parse_number(value.substr(separator + 1), 128, length)) {
+            return false;
+        }
+        address = value.substr(0, separator);
+    }
+    terms.needs_ip = true;
+    IPv4Address ipv4;
+    IPv6Address ipv6;
+    if (qualifier != "ip6" && parse_address(address, ipv4)) {
+        if (type == "host") {
+            length = 32;
+        }
+        else if (length > 32) {
+            return false;
+        }
+        const IPv4Range range = ipv4 / static_cast<int>(length);
+        const uint32_t first = Internals::ipv4_key(range.first());
+        const uint32_t last = Internals::ipv4_key(range.last());
+        if (is_src) {
+            return restrict_range(terms.src_ipv4, first, last);
+        }
+        if (is_dst) {
+            return restrict_range(terms.dst_ipv4, first, last);
+        }
+        return set_either(terms.ipv4, first, last);
+    }
+    if (qualifier != "ip" && parse_address(address, ipv6)) {
+        if (type == "host") {
+            length = 128;
+        }
+        const IPv6Range range = ipv6 / static_cast<int>(length);
+        const Internals::classifier_ipv6_key first(range.first());
+        const Internals::classifier_ipv6_key last(range.last());
+        if (is_src) {
+            return restrict_range(terms.src_ipv6, first, last);
+        }
+        if (is_dst) {
+            return restrict_range(terms.dst_ipv6, first, last);
+        }
+        return set_either(terms.ipv6, first, last);
+    }
+    return false;
+}
+
+/*
+ * Translates a conjunction of simple primitives into header fields. Fails
+ * if the expression uses anything else, or if its meaning in pcap could
+ * differ from the one of the translated fields.
+ */
+bool parse_filter(const string& filter, filter_terms& terms) {
+    vector<string> tokens;
+    std::istringstream input(filter);
+    string token;
+    while (input >> token) {
+        if (token != "&&" && token.find_first_of("()!|&<>=[]") != string::npos) {
+            return false;
+        }
+        tokens.push_back(token);
+    }
+    if (tokens.empty()) {
+        return false;
+    }
+    size_t i = 0;
+    while (true) {
+        // Takes the next token, unless the primitive ends here
+        const auto next = [&](string& output) {
+            if (i == tokens.size() || is_conjunction(tokens[i])) {
+                return false;
+            }
+            output = tokens[i++];
+            return true;
+        };
+        string current;
+        string qualifier;
+        if (!next(current)) {
+            return false;
+        }
+        if (current == "ether") {
+            uint32_t ether_type;
+            // Lower values are 802.3 lengths, and pcap checks the outer 
+            // ethertype while we use the innermost VLAN tag's one
+            if (!next(current) || current != "proto" || !next(current) ||
+                !parse_number(current, 0xffff, ether_type) || ether_type <= 1500 ||
+                ether_type == Constants::Ethernet::VLAN || ether_type == 0x88a8 ||
+                ether_type == 0x9100 ||
+                !restrict_range(terms.ether_type, ether_type, ether_type)) {
+                return false;
+            }
+        }
+        else {
+            // Protocols are primitives on their own, but they can also 
+            // qualify the rest of the primitive
+            bool has_rest = true;
+            if (apply_protocol(current, terms)) {
+                qualifier = current;
+                has_rest = next(current);
+            }
+            string direction;
+            string value;
+            uint32_t protocol;
+            if (!has_rest) {
+                // Nothing else to parse
+            }
+            else if (current == "proto") {
+                if ((qualifier != "ip" && qualifier != "ip6") || !next(current) ||
+                    !parse_number(current, 0xff, protocol) ||
+                    !restrict_range(terms.protocol, protocol, protocol)) {
+                    return false;
+                }
+            }
+            else {
+                if (current == "src" || current == "dst") {
+                    direction = current;
+                    if (!next(current)) {
+                        return false;
+                    }
+                }
+                if (!next(value) || 
+                    !apply_field(qualifier, direction, current, value, terms)) {
+                    return false;
+                }
+            }
+        }
+        if (i == tokens.size()) {
+            break;
+        }
+        // Anything left in this primitive isn't understood
+        if (!is_conjunction(tokens[i++])) {
+            return false;
+        }
+    }
+    // Without these, pcap would also match SCTP ports and ARP addresses
+    return (!terms.needs_ip || terms.has_ip) && 
+           (!terms.needs_transport || terms.has_transport);
+}
+
+} // anonymous namespace
+
+// PacketClassifier::Rule
+
+void PacketClassifier::Rule::set_ether_type(uint16_t ether_type) {
+    ether_type_.set(ether_type, ether_type);
+}
+
+void PacketClassifier::Rule::set_protocol(uint8_t protocol) {
+    protocol_.set(protocol, protocol);
+}
+
+void PacketClassifier::Rule::set_src_addr(const IPv4Range& range) {
+    src_ipv4_.set(Internals::ipv4_key(range.first()), 
+                  Internals::ipv4_key(range.last()));
+    src_ipv6_ = ipv6_range_type();
+}
+
+void PacketClassifier::Rule::set_dst_addr(const IPv4Range& range) {
+    dst_ipv4_.set(Internals::ipv4_key(range.first()), 
+                  Internals::ipv4_key(range.last()));
+    dst_ipv6_ = ipv6_range_type();
+}
+
+void PacketClassifier::Rule::set_src_addr(const IPv6Range& range) {
+    src_ipv6_.set(range.first(), range.last());
+    src_ipv4_ = range_type();
+}
+
+void PacketClassifier::Rule::set_dst_addr(const IPv6Range& range) {
+    dst_ipv6_.set(range.first(), range.last());
+    dst_ipv4_ = range_type();
+}
+
+void PacketClassifier::Rule::set_sport(uint16_t port) {
+    sport_.set(port, port);
+}
+
+void PacketClassifier::Rule::set_sport(uint16_t first, uint16_t last) {
+    if (last < first) {
+        throw exception_base("Invalid port range");
+    }
+    sport_.set(first, last);
+}
+
+void PacketClassifier::Rule::set_dport(uint16_t port) {
+    dport_.set(port, port);
+}
+
+void PacketClassifier::Rule::set_dport(uint16_t first, uint16_t last) {
+    if (last < first) {
+        throw exception_base("Invalid port range");
+    }
+    dport_.set(first, last);
+}
+
+void PacketClassifier::Rule::set_filter(const string& filter) {
+    filter_ = filter;
+}
+
+// PacketClassifier::MatchSet
+
+PacketClassifier::MatchSet::MatchSet() 
+: size_(0) {
+
+}
+
+bool PacketClassifier::MatchSet::any() const {
+    for (size_t i = 0; i < words_.size(); ++i) {
+        if (words_[i]) {
+            return true;
+        }
+    }
+    return false;
+}
+
+size_t PacketClassifier::MatchSet::count() const {
+    size_t output = 0;
+    for (size_t i = 0; i < words_.size(); ++i) {
+        uint64_t word = words_[i];
+        while (word) {
+            word &= word - 1;
+            ++output;
+        }
+    }
+    return output;
+}
+
+vector<PacketClassifier::rule_id> PacketClassifier::MatchSet::ids() const {
+    vector<rule_id> output;
+    for (size_t i = 0; i < words_.size(); ++i) {
+        uint64_t word = words_[i];
+        for (rule_id id = static_cast<rule_id>(i * 64); word; word >>= 1, ++id) {
+            if (word & 1) {
+                output.push_back(id);
+            }
+        }
+    }
+    return output;
+}
+
+// PacketClassifier
+
+struct PacketClassifier::packet_fields {
+    packet_fields() 
+    : has_ether_type(false), has_protocol(false), has_ipv4(false), has_ipv6(false), 
+      has_ports(false), is_exact(false), is_tagged(false), ether_type(0), protocol(0),
+      src_ipv4(0), dst_ipv4(0), sport(0), dport(0) {
+
+    }
+
+    bool has_ether_type;
+    bool has_protocol;
+    bool has_ipv4;
+    bool has_ipv6;
+    bool has_ports;
+    // Whether these are the fields pcap would see, so the rules whose filter
+    // was translated can be matched without evaluating it
+    bool is_exact;
+    // Translated expressions never match tagged frames, as every one of them
+    // checks the outer ethertype
+    bool is_tagged;
+    uint32_t ether_type;
+    uint32_t protocol;
+    uint32_t src_ipv4;
+    uint32_t dst_ipv4;
+    Internals::classifier_ipv6_key src_ipv6;
+    Internals::classifier_ipv6_key dst_ipv6;
+    uint32_t sport;
+    uint32_t dport;
+};
+
+PacketClassifier::rule_id PacketClassifier::add_rule(const Rule& rule) {
+    const rule_id id = static_cast<rule_id>(rules_.size());
+    add(rule);
+    return id;
+}
+
+PacketClassifier::rule_id PacketClassifier::add_rules(const vector<Rule>& rules) {
+    const rule_id id = static_cast<rule_id>(rules_.size());
+    for (size_t i = 0; i < rules.size(); ++i) {
+        add(rules[i]);
+    }
+    return id;
+}
+
+size_t PacketClassifier::rule_count() const {
+    return rules_.size();
+}
+
+bool PacketClassifier::translate_filter(const string& filter, Rule& rule) {
+    filter_terms terms;
+    if (!parse_filter(filter, terms)) {
+        return false;
+    }
+    rule.ether_type_ = terms.ether_type;
+    rule.protocol_ = terms.protocol;
+    rule.src_ipv4_ = terms.src_ipv4;
+    rule.dst_ipv4_ = terms.dst_ipv4;
+    rule.ipv4_ = terms.ipv4;
+    rule.src_ipv6_ = terms.src_ipv6;
+    rule.dst_ipv6_ = terms.dst_ipv6;
+    rule.ipv6_ = terms.ipv6;
+    rule.sport_ = terms.sport;
+    rule.dport_ = terms.dport;
+    rule.port_ = terms.port;
+    return true;
+}
+
+void PacketClassifier::add(const Rule& rule) {
+    int filter_id = -1;
+    if (!rule.filter_.empty()) {
+        std::map<string, int>::const_iterator iter = filter_ids_.find(rule.filter_);
+        if (iter != filter_ids_.end()) {
+            filter_id = iter->second;
+        }
+        else {
+            filter_ptr filter(filter_factory_(rule.filter_));
+            filter_id = static_cast<int>(filters_.size());
+            filters_.push_back(std::move(filter));
+            filter_ids_.insert(std::make_pair(rule.filter_, filter_id));
+        }
+    }
+    // Rules that constrain header fields themselves are left alone, as the
+    // expression would have to be merged into them
+    const bool has_fields = rule.ether_type_.present || rule.protocol_.present ||
+                            rule.src_ipv4_.present || rule.dst_ipv4_.present ||
+                            rule.src_ipv6_.present || rule.dst_ipv6_.present ||
+                            rule.sport_.present || rule.dport_.present;
+    Rule stored = rule;
+    const bool translated = filter_id != -1 && !has_fields && 
+                            translate_filter(rule.filter_, stored);
+    rules_.push_back(stored);
+    rule_filters_.push_back(filter_id);
+    translated_.push_back(translated);
+    has_translated_ = has_translated_ || translated;
+    built_.store(false, std::memory_order_relaxed);
+}
+
+void PacketClassifier::build() const {
+    std::lock_guard<std::mutex> lock(build_mutex_);
+    if (built_.load(std::memory_order_relaxed)) {
+        return;
+    }
+    const size_t words = (rules_.size() + 63) / 64;
+    vector<Rule::range_type> ether_types, protocols, src_ipv4, dst_ipv4, ipv4;
+    vector<Rule::range_type> sports, dports, ports;
+    vector<Rule::ipv6_range_type> src_ipv6, dst_ipv6, ipv6;
+    all_rules_.assign(words, 0);
+    filter_rules_.assign(words, 0);
+    untranslated_filter_rules_.assign(words, 0);
+    translated_rules_.assign(words, 0);
+    for (size_t i = 0; i < rules_.size(); ++i) {
+        const Rule& rule = rules_[i];
+        ether_types.push_back(rule.ether_type_);
+        protocols.push_back(rule.protocol_);
+        src_ipv4.push_back(rule.src_ipv4_);
+        dst_ipv4.push_back(rule.dst_ipv4_);
+        src_ipv6.push_back(rule.src_ipv6_);
+        dst_ipv6.push_back(rule.dst_ipv6_);
+        sports.push_back(rule.sport_);
+        dports.push_back(rule.dport_);
+        ipv4.push_back(rule.ipv4_);
+        ipv6.push_back(rule.ipv6_);
+        ports.push_back(rule.port_);
+        Internals::set_bit(&all_rules_[0], i);
+        if (rule_filters_[i] != -1) {
+            Internals::set_bit(&filter_rules_[0], i);
+        }
+        if (translated_[i]) {
+            Internals::set_bit(&translated_rules_[0], i);
+        }
+        else if (rule_filters_[i] != -1) {
+            Internals::set_bit(&untranslated_filter_rules_[0], i);
+        }
+    }
+    // Fields with up to 16 bits use direct tables
+    ether_type_index_.build(ether_types, words, 0x10000);
+    protocol_index_.build(protocols, words, 0x100);
+    src_ipv4_index_.build(src_ipv4, words);
+    dst_ipv4_index_.build(dst_ipv4, words);
+    ipv4_index_.build(ipv4, words);
+    src_ipv6_index_.build(src_ipv6, words);
+    dst_ipv6_index_.build(dst_ipv6, words);
+    ipv6_index_.build(ipv6, words);
+    sport_index_.build(sports, words, 0x10000);
+    dport_index_.build(dports, words, 0x10000);
+    port_index_.build(ports, words, 0x10000);
+    built_.store(true, std::memory_order_release);
+}
+
+void PacketClassifier::classify(const uint8_t* buffer, uint32_t total_sz, 
+                                MatchSet& matches) const {
+    PacketView view(buffer, total_sz, link_type_);
+    packet_fields fields;
+    if (view.has_ip()) {
+        PacketView::IPHeader ip = view.ip();
+        fields.has_ether_type = true;
+        fields.ether_type = Constants::Ethernet::IP;
+        fields.has_ipv4 = true;
+        fields.src_ipv4 = Internals::ipv4_key(ip.src_addr());
+        fields.dst_ipv4 = Internals::ipv4_key(ip.dst_addr());
+    }
+    else if (view.has_ipv6()) {
+        PacketView::IPv6Header ipv6 = view.ipv6();
+        fields.has_ether_type = true;
+        fields.ether_type = Constants::Ethernet::IPV6;
+        fields.has_ipv6 = true;
+        fields.src_ipv6 = ipv6.src_addr();
+        fields.dst_ipv6 = ipv6.dst_addr();
+    }
+    else if (view.has_dot1q()) {
+        // Use the payload type of the innermost tag, which are 4 bytes each
+        const uint32_t offset = view.dot1q_offset() + (view.vlan_count() - 1) * 4;
+        fields.has_ether_type = true;
+        fields.ether_type = PacketView::Dot1QHeader(buffer + offset).payload_type();
+    }
+    else if (view.has_ethernet()) {
+        fields.has_ether_type = true;
+        fields.ether_type = view.ethernet().payload_type();
+    }
+    if (fields.has_ipv4 || fields.has_ipv6) {
+        fields.has_protocol = true;
+        fields.protocol = view.transport_protocol();
+    }
+    if (view.has_tcp()) {
+        fields.has_ports = true;
+        fields.sport = view.tcp().sport();
+        fields.dport = view.tcp().dport();
+    }
+    else if (view.has_udp()) {
+        fields.has_ports = true;
+        fields.sport = view.udp().sport();
+        fields.dport = view.udp().dport();
+    }
+    // pcap looks at the outer ethertype and doesn't follow IPv6 extension
+    // headers. Translated expressions are also evaluated whenever the 
+    // headers couldn't be fully parsed, as pcap may still read them
+    const bool has_transport = fields.has_ports || 
+                               (fields.protocol != Constants::IP::PROTO_TCP && 
+                                fields.protocol != Constants::IP::PROTO_UDP);
+    if (view.vlan_count() > 0) {
+        fields.is_exact = true;
+        fields.is_tagged = true;
+    }
+    else if (fields.has_ipv4) {
+        fields.is_exact = has_transport;
+    }
+    else if (fields.has_ipv6) {
+        fields.is_exact = has_transport && 
+                          view.ipv6().next_header() == view.transport_protocol();
+    }
+    else {
+        fields.is_exact = view.has_ethernet() && 
+                          fields.ether_type != Constants::Ethernet::IP &&
+                          fields.ether_type != Constants::Ethernet::IPV6;
+    }
+    match_fields(fields, matches);
+    const vector<uint64_t>& filter_rules = filters_to_evaluate(fields);
+    if (has_filter_candidates(matches, filter_rules)) {
+        match_filters(buffer, total_sz, filter_rules, matches);
+    }
+}
+
+PacketClassifier::MatchSet PacketClassifier::classify(const uint8_t* buffer, 
+                                                      uint32_t total_sz) const {
+    MatchSet matches;
+    classify(buffer, total_sz, matches);
+    return matches;
+}
+
+void PacketClassifier::classify(PDU& pdu, MatchSet& matches) const {
+    if (has_translated_) {
+        // Match translated expressions against what pcap would see
+        Internals::ScratchSerialization buffer(pdu);
+        classify(buffer.data(), buffer.size(), matches);
+        return;
+    }
+    packet_fields fields;
+    const TCP* tcp = pdu.find_pdu<TCP>();
+    const UDP* udp = pdu.find_pdu<UDP>();
+    if (const IP* ip = pdu.find_pdu<IP>()) {
+        fields.has_ether_type = true;
+        fields.ether_type = Constants::Ethernet::IP;
+        fields.has_ipv4 = true;
+        fields.src_ipv4 = Internals::ipv4_key(ip->src_addr());
+        fields.dst_ipv4 = Internals::ipv4_key(ip->dst_addr());
+        fields.has_protocol = true;
+        fields.protocol = ip->protocol();
+    }
+    else if (const IPv6* ipv6 = pdu.find_pdu<IPv6>()) {
+        fields.has_ether_type = true;
+        fields.ether_type = Constants::Ethernet::IPV6;
+        fields.has_ipv6 = true;
+        fields.src_ipv6 = ipv6->src_addr();
+        fields.dst_ipv6 = ipv6->dst_addr();
+        fields.has_protocol = true;
+        fields.protocol = ipv6->next_header();
+    }
+    else if (Dot1Q* dot1q = pdu.find_pdu<Dot1Q>()) {
+        // Stacked tags are nested Dot1Q PDUs, use the innermost one
+        while (Dot1Q* inner = tins_cast<Dot1Q*>(dot1q->inner_pdu())) {
+            dot1q = inner;
+        }
+        fields.has_ether_type = true;
+        fields.ether_type = dot1q->payload_type();
+    }
+    else if (const EthernetII* eth = pdu.find_pdu<EthernetII>()) {
+        fields.has_ether_type = true;
+        fields.ether_type = eth->payload_type();
+    }
+    // The protocol fields of PDUs that were built rather than parsed
+    // are only filled in when serializing them
+    if (tcp) {
+        fields.protocol = Constants::IP::PROTO_TCP;
+        fields.has_ports = true;
+        fields.sport = tcp->sport();
+        fields.dport = tcp->dport();
+    }
+    else if (udp) {
+        fields.protocol = Constants::IP::PROTO_UDP;
+        fields.has_ports = true;
+        fields.sport = udp->sport();
+        fields.dport = udp->dport();
+    }
+    match_fields(fields, matches);
+    if (has_filter_candidates(matches, filter_rules_)) {
+        Internals::ScratchSerialization buffer(pdu);
+        match_filters(buffer.data(), buffer.size(), filter_rules_, matches);
+    }
+}
+
+void PacketClassifier::match_fields(const packet_fields& fields, MatchSet& matches) const {
+    ensure_built();
+    const size_t words = all_rules_.size();
+    matches.words_.assign(all_rules_.begin(), all_rules_.end());
+    matches.size_ = rules_.size();
+    uint64_t* output = words ? &matches.words_[0] : 0;
+    // A rule matches a field if it's in either set. Fields that apply to
+    // both directions look up the source and destination separately
+    const uint64_t* sets[11];
+    const uint64_t* alternatives[11];
+    size_t set_count = 0;
+    if (ether_type_index_.is_active()) {
+        sets[set_count++] = fields.has_ether_type ? 
+                            ether_type_index_.find(fields.ether_type) :
+                            ether_type_index_.wildcard();
+    }
+    if (protocol_index_.is_active()) {
+        sets[set_count++] = fields.has_protocol ? 
+                            protocol_index_.find(fields.protocol) :
+                            protocol_index_.wildcard();
+    }
+    if (src_ipv4_index_.is_active()) {
+        sets[set_count++] = fields.has_ipv4 ? 
+                            src_ipv4_index_.find(fields.src_ipv4) :
+                            src_ipv4_index_.wildcard();
+    }
+    if (dst_ipv4_index_.is_active()) {
+        sets[set_count++] = fields.has_ipv4 ? 
+                            dst_ipv4_index_.find(fields.dst_ipv4) :
+                            dst_ipv4_index_.wildcard();
+    }
+    if (src_ipv6_index_.is_active()) {
+        sets[set_count++] = fields.has_ipv6 ? 
+                            src_ipv6_index_.find(fields.src_ipv6) :
+                            src_ipv6_index_.wildcard();
+    }
+    if (dst_ipv6_index_.is_active()) {
+        sets[set_count++] = fields.has_ipv6 ? 
+                            dst_ipv6_index_.find(fields.dst_ipv6) :
+                            dst_ipv6_index_.wildcard();
+    }
+    if (sport_index_.is_active()) {
+        sets[set_count++] = fields.has_ports ? 
+                            sport_index_.find(fields.sport) :
+                            sport_index_.wildcard();
+    }
+    if (dport_index_.is_active()) {
+        sets[set_count++] = fields.has_ports ? 
+                            dport_index_.find(fields.dport) :
+                            dport_index_.wildcard();
+    }
+    for (size_t i = 0; i < set_count; ++i) {
+        alternatives[i] = sets[i];
+    }
+    if (ipv4_index_.is_active()) {
+        sets[set_count] = fields.has_ipv4 ? 
+                          ipv4_index_.find(fields.src_ipv4) :
+                          ipv4_index_.wildcard();
+        alternatives[set_count++] = fields.has_ipv4 ? 
+                                    ipv4_index_.find(fields.dst_ipv4) :
+                                    ipv4_index_.wildcard();
+    }
+    if (ipv6_index_.is_active()) {
+        sets[set_count] = fields.has_ipv6 ? 
+                          ipv6_index_.find(fields.src_ipv6) :
+                          ipv6_index_.wildcard();
+        alternatives[set_count++] = fields.has_ipv6 ? 
+                                    ipv6_index_.find(fields.dst_ipv6) :
+                                    ipv6_index_.wildcard();
+    }
+    if (port_index_.is_active()) {
+        sets[set_count] = fields.has_ports ? 
+                          port_index_.find(fields.sport) :
+                          port_index_.wildcard();
+        alternatives[set_count++] = fields.has_ports ? 
+                                    port_index_.find(fields.dport) :
+                                    port_index_.wildcard();
+    }
+    for (size_t i = 0; i < set_count; ++i) {
+        for (size_t j = 0; j < words; ++j) {
+            output[j] &= sets[i][j] | alternatives[i][j];
+        }
+    }
+    if (!fields.is_exact) {
+        // The translated fields may not be what pcap sees, so these rules'
+        // filters decide instead
+        for (size_t j = 0; j < words; ++j) {
+            output[j] |= translated_rules_[j];
+        }
+    }
+    else if (fields.is_tagged) {
+        for (size_t j = 0; j < words; ++j) {
+            output[j] &= ~translated_rules_[j];
+        }
+    }
+}
+
+const vector<uint64_t>& PacketClassifier::filters_to_evaluate(
+                                            const packet_fields& fields) const {
+    return fields.is_exact ? untranslated_filter_rules_ : filter_rules_;
+}
+
+bool PacketClassifier::has_filter_candidates(const MatchSet& matches,
+                                             const vector<uint64_t>& filter_rules) const {
+    for (size_t i = 0; i < filter_rules.size(); ++i) {
+        if (matches.words_[i] & filter_rules[i]) {
+            return true;
+        }
+    }
+    return false;
+}
+
+void PacketClassifier::match_filters(const uint8_t* buffer, uint32_t total_sz, 
+                                     const vector<uint64_t>& filter_rules,
+                                     MatchSet& matches) const {
+    // Each distinct filter is evaluated at most once
+    enum { UNKNOWN, MATCHED, NOT_MATCHED };
+    vector<uint8_t> results(filters_.size(), UNKNOWN);
+    for (size_t i = 0; i < filter_rules.size(); ++i) {
+        uint64_t candidates = matches.words_[i] & filter_rules[i];
+        for (size_t bit = 0; candidates; candidates >>= 1, ++bit) {
+            if ((candidates & 1) == 0) {
+                continue;
+            }
+            const int filter_id = rule_filters_[i * 64 + bit];
+            uint8_t& result = results[filter_id];
+            if (result == UNKNOWN) {
+                result = filters_[filter_id]->matches_filter(buffer, total_sz) ?
+                         MATCHED : NOT_MATCHED;
+            }
+            if (result == NOT_MATCHED) {
+                matches.words_[i] &= ~(static_cast<uint64_t>(1) << bit);
+            }
+        }
+    }
+}
+
+} // Tins
+
+#endif // TINS_HAVE_PCAP && TINS_IS_CXX11
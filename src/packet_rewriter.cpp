@@ -0,0 +1,264 @@
+/*
+ * Copyright (c) 2017, Matias Fontanini
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are
+ * met:
+ * 
+ * * Redistributions of source code must retain the above copyright
+ *   notice, this list of conditions and the following disclaimer.
+ * * Redistributions in binary form must reproduce the above
+ *   copyright notice, this list of conditions and the following disclaimer
+ *   in the documentation and/or other materials provided with the
+ *   distribution.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+
+#include <cstring>
+#include <tins/packet_rewriter.h>
+#include <tins/packet_view.h>
+#include <tins/ip.h>
+#include <tins/ipv6.h>
+#include <tins/tcp.h>
+#include <tins/udp.h>
+#include <tins/exceptions.h>
+#include <tins/memory_helpers.h>
+#include <tins/detail/pdu_helpers.h>
+
+using std::memcpy;
+
+namespace Tins {
+
+namespace {
+
+void address_bytes(IPv4Address address, uint8_t* output) {
+    // This is already in network byte order
+    const uint32_t value = address;
+    memcpy(output, &value, sizeof(value));
+}
+
+} // anonymous namespace
+
+PacketRewriter::PacketRewriter(uint8_t* buffer, uint32_t total_sz, PDU::PDUType link_type)
+: network_(), transport_(), transport_checksum_(), ip_(), ipv6_(), tcp_(), udp_(),
+  is_ipv6_(false), is_udp_(false) {
+    PacketView view(buffer, total_sz, link_type);
+    if (view.has_ip() || view.has_ipv6()) {
+        network_ = buffer + view.network_offset();
+        is_ipv6_ = view.has_ipv6();
+    }
+    if (view.has_tcp()) {
+        transport_ = buffer + view.transport_offset();
+        transport_checksum_ = transport_ + 16;
+    }
+    else if (view.has_udp()) {
+        transport_ = buffer + view.transport_offset();
+        transport_checksum_ = transport_ + 6;
+        is_udp_ = true;
+    }
+}
+
+PacketRewriter::PacketRewriter(PDU& pdu)
+: network_(), transport_(), transport_checksum_(), ip_(), ipv6_(), tcp_(), udp_(),
+  is_ipv6_(false), is_udp_(false) {
+    PDU* network = ip_ = pdu.find_pdu<IP>();
+    if (!ip_) {
+        network = ipv6_ = pdu.find_pdu<IPv6>();
+        is_ipv6_ = ipv6_ != 0;
+    }
+    // Only the transport layer right on top of the network layer uses 
+    // its addresses in the pseudo header
+    if (network && network->inner_pdu()) {
+        tcp_ = tins_cast<TCP*>(network->inner_pdu());
+        udp_ = tins_cast<UDP*>(network->inner_pdu());
+        is_udp_ = udp_ != 0;
+    }
+}
+
+void PacketRewriter::ttl(uint8_t new_ttl) {
+    if (ip_) {
+        // The TTL shares its checksummed word with the protocol field
+        const uint8_t old_value[] = { ip_->ttl(), ip_->protocol() };
+        const uint8_t new_value[] = { new_ttl, ip_->protocol() };
+        update_pdu_checksums(old_value, new_value, sizeof(new_value), NETWORK_CHECKSUM);
+        ip_->ttl(new_ttl);
+    }
+    else if (ipv6_) {
+        ipv6_->hop_limit(new_ttl);
+    }
+    else if (network_ && is_ipv6_) {
+        network_[7] = new_ttl;
+    }
+    else if (network_) {
+        const uint8_t new_value[] = { new_ttl, network_[9] };
+        rewrite_buffer(network_ + 8, new_value, sizeof(new_value), NETWORK_CHECKSUM);
+    }
+    else {
+        throw pdu_not_found();
+    }
+}
+
+void PacketRewriter::src_addr(IPv4Address address) {
+    uint8_t new_value[4];
+    address_bytes(address, new_value);
+    if (ip_) {
+        uint8_t old_value[4];
+        address_bytes(ip_->src_addr(), old_value);
+        update_pdu_checksums(old_value, new_value, sizeof(new_value), 
+                             NETWORK_CHECKSUM | TRANSPORT_CHECKSUM);
+        ip_->src_addr(address);
+    }
+    else if (network_ && !is_ipv6_) {
+        rewrite_buffer(network_ + 12, new_value, sizeof(new_value), 
+                       NETWORK_CHECKSUM | TRANSPORT_CHECKSUM);
+    }
+    else {
+        throw pdu_not_found();
+    }
+}
+
+void PacketRewriter::dst_addr(IPv4Address address) {
+    uint8_t new_value[4];
+    address_bytes(address, new_value);
+    if (ip_) {
+        uint8_t old_value[4];
+        address_bytes(ip_->dst_addr(), old_value);
+        update_pdu_checksums(old_value, new_value, sizeof(new_value), 
+                             NETWORK_CHECKSUM | TRANSPORT_CHECKSUM);
+        ip_->dst_addr(address);
+    }
+    else if (network_ && !is_ipv6_) {
+        rewrite_buffer(network_ + 16, new_value, sizeof(new_value), 
+                       NETWORK_CHECKSUM | TRANSPORT_CHECKSUM);
+    }
+    else {
+        throw pdu_not_found();
+    }
+}
+
+void PacketRewriter::src_addr(const IPv6Address& address) {
+    if (ipv6_) {
+        const IPv6Address old_address = ipv6_->src_addr();
+        update_pdu_checksums(old_address.begin(), address.begin(), 
+                             IPv6Address::address_size, TRANSPORT_CHECKSUM);
+        ipv6_->src_addr(address);
+    }
+    else if (network_ && is_ipv6_) {
+        rewrite_buffer(network_ + 8, address.begin(), IPv6Address::address_size,
+                       TRANSPORT_CHECKSUM);
+    }
+    else {
+        throw pdu_not_found();
+    }
+}
+
+void PacketRewriter::dst_addr(const IPv6Address& address) {
+    if (ipv6_) {
+        const IPv6Address old_address = ipv6_->dst_addr();
+        update_pdu_checksums(old_address.begin(), address.begin(), 
+                             IPv6Address::address_size, TRANSPORT_CHECKSUM);
+        ipv6_->dst_addr(address);
+    }
+    else if (network_ && is_ipv6_) {
+        rewrite_buffer(network_ + 24, address.begin(), IPv6Address::address_size,
+                       TRANSPORT_CHECKSUM);
+    }
+    else {
+        throw pdu_not_found();
+    }
+}
+
+void PacketRewriter::sport(uint16_t port) {
+    uint8_t new_value[2];
+    Memory::write_be_value(new_value, port);
+    if (tcp_ || udp_) {
+        uint8_t old_value[2];
+        Memory::write_be_value(old_value, tcp_ ? tcp_->sport() : udp_->sport());
+        update_pdu_checksums(old_value, new_value, sizeof(new_value), TRANSPORT_CHECKSUM);
+        if (tcp_) {
+            tcp_->sport(port);
+        }
+        else {
+            udp_->sport(port);
+        }
+    }
+    else if (transport_) {
+        rewrite_buffer(transport_, new_value, sizeof(new_value), TRANSPORT_CHECKSUM);
+    }
+    else {
+        throw pdu_not_found();
+    }
+}
+
+void PacketRewriter::dport(uint16_t port) {
+    uint8_t new_value[2];
+    Memory::write_be_value(new_value, port);
+    if (tcp_ || udp_) {
+        uint8_t old_value[2];
+        Memory::write_be_value(old_value, tcp_ ? tcp_->dport() : udp_->dport());
+        update_pdu_checksums(old_value, new_value, sizeof(new_value), TRANSPORT_CHECKSUM);
+        if (tcp_) {
+            tcp_->dport(port);
+        }
+        else {
+            udp_->dport(port);
+        }
+    }
+    else if (transport_) {
+        rewrite_buffer(transport_ + 2, new_value, sizeof(new_value), TRANSPORT_CHECKSUM);
+    }
+    else {
+        throw pdu_not_found();
+    }
+}
+
+void PacketRewriter::rewrite_buffer(uint8_t* field, const uint8_t* value, 
+                                    uint32_t size, int scope) {
+    const uint16_t old_sum = Internals::sum_bytes(field, size);
+    const uint16_t new_sum = Internals::sum_bytes(value, size);
+    if ((scope & NETWORK_CHECKSUM) != 0) {
+        Internals::patch_checksum(network_ + 10, old_sum, new_sum, false);
+    }
+    if ((scope & TRANSPORT_CHECKSUM) != 0 && transport_checksum_) {
+        Internals::patch_checksum(transport_checksum_, old_sum, new_sum, is_udp_);
+    }
+    memcpy(field, value, size);
+}
+
+void PacketRewriter::update_pdu_checksums(const uint8_t* old_value, 
+                                          const uint8_t* new_value, 
+                                          uint32_t size, int scope) {
+    const uint16_t old_sum = Internals::sum_bytes(old_value, size);
+    const uint16_t new_sum = Internals::sum_bytes(new_value, size);
+    if ((scope & NETWORK_CHECKSUM) != 0 && ip_) {
+        ip_->checksum(Internals::update_checksum(ip_->checksum(), old_sum, new_sum, false));
+    }
+    if ((scope & TRANSPORT_CHECKSUM) != 0) {
+        if (tcp_) {
+            tcp_->checksum(
+                Internals::update_checksum(tcp_->checksum(), old_sum, new_sum, false)
+            );
+        }
+        else if (udp_) {
+            udp_->checksum(
+                Internals::update_checksum(udp_->checksum(), old_sum, new_sum, true)
+            );
+        }
+    }
+}
+
+} // Tins
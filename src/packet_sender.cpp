@@ -32,6 +32,7 @@
     #include <sys/socket.h>
     #include <sys/select.h>
     #include <sys/time.h>
+    #include <sys/uio.h>
     #include <arpa/inet.h>
     #include <unistd.h>
     #if defined(BSD) || defined(__FreeBSD_kernel__)
@@ -45,6 +46,15 @@
         #include <linux/if_ether.h>
         #include <linux/if_packet.h>
     #endif
+    #ifdef TINS_HAVE_PACKET_RING
+        #include <sys/mman.h>
+        #include <sys/ioctl.h>
+        #include <net/if.h>
+        #include <poll.h>
+    #endif // TINS_HAVE_PACKET_RING
+    #ifdef TINS_HAVE_EPOLL
+        #include <sys/epoll.h>
+    #endif // TINS_HAVE_EPOLL
     #include <netdb.h>
     #include <netinet/in.h>
     #include <errno.h>
@@ -53,7 +63,9 @@
     #include <ws2tcpip.h>
 #endif
 #include <cstring>
+#include <cerrno>
 #include <ctime>
+#include <algorithm>
 #include <sstream>
 #include <tins/pdu.h>
 #include <tins/macros.h>
@@ -63,6 +75,9 @@
 #include <tins/dot11/dot11_base.h>
 #include <tins/radiotap.h>
 #include <tins/ieee802_3.h>
+// PDUs inspected when filtering responses
+#include <tins/ip.h>
+#include <tins/ipv6.h>
 #include <tins/cxxstd.h>
 #include <tins/detail/pdu_helpers.h>
 #if TINS_IS_CXX11
@@ -86,6 +101,29 @@ const uint32_t PacketSender::DEFAULT_TIMEOUT = 2;
     const char* make_error_string() {
         return strerror(errno);
     }
+
+    // Points the iovecs to the headers and, if present, the payload
+    int make_iovecs(const Internals::GatherSerialization& buffer, struct iovec* iov) {
+        iov[0].iov_base = const_cast<uint8_t*>(buffer.headers());
+        iov[0].iov_len = buffer.headers_size();
+        iov[1].iov_base = const_cast<uint8_t*>(buffer.payload());
+        iov[1].iov_len = buffer.payload_size();
+        return buffer.payload_size() > 0 ? 2 : 1;
+    }
+
+    ssize_t send_buffers(int sock, 
+                         const Internals::GatherSerialization& buffer,
+                         struct sockaddr* link_addr, 
+                         uint32_t len_addr) {
+        struct iovec iov[2];
+        struct msghdr msg;
+        memset(&msg, 0, sizeof(msg));
+        msg.msg_name = link_addr;
+        msg.msg_namelen = len_addr;
+        msg.msg_iov = iov;
+        msg.msg_iovlen = make_iovecs(buffer, iov);
+        return ::sendmsg(sock, &msg, 0);
+    }
 #else
     typedef SOCKET socket_type;
 
@@ -95,6 +133,354 @@ const uint32_t PacketSender::DEFAULT_TIMEOUT = 2;
     }
 #endif
 
+namespace {
+
+// Keeps the addresses stored in batch buffers aligned
+uint32_t align_batch_offset(size_t offset) {
+    return static_cast<uint32_t>((offset + 7) & ~static_cast<size_t>(7));
+}
+
+#ifndef TINS_HAVE_SENDMMSG
+int last_socket_error() {
+    #ifndef _WIN32
+        return errno;
+    #else
+        return WSAGetLastError();
+    #endif // _WIN32
+}
+#endif // TINS_HAVE_SENDMMSG
+
+// Cheap check performed before PDU::matches_response. It compares a single 
+// field of the outermost header that any response must carry, so most 
+// unrelated traffic is dropped without being parsed
+class ResponseFilter {
+public:
+    ResponseFilter(const PDU& pdu) 
+    : offset_(0), size_(0), bypass_offset_(0), bypass_value_(0), has_bypass_(false) {
+        if (const EthernetII* eth = tins_cast<const EthernetII*>(&pdu)) {
+            // Responses are sent to our hardware address
+            set_key(0, eth->src_addr().begin(), EthernetII::address_type::address_size);
+        }
+        else if (const IP* ip = tins_cast<const IP*>(&pdu)) {
+            // This is already in network byte order
+            const uint32_t address = ip->src_addr();
+            if (address != 0) {
+                set_key(16, (const uint8_t*)&address, sizeof(address));
+                // ICMP errors are matched using the quoted header instead
+                has_bypass_ = true;
+                bypass_offset_ = 9;
+                bypass_value_ = Constants::IP::PROTO_ICMP;
+            }
+        }
+        else if (const IPv6* ipv6 = tins_cast<const IPv6*>(&pdu)) {
+            set_key(24, ipv6->src_addr().begin(), IPv6Address::address_size);
+        }
+    }
+
+    bool accepts(const uint8_t* ptr, uint32_t size) const {
+        if (size_ == 0) {
+            return true;
+        }
+        if (has_bypass_ && size > bypass_offset_ && ptr[bypass_offset_] == bypass_value_) {
+            return true;
+        }
+        return size >= offset_ + size_ && memcmp(ptr + offset_, key_, size_) == 0;
+    }
+private:
+    void set_key(uint32_t offset, const uint8_t* data, uint32_t size) {
+        offset_ = offset;
+        size_ = size;
+        memcpy(key_, data, size);
+    }
+
+    uint8_t key_[16];
+    uint32_t offset_;
+    uint32_t size_;
+    uint32_t bypass_offset_;
+    uint8_t bypass_value_;
+    bool has_bypass_;
+};
+
+#ifdef TINS_HAVE_EPOLL
+
+// Datagrams read by each recvmmsg call, and the space reserved for each of them
+const unsigned RECV_BATCH_SIZE = 16;
+const unsigned RECV_SLOT_SIZE = 2048;
+
+uint64_t monotonic_usec() {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return static_cast<uint64_t>(now.tv_sec) * 1000000 + now.tv_nsec / 1000;
+}
+
+#endif // TINS_HAVE_EPOLL
+
+} // anonymous namespace
+
+#ifdef TINS_HAVE_PACKET_RING
+
+// TxRingConfiguration
+
+const unsigned TxRingConfiguration::DEFAULT_FRAME_SIZE = 2048;
+const unsigned TxRingConfiguration::DEFAULT_FRAME_COUNT = 1024;
+
+TxRingConfiguration::TxRingConfiguration()
+: frame_size_(DEFAULT_FRAME_SIZE), frame_count_(DEFAULT_FRAME_COUNT),
+  flush_mode_(FLUSH_BLOCKING) {
+
+}
+
+void TxRingConfiguration::set_frame_size(unsigned size) {
+    frame_size_ = size;
+}
+
+void TxRingConfiguration::set_frame_count(unsigned count) {
+    frame_count_ = count;
+}
+
+void TxRingConfiguration::set_flush_mode(FlushMode mode) {
+    flush_mode_ = mode;
+}
+
+unsigned TxRingConfiguration::frame_size() const {
+    return frame_size_;
+}
+
+unsigned TxRingConfiguration::frame_count() const {
+    return frame_count_;
+}
+
+TxRingConfiguration::FlushMode TxRingConfiguration::flush_mode() const {
+    return flush_mode_;
+}
+
+namespace Internals {
+
+// The offset of the packet data within each frame
+const uint32_t TX_RING_DATA_OFFSET = TPACKET2_HDRLEN - sizeof(sockaddr_ll);
+
+void validate_tx_ring_configuration(const TxRingConfiguration& configuration) {
+    const unsigned frame_size = configuration.frame_size();
+    if (frame_size <= TX_RING_DATA_OFFSET || frame_size % TPACKET_ALIGNMENT != 0 ||
+        configuration.frame_count() == 0) {
+        throw invalid_ring_configuration();
+    }
+}
+
+// A TPACKET_V2 PACKET_TX_RING bound to a single interface
+class TxRing {
+public:
+    TxRing(const NetworkInterface& iface, const TxRingConfiguration& configuration);
+    ~TxRing();
+
+    int socket() const {
+        return fd_;
+    }
+
+    // Returns false and sets errno if the packet is too large or there's 
+    // no free frame
+    bool write(PDU& pdu, const uint8_t* payload, uint32_t payload_size);
+    // Returns false and sets errno if the kernel couldn't be told to send
+    bool flush();
+private:
+    TxRing(const TxRing&);
+    TxRing& operator=(const TxRing&);
+
+    tpacket2_hdr* frame_header(uint32_t index) const;
+    bool reserve_frame(tpacket2_hdr* header, uint32_t size);
+    bool wait_for_frame(tpacket2_hdr* header);
+    void cleanup();
+
+    uint8_t* ring_;
+    size_t ring_size_;
+    int fd_;
+    uint32_t block_size_;
+    uint32_t frame_size_;
+    uint32_t frames_per_block_;
+    uint32_t frame_count_;
+    uint32_t current_frame_;
+    uint32_t max_packet_size_;
+    bool blocking_;
+    bool pending_;
+};
+
+TxRing::TxRing(const NetworkInterface& iface, const TxRingConfiguration& configuration)
+: ring_(0), ring_size_(0), fd_(-1), block_size_(), frame_size_(configuration.frame_size()),
+  frames_per_block_(), frame_count_(), current_frame_(0), max_packet_size_(),
+  blocking_(configuration.flush_mode() == TxRingConfiguration::FLUSH_BLOCKING),
+  pending_(false) {
+    validate_tx_ring_configuration(configuration);
+    // Frames can't span blocks, which must be a multiple of the page size
+    const uint32_t page_size = static_cast<uint32_t>(sysconf(_SC_PAGESIZE));
+    block_size_ = (frame_size_ + page_size - 1) / page_size * page_size;
+    frames_per_block_ = block_size_ / frame_size_;
+    const uint32_t block_count = (configuration.frame_count() + frames_per_block_ - 1) / 
+                                 frames_per_block_;
+    frame_count_ = block_count * frames_per_block_;
+    try {
+        // Protocol 0, as this socket is never used to receive packets
+        fd_ = ::socket(AF_PACKET, SOCK_RAW, 0);
+        if (fd_ < 0) {
+            throw socket_open_error(make_error_string());
+        }
+        int version = TPACKET_V2;
+        if (setsockopt(fd_, SOL_PACKET, PACKET_VERSION, &version, sizeof(version)) < 0) {
+            throw socket_open_error(make_error_string());
+        }
+        // Otherwise, the kernel stops sending at the first frame it can't
+        // send, marking it as TP_STATUS_WRONG_FORMAT, and never moves past it
+        int loss = 1;
+        if (setsockopt(fd_, SOL_PACKET, PACKET_LOSS, &loss, sizeof(loss)) < 0) {
+            throw socket_open_error(make_error_string());
+        }
+        // The kernel rejects packets larger than the MTU plus the link 
+        // layer and VLAN headers, so these are reported before being written
+        ifreq request_mtu;
+        memset(&request_mtu, 0, sizeof(request_mtu));
+        strncpy(request_mtu.ifr_name, iface.name().c_str(), sizeof(request_mtu.ifr_name) - 1);
+        if (ioctl(fd_, SIOCGIFMTU, &request_mtu) < 0) {
+            throw socket_open_error(make_error_string());
+        }
+        max_packet_size_ = std::min<uint32_t>(
+            frame_size_ - TX_RING_DATA_OFFSET,
+            static_cast<uint32_t>(request_mtu.ifr_mtu) + ETH_HLEN + 4
+        );
+
+        tpacket_req request;
+        memset(&request, 0, sizeof(request));
+        request.tp_block_size = block_size_;
+        request.tp_block_nr = block_count;
+        request.tp_frame_size = frame_size_;
+        request.tp_frame_nr = frame_count_;
+        if (setsockopt(fd_, SOL_PACKET, PACKET_TX_RING, &request, sizeof(request)) < 0) {
+            throw socket_open_error(make_error_string());
+        }
+        ring_size_ = static_cast<size_t>(block_size_) * block_count;
+        void* ring = mmap(0, ring_size_, PROT_READ | PROT_WRITE, MAP_SHARED, fd_, 0);
+        if (ring == MAP_FAILED) {
+            ring_size_ = 0;
+            throw socket_open_error(make_error_string());
+        }
+        ring_ = static_cast<uint8_t*>(ring);
+
+        sockaddr_ll address;
+        memset(&address, 0, sizeof(address));
+        address.sll_family = AF_PACKET;
+        address.sll_ifindex = iface.id();
+        if (bind(fd_, (const sockaddr*)&address, sizeof(address)) < 0) {
+            throw socket_open_error(make_error_string());
+        }
+    }
+    catch (...) {
+        cleanup();
+        throw;
+    }
+}
+
+TxRing::~TxRing() {
+    cleanup();
+}
+
+bool TxRing::write(PDU& pdu, const uint8_t* payload, uint32_t payload_size) {
+    tpacket2_hdr* header = frame_header(current_frame_);
+    uint8_t* data = (uint8_t*)header + TX_RING_DATA_OFFSET;
+    uint32_t size;
+    if (payload_size == 0) {
+        size = pdu.size();
+        if (!reserve_frame(header, size)) {
+            return false;
+        }
+        pdu.serialize_into(data, size);
+    }
+    else {
+        // The headers have to account for the external payload
+        Internals::GatherSerialization buffer(pdu, payload, payload_size, true);
+        size = buffer.size();
+        if (!reserve_frame(header, size)) {
+            return false;
+        }
+        memcpy(data, buffer.headers(), buffer.headers_size());
+        if (buffer.payload_size() > 0) {
+            memcpy(data + buffer.headers_size(), buffer.payload(), buffer.payload_size());
+        }
+    }
+    header->tp_len = size;
+    // The frame is handed to the kernel only after it's been written
+    __atomic_store_n(&header->tp_status, TP_STATUS_SEND_REQUEST, __ATOMIC_RELEASE);
+    current_frame_ = (current_frame_ + 1) % frame_count_;
+    pending_ = true;
+    return true;
+}
+
+bool TxRing::flush() {
+    if (!pending_) {
+        return true;
+    }
+    // In blocking mode, this returns once every frame has been sent
+    while (::send(fd_, 0, 0, blocking_ ? 0 : MSG_DONTWAIT) < 0) {
+        if (errno != EINTR) {
+            return false;
+        }
+    }
+    pending_ = false;
+    return true;
+}
+
+tpacket2_hdr* TxRing::frame_header(uint32_t index) const {
+    const uint32_t block = index / frames_per_block_;
+    const uint32_t frame = index % frames_per_block_;
+    return (tpacket2_hdr*)(ring_ + block * block_size_ + frame * frame_size_);
+}
+
+bool TxRing::reserve_frame(tpacket2_hdr* header, uint32_t size) {
+    if (size > max_packet_size_) {
+        errno = EMSGSIZE;
+        return false;
+    }
+    return wait_for_frame(header);
+}
+
+bool TxRing::wait_for_frame(tpacket2_hdr* header) {
+    while (true) {
+        const uint32_t status = __atomic_load_n(&header->tp_status, __ATOMIC_ACQUIRE);
+        // PACKET_LOSS makes the kernel release rejected frames, but treat 
+        // them as free in case it ever leaves one behind
+        if (status == TP_STATUS_AVAILABLE || (status & TP_STATUS_WRONG_FORMAT) != 0) {
+            return true;
+        }
+        if (!blocking_) {
+            errno = ENOBUFS;
+            return false;
+        }
+        // Frames only become available once the kernel is told to send them
+        if (!flush()) {
+            return false;
+        }
+        pollfd descriptor;
+        descriptor.fd = fd_;
+        descriptor.events = POLLOUT;
+        descriptor.revents = 0;
+        if (poll(&descriptor, 1, -1) < 0 && errno != EINTR) {
+            return false;
+        }
+    }
+}
+
+void TxRing::cleanup() {
+    if (ring_) {
+        munmap(ring_, ring_size_);
+        ring_ = 0;
+    }
+    if (fd_ != -1) {
+        ::close(fd_);
+        fd_ = -1;
+    }
+}
+
+} // Internals
+
+#endif // TINS_HAVE_PACKET_RING
+
 PacketSender::PacketSender(const NetworkInterface& iface, 
                            uint32_t recv_timeout, 
                            uint32_t usec) 
@@ -102,7 +488,13 @@ PacketSender::PacketSender(const NetworkInterface& iface,
 #if !defined(BSD) && !defined(_WIN32) && !defined(__FreeBSD_kernel__)
   ether_socket_(INVALID_RAW_SOCKET),
 #endif
-  _timeout(recv_timeout), timeout_usec_(usec), default_iface_(iface) {
+  _timeout(recv_timeout), timeout_usec_(usec), default_iface_(iface),
+  payload_(), payload_size_(), gather_payloads_(false), batch_packets_(),
+  batching_(false)
+#ifdef TINS_HAVE_PACKET_RING
+  , tx_ring_enabled_(false)
+#endif // TINS_HAVE_PACKET_RING
+  {
     types_[IP_TCP_SOCKET] = IPPROTO_TCP;
     types_[IP_UDP_SOCKET] = IPPROTO_UDP;
     types_[IP_RAW_SOCKET] = IPPROTO_RAW;
@@ -138,6 +530,12 @@ PacketSender::~PacketSender() {
         }
         pcap_handles_.clear();
     #endif // TINS_HAVE_PACKET_SENDER_PCAP_SENDPACKET
+    #ifdef TINS_HAVE_PACKET_RING
+        close_tx_rings();
+    #endif // TINS_HAVE_PACKET_RING
+    #ifdef TINS_HAVE_EPOLL
+        close_epoll_sets(INVALID_RAW_SOCKET);
+    #endif // TINS_HAVE_EPOLL
 }
 
 void PacketSender::default_interface(const NetworkInterface& iface) {
@@ -148,6 +546,79 @@ const NetworkInterface& PacketSender::default_interface() const {
     return default_iface_;
 }
 
+void PacketSender::gather_payloads(bool value) {
+    gather_payloads_ = value;
+}
+
+bool PacketSender::gather_payloads() const {
+    return gather_payloads_;
+}
+
+#ifdef TINS_HAVE_PACKET_RING
+
+void PacketSender::enable_tx_ring(const TxRingConfiguration& configuration) {
+    // Report invalid configurations now rather than on the first send
+    Internals::validate_tx_ring_configuration(configuration);
+    close_tx_rings();
+    tx_ring_configuration_ = configuration;
+    tx_ring_enabled_ = true;
+}
+
+void PacketSender::disable_tx_ring() {
+    close_tx_rings();
+    tx_ring_enabled_ = false;
+}
+
+bool PacketSender::tx_ring_enabled() const {
+    return tx_ring_enabled_;
+}
+
+Internals::TxRing& PacketSender::get_tx_ring(const NetworkInterface& iface) {
+    TxRings::iterator iter = tx_rings_.find(iface.id());
+    if (iter == tx_rings_.end()) {
+        open_l2_socket(iface);
+        iter = tx_rings_.find(iface.id());
+    }
+    return *iter->second;
+}
+
+Internals::TxRing* PacketSender::find_tx_ring(int sock) const {
+    for (TxRings::const_iterator iter = tx_rings_.begin(); iter != tx_rings_.end(); ++iter) {
+        if (iter->second->socket() == sock) {
+            return iter->second;
+        }
+    }
+    return 0;
+}
+
+void PacketSender::send_tx_ring(PDU& pdu, const NetworkInterface& iface) {
+    Internals::TxRing& ring = get_tx_ring(iface);
+    if (batching_) {
+        // The ring is flushed once the whole batch has been written
+        batch_message message = batch_message();
+        message.socket = ring.socket();
+        message.packet_index = batch_packets_;
+        message.tx_ring = true;
+        if (!ring.write(pdu, payload_, payload_size_)) {
+            message.error = errno;
+        }
+        batch_messages_.push_back(message);
+        return;
+    }
+    if (!ring.write(pdu, payload_, payload_size_) || !ring.flush()) {
+        throw socket_write_error(make_error_string());
+    }
+}
+
+void PacketSender::close_tx_rings() {
+    for (TxRings::iterator iter = tx_rings_.begin(); iter != tx_rings_.end(); ++iter) {
+        delete iter->second;
+    }
+    tx_rings_.clear();
+}
+
+#endif // TINS_HAVE_PACKET_RING
+
 #if !defined(_WIN32) || defined(TINS_HAVE_PACKET_SENDER_PCAP_SENDPACKET)
 
 #ifndef _WIN32
@@ -234,6 +705,13 @@ void PacketSender::open_l2_socket(const NetworkInterface& iface) {
         }
         ether_socket_[iface.id()] = sock;
     #else
+    #ifdef TINS_HAVE_PACKET_RING
+    if (tx_ring_enabled_ && tx_rings_.count(iface.id()) == 0) {
+        Internals::TxRing* ring = new Internals::TxRing(iface, tx_ring_configuration_);
+        tx_rings_.insert(make_pair(iface.id(), ring));
+    }
+    // The socket is still needed to receive responses
+    #endif // TINS_HAVE_PACKET_RING
     Internals::unused(iface);
     if (ether_socket_ == INVALID_RAW_SOCKET) {
         ether_socket_ = socket(PF_PACKET, SOCK_RAW, htons(ETH_P_ALL));
@@ -290,6 +768,9 @@ void PacketSender::close_socket(SocketType type, const NetworkInterface& iface)
         if (ether_socket_ == INVALID_RAW_SOCKET) {
             throw invalid_socket_type();
         }
+        #ifdef TINS_HAVE_EPOLL
+        close_epoll_sets(ether_socket_);
+        #endif // TINS_HAVE_EPOLL
         if (::close(ether_socket_) == -1) {
             throw socket_close_error(make_error_string());
         }
@@ -301,6 +782,9 @@ void PacketSender::close_socket(SocketType type, const NetworkInterface& iface)
         if (type >= SOCKETS_END || sockets_[type] == INVALID_RAW_SOCKET) {
             throw invalid_socket_type();
         }
+        #ifdef TINS_HAVE_EPOLL
+        close_epoll_sets(sockets_[type]);
+        #endif // TINS_HAVE_EPOLL
         #ifndef _WIN32
         if (close(sockets_[type]) == -1) {
             throw socket_close_error(make_error_string());
@@ -336,6 +820,209 @@ void PacketSender::send(PDU& pdu, const NetworkInterface& iface) {
     }
 }
 
+void PacketSender::send(PDU& pdu, const uint8_t* payload, uint32_t payload_size) {
+    send(pdu, payload, payload_size, default_iface_);
+}
+
+void PacketSender::send(PDU& pdu, const uint8_t* payload, uint32_t payload_size,
+                        const NetworkInterface& iface) {
+    // The payload is picked up by send_l2/send_l3 once the PDU calls them
+    payload_ = payload;
+    payload_size_ = payload_size;
+    try {
+        send(pdu, iface);
+    }
+    catch (...) {
+        payload_ = 0;
+        payload_size_ = 0;
+        throw;
+    }
+    payload_ = 0;
+    payload_size_ = 0;
+}
+
+void PacketSender::begin_batch() {
+    batch_buffer_.clear();
+    batch_messages_.clear();
+    batch_packets_ = 0;
+    batching_ = true;
+}
+
+void PacketSender::queue_batch_packet(PDU& pdu) {
+    const size_t queued_messages = batch_messages_.size();
+    try {
+        // send_l2/send_l3 queue the packet rather than sending it
+        send(pdu);
+    }
+    catch (exception_base&) {
+        // Report it as this packet's error and keep going. Frames this 
+        // packet already wrote into a TX ring are still sent.
+        size_t kept = queued_messages;
+        for (size_t i = queued_messages; i < batch_messages_.size(); ++i) {
+            if (batch_messages_[i].tx_ring) {
+                batch_messages_[kept++] = batch_messages_[i];
+            }
+        }
+        batch_messages_.resize(kept);
+        batch_message message = batch_message();
+        message.socket = INVALID_RAW_SOCKET;
+        message.packet_index = batch_packets_;
+        message.error = EINVAL;
+        batch_messages_.push_back(message);
+    }
+    batch_packets_++;
+}
+
+void PacketSender::queue_batch_message(int sock, PDU& pdu, struct sockaddr* link_addr,
+                                       uint32_t len_addr) {
+    batch_message message;
+    message.socket = sock;
+    message.packet_index = batch_packets_;
+    message.address_offset = align_batch_offset(batch_buffer_.size());
+    message.address_size = link_addr ? len_addr : 0;
+    message.data_offset = align_batch_offset(message.address_offset + message.address_size);
+    message.data_size = pdu.size();
+    message.error = 0;
+    message.tx_ring = false;
+    batch_buffer_.resize(message.data_offset + message.data_size);
+    if (message.address_size > 0) {
+        memcpy(&batch_buffer_[message.address_offset], link_addr, message.address_size);
+    }
+    if (message.data_size > 0) {
+        pdu.serialize_into(&batch_buffer_[message.data_offset], message.data_size);
+    }
+    batch_messages_.push_back(message);
+}
+
+uint32_t PacketSender::flush_batch(vector<int>* errors) {
+    const uint32_t packet_count = batch_packets_;
+    if (errors) {
+        errors->assign(packet_count, 0);
+    }
+    uint32_t failures = 0;
+    size_t first = 0;
+    try {
+        while (first < batch_messages_.size()) {
+            const batch_message& message = batch_messages_[first];
+            if (message.error != 0) {
+                if (errors) {
+                    (*errors)[message.packet_index] = message.error;
+                }
+                ++failures;
+                ++first;
+                continue;
+            }
+            // Consecutive messages going through the same socket are sent together
+            size_t last = first + 1;
+            while (last < batch_messages_.size() && 
+                   batch_messages_[last].socket == message.socket &&
+                   batch_messages_[last].error == 0) {
+                ++last;
+            }
+            failures += send_batch_messages(first, last, errors);
+            first = last;
+        }
+    }
+    catch (...) {
+        end_batch();
+        throw;
+    }
+    end_batch();
+    return packet_count - failures;
+}
+
+uint32_t PacketSender::send_batch_messages(size_t first, size_t last, vector<int>* errors) {
+    uint32_t failures = 0;
+    #ifdef TINS_HAVE_PACKET_RING
+        if (batch_messages_[first].tx_ring) {
+            // These were already written into the ring, which only needs a kick
+            Internals::TxRing* ring = find_tx_ring(batch_messages_[first].socket);
+            if (ring && ring->flush()) {
+                return 0;
+            }
+            const int error = errno;
+            for (size_t i = first; i < last; ++i) {
+                if (errors) {
+                    (*errors)[batch_messages_[i].packet_index] = error;
+                }
+            }
+            return static_cast<uint32_t>(last - first);
+        }
+    #endif // TINS_HAVE_PACKET_RING
+    #ifdef TINS_HAVE_SENDMMSG
+        const size_t count = last - first;
+        if (batch_headers_.size() < count) {
+            batch_headers_.resize(count);
+            batch_iovecs_.resize(count);
+        }
+        struct mmsghdr* headers = &batch_headers_[0];
+        struct iovec* buffers = &batch_iovecs_[0];
+        for (size_t i = 0; i < count; ++i) {
+            const batch_message& message = batch_messages_[first + i];
+            buffers[i].iov_base = &batch_buffer_[0] + message.data_offset;
+            buffers[i].iov_len = message.data_size;
+            memset(&headers[i], 0, sizeof(headers[i]));
+            if (message.address_size > 0) {
+                headers[i].msg_hdr.msg_name = &batch_buffer_[message.address_offset];
+                headers[i].msg_hdr.msg_namelen = message.address_size;
+            }
+            headers[i].msg_hdr.msg_iov = &buffers[i];
+            headers[i].msg_hdr.msg_iovlen = 1;
+        }
+        const int sock = batch_messages_[first].socket;
+        size_t index = 0;
+        while (index < count) {
+            const int result = ::sendmmsg(sock, &headers[index], 
+                                          static_cast<unsigned>(count - index), 0);
+            if (result > 0) {
+                index += result;
+                continue;
+            }
+            if (errno == EINTR) {
+                continue;
+            }
+            // The first message that couldn't be sent is skipped
+            if (errors) {
+                (*errors)[batch_messages_[first + index].packet_index] = errno;
+            }
+            ++failures;
+            ++index;
+        }
+    #else
+        for (size_t i = first; i < last; ++i) {
+            const batch_message& message = batch_messages_[i];
+            const char* data = (const char*)&batch_buffer_[0] + message.data_offset;
+            const int data_size = static_cast<int>(message.data_size);
+            int result;
+            if (message.address_size > 0) {
+                struct sockaddr* address = (struct sockaddr*)&batch_buffer_[message.address_offset];
+                result = ::sendto((socket_type)message.socket, data, data_size, 0, 
+                                  address, message.address_size);
+            }
+            else {
+                #ifndef _WIN32
+                    result = ::write(message.socket, data, data_size);
+                #else
+                    result = ::send((socket_type)message.socket, data, data_size, 0);
+                #endif // _WIN32
+            }
+            if (result == -1) {
+                if (errors) {
+                    (*errors)[message.packet_index] = last_socket_error();
+                }
+                ++failures;
+            }
+        }
+    #endif // TINS_HAVE_SENDMMSG
+    return failures;
+}
+
+void PacketSender::end_batch() {
+    batch_messages_.clear();
+    batch_packets_ = 0;
+    batching_ = false;
+}
+
 PDU* PacketSender::send_recv(PDU& pdu) {
     return send_recv(pdu, default_iface_);
 }
@@ -355,26 +1042,45 @@ void PacketSender::send_l2(PDU& pdu,
                            struct sockaddr* link_addr, 
                            uint32_t len_addr,
                            const NetworkInterface& iface) {
-    PDU::serialization_type buffer = pdu.serialize();
-
     #ifdef TINS_HAVE_PACKET_SENDER_PCAP_SENDPACKET
         Internals::unused(len_addr);
         Internals::unused(link_addr);
+        // pcap_sendpacket takes a single buffer
+        Internals::GatherSerialization buffer(pdu, payload_, payload_size_, false);
         open_l2_socket(iface);
         pcap_t* handle = pcap_handles_[iface];
         const int buf_size = static_cast<int>(buffer.size());
-        if (pcap_sendpacket(handle, (u_char*)&buffer[0], buf_size) != 0) {
+        if (pcap_sendpacket(handle, (u_char*)buffer.headers(), buf_size) != 0) {
             throw pcap_error("Failed to send packet: " + string(pcap_geterr(handle)));
         }
     #else // TINS_HAVE_PACKET_SENDER_PCAP_SENDPACKET
+        #ifdef TINS_HAVE_PACKET_RING
+        if (tx_ring_enabled_) {
+            Internals::unused(len_addr);
+            Internals::unused(link_addr);
+            send_tx_ring(pdu, iface);
+            return;
+        }
+        #endif // TINS_HAVE_PACKET_RING
         int sock = get_ether_socket(iface);
-        if (!buffer.empty()) {
+        if (batching_) {
+            #if defined(BSD) || defined(__FreeBSD_kernel__)
+            // BPF devices are written to directly
+            queue_batch_message(sock, pdu, 0, 0);
+            #else
+            queue_batch_message(sock, pdu, link_addr, len_addr);
+            #endif
+            return;
+        }
+        Internals::GatherSerialization buffer(pdu, payload_, payload_size_, gather_payloads_);
+        if (buffer.size() > 0) {
             #if defined(BSD) || defined(__FreeBSD_kernel__)
             Internals::unused(len_addr);
             Internals::unused(link_addr);
-            if (::write(sock, &buffer[0], buffer.size()) == -1) {
+            struct iovec iov[2];
+            if (::writev(sock, iov, make_iovecs(buffer, iov)) == -1) {
             #else
-            if (::sendto(sock, &buffer[0], buffer.size(), 0, link_addr, len_addr) == -1) {
+            if (send_buffers(sock, buffer, link_addr, len_addr) == -1) {
             #endif
                 throw socket_write_error(make_error_string());
             }
@@ -417,11 +1123,22 @@ void PacketSender::send_l3(PDU& pdu,
                            SocketType type) {
     open_l3_socket(type);
     int sock = sockets_[type];
-    PDU::serialization_type buffer = pdu.serialize();
-    const int buf_size = static_cast<int>(buffer.size());
-    if (sendto(sock, (const char*)&buffer[0], buf_size, 0, link_addr, len_addr) == -1) {
-        throw socket_write_error(make_error_string());
+    if (batching_) {
+        queue_batch_message(sock, pdu, link_addr, len_addr);
+        return;
     }
+    #ifndef _WIN32
+        Internals::GatherSerialization buffer(pdu, payload_, payload_size_, gather_payloads_);
+        if (send_buffers(sock, buffer, link_addr, len_addr) == -1) {
+            throw socket_write_error(make_error_string());
+        }
+    #else
+        Internals::GatherSerialization buffer(pdu, payload_, payload_size_, false);
+        const int buf_size = static_cast<int>(buffer.size());
+        if (sendto(sock, (const char*)buffer.headers(), buf_size, 0, link_addr, len_addr) == -1) {
+            throw socket_write_error(make_error_string());
+        }
+    #endif // _WIN32
 }
 
 PDU* PacketSender::recv_match_loop(const vector<int>& sockets, 
@@ -436,6 +1153,20 @@ PDU* PacketSender::recv_match_loop(const vector<int>& sockets,
         typedef socklen_t socket_len_type;
         typedef ssize_t recvfrom_ret_type;
     #endif
+    // Neither epoll_ctl nor FD_SET can handle sockets that failed to open
+    if (std::find(sockets.begin(), sockets.end(), INVALID_RAW_SOCKET) != sockets.end()) {
+        throw socket_open_error("Invalid socket");
+    }
+    #ifdef TINS_HAVE_EPOLL
+        const int epoll_fd = get_epoll_set(sockets);
+        if (epoll_fd != INVALID_RAW_SOCKET) {
+            Internals::unused(link_addr);
+            Internals::unused(addrlen);
+            Internals::unused(is_layer_3);
+            return recv_match_epoll(epoll_fd, pdu);
+        }
+    #endif // TINS_HAVE_EPOLL
+    const ResponseFilter filter(pdu);
     fd_set readfds;
     struct timeval timeout,  end_time;
     int read;
@@ -477,7 +1208,8 @@ PDU* PacketSender::recv_match_loop(const vector<int>& sockets,
                         while (ptr < (buffer + size)) {
                             const bpf_hdr* bpf_header = reinterpret_cast<const bpf_hdr*>(ptr);
                             const uint8_t* pkt_start = ptr + bpf_header->bh_hdrlen;
-                            if (pdu.matches_response(pkt_start, bpf_header->bh_caplen)) {
+                            if (filter.accepts(pkt_start, bpf_header->bh_caplen) &&
+                                pdu.matches_response(pkt_start, bpf_header->bh_caplen)) {
                                 return Internals::pdu_from_flag(pdu.pdu_type(), pkt_start, bpf_header->bh_caplen);
                             }
                             ptr += BPF_WORDALIGN(bpf_header->bh_hdrlen + bpf_header->bh_caplen);
@@ -487,7 +1219,8 @@ PDU* PacketSender::recv_match_loop(const vector<int>& sockets,
                     else {
                         socket_len_type length = addrlen;
                         size = ::recvfrom(*it, (char*)buffer, buffer_size, 0, link_addr, &length);
-                        if (pdu.matches_response(buffer, size)) {
+                        if (size > 0 && filter.accepts(buffer, size) && 
+                            pdu.matches_response(buffer, size)) {
                             return Internals::pdu_from_flag(pdu.pdu_type(), buffer, size);
                         }
                     }
@@ -533,6 +1266,93 @@ PDU* PacketSender::recv_match_loop(const vector<int>& sockets,
     return 0;
 }
 
+#ifdef TINS_HAVE_EPOLL
+
+int PacketSender::get_epoll_set(const vector<int>& sockets) {
+    EpollSets::const_iterator iter = epoll_sets_.find(sockets);
+    if (iter != epoll_sets_.end()) {
+        return iter->second;
+    }
+    const int epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    if (epoll_fd == -1) {
+        return INVALID_RAW_SOCKET;
+    }
+    for (size_t i = 0; i < sockets.size(); ++i) {
+        struct epoll_event event;
+        memset(&event, 0, sizeof(event));
+        event.events = EPOLLIN;
+        event.data.fd = sockets[i];
+        if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, sockets[i], &event) == -1) {
+            ::close(epoll_fd);
+            return INVALID_RAW_SOCKET;
+        }
+    }
+    epoll_sets_.insert(make_pair(sockets, epoll_fd));
+    return epoll_fd;
+}
+
+void PacketSender::close_epoll_sets(int sock) {
+    EpollSets::iterator iter = epoll_sets_.begin();
+    while (iter != epoll_sets_.end()) {
+        const vector<int>& sockets = iter->first;
+        if (sock == INVALID_RAW_SOCKET || 
+            std::find(sockets.begin(), sockets.end(), sock) != sockets.end()) {
+            ::close(iter->second);
+            epoll_sets_.erase(iter++);
+        }
+        else {
+            ++iter;
+        }
+    }
+}
+
+PDU* PacketSender::recv_match_epoll(int epoll_fd, PDU& pdu) {
+    const ResponseFilter filter(pdu);
+    const uint64_t end_time = monotonic_usec() + static_cast<uint64_t>(_timeout) * 1000000 + 
+                              timeout_usec_;
+    recv_buffer_.resize(RECV_BATCH_SIZE * RECV_SLOT_SIZE);
+    struct mmsghdr headers[RECV_BATCH_SIZE];
+    struct iovec iov[RECV_BATCH_SIZE];
+    struct epoll_event events[RECV_BATCH_SIZE];
+    while (true) {
+        const uint64_t now = monotonic_usec();
+        if (now > end_time) {
+            return 0;
+        }
+        // Round up so we don't wake up right before the deadline
+        const int timeout_ms = static_cast<int>((end_time - now + 999) / 1000);
+        const int ready = epoll_wait(epoll_fd, events, RECV_BATCH_SIZE, timeout_ms);
+        if (ready == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return 0;
+        }
+        for (int i = 0; i < ready; ++i) {
+            for (unsigned j = 0; j < RECV_BATCH_SIZE; ++j) {
+                iov[j].iov_base = &recv_buffer_[j * RECV_SLOT_SIZE];
+                iov[j].iov_len = RECV_SLOT_SIZE;
+                memset(&headers[j], 0, sizeof(headers[j]));
+                headers[j].msg_hdr.msg_iov = &iov[j];
+                headers[j].msg_hdr.msg_iovlen = 1;
+            }
+            const int received = recvmmsg(events[i].data.fd, headers, RECV_BATCH_SIZE, 
+                                          MSG_DONTWAIT, 0);
+            // Anything read after a match is dropped, just like any other 
+            // packet that isn't a response
+            for (int j = 0; j < received; ++j) {
+                const uint8_t* buffer = &recv_buffer_[j * RECV_SLOT_SIZE];
+                const uint32_t size = headers[j].msg_len;
+                if (filter.accepts(buffer, size) && pdu.matches_response(buffer, size)) {
+                    return Internals::pdu_from_flag(pdu.pdu_type(), buffer, size);
+                }
+            }
+        }
+    }
+}
+
+#endif // TINS_HAVE_EPOLL
+
 int PacketSender::find_type(SocketType type) {
     SocketTypeMap::iterator it = types_.find(type);
     if (it == types_.end()) {
@@ -0,0 +1,215 @@
+/*
+ * Copyright (c) 2017, Matias Fontanini
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are
+ * met:
+ * 
+ * * Redistributions of source code must retain the above copyright
+ *   notice, this list of conditions and the following disclaimer.
+ * * Redistributions in binary form must reproduce the above
+ *   copyright notice, this list of conditions and the following disclaimer
+ *   in the documentation and/or other materials provided with the
+ *   distribution.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+
+#include <cstring>
+#include <stdexcept>
+#include <tins/packet_template.h>
+#include <tins/packet_view.h>
+#include <tins/exceptions.h>
+#include <tins/memory_helpers.h>
+#include <tins/detail/pdu_helpers.h>
+
+using std::memcpy;
+using std::runtime_error;
+
+namespace Tins {
+
+PacketTemplate::PacketTemplate(PDU& pdu)
+: network_offset_(), network_header_end_(), transport_offset_(), transport_end_(),
+  payload_offset_(), transport_checksum_(), has_ip_(false), has_ipv6_(false),
+  has_tcp_(false), has_udp_(false) {
+    pdu.serialize_into(buffer_);
+    if (buffer_.empty()) {
+        return;
+    }
+    const PacketView view(&buffer_[0], size(), pdu.pdu_type());
+    has_ip_ = view.has_ip();
+    has_ipv6_ = view.has_ipv6();
+    has_tcp_ = view.has_tcp();
+    has_udp_ = view.has_udp();
+    if (has_ip_ || has_ipv6_) {
+        network_offset_ = view.network_offset();
+        transport_end_ = network_offset_ + view.network_size();
+        if (has_ip_) {
+            network_header_end_ = network_offset_ + (buffer_[network_offset_] & 0x0f) * 4;
+        }
+        else {
+            network_header_end_ = network_offset_ + 40;
+        }
+    }
+    if (has_tcp_ || has_udp_) {
+        transport_offset_ = view.transport_offset();
+        transport_checksum_ = transport_offset_ + (has_tcp_ ? 16 : 6);
+        payload_offset_ = static_cast<uint32_t>(view.payload() - view.data());
+    }
+}
+
+PacketTemplate::field_id PacketTemplate::add_field(Field field) {
+    switch (field) {
+        case SRC_ADDR:
+        case DST_ADDR:
+            if (has_ip_) {
+                return add_field(network_offset_ + (field == SRC_ADDR ? 12 : 16), 4, 
+                                 IPV4_FIELD, NETWORK_CHECKSUM | TRANSPORT_CHECKSUM);
+            }
+            if (has_ipv6_) {
+                return add_field(network_offset_ + (field == SRC_ADDR ? 8 : 24), 16,
+                                 IPV6_FIELD, TRANSPORT_CHECKSUM);
+            }
+            break;
+        case IP_ID:
+            if (has_ip_) {
+                return add_field(network_offset_ + 4, 2, INTEGER_FIELD, NETWORK_CHECKSUM);
+            }
+            break;
+        case SPORT:
+        case DPORT:
+            if (has_tcp_ || has_udp_) {
+                return add_field(transport_offset_ + (field == SPORT ? 0 : 2), 2,
+                                 INTEGER_FIELD, TRANSPORT_CHECKSUM);
+            }
+            break;
+        case SEQ:
+        case ACK_SEQ:
+            if (has_tcp_) {
+                return add_field(transport_offset_ + (field == SEQ ? 4 : 8), 4,
+                                 INTEGER_FIELD, TRANSPORT_CHECKSUM);
+            }
+            break;
+    }
+    throw pdu_not_found();
+}
+
+PacketTemplate::field_id PacketTemplate::add_payload_field(uint32_t offset, uint32_t size) {
+    if (!has_tcp_ && !has_udp_) {
+        throw pdu_not_found();
+    }
+    if (offset > transport_end_ - payload_offset_ || 
+        size > transport_end_ - payload_offset_ - offset) {
+        throw runtime_error("Payload field doesn't fit in the payload");
+    }
+    return add_field(payload_offset_ + offset, size, PAYLOAD_FIELD, TRANSPORT_CHECKSUM);
+}
+
+void PacketTemplate::set(field_id id, uint32_t value) {
+    const field_info& field = get_field(id, INTEGER_FIELD);
+    uint8_t data[sizeof(uint32_t)];
+    if (field.size == sizeof(uint16_t)) {
+        Memory::write_be_value(data, static_cast<uint16_t>(value));
+    }
+    else {
+        Memory::write_be_value(data, value);
+    }
+    patch(field, data);
+}
+
+void PacketTemplate::set(field_id id, IPv4Address address) {
+    const field_info& field = get_field(id, IPV4_FIELD);
+    // This is already in network byte order
+    const uint32_t value = address;
+    uint8_t data[sizeof(value)];
+    memcpy(data, &value, sizeof(value));
+    patch(field, data);
+}
+
+void PacketTemplate::set(field_id id, const IPv6Address& address) {
+    patch(get_field(id, IPV6_FIELD), address.begin());
+}
+
+void PacketTemplate::set(field_id id, const uint8_t* data) {
+    patch(get_field(id), data);
+}
+
+uint32_t PacketTemplate::field_size(field_id id) const {
+    return get_field(id).size;
+}
+
+PacketTemplate::field_id PacketTemplate::add_field(uint32_t offset, uint32_t size, 
+                                                   field_kind kind, int scope) {
+    fields_.push_back(field_info(offset, size, kind, scope));
+    return static_cast<field_id>(fields_.size() - 1);
+}
+
+const PacketTemplate::field_info& PacketTemplate::get_field(field_id id) const {
+    if (id >= fields_.size()) {
+        throw runtime_error("Invalid field identifier");
+    }
+    return fields_[id];
+}
+
+const PacketTemplate::field_info& PacketTemplate::get_field(field_id id, 
+                                                            field_kind kind) const {
+    const field_info& field = get_field(id);
+    if (field.kind != kind) {
+        throw runtime_error("Field has a different type");
+    }
+    return field;
+}
+
+void PacketTemplate::patch(const field_info& field, const uint8_t* data) {
+    // Fields in the network header are part of the pseudo header as well
+    const bool in_network_header = field.offset < network_header_end_;
+    const uint32_t origin = in_network_header ? network_offset_ : transport_offset_;
+    const uint32_t end = in_network_header ? network_header_end_ : transport_end_;
+    const bool update_network = (field.scope & NETWORK_CHECKSUM) != 0 && has_ip_;
+    // A UDP checksum of 0 means there's no checksum at all
+    const bool update_transport = (field.scope & TRANSPORT_CHECKSUM) != 0 &&
+                                  (has_tcp_ || (has_udp_ && 
+                                   Memory::read_be_value<uint16_t>(
+                                       &buffer_[transport_checksum_]) != 0));
+    if (!update_network && !update_transport) {
+        memcpy(&buffer_[field.offset], data, field.size);
+        return;
+    }
+    // The difference between the old and new sums applies to both checksums
+    const uint16_t old_sum = window_sum(field.offset, field.size, origin, end);
+    memcpy(&buffer_[field.offset], data, field.size);
+    const uint16_t new_sum = window_sum(field.offset, field.size, origin, end);
+    if (update_network) {
+        Internals::patch_checksum(&buffer_[network_offset_ + 10], old_sum, new_sum, false);
+    }
+    if (update_transport) {
+        Internals::patch_checksum(&buffer_[transport_checksum_], old_sum, new_sum, has_udp_);
+    }
+}
+
+uint16_t PacketTemplate::window_sum(uint32_t offset, uint32_t size, uint32_t origin, 
+                                    uint32_t end) const {
+    // Checksums are computed over 16 bit words, so widen the field until it
+    // covers whole words. An odd trailing byte is padded with a zero.
+    uint32_t start = offset - ((offset - origin) & 1);
+    uint32_t stop = offset + size;
+    if (((stop - origin) & 1) != 0 && stop < end) {
+        ++stop;
+    }
+    return Internals::sum_bytes(&buffer_[start], stop - start);
+}
+
+} // Tins
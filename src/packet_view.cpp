@@ -0,0 +1,237 @@
+/*
+ * Copyright (c) 2017, Matias Fontanini
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are
+ * met:
+ * 
+ * * Redistributions of source code must retain the above copyright
+ *   notice, this list of conditions and the following disclaimer.
+ * * Redistributions in binary form must reproduce the above
+ *   copyright notice, this list of conditions and the following disclaimer
+ *   in the documentation and/or other materials provided with the
+ *   distribution.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+
+#include <tins/packet_view.h>
+#include <tins/constants.h>
+
+namespace Tins {
+
+PacketView::PacketView()
+: buffer_(0), size_(0), wire_size_(0), link_type_(PDU::UNKNOWN), layers_(0),
+  vlan_count_(0), ethernet_offset_(0), dot1q_offset_(0), network_offset_(0),
+  transport_offset_(0), payload_offset_(0), network_end_(0),
+  transport_protocol_(0), is_fragment_(false) {
+
+}
+
+PacketView::PacketView(const uint8_t* buffer, uint32_t total_sz, PDU::PDUType link_type)
+: buffer_(buffer), size_(total_sz), wire_size_(total_sz), link_type_(link_type),
+  layers_(0), vlan_count_(0), ethernet_offset_(0), dot1q_offset_(0),
+  network_offset_(0), transport_offset_(0), payload_offset_(0),
+  network_end_(total_sz), transport_protocol_(0), is_fragment_(false) {
+    parse();
+}
+
+PacketView::PacketView(const uint8_t* buffer, uint32_t total_sz, PDU::PDUType link_type,
+                       const Timestamp& ts, uint32_t wire_size)
+: buffer_(buffer), size_(total_sz), wire_size_(wire_size), ts_(ts),
+  link_type_(link_type), layers_(0), vlan_count_(0), ethernet_offset_(0),
+  dot1q_offset_(0), network_offset_(0), transport_offset_(0), payload_offset_(0),
+  network_end_(total_sz), transport_protocol_(0), is_fragment_(false) {
+    parse();
+}
+
+void PacketView::parse() {
+    switch (link_type_) {
+        case PDU::ETHERNET_II:
+            if (size_ >= 14) {
+                layers_ |= ETHERNET_LAYER;
+                payload_offset_ = 14;
+                parse_ethertype(read_be<uint16_t>(buffer_ + 12), 14);
+            }
+            break;
+        case PDU::IP:
+        case PDU::IPv6:
+            parse_network(0);
+            break;
+        case PDU::LOOPBACK:
+            // The loopback header contains the address family, but its value
+            // for IPv6 is platform dependent, so use the IP version instead.
+            if (size_ >= sizeof(uint32_t)) {
+                payload_offset_ = sizeof(uint32_t);
+                parse_network(sizeof(uint32_t));
+            }
+            break;
+        case PDU::SLL:
+            if (size_ >= 16) {
+                payload_offset_ = 16;
+                parse_ethertype(read_be<uint16_t>(buffer_ + 14), 16);
+            }
+            break;
+        default:
+            break;
+    }
+}
+
+void PacketView::parse_ethertype(uint16_t ether_type, uint32_t offset) {
+    while (ether_type == Constants::Ethernet::VLAN || 
+           ether_type == Constants::Ethernet::QINQ ||
+           ether_type == Constants::Ethernet::OLD_QINQ) {
+        if (size_ - offset < 4) {
+            return;
+        }
+        if (vlan_count_++ == 0) {
+            layers_ |= DOT1Q_LAYER;
+            dot1q_offset_ = offset;
+        }
+        ether_type = read_be<uint16_t>(buffer_ + offset + 2);
+        offset += 4;
+        payload_offset_ = offset;
+    }
+    if (ether_type == Constants::Ethernet::IP || ether_type == Constants::Ethernet::IPV6) {
+        parse_network(offset);
+    }
+}
+
+void PacketView::parse_network(uint32_t offset) {
+    if (offset >= size_) {
+        return;
+    }
+    switch (buffer_[offset] >> 4) {
+        case 4:
+            parse_ip(offset);
+            break;
+        case 6:
+            parse_ipv6(offset);
+            break;
+        default:
+            break;
+    }
+}
+
+void PacketView::parse_ip(uint32_t offset) {
+    const uint32_t available = size_ - offset;
+    if (available < 20) {
+        return;
+    }
+    IPHeader header(buffer_ + offset);
+    const uint32_t header_size = header.head_len() * sizeof(uint32_t);
+    if (header_size < 20 || header_size > available) {
+        return;
+    }
+    layers_ |= IP_LAYER;
+    network_offset_ = offset;
+    payload_offset_ = offset + header_size;
+    transport_protocol_ = header.protocol();
+    // Trim any link layer padding, unless the packet was truncated
+    uint32_t total_length = header.tot_len();
+    if (total_length >= header_size && total_length < available) {
+        network_end_ = offset + total_length;
+    }
+    // More fragments flag or a non zero offset
+    is_fragment_ = (header.flags() & 1) != 0 || header.fragment_offset() != 0;
+    // Only the first fragment contains the transport layer header
+    if (header.fragment_offset() == 0) {
+        parse_transport(transport_protocol_, payload_offset_);
+    }
+}
+
+void PacketView::parse_ipv6(uint32_t offset) {
+    const uint32_t available = size_ - offset;
+    if (available < 40) {
+        return;
+    }
+    IPv6Header header(buffer_ + offset);
+    layers_ |= IPV6_LAYER;
+    network_offset_ = offset;
+    const uint32_t total_length = header.payload_length() + 40;
+    if (total_length < available) {
+        network_end_ = offset + total_length;
+    }
+    uint8_t next_header = header.next_header();
+    offset += 40;
+    payload_offset_ = offset;
+    bool first_fragment = true;
+    while (true) {
+        uint32_t extension_size;
+        switch (next_header) {
+            case Constants::IP::PROTO_HOPOPTS:
+            case Constants::IP::PROTO_ROUTING:
+            case Constants::IP::PROTO_DSTOPTS:
+                if (network_end_ - offset < 2) {
+                    return;
+                }
+                extension_size = (buffer_[offset + 1] + 1) * 8;
+                break;
+            case Constants::IP::PROTO_FRAGMENT:
+                if (network_end_ - offset < 8) {
+                    return;
+                }
+                is_fragment_ = true;
+                first_fragment = (read_be<uint16_t>(buffer_ + offset + 2) & 0xfff8) == 0;
+                extension_size = 8;
+                break;
+            case Constants::IP::PROTO_AH:
+                if (network_end_ - offset < 2) {
+                    return;
+                }
+                extension_size = (buffer_[offset + 1] + 2) * 4;
+                break;
+            default:
+                transport_protocol_ = next_header;
+                if (first_fragment) {
+                    parse_transport(next_header, offset);
+                }
+                return;
+        }
+        if (network_end_ - offset < extension_size) {
+            return;
+        }
+        next_header = buffer_[offset];
+        offset += extension_size;
+        payload_offset_ = offset;
+    }
+}
+
+void PacketView::parse_transport(uint8_t protocol, uint32_t offset) {
+    const uint32_t available = network_end_ - offset;
+    if (protocol == Constants::IP::PROTO_TCP) {
+        if (available < 20) {
+            return;
+        }
+        const uint32_t header_size = TCPHeader(buffer_ + offset).data_offset() * sizeof(uint32_t);
+        if (header_size < 20 || header_size > available) {
+            return;
+        }
+        layers_ |= TCP_LAYER;
+        transport_offset_ = offset;
+        payload_offset_ = offset + header_size;
+    }
+    else if (protocol == Constants::IP::PROTO_UDP) {
+        if (available < 8) {
+            return;
+        }
+        layers_ |= UDP_LAYER;
+        transport_offset_ = offset;
+        payload_offset_ = offset + 8;
+    }
+}
+
+} // Tins
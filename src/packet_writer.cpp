@@ -31,15 +31,77 @@
     #include <sys/time.h>
 #endif
 #include <string.h>
+#include <algorithm>
+#include <stdexcept>
+#include <memory>
 #include <tins/packet_writer.h>
 #include <tins/packet.h>
 #include <tins/pdu.h>
 #include <tins/exceptions.h>
+#include <tins/detail/compressed_file.h>
+#include <tins/detail/async_file_writer.h>
+#include <tins/detail/pdu_helpers.h>
 
 using std::string;
 
 namespace Tins {
 
+#if TINS_IS_CXX11 && !defined(_WIN32)
+
+namespace {
+
+const uint32_t SNAP_LENGTH = 65535;
+
+// The headers pcap_dump writes, in host byte order
+struct pcap_file_header_type {
+    uint32_t magic;
+    uint16_t version_major;
+    uint16_t version_minor;
+    int32_t this_zone;
+    uint32_t sigfigs;
+    uint32_t snap_length;
+    uint32_t link_type;
+};
+
+struct pcap_record_header_type {
+    uint32_t seconds;
+    uint32_t microseconds;
+    uint32_t captured_length;
+    uint32_t length;
+};
+
+} // anonymous namespace
+
+#endif // TINS_IS_CXX11 && !_WIN32
+
+// AsyncWriterConfiguration
+
+const size_t AsyncWriterConfiguration::DEFAULT_BUFFER_SIZE = 4 * 1024 * 1024;
+
+AsyncWriterConfiguration::AsyncWriterConfiguration()
+: buffer_size_(DEFAULT_BUFFER_SIZE), backpressure_policy_(BLOCK) {
+
+}
+
+void AsyncWriterConfiguration::set_buffer_size(size_t size) {
+    buffer_size_ = size;
+}
+
+void AsyncWriterConfiguration::set_backpressure_policy(BackpressurePolicy policy) {
+    backpressure_policy_ = policy;
+}
+
+size_t AsyncWriterConfiguration::buffer_size() const {
+    return buffer_size_;
+}
+
+AsyncWriterConfiguration::BackpressurePolicy 
+AsyncWriterConfiguration::backpressure_policy() const {
+    return backpressure_policy_;
+}
+
+// PacketWriter
+
 PacketWriter::PacketWriter(const string& file_name, LinkType lt) {
     init(file_name, lt);
 }
@@ -49,6 +111,14 @@ PacketWriter::~PacketWriter() {
         pcap_dump_close(dumper_);
         pcap_close(handle_);
     }
+    #ifdef TINS_HAVE_COMPRESSION
+    // The stream was closed above, so this waits for the file to be finished
+    delete compressor_;
+    #endif // TINS_HAVE_COMPRESSION
+    #if TINS_IS_CXX11 && !defined(_WIN32)
+    // This writes whatever is still buffered
+    delete async_writer_;
+    #endif // TINS_IS_CXX11 && !_WIN32
 }
 
 void PacketWriter::write(PDU& pdu) {
@@ -69,17 +139,99 @@ void PacketWriter::write(Packet& packet) {
     write(*packet.pdu(), tv);
 }
 
+void PacketWriter::flush() {
+    #if TINS_IS_CXX11 && !defined(_WIN32)
+    if (async_writer_) {
+        async_writer_->flush();
+        return;
+    }
+    #endif // TINS_IS_CXX11 && !_WIN32
+    if (dumper_) {
+        pcap_dump_flush(dumper_);
+    }
+    #ifdef TINS_HAVE_COMPRESSION
+    if (compressor_) {
+        compressor_->check_error();
+    }
+    #endif // TINS_HAVE_COMPRESSION
+}
+
+void PacketWriter::close() {
+    if (dumper_ && handle_) {
+        pcap_dump_close(dumper_);
+        pcap_close(handle_);
+    }
+    dumper_ = 0;
+    handle_ = 0;
+    #ifdef TINS_HAVE_COMPRESSION
+    if (compressor_) {
+        // Reset it first so the destructor doesn't see it if this throws
+        std::unique_ptr<Internals::CompressionThread> compressor(compressor_);
+        compressor_ = 0;
+        compressor->finish();
+    }
+    #endif // TINS_HAVE_COMPRESSION
+    #if TINS_IS_CXX11 && !defined(_WIN32)
+    if (async_writer_) {
+        std::unique_ptr<Internals::AsyncFileWriter> async_writer(async_writer_);
+        async_writer_ = 0;
+        async_writer->flush();
+    }
+    #endif // TINS_IS_CXX11 && !_WIN32
+}
+
+uint64_t PacketWriter::written_bytes() const {
+    #if TINS_IS_CXX11 && !defined(_WIN32)
+    if (async_writer_) {
+        return async_writer_->written_bytes();
+    }
+    #endif // TINS_IS_CXX11 && !_WIN32
+    return 0;
+}
+
+uint64_t PacketWriter::dropped_bytes() const {
+    #if TINS_IS_CXX11 && !defined(_WIN32)
+    if (async_writer_) {
+        return async_writer_->dropped_bytes();
+    }
+    #endif // TINS_IS_CXX11 && !_WIN32
+    return 0;
+}
+
+uint64_t PacketWriter::dropped_packets() const {
+    #if TINS_IS_CXX11 && !defined(_WIN32)
+    if (async_writer_) {
+        return async_writer_->dropped_records();
+    }
+    #endif // TINS_IS_CXX11 && !_WIN32
+    return 0;
+}
+
 void PacketWriter::write(PDU& pdu, const struct timeval& tv) {
-    PDU::serialization_type buffer = pdu.serialize();
+    Internals::ScratchSerialization buffer(pdu);
+    #if TINS_IS_CXX11 && !defined(_WIN32)
+    if (async_writer_) {
+        pcap_record_header_type header;
+        header.seconds = static_cast<uint32_t>(tv.tv_sec);
+        header.microseconds = static_cast<uint32_t>(tv.tv_usec);
+        header.captured_length = std::min(buffer.size(), SNAP_LENGTH);
+        header.length = buffer.size();
+        async_writer_->write((const uint8_t*)&header, sizeof(header), buffer.data(), 
+                             header.captured_length);
+        return;
+    }
+    #endif // TINS_IS_CXX11 && !_WIN32
     struct pcap_pkthdr header;
     memset(&header, 0, sizeof(header));
     header.ts = tv;
-    header.caplen = static_cast<bpf_u_int32>(buffer.size());
-    header.len = static_cast<bpf_u_int32>(buffer.size());
-    pcap_dump((u_char*)dumper_, &header, &buffer[0]);
+    header.caplen = buffer.size();
+    header.len = buffer.size();
+    pcap_dump((u_char*)dumper_, &header, buffer.data());
 }
 
 void PacketWriter::init(const string& file_name, int link_type) {
+    compressor_ = 0;
+    async_writer_ = 0;
     handle_ = pcap_open_dead(link_type, 65535);
     if (!handle_) {
         throw pcap_open_failed();
@@ -91,4 +243,82 @@ void PacketWriter::init(const string& file_name, int link_type) {
     }
 }
 
+void PacketWriter::init(const string& file_name, int link_type, Compression compression,
+                        int level) {
+    if (compression == NO_COMPRESSION) {
+        init(file_name, link_type);
+        return;
+    }
+    #ifdef TINS_HAVE_COMPRESSION
+    const Internals::CompressionFormat format = (compression == GZIP) ? 
+                                                Internals::GZIP_COMPRESSION :
+                                                Internals::ZSTD_COMPRESSION;
+    async_writer_ = 0;
+    compressor_ = new Internals::CompressionThread(file_name, format, level);
+    handle_ = pcap_open_dead(link_type, 65535);
+    if (handle_) {
+        dumper_ = pcap_dump_fopen(handle_, compressor_->stream());
+    }
+    if (!handle_ || !dumper_) {
+        const string error = handle_ ? pcap_geterr(handle_) : "Failed to open pcap handle";
+        fclose(compressor_->stream());
+        delete compressor_;
+        if (handle_) {
+            pcap_close(handle_);
+        }
+        throw pcap_error(error);
+    }
+    #else
+    (void)file_name;
+    (void)link_type;
+    (void)level;
+    throw feature_disabled();
+    #endif // TINS_HAVE_COMPRESSION
+}
+
+void PacketWriter::init(const string& file_name, int link_type, 
+                        const AsyncWriterConfiguration& configuration) {
+    #if TINS_IS_CXX11 && !defined(_WIN32)
+    if (configuration.buffer_size() < sizeof(pcap_record_header_type) + SNAP_LENGTH) {
+        throw std::runtime_error("The buffer size must fit a full sized packet");
+    }
+    handle_ = 0;
+    dumper_ = 0;
+    compressor_ = 0;
+    Internals::OverflowPolicy policy;
+    switch (configuration.backpressure_policy()) {
+        case AsyncWriterConfiguration::DROP_NEWEST:
+            policy = Internals::DROP_NEWEST_ON_OVERFLOW;
+            break;
+        case AsyncWriterConfiguration::DROP_OLDEST:
+            policy = Internals::DROP_OLDEST_ON_OVERFLOW;
+            break;
+        default:
+            policy = Internals::BLOCK_ON_OVERFLOW;
+            break;
+    }
+    // Files store LINKTYPE_* values rather than DLT_* ones
+    uint32_t file_link_type;
+    if (!Internals::dlt_to_link_type(link_type, file_link_type)) {
+        throw unknown_link_type();
+    }
+    async_writer_ = new Internals::AsyncFileWriter(file_name, configuration.buffer_size(), 
+                                                   policy);
+    pcap_file_header_type header;
+    header.magic = 0xa1b2c3d4;
+    header.version_major = 2;
+    header.version_minor = 4;
+    header.this_zone = 0;
+    header.sigfigs = 0;
+    header.snap_length = SNAP_LENGTH;
+    header.link_type = file_link_type;
+    async_writer_->write((const uint8_t*)&header, sizeof(header), 0, 0);
+    #else
+    (void)file_name;
+    (void)link_type;
+    (void)configuration;
+    throw feature_disabled();
+    #endif // TINS_IS_CXX11 && !_WIN32
+}
+
 } // Tins
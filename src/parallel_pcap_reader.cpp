@@ -0,0 +1,317 @@
+/*
+ * Copyright (c) 2017, Matias Fontanini
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are
+ * met:
+ * 
+ * * Redistributions of source code must retain the above copyright
+ *   notice, this list of conditions and the following disclaimer.
+ * * Redistributions in binary form must reproduce the above
+ *   copyright notice, this list of conditions and the following disclaimer
+ *   in the documentation and/or other materials provided with the
+ *   distribution.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+
+#include <tins/parallel_pcap_reader.h>
+
+#if TINS_IS_CXX11 && !defined(_WIN32)
+
+#include <queue>
+#include <limits>
+#include <algorithm>
+#include <stdexcept>
+#include <functional>
+
+using std::string;
+using std::vector;
+using std::pair;
+
+namespace Tins {
+
+namespace {
+
+const uint64_t FILE_HEADER_SIZE = 24;
+
+uint64_t chunks_in_file(uint64_t file_size, uint64_t chunk_size) {
+    const uint64_t data_size = file_size - FILE_HEADER_SIZE;
+    return (data_size + chunk_size - 1) / chunk_size;
+}
+
+} // anonymous namespace
+
+const uint64_t ParallelPcapReader::DEFAULT_CHUNK_SIZE = 16 * 1024 * 1024;
+
+ParallelPcapReader::ParallelPcapReader(const string& file_name, size_t thread_count)
+: stopped_(false), chunk_size_(DEFAULT_CHUNK_SIZE), thread_count_(thread_count),
+  lazy_decoding_(false) {
+    initialize(vector<string>(1, file_name));
+}
+
+ParallelPcapReader::ParallelPcapReader(const vector<string>& file_names,
+                                       size_t thread_count)
+: stopped_(false), chunk_size_(DEFAULT_CHUNK_SIZE), thread_count_(thread_count),
+  lazy_decoding_(false) {
+    initialize(file_names);
+}
+
+void ParallelPcapReader::initialize(const vector<string>& file_names) {
+    if (thread_count_ == 0) {
+        throw std::runtime_error("At least one thread is required");
+    }
+    for (size_t i = 0; i < file_names.size(); ++i) {
+        readers_.emplace_back(new MappedPcapReader(file_names[i]));
+    }
+}
+
+void ParallelPcapReader::set_chunk_size(uint64_t size) {
+    if (size == 0) {
+        throw std::runtime_error("Chunk size can't be 0");
+    }
+    chunk_size_ = size;
+    chunks_.clear();
+}
+
+void ParallelPcapReader::set_extract_raw_pdus(bool value) {
+    for (size_t i = 0; i < readers_.size(); ++i) {
+        readers_[i]->set_extract_raw_pdus(value);
+    }
+}
+
+void ParallelPcapReader::set_lazy_decoding(bool value) {
+    lazy_decoding_ = value;
+}
+
+size_t ParallelPcapReader::chunk_count() const {
+    size_t output = 0;
+    for (size_t i = 0; i < readers_.size(); ++i) {
+        output += chunks_in_file(readers_[i]->file_size(), chunk_size_);
+    }
+    return output;
+}
+
+size_t ParallelPcapReader::thread_count() const {
+    return thread_count_;
+}
+
+void ParallelPcapReader::split() {
+    if (!chunks_.empty()) {
+        return;
+    }
+    for (size_t i = 0; i < readers_.size(); ++i) {
+        const uint64_t file_size = readers_[i]->file_size();
+        const uint64_t count = chunks_in_file(file_size, chunk_size_);
+        for (uint64_t j = 0; j < count; ++j) {
+            chunk output;
+            output.file = i;
+            output.begin = FILE_HEADER_SIZE + j * chunk_size_;
+            output.limit = std::min(file_size, output.begin + chunk_size_);
+            output.first_timestamp = 0;
+            output.first_in_file = j == 0;
+            chunks_.push_back(output);
+        }
+    }
+    // This only reads a few record headers per chunk, but these are spread 
+    // over the whole file
+    const size_t thread_count = std::min(thread_count_, chunks_.size());
+    vector<std::thread> threads;
+    for (size_t i = 0; i < thread_count; ++i) {
+        threads.emplace_back([&, i]() {
+            for (size_t j = i; j < chunks_.size(); j += thread_count) {
+                guess_begin(chunks_[j]);
+            }
+        });
+    }
+    for (size_t i = 0; i < threads.size(); ++i) {
+        threads[i].join();
+    }
+}
+
+void ParallelPcapReader::guess_begin(chunk& output) const {
+    const MappedPcapReader& reader = *readers_[output.file];
+    if (!output.first_in_file) {
+        output.begin = reader.find_record(output.begin);
+    }
+    MappedPcapReader::record current;
+    if (reader.try_record_at(output.begin, current) != 0) {
+        output.first_timestamp = current.seconds * 1000000000ULL + current.nanoseconds;
+    }
+    else {
+        // There are no records left. Make sure this chunk doesn't hold
+        // back the rest of the file's chunks when merging
+        output.first_timestamp = std::numeric_limits<uint64_t>::max();
+    }
+}
+
+vector<size_t> ParallelPcapReader::timestamp_order() const {
+    // Chunks in the same file stay in file order, as each one needs the 
+    // previous one to find where it starts. Files are then merged using 
+    // the timestamp of each chunk's first record, breaking ties using the 
+    // order in which files were provided.
+    typedef pair<uint64_t, size_t> entry;
+    std::priority_queue<entry, vector<entry>, std::greater<entry> > heap;
+    vector<size_t> next_chunk(readers_.size());
+    for (size_t i = chunks_.size(); i > 0; --i) {
+        next_chunk[chunks_[i - 1].file] = i - 1;
+    }
+    for (size_t i = 0; i < chunks_.size(); ++i) {
+        if (chunks_[i].first_in_file) {
+            heap.push(entry(chunks_[i].first_timestamp, chunks_[i].file));
+        }
+    }
+    vector<size_t> output;
+    output.reserve(chunks_.size());
+    while (!heap.empty()) {
+        const size_t file = heap.top().second;
+        heap.pop();
+        const size_t index = next_chunk[file]++;
+        output.push_back(index);
+        if (index + 1 < chunks_.size() && !chunks_[index + 1].first_in_file) {
+            heap.push(entry(chunks_[index + 1].first_timestamp, file));
+        }
+    }
+    return output;
+}
+
+void ParallelPcapReader::locate_chunk(size_t index, uint64_t& begin, uint64_t& end) {
+    const chunk& input = chunks_[index];
+    const MappedPcapReader& reader = *readers_[input.file];
+    const bool has_next = index + 1 < chunks_.size() && !chunks_[index + 1].first_in_file;
+    // Every worker walks its chunk from the guessed start before waiting 
+    // for the previous chunk, so this is done in parallel
+    bool complete = walk_records(reader, input.begin, input.limit, end);
+    begin = boundaries_.wait(index);
+    try {
+        // Either the guess was fooled by packet contents that look like 
+        // records, or the walk hit a bad record. Walking again from the 
+        // actual start throws in the latter case
+        if (begin != input.begin || !complete) {
+            end = begin;
+            strict_walk_records(reader, input.limit, end);
+        }
+    }
+    catch (...) {
+        // Don't leave the next chunk waiting for a boundary forever
+        if (has_next) {
+            boundaries_.set(index + 1, reader.file_size());
+        }
+        throw;
+    }
+    if (has_next) {
+        boundaries_.set(index + 1, end);
+    }
+}
+
+bool ParallelPcapReader::walk_records(const MappedPcapReader& reader, uint64_t offset, 
+                                      uint64_t limit, uint64_t& end) {
+    MappedPcapReader::record current;
+    while (offset < limit) {
+        const uint64_t next_offset = reader.try_record_at(offset, current);
+        if (next_offset == 0) {
+            end = reader.file_size();
+            return offset == end;
+        }
+        offset = next_offset;
+    }
+    end = offset;
+    return true;
+}
+
+void ParallelPcapReader::strict_walk_records(const MappedPcapReader& reader, 
+                                             uint64_t limit, uint64_t& offset) {
+    MappedPcapReader::record current;
+    while (offset < limit) {
+        const uint64_t next_offset = reader.record_at(offset, current);
+        if (next_offset == 0) {
+            return;
+        }
+        offset = next_offset;
+    }
+}
+
+void ParallelPcapReader::decode_chunk(size_t index, uint64_t begin, uint64_t end, 
+                                      decoded_chunk& output) const {
+    const MappedPcapReader& reader = *readers_[chunks_[index].file];
+    MappedPcapReader::record current;
+    uint64_t offset = begin;
+    while (offset < end && !stopped_.load(std::memory_order_relaxed)) {
+        offset = reader.record_at(offset, current);
+        if (offset == 0) {
+            break;
+        }
+        if (PDU* pdu = reader.decode(current)) {
+            output.emplace_back(
+                Packet(pdu, current.timestamp(), Packet::own_pdu()),
+                current.seconds * 1000000000ULL + current.nanoseconds
+            );
+        }
+    }
+}
+
+// BoundaryTracker
+
+void ParallelPcapReader::BoundaryTracker::reset(const vector<chunk>& chunks) {
+    std::lock_guard<std::mutex> _(mutex_);
+    starts_.assign(chunks.size(), 0);
+    known_.assign(chunks.size(), false);
+    // Only the first record in each file is known up front
+    for (size_t i = 0; i < chunks.size(); ++i) {
+        if (chunks[i].first_in_file) {
+            starts_[i] = chunks[i].begin;
+            known_[i] = true;
+        }
+    }
+}
+
+uint64_t ParallelPcapReader::BoundaryTracker::wait(size_t index) {
+    std::unique_lock<std::mutex> lock(mutex_);
+    condition_.wait(lock, [&]() { return known_[index]; });
+    return starts_[index];
+}
+
+void ParallelPcapReader::BoundaryTracker::set(size_t index, uint64_t offset) {
+    std::lock_guard<std::mutex> _(mutex_);
+    starts_[index] = offset;
+    known_[index] = true;
+    condition_.notify_all();
+}
+
+// ErrorHandler
+
+ParallelPcapReader::ErrorHandler::ErrorHandler(std::atomic<bool>& stopped)
+: stopped_(stopped) {
+
+}
+
+void ParallelPcapReader::ErrorHandler::set_current_exception() {
+    std::lock_guard<std::mutex> _(mutex_);
+    if (!error_) {
+        error_ = std::current_exception();
+    }
+    stopped_ = true;
+}
+
+void ParallelPcapReader::ErrorHandler::rethrow() {
+    if (error_) {
+        std::rethrow_exception(error_);
+    }
+}
+
+} // Tins
+
+#endif // TINS_IS_CXX11 && !_WIN32
@@ -0,0 +1,246 @@
+/*
+ * Copyright (c) 2017, Matias Fontanini
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are
+ * met:
+ * 
+ * * Redistributions of source code must retain the above copyright
+ *   notice, this list of conditions and the following disclaimer.
+ * * Redistributions in binary form must reproduce the above
+ *   copyright notice, this list of conditions and the following disclaimer
+ *   in the documentation and/or other materials provided with the
+ *   distribution.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+
+#include <tins/parallel_sniffer.h>
+
+#if defined(TINS_HAVE_PCAP) && TINS_IS_CXX11
+
+#include <chrono>
+#include <tins/packet_view.h>
+
+namespace Tins {
+
+namespace {
+
+// Final mix of murmurhash3, so close flows end up in different workers
+uint32_t mix(uint32_t value) {
+    value ^= value >> 16;
+    value *= 0x85ebca6b;
+    value ^= value >> 13;
+    value *= 0xc2b2ae35;
+    value ^= value >> 16;
+    return value;
+}
+
+uint32_t fold_address(const uint8_t* ptr, size_t size) {
+    uint32_t output = 0;
+    for (size_t i = 0; i < size; i += sizeof(uint32_t)) {
+        uint32_t word;
+        std::memcpy(&word, ptr + i, sizeof(word));
+        output ^= word;
+    }
+    return output;
+}
+
+} // anonymous namespace
+
+const size_t ParallelSniffer::DEFAULT_QUEUE_SIZE = 8 * 1024 * 1024;
+const size_t ParallelSniffer::NO_FLOW = static_cast<size_t>(-1);
+
+ParallelSniffer::ParallelSniffer(BaseSniffer& sniffer, size_t worker_count,
+                                 size_t queue_size)
+: sniffer_(sniffer), stopped_(false), capture_done_(false), packets_captured_(0),
+  packets_dropped_(0), decoder_(0), link_type_(PDU::UNKNOWN), next_worker_(0),
+  flow_affinity_(false), drop_when_full_(false), lazy_decoding_(false) {
+    if (worker_count == 0) {
+        throw std::runtime_error("At least one worker is required");
+    }
+    for (size_t i = 0; i < worker_count; ++i) {
+        queues_.emplace_back(new Internals::FrameQueue(queue_size));
+    }
+}
+
+void ParallelSniffer::set_flow_affinity(bool enabled) {
+    flow_affinity_ = enabled;
+}
+
+void ParallelSniffer::set_drop_when_full(bool enabled) {
+    drop_when_full_ = enabled;
+}
+
+void ParallelSniffer::stop_sniff() {
+    stopped_ = true;
+    pcap_breakloop(sniffer_.get_pcap_handle());
+}
+
+uint64_t ParallelSniffer::packets_captured() const {
+    return packets_captured_;
+}
+
+uint64_t ParallelSniffer::packets_dropped() const {
+    return packets_dropped_;
+}
+
+size_t ParallelSniffer::worker_count() const {
+    return queues_.size();
+}
+
+void ParallelSniffer::prepare() {
+    stopped_ = false;
+    capture_done_ = false;
+    packets_captured_ = 0;
+    packets_dropped_ = 0;
+    next_worker_ = 0;
+    // Resolve everything needed by the workers before they're started
+    decoder_ = sniffer_.packet_decoder();
+    lazy_decoding_ = sniffer_.lazy_decoding_;
+    link_type_ = PDU::UNKNOWN;
+    if (flow_affinity_) {
+        try {
+            link_type_ = sniffer_.view_link_type();
+        }
+        catch (unknown_link_type&) {
+            // Use round robin then
+        }
+    }
+    // Discard anything left over by a stopped loop
+    Internals::FrameQueue::frame frame;
+    for (size_t i = 0; i < queues_.size(); ++i) {
+        while (queues_[i]->front(frame)) {
+            queues_[i]->pop();
+        }
+    }
+}
+
+void ParallelSniffer::wait_for_frames(unsigned& idle_rounds) {
+    // Spin for a bit, then start yielding and eventually sleep
+    if (idle_rounds < 64) {
+        idle_rounds++;
+    }
+    else if (idle_rounds < 128) {
+        idle_rounds++;
+        std::this_thread::yield();
+    }
+    else {
+        std::this_thread::sleep_for(std::chrono::microseconds(100));
+    }
+}
+
+void ParallelSniffer::capture_handler(u_char* user, const struct pcap_pkthdr* h,
+                                      const u_char* bytes) {
+    ParallelSniffer* sniffer = (ParallelSniffer*)user;
+    if (!sniffer->stopped_.load(std::memory_order_relaxed)) {
+        sniffer->dispatch(h, (const uint8_t*)bytes);
+    }
+}
+
+void ParallelSniffer::run_capture(uint32_t max_packets) {
+    pcap_t* handle = sniffer_.get_pcap_handle();
+    while (!stopped_) {
+        const uint64_t captured = packets_captured_.load(std::memory_order_relaxed);
+        const int count = max_packets ? static_cast<int>(max_packets - captured) : -1;
+        const int result = sniffer_.pcap_sniffing_method_(
+            handle,
+            count,
+            &ParallelSniffer::capture_handler,
+            (u_char*)this
+        );
+        if (result <= 0 || (max_packets && packets_captured_ >= max_packets)) {
+            break;
+        }
+    }
+}
+
+void ParallelSniffer::dispatch(const struct pcap_pkthdr* h, const uint8_t* bytes) {
+    packets_captured_.fetch_add(1, std::memory_order_relaxed);
+    // Every queue has the same capacity. A frame that doesn't fit in an 
+    // empty one would make us wait forever
+    if (!queues_[0]->fits(h->caplen)) {
+        packets_dropped_.fetch_add(1, std::memory_order_relaxed);
+        return;
+    }
+    const Timestamp timestamp(h->ts);
+    const size_t queue_count = queues_.size();
+    const size_t worker = link_type_ != PDU::UNKNOWN ? 
+                          flow_worker(bytes, h->caplen) : 
+                          NO_FLOW;
+    if (worker != NO_FLOW) {
+        // The flow's worker is the only one we can use
+        Internals::FrameQueue& queue = *queues_[worker];
+        unsigned idle_rounds = 0;
+        while (!queue.push(bytes, h->caplen, h->len, timestamp)) {
+            if (drop_when_full_ || stopped_) {
+                packets_dropped_.fetch_add(1, std::memory_order_relaxed);
+                return;
+            }
+            wait_for_frames(idle_rounds);
+        }
+        return;
+    }
+    unsigned idle_rounds = 0;
+    while (true) {
+        // Try every worker, starting from the next one in line
+        for (size_t i = 0; i < queue_count; ++i) {
+            const size_t index = (next_worker_ + i) % queue_count;
+            if (queues_[index]->push(bytes, h->caplen, h->len, timestamp)) {
+                next_worker_ = (index + 1) % queue_count;
+                return;
+            }
+        }
+        if (drop_when_full_ || stopped_) {
+            packets_dropped_.fetch_add(1, std::memory_order_relaxed);
+            return;
+        }
+        wait_for_frames(idle_rounds);
+    }
+}
+
+size_t ParallelSniffer::flow_worker(const uint8_t* bytes, uint32_t size) const {
+    const PacketView view(bytes, size, link_type_);
+    uint32_t hash = 0;
+    // Use XOR so both directions of a flow get the same hash
+    if (view.has_ip()) {
+        hash = view.ip().src_addr() ^ view.ip().dst_addr();
+    }
+    else if (view.has_ipv6()) {
+        const uint8_t* header = bytes + view.network_offset();
+        hash = fold_address(header + 8, IPv6Address::address_size) ^ 
+               fold_address(header + 24, IPv6Address::address_size);
+    }
+    else {
+        return NO_FLOW;
+    }
+    // Only the first fragment has ports, so fragments are hashed without
+    // them to keep the whole datagram in the same worker
+    if (!view.is_fragment()) {
+        if (view.has_tcp()) {
+            hash ^= view.tcp().sport() ^ view.tcp().dport();
+        }
+        else if (view.has_udp()) {
+            hash ^= view.udp().sport() ^ view.udp().dport();
+        }
+    }
+    hash ^= view.transport_protocol();
+    return mix(hash) % queues_.size();
+}
+
+} // Tins
+
+#endif // TINS_HAVE_PCAP && TINS_IS_CXX11
@@ -0,0 +1,408 @@
+/*
+ * Copyright (c) 2017, Matias Fontanini
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are
+ * met:
+ * 
+ * * Redistributions of source code must retain the above copyright
+ *   notice, this list of conditions and the following disclaimer.
+ * * Redistributions in binary form must reproduce the above
+ *   copyright notice, this list of conditions and the following disclaimer
+ *   in the documentation and/or other materials provided with the
+ *   distribution.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+
+#ifndef _WIN32
+    #include <sys/time.h>
+#endif
+#include <cstring>
+#include <algorithm>
+#include <tins/pcapng_reader.h>
+#include <tins/rawpdu.h>
+#include <tins/lazy_decoding.h>
+#include <tins/endianness.h>
+#include <tins/detail/pdu_helpers.h>
+
+using std::string;
+
+namespace Tins {
+
+namespace {
+
+const uint32_t SECTION_HEADER_BLOCK = 0x0a0d0d0a;
+const uint32_t INTERFACE_DESCRIPTION_BLOCK = 1;
+const uint32_t SIMPLE_PACKET_BLOCK = 3;
+const uint32_t INTERFACE_STATISTICS_BLOCK = 5;
+const uint32_t ENHANCED_PACKET_BLOCK = 6;
+const uint32_t BYTE_ORDER_MAGIC = 0x1a2b3c4d;
+// Block type and both total length fields
+const uint32_t BLOCK_OVERHEAD = 12;
+// The largest block we'll read. Blocks are buffered whole, so this keeps
+// a corrupt length from making us allocate up to 4GB
+const uint32_t MAX_BLOCK_SIZE = 16 * 1024 * 1024;
+
+const uint16_t OPTION_END = 0;
+const uint16_t OPTION_IF_NAME = 2;
+const uint16_t OPTION_IF_TSRESOL = 9;
+const uint16_t OPTION_IF_TSOFFSET = 14;
+const uint16_t OPTION_ISB_IFRECV = 4;
+const uint16_t OPTION_ISB_IFDROP = 5;
+
+const uint64_t NANOSECONDS_PER_SECOND = 1000000000ULL;
+
+uint32_t padded_size(uint32_t size) {
+    return (size + 3) & ~3U;
+}
+
+template <typename T>
+T read_value(const uint8_t* ptr, bool swapped) {
+    T value;
+    std::memcpy(&value, ptr, sizeof(value));
+    return swapped ? Endian::change_endian(value) : value;
+}
+
+} // anonymous namespace
+
+Timestamp PcapngReader::record::timestamp() const {
+    timeval tv;
+    tv.tv_sec = static_cast<Timestamp::seconds_type>(seconds);
+    tv.tv_usec = nanoseconds / 1000;
+    return tv;
+}
+
+const size_t PcapngReader::DEFAULT_BUFFER_SIZE = 1024 * 1024;
+
+PcapngReader::PcapngReader(const string& file_name, size_t buffer_size)
+: file_(fopen(file_name.c_str(), "rb")), buffer_(buffer_size), buffer_begin_(0),
+  buffer_end_(0), section_count_(0), swapped_(false), extract_raw_(false), 
+  lazy_decoding_(false) {
+    if (!file_) {
+        throw capture_file_error("Failed to open " + file_name);
+    }
+    // Blocks are already buffered here
+    setvbuf(file_, 0, _IONBF, 0);
+    uint32_t type;
+    const uint8_t* body;
+    uint32_t body_size;
+    try {
+        if (!next_block(type, body, body_size) || type != SECTION_HEADER_BLOCK) {
+            throw capture_file_error("Not a pcapng file");
+        }
+        read_section_header(body, body_size);
+    }
+    catch (...) {
+        fclose(file_);
+        throw;
+    }
+}
+
+PcapngReader::~PcapngReader() {
+    fclose(file_);
+}
+
+bool PcapngReader::next_record(record& output) {
+    uint32_t type;
+    const uint8_t* body;
+    uint32_t body_size;
+    while (next_block(type, body, body_size)) {
+        switch (type) {
+            case SECTION_HEADER_BLOCK:
+                read_section_header(body, body_size);
+                break;
+            case INTERFACE_DESCRIPTION_BLOCK:
+                read_interface(body, body_size);
+                break;
+            case INTERFACE_STATISTICS_BLOCK:
+                read_statistics(body, body_size);
+                break;
+            case ENHANCED_PACKET_BLOCK:
+                {
+                    if (body_size < 20) {
+                        throw capture_file_error("Invalid enhanced packet block");
+                    }
+                    const uint32_t interface_id = read32(body);
+                    if (interface_id >= interfaces_.size()) {
+                        throw capture_file_error("Packet refers to an unknown interface");
+                    }
+                    output.size = read32(body + 12);
+                    output.wire_size = read32(body + 16);
+                    if (output.size > body_size - 20) {
+                        throw capture_file_error("Invalid enhanced packet block");
+                    }
+                    output.data = body + 20;
+                    output.interface_id = interface_id;
+                    convert_timestamp(body + 4, interfaces_[interface_id], output);
+                    return true;
+                }
+            case SIMPLE_PACKET_BLOCK:
+                {
+                    if (body_size < 4 || interfaces_.empty()) {
+                        throw capture_file_error("Invalid simple packet block");
+                    }
+                    // The captured size is implied by the block's size
+                    // and the interface's snapshot length
+                    const uint32_t snap_len = interfaces_[0].snap_len;
+                    output.wire_size = read32(body);
+                    output.size = std::min(output.wire_size, body_size - 4);
+                    if (snap_len != 0) {
+                        output.size = std::min(output.size, snap_len);
+                    }
+                    output.data = body + 4;
+                    output.interface_id = 0;
+                    output.seconds = 0;
+                    output.nanoseconds = 0;
+                    return true;
+                }
+            default:
+                // Anything else is skipped
+                break;
+        }
+    }
+    return false;
+}
+
+PtrPacket PcapngReader::next_packet() {
+    LazyDecodingGuard lazy_guard(lazy_decoding_);
+    record current;
+    while (next_record(current)) {
+        const uint16_t link_type = interfaces_[current.interface_id].link_type;
+        if (PDU* pdu = packet_decoder(link_type)(current.data, current.size)) {
+            return PtrPacket(pdu, current.timestamp());
+        }
+    }
+    return PtrPacket(0, Timestamp());
+}
+
+void PcapngReader::set_extract_raw_pdus(bool value) {
+    extract_raw_ = value;
+}
+
+void PcapngReader::set_lazy_decoding(bool value) {
+    lazy_decoding_ = value;
+}
+
+uint32_t PcapngReader::interface_count() const {
+    return static_cast<uint32_t>(interfaces_.size());
+}
+
+const PcapngReader::interface_info& PcapngReader::interface(uint32_t interface_id) const {
+    if (interface_id >= interfaces_.size()) {
+        throw invalid_interface();
+    }
+    return interfaces_[interface_id];
+}
+
+uint32_t PcapngReader::section_count() const {
+    return section_count_;
+}
+
+bool PcapngReader::ensure(size_t size) {
+    if (buffer_end_ - buffer_begin_ >= size) {
+        return true;
+    }
+    // Move whatever is left to the beginning of the buffer
+    const size_t remaining = buffer_end_ - buffer_begin_;
+    if (remaining > 0 && buffer_begin_ > 0) {
+        std::memmove(&buffer_[0], &buffer_[buffer_begin_], remaining);
+    }
+    buffer_begin_ = 0;
+    buffer_end_ = remaining;
+    if (size > buffer_.size()) {
+        buffer_.resize(size);
+    }
+    while (buffer_end_ < size) {
+        const size_t read = fread(&buffer_[buffer_end_], 1, buffer_.size() - buffer_end_, file_);
+        if (read == 0) {
+            return false;
+        }
+        buffer_end_ += read;
+    }
+    return true;
+}
+
+bool PcapngReader::next_block(uint32_t& type, const uint8_t*& body, uint32_t& body_size) {
+    if (!ensure(8)) {
+        if (buffer_end_ != buffer_begin_) {
+            throw capture_file_error("Truncated block");
+        }
+        return false;
+    }
+    // Section header blocks define the byte order of the rest of the section
+    if (read_value<uint32_t>(&buffer_[buffer_begin_], false) == SECTION_HEADER_BLOCK) {
+        if (!ensure(12)) {
+            throw capture_file_error("Truncated block");
+        }
+        const uint32_t magic = read_value<uint32_t>(&buffer_[buffer_begin_ + 8], false);
+        if (magic == BYTE_ORDER_MAGIC) {
+            swapped_ = false;
+        }
+        else if (Endian::change_endian(magic) == BYTE_ORDER_MAGIC) {
+            swapped_ = true;
+        }
+        else {
+            throw capture_file_error("Invalid byte order magic");
+        }
+    }
+    type = read32(&buffer_[buffer_begin_]);
+    const uint32_t total_size = read32(&buffer_[buffer_begin_ + 4]);
+    if (total_size < BLOCK_OVERHEAD || total_size % 4 != 0) {
+        throw capture_file_error("Invalid block length");
+    }
+    if (total_size > MAX_BLOCK_SIZE) {
+        throw capture_file_error("Block too large");
+    }
+    if (!ensure(total_size)) {
+        throw capture_file_error("Truncated block");
+    }
+    body = &buffer_[buffer_begin_ + 8];
+    body_size = total_size - BLOCK_OVERHEAD;
+    buffer_begin_ += total_size;
+    return true;
+}
+
+void PcapngReader::read_section_header(const uint8_t* body, uint32_t body_size) {
+    if (body_size < 16) {
+        throw capture_file_error("Invalid section header block");
+    }
+    if (read16(body + 4) != 1) {
+        throw capture_file_error("Unsupported pcapng version");
+    }
+    // Interfaces are local to each section
+    interfaces_.clear();
+    section_count_++;
+}
+
+void PcapngReader::read_interface(const uint8_t* body, uint32_t body_size) {
+    if (body_size < 8) {
+        throw capture_file_error("Invalid interface description block");
+    }
+    interface_info interface;
+    interface.link_type = read16(body);
+    interface.snap_len = read32(body + 4);
+    interface.units_per_second = 1000000;
+    interface.timestamp_offset = 0;
+    interface.packets_received = 0;
+    interface.packets_dropped = 0;
+    const uint8_t* ptr = body + 8;
+    const uint8_t* end = body + body_size;
+    while (ptr + 4 <= end) {
+        const uint16_t code = read16(ptr);
+        const uint16_t length = read16(ptr + 2);
+        ptr += 4;
+        if (code == OPTION_END || length > end - ptr) {
+            break;
+        }
+        if (code == OPTION_IF_NAME) {
+            // Names may or may not be null terminated
+            const char* name = (const char*)ptr;
+            interface.name.assign(name, std::find(name, name + length, '\0'));
+        }
+        else if (code == OPTION_IF_TSRESOL && length >= 1) {
+            // The highest bit indicates whether it's a power of 2 or 10
+            const uint8_t exponent = *ptr & 0x7f;
+            if (*ptr & 0x80) {
+                if (exponent < 64) {
+                    interface.units_per_second = 1ULL << exponent;
+                }
+            }
+            else if (exponent < 20) {
+                interface.units_per_second = 1;
+                for (uint8_t i = 0; i < exponent; ++i) {
+                    interface.units_per_second *= 10;
+                }
+            }
+        }
+        else if (code == OPTION_IF_TSOFFSET && length >= 8) {
+            interface.timestamp_offset = static_cast<int64_t>(read64(ptr));
+        }
+        ptr += padded_size(length);
+    }
+    interfaces_.push_back(interface);
+}
+
+void PcapngReader::read_statistics(const uint8_t* body, uint32_t body_size) {
+    if (body_size < 12) {
+        throw capture_file_error("Invalid interface statistics block");
+    }
+    const uint32_t interface_id = read32(body);
+    if (interface_id >= interfaces_.size()) {
+        return;
+    }
+    interface_info& interface = interfaces_[interface_id];
+    const uint8_t* ptr = body + 12;
+    const uint8_t* end = body + body_size;
+    while (ptr + 4 <= end) {
+        const uint16_t code = read16(ptr);
+        const uint16_t length = read16(ptr + 2);
+        ptr += 4;
+        if (code == OPTION_END || length > end - ptr) {
+            break;
+        }
+        if (code == OPTION_ISB_IFRECV && length >= 8) {
+            interface.packets_received = read64(ptr);
+        }
+        else if (code == OPTION_ISB_IFDROP && length >= 8) {
+            interface.packets_dropped = read64(ptr);
+        }
+        ptr += padded_size(length);
+    }
+}
+
+void PcapngReader::convert_timestamp(const uint8_t* ptr, const interface_info& interface,
+                                     record& output) const {
+    // The high 32 bits go first, regardless of the byte order
+    const uint64_t value = (static_cast<uint64_t>(read32(ptr)) << 32) | read32(ptr + 4);
+    const uint64_t units = interface.units_per_second;
+    const uint64_t fraction = value % units;
+    output.seconds = value / units + interface.timestamp_offset;
+    if (units <= NANOSECONDS_PER_SECOND && NANOSECONDS_PER_SECOND % units == 0) {
+        output.nanoseconds = static_cast<uint32_t>(fraction * (NANOSECONDS_PER_SECOND / units));
+    }
+    else if (units % NANOSECONDS_PER_SECOND == 0) {
+        output.nanoseconds = static_cast<uint32_t>(fraction / (units / NANOSECONDS_PER_SECOND));
+    }
+    else {
+        // Powers of 2
+        output.nanoseconds = static_cast<uint32_t>(
+            static_cast<double>(fraction) * NANOSECONDS_PER_SECOND / units
+        );
+    }
+}
+
+PcapngReader::PacketDecoder PcapngReader::packet_decoder(uint16_t link_type) const {
+    Internals::frame_decoder decoder = 0;
+    if (!extract_raw_) {
+        decoder = Internals::frame_decoder_from_link_type(link_type);
+    }
+    return decoder ? decoder : &Internals::decode_raw_frame;
+}
+
+uint16_t PcapngReader::read16(const uint8_t* ptr) const {
+    return read_value<uint16_t>(ptr, swapped_);
+}
+
+uint32_t PcapngReader::read32(const uint8_t* ptr) const {
+    return read_value<uint32_t>(ptr, swapped_);
+}
+
+uint64_t PcapngReader::read64(const uint8_t* ptr) const {
+    return read_value<uint64_t>(ptr, swapped_);
+}
+
+} // Tins
@@ -0,0 +1,268 @@
+/*
+ * Copyright (c) 2017, Matias Fontanini
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are
+ * met:
+ * 
+ * * Redistributions of source code must retain the above copyright
+ *   notice, this list of conditions and the following disclaimer.
+ * * Redistributions in binary form must reproduce the above
+ *   copyright notice, this list of conditions and the following disclaimer
+ *   in the documentation and/or other materials provided with the
+ *   distribution.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+
+#include <cstring>
+#include <tins/pcapng_writer.h>
+#include <tins/pdu.h>
+#include <tins/packet.h>
+#include <tins/exceptions.h>
+#include <tins/detail/pdu_helpers.h>
+
+using std::string;
+
+namespace Tins {
+
+namespace {
+
+const uint32_t SECTION_HEADER_BLOCK = 0x0a0d0d0a;
+const uint32_t INTERFACE_DESCRIPTION_BLOCK = 1;
+const uint32_t INTERFACE_STATISTICS_BLOCK = 5;
+const uint32_t ENHANCED_PACKET_BLOCK = 6;
+const uint32_t SIMPLE_PACKET_BLOCK = 3;
+const uint32_t BYTE_ORDER_MAGIC = 0x1a2b3c4d;
+
+const uint16_t OPTION_END = 0;
+const uint16_t OPTION_IF_NAME = 2;
+const uint16_t OPTION_IF_TSRESOL = 9;
+const uint16_t OPTION_ISB_IFRECV = 4;
+const uint16_t OPTION_ISB_IFDROP = 5;
+
+// Block type and both total length fields
+const uint32_t BLOCK_OVERHEAD = 12;
+
+uint32_t padded_size(uint32_t size) {
+    return (size + 3) & ~3U;
+}
+
+template <typename T>
+uint8_t* write_value(uint8_t* buffer, T value) {
+    std::memcpy(buffer, &value, sizeof(value));
+    return buffer + sizeof(value);
+}
+
+uint8_t* write_option(uint8_t* buffer, uint16_t code, const void* data, uint16_t size) {
+    buffer = write_value(buffer, code);
+    buffer = write_value(buffer, size);
+    std::memcpy(buffer, data, size);
+    std::memset(buffer + size, 0, padded_size(size) - size);
+    return buffer + padded_size(size);
+}
+
+uint32_t option_size(uint32_t data_size) {
+    return 4 + padded_size(data_size);
+}
+
+} // anonymous namespace
+
+const size_t PcapngWriter::DEFAULT_BUFFER_SIZE = 1024 * 1024;
+
+PcapngWriter::PcapngWriter(const string& file_name, size_t buffer_size)
+: file_(fopen(file_name.c_str(), "wb")), buffer_(buffer_size), buffer_used_(0) {
+    if (!file_) {
+        throw capture_file_error("Failed to open " + file_name);
+    }
+    // Blocks are already buffered here
+    setvbuf(file_, 0, _IONBF, 0);
+    write_header();
+}
+
+PcapngWriter::~PcapngWriter() {
+    try {
+        flush();
+    }
+    catch (capture_file_error&) {
+        // Nothing we can do about this here
+    }
+    fclose(file_);
+}
+
+uint32_t PcapngWriter::add_interface(uint16_t link_type, const string& name,
+                                     uint32_t snap_len, Resolution resolution) {
+    // Option lengths are 16 bits long
+    if (name.size() > 0xffff) {
+        throw option_payload_too_large();
+    }
+    const uint16_t name_size = static_cast<uint16_t>(name.size());
+    uint32_t body_size = 8 + 4;
+    if (name_size > 0) {
+        body_size += option_size(name_size);
+    }
+    if (resolution == NANOSECONDS) {
+        body_size += option_size(1);
+    }
+    uint8_t* buffer = start_block(INTERFACE_DESCRIPTION_BLOCK, body_size);
+    buffer = write_value(buffer, link_type);
+    buffer = write_value<uint16_t>(buffer, 0);
+    buffer = write_value(buffer, snap_len);
+    if (name_size > 0) {
+        buffer = write_option(buffer, OPTION_IF_NAME, name.data(), name_size);
+    }
+    if (resolution == NANOSECONDS) {
+        // Powers of 10, 10^-9
+        const uint8_t exponent = 9;
+        buffer = write_option(buffer, OPTION_IF_TSRESOL, &exponent, 1);
+    }
+    write_option(buffer, OPTION_END, 0, 0);
+    resolutions_.push_back(resolution);
+    return static_cast<uint32_t>(resolutions_.size() - 1);
+}
+
+uint32_t PcapngWriter::add_dlt_interface(int dlt, const string& name, uint32_t snap_len,
+                                         Resolution resolution) {
+    #ifdef TINS_HAVE_PCAP
+        // Files store LINKTYPE_* values rather than DLT_* ones
+        uint32_t link_type;
+        if (!Internals::dlt_to_link_type(dlt, link_type) || link_type > 0xffff) {
+            throw unknown_link_type();
+        }
+        return add_interface(static_cast<uint16_t>(link_type), name, snap_len, resolution);
+    #else
+        return add_interface(static_cast<uint16_t>(dlt), name, snap_len, resolution);
+    #endif // TINS_HAVE_PCAP
+}
+
+void PcapngWriter::write(PDU& pdu, uint32_t interface_id) {
+    write(pdu, Timestamp::current_time(), interface_id);
+}
+
+void PcapngWriter::write(Packet& packet, uint32_t interface_id) {
+    write(*packet.pdu(), packet.timestamp(), interface_id);
+}
+
+void PcapngWriter::write(PDU& pdu, const Timestamp& timestamp, uint32_t interface_id) {
+    Internals::ScratchSerialization buffer(pdu);
+    write(buffer.data(), buffer.size(), buffer.size(), timestamp.seconds(),
+          static_cast<uint32_t>(timestamp.microseconds()) * 1000, interface_id);
+}
+
+void PcapngWriter::write(const uint8_t* data, uint32_t size, uint32_t wire_size,
+                         uint64_t seconds, uint32_t nanoseconds, uint32_t interface_id) {
+    check_interface(interface_id);
+    const uint32_t data_size = padded_size(size);
+    uint8_t* buffer = start_block(ENHANCED_PACKET_BLOCK, 20 + data_size);
+    buffer = write_value(buffer, interface_id);
+    write_timestamp(buffer, interface_id, seconds, nanoseconds);
+    buffer += 8;
+    buffer = write_value(buffer, size);
+    buffer = write_value(buffer, wire_size);
+    std::memcpy(buffer, data, size);
+    std::memset(buffer + size, 0, data_size - size);
+}
+
+void PcapngWriter::write_simple(PDU& pdu) {
+    check_interface(0);
+    Internals::ScratchSerialization serialization(pdu);
+    const uint32_t size = serialization.size();
+    const uint32_t data_size = padded_size(size);
+    uint8_t* buffer = start_block(SIMPLE_PACKET_BLOCK, 4 + data_size);
+    buffer = write_value(buffer, size);
+    std::memcpy(buffer, serialization.data(), size);
+    std::memset(buffer + size, 0, data_size - size);
+}
+
+void PcapngWriter::write_statistics(uint32_t interface_id, const Timestamp& timestamp,
+                                    uint64_t packets_received, uint64_t packets_dropped) {
+    check_interface(interface_id);
+    const uint32_t body_size = 12 + 2 * option_size(sizeof(uint64_t)) + option_size(0);
+    uint8_t* buffer = start_block(INTERFACE_STATISTICS_BLOCK, body_size);
+    buffer = write_value(buffer, interface_id);
+    write_timestamp(buffer, interface_id, timestamp.seconds(),
+                    static_cast<uint32_t>(timestamp.microseconds()) * 1000);
+    buffer += 8;
+    buffer = write_option(buffer, OPTION_ISB_IFRECV, &packets_received, 
+                          sizeof(packets_received));
+    buffer = write_option(buffer, OPTION_ISB_IFDROP, &packets_dropped,
+                          sizeof(packets_dropped));
+    write_option(buffer, OPTION_END, 0, 0);
+}
+
+void PcapngWriter::flush() {
+    if (buffer_used_ > 0) {
+        const size_t size = buffer_used_;
+        buffer_used_ = 0;
+        if (fwrite(&buffer_[0], 1, size, file_) != size) {
+            throw capture_file_error("Failed to write to file");
+        }
+    }
+}
+
+uint32_t PcapngWriter::interface_count() const {
+    return static_cast<uint32_t>(resolutions_.size());
+}
+
+uint8_t* PcapngWriter::start_block(uint32_t type, uint32_t body_size) {
+    const uint32_t total_size = body_size + BLOCK_OVERHEAD;
+    if (buffer_used_ + total_size > buffer_.size()) {
+        flush();
+        // Make room for blocks larger than the buffer
+        if (total_size > buffer_.size()) {
+            buffer_.resize(total_size);
+        }
+    }
+    uint8_t* block = &buffer_[buffer_used_];
+    buffer_used_ += total_size;
+    write_value(block, type);
+    write_value(block + 4, total_size);
+    write_value(block + total_size - 4, total_size);
+    return block + 8;
+}
+
+void PcapngWriter::write_timestamp(uint8_t* buffer, uint32_t interface_id,
+                                   uint64_t seconds, uint32_t nanoseconds) const {
+    uint64_t value;
+    if (resolutions_[interface_id] == NANOSECONDS) {
+        value = seconds * 1000000000ULL + nanoseconds;
+    }
+    else {
+        value = seconds * 1000000ULL + nanoseconds / 1000;
+    }
+    // The high 32 bits go first, regardless of the byte order
+    write_value(buffer, static_cast<uint32_t>(value >> 32));
+    write_value(buffer + 4, static_cast<uint32_t>(value));
+}
+
+void PcapngWriter::check_interface(uint32_t interface_id) const {
+    if (interface_id >= resolutions_.size()) {
+        throw invalid_interface();
+    }
+}
+
+void PcapngWriter::write_header() {
+    uint8_t* buffer = start_block(SECTION_HEADER_BLOCK, 16 + option_size(0));
+    buffer = write_value(buffer, BYTE_ORDER_MAGIC);
+    // Version 1.0
+    buffer = write_value<uint16_t>(buffer, 1);
+    buffer = write_value<uint16_t>(buffer, 0);
+    // Section length is unknown
+    buffer = write_value<uint64_t>(buffer, 0xffffffffffffffffULL);
+    write_option(buffer, OPTION_END, 0, 0);
+}
+
+} // Tins
@@ -27,14 +27,51 @@
  *
  */
  
+#include <atomic>
+#include <cstring>
 #include <tins/pdu.h>
 #include <tins/packet_sender.h>
+#include <tins/detail/pdu_helpers.h>
 
 using std::swap;
 using std::vector;
 
 namespace Tins {
 
+// Only PDU types below this have a bit in PDU::inner_flags_
+static const uint32_t flag_count = 64;
+
+// Layers deeper than this aren't indexed by PDU::layer_depths_
+static const uint8_t max_layer_depth = 255;
+
+// The flags each PDU type matches, indexed by PDU type. 0 means unknown,
+// as every PDU at least matches its own type
+static std::atomic<uint64_t> type_flags[flag_count];
+
+static uint64_t compute_layer_flags(const PDU& pdu) {
+    uint64_t flags = 0;
+    for (uint32_t i = 0; i < flag_count; ++i) {
+        if (pdu.matches_flag(static_cast<PDU::PDUType>(i))) {
+            flags |= static_cast<uint64_t>(1) << i;
+        }
+    }
+    return flags;
+}
+
+static uint64_t layer_flags(const PDU& pdu) {
+    const uint32_t type = pdu.pdu_type();
+    // User defined PDUs can't be cached by type
+    if (type >= flag_count) {
+        return compute_layer_flags(pdu);
+    }
+    uint64_t flags = type_flags[type].load(std::memory_order_relaxed);
+    if (TINS_UNLIKELY(flags == 0)) {
+        flags = compute_layer_flags(pdu);
+        type_flags[type].store(flags, std::memory_order_relaxed);
+    }
+    return flags;
+}
+
 PDU::metadata::metadata() 
 : header_size(0), current_pdu_type(PDU::UNKNOWN), next_pdu_type(PDU::UNKNOWN) {
 
@@ -48,11 +85,13 @@ PDU::metadata::metadata(uint32_t header_size, PDUType current_type, PDUType next
 // PDU
 
 PDU::PDU()
-: inner_pdu_(), parent_pdu_(), malformed_() {
+: inner_pdu_(), parent_pdu_(), inner_flags_(), layer_depths_(), malformed_(),
+  lazy_placeholder_(), lazy_inner_() {
 }
 
 PDU::PDU(const PDU& other) 
-: inner_pdu_(), parent_pdu_(), malformed_(other.malformed_) {
+: inner_pdu_(), parent_pdu_(), inner_flags_(), layer_depths_(), 
+  malformed_(other.malformed_), lazy_placeholder_(), lazy_inner_() {
     copy_inner_pdu(other);
 }
 
@@ -67,8 +106,9 @@ PDU::~PDU() {
 }
 
 void PDU::copy_inner_pdu(const PDU& pdu) {
-    if (pdu.inner_pdu()) {
-        inner_pdu(pdu.inner_pdu()->clone());
+    // Use the inner PDU as is, so lazily decoded PDUs are cloned as such
+    if (pdu.inner_pdu_) {
+        inner_pdu(pdu.inner_pdu_->clone());
     }
 }
 
@@ -77,7 +117,7 @@ void PDU::prepare_for_serialize() {
 
 uint32_t PDU::size() const {
     uint32_t sz = header_size() + trailer_size();
-    const PDU* ptr(inner_pdu_);
+    const PDU* ptr(inner_pdu());
     while (ptr) {
         sz += ptr->header_size() + ptr->trailer_size();
         ptr = ptr->inner_pdu();
@@ -103,6 +143,7 @@ void PDU::inner_pdu(PDU* next_pdu) {
     if (inner_pdu_) {
         inner_pdu_->parent_pdu(this);
     }
+    update_inner_flags();
 }
 
 void PDU::inner_pdu(const PDU& next_pdu) {
@@ -110,20 +151,44 @@ void PDU::inner_pdu(const PDU& next_pdu) {
 }
 
 PDU* PDU::release_inner_pdu() {
+    // Make sure we never hand out a placeholder
+    inner_pdu();
     PDU* result = 0;
     swap(result, inner_pdu_);
     if (result) {
         result->parent_pdu(0);
     }
+    update_inner_flags();
     return result;
 }
 
 PDU::serialization_type PDU::serialize() {
-    vector<uint8_t> buffer(size());
-    serialize(&buffer[0], static_cast<uint32_t>(buffer.size()));
+    serialization_type buffer;
+    serialize_into(buffer);
     return buffer;
 }
 
+void PDU::serialize_into(serialization_type& buffer) {
+    // The size is computed once, inner PDUs are given whatever is left
+    // after their outer layers' headers and trailers
+    const uint32_t total_sz = size();
+    buffer.resize(total_sz);
+    if (total_sz > 0) {
+        serialize(&buffer[0], total_sz);
+    }
+}
+
+uint32_t PDU::serialize_into(uint8_t* buffer, uint32_t total_sz) {
+    const uint32_t sz = size();
+    if (total_sz < sz) {
+        throw serialization_error();
+    }
+    if (sz > 0) {
+        serialize(buffer, sz);
+    }
+    return sz;
+}
+
 void PDU::serialize(uint8_t* buffer, uint32_t total_sz) {
     uint32_t sz = header_size() + trailer_size();
     // Must not happen...
@@ -131,8 +196,9 @@ void PDU::serialize(uint8_t* buffer, uint32_t total_sz) {
     assert(total_sz >= sz);
     #endif
     prepare_for_serialize();
-    if (inner_pdu_) {
-        inner_pdu_->serialize(buffer + header_size(), total_sz - sz);
+    // size() accounts for the decoded inner PDUs, so serialize those
+    if (PDU* inner = inner_pdu()) {
+        inner->serialize(buffer + header_size(), total_sz - sz);
     }
     write_serialization(buffer, total_sz);
 }
@@ -141,4 +207,143 @@ void PDU::parent_pdu(PDU* parent) {
     parent_pdu_ = parent;
 }
 
+void PDU::decode() {
+    bool is_malformed = false;
+    PDU* pdu = this;
+    while (pdu) {
+        if (pdu->inner_pdu_ && pdu->inner_pdu_->lazy_placeholder_) {
+            is_malformed = !pdu->decode_inner_pdu() || is_malformed;
+        }
+        pdu = pdu->inner_pdu_;
+    }
+    if (is_malformed) {
+        throw malformed_packet();
+    }
+}
+
+bool PDU::decode_inner_pdu() {
+    PDU* placeholder = inner_pdu_;
+    bool is_valid = true;
+    // Take the PDU decoded by const accessors, if any
+    PDU* decoded = Internals::release_decoded_lazy_pdu(*placeholder, is_valid);
+    if (!decoded) {
+        decoded = Internals::decode_lazy_pdu(*placeholder, is_valid);
+    }
+    inner_pdu_ = decoded;
+    decoded->parent_pdu(this);
+    delete placeholder;
+    update_inner_flags();
+    return is_valid;
+}
+
+PDU* PDU::decoded_inner_pdu() const {
+    return Internals::shared_decoded_lazy_pdu(*inner_pdu_, const_cast<PDU*>(this));
+}
+
+const PDU* PDU::find_layer(PDUType type) const {
+    const uint32_t flag = type;
+    if (flag < flag_count) {
+        const uint64_t mask = static_cast<uint64_t>(1) << flag;
+        if (layer_flags(*this) & mask) {
+            return this;
+        }
+        if (const uint8_t depth = layer_depths_[flag]) {
+            const PDU* pdu = this;
+            for (uint8_t i = 0; i < depth; ++i) {
+                pdu = pdu->inner_pdu_;
+            }
+            return pdu;
+        }
+        // Otherwise, only layers that still have to be decoded or that are
+        // too deep to be indexed can match
+        if ((inner_flags_ & mask) == 0 && !lazy_inner_) {
+            return 0;
+        }
+    }
+    const PDU* pdu = this;
+    while (pdu) {
+        if (pdu->matches_flag(type)) {
+            return pdu;
+        }
+        pdu = pdu->inner_pdu();
+    }
+    return 0;
+}
+
+PDU* PDU::find_layer(PDUType type) {
+    const uint32_t flag = type;
+    if (flag < flag_count) {
+        const uint64_t mask = static_cast<uint64_t>(1) << flag;
+        if (layer_flags(*this) & mask) {
+            return this;
+        }
+        if (const uint8_t depth = layer_depths_[flag]) {
+            PDU* pdu = this;
+            for (uint8_t i = 0; i < depth; ++i) {
+                pdu = pdu->inner_pdu_;
+            }
+            return pdu;
+        }
+        if ((inner_flags_ & mask) == 0 && !lazy_inner_) {
+            return 0;
+        }
+    }
+    PDU* pdu = this;
+    while (pdu) {
+        if (pdu->matches_flag(type)) {
+            return pdu;
+        }
+        pdu = pdu->inner_pdu();
+    }
+    return 0;
+}
+
+bool PDU::has_layer(PDUType type) const {
+    const uint32_t flag = type;
+    if (flag < flag_count) {
+        const uint64_t mask = static_cast<uint64_t>(1) << flag;
+        if ((layer_flags(*this) | inner_flags_) & mask) {
+            return true;
+        }
+        if (!lazy_inner_) {
+            return false;
+        }
+    }
+    return find_layer(type) != 0;
+}
+
+void PDU::update_inner_flags() {
+    PDU* pdu = this;
+    while (pdu) {
+        const PDU* inner = pdu->inner_pdu_;
+        if (!inner || inner->lazy_placeholder_) {
+            pdu->inner_flags_ = 0;
+            pdu->lazy_inner_ = inner != 0;
+            memset(pdu->layer_depths_, 0, sizeof(pdu->layer_depths_));
+        }
+        else {
+            const uint64_t flags = layer_flags(*inner);
+            pdu->inner_flags_ = flags | inner->inner_flags_;
+            pdu->lazy_inner_ = inner->lazy_inner_;
+            // The inner PDU's index, one layer deeper, except for the flags
+            // the inner PDU itself matches
+            for (uint32_t i = 0; i < flag_count; ++i) {
+                const uint8_t depth = inner->layer_depths_[i];
+                if ((flags >> i) & 1) {
+                    pdu->layer_depths_[i] = 1;
+                }
+                else {
+                    pdu->layer_depths_[i] = (depth == 0 || depth == max_layer_depth) ? 0 : depth + 1;
+                }
+            }
+        }
+        PDU* parent = pdu->parent_pdu_;
+        // PDUs decoded by const accessors aren't part of their parent's chain
+        if (parent && parent->inner_pdu_ != pdu) {
+            break;
+        }
+        pdu = parent;
+    }
+}
+
 } // Tins
@@ -0,0 +1,576 @@
+/*
+ * Copyright (c) 2017, Matias Fontanini
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are
+ * met:
+ * 
+ * * Redistributions of source code must retain the above copyright
+ *   notice, this list of conditions and the following disclaimer.
+ * * Redistributions in binary form must reproduce the above
+ *   copyright notice, this list of conditions and the following disclaimer
+ *   in the documentation and/or other materials provided with the
+ *   distribution.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+
+#include <tins/prober.h>
+
+#if TINS_IS_CXX11
+
+#include <cstring>
+#include <limits>
+#include <stdexcept>
+#include <tins/packet_sender.h>
+#include <tins/network_interface.h>
+#include <tins/ip.h>
+#include <tins/ipv6.h>
+#include <tins/tcp.h>
+#include <tins/udp.h>
+#include <tins/icmp.h>
+#include <tins/icmpv6.h>
+#include <tins/arp.h>
+#include <tins/dns.h>
+#include <tins/rawpdu.h>
+#include <tins/endianness.h>
+#include <tins/memory_helpers.h>
+#include <tins/constants.h>
+#include <tins/exceptions.h>
+#ifdef TINS_HAVE_PCAP
+    #include <tins/sniffer.h>
+    #ifndef _WIN32
+        #include <poll.h>
+        #include <errno.h>
+    #endif // _WIN32
+#endif // TINS_HAVE_PCAP
+
+using std::vector;
+using std::unique_ptr;
+using std::shared_ptr;
+using std::promise;
+using std::lock_guard;
+using std::mutex;
+using std::runtime_error;
+
+namespace Tins {
+
+namespace {
+
+enum KeyKind {
+    NO_KEY,
+    ICMP_KEY,
+    TCP_KEY,
+    UDP_KEY,
+    DNS_KEY,
+    ARP_KEY
+};
+
+const uint16_t DNS_PORT = 53;
+
+// Builds keys by appending fields in network byte order
+template <typename Key>
+class KeyBuilder {
+public:
+    KeyBuilder(Key& key, KeyKind kind)
+    : key_(key) {
+        key_.kind = kind;
+        key_.size = 0;
+    }
+
+    void add(const uint8_t* data, size_t size) {
+        memcpy(key_.data + key_.size, data, size);
+        key_.size += static_cast<uint8_t>(size);
+    }
+
+    void add(IPv4Address address) {
+        // This is already in network byte order
+        const uint32_t value = address;
+        add((const uint8_t*)&value, sizeof(value));
+    }
+
+    void add(const IPv6Address& address) {
+        add(address.begin(), IPv6Address::address_size);
+    }
+
+    void add16(uint16_t value) {
+        value = Endian::host_to_be(value);
+        add((const uint8_t*)&value, sizeof(value));
+    }
+
+    void add32(uint32_t value) {
+        value = Endian::host_to_be(value);
+        add((const uint8_t*)&value, sizeof(value));
+    }
+private:
+    Key& key_;
+};
+
+// Returns the DNS identifier carried by a UDP datagram, if any
+bool dns_id(const UDP& udp, uint16_t& id) {
+    if (const DNS* dns = udp.find_pdu<DNS>()) {
+        id = dns->id();
+        return true;
+    }
+    const RawPDU* raw = udp.find_pdu<RawPDU>();
+    if (raw && raw->payload_size() >= sizeof(uint16_t)) {
+        id = Memory::read_be_value<uint16_t>(&raw->payload()[0]);
+        return true;
+    }
+    return false;
+}
+
+// Keys for probes and for the responses sent by remote_address have the 
+// same layout, so they can be built by the same functions
+template <typename Key, typename Address>
+bool make_transport_key(Key& key, const Address& remote_address, const PDU& transport,
+                        bool is_response) {
+    if (const TCP* tcp = tins_cast<const TCP*>(&transport)) {
+        KeyBuilder<Key> builder(key, TCP_KEY);
+        builder.add(remote_address);
+        if (is_response) {
+            builder.add16(tcp->sport());
+            builder.add16(tcp->dport());
+            builder.add32(tcp->ack_seq() - 1);
+        }
+        else {
+            builder.add16(tcp->dport());
+            builder.add16(tcp->sport());
+            builder.add32(tcp->seq());
+        }
+        return true;
+    }
+    if (const UDP* udp = tins_cast<const UDP*>(&transport)) {
+        const uint16_t remote_port = is_response ? udp->sport() : udp->dport();
+        const uint16_t local_port = is_response ? udp->dport() : udp->sport();
+        uint16_t id;
+        const bool is_dns = remote_port == DNS_PORT && dns_id(*udp, id);
+        KeyBuilder<Key> builder(key, is_dns ? DNS_KEY : UDP_KEY);
+        builder.add(remote_address);
+        builder.add16(remote_port);
+        builder.add16(local_port);
+        if (is_dns) {
+            builder.add16(id);
+        }
+        return true;
+    }
+    return false;
+}
+
+template <typename Key, typename Address>
+void make_echo_key(Key& key, const Address& remote_address, uint16_t id, uint16_t sequence) {
+    KeyBuilder<Key> builder(key, ICMP_KEY);
+    builder.add(remote_address);
+    builder.add16(id);
+    builder.add16(sequence);
+}
+
+// Builds the key of the probe quoted by an ICMP or ICMPv6 error
+template <typename Key>
+bool make_quoted_key(Key& key, const PDU& icmp, bool is_ipv6) {
+    const RawPDU* raw = tins_cast<const RawPDU*>(icmp.inner_pdu());
+    if (!raw) {
+        return false;
+    }
+    const uint8_t* ptr = raw->payload().data();
+    uint32_t size = raw->payload_size();
+    uint8_t protocol;
+    uint32_t header_size;
+    if (is_ipv6) {
+        header_size = 40;
+        if (size < header_size) {
+            return false;
+        }
+        protocol = ptr[6];
+    }
+    else {
+        if (size < 20) {
+            return false;
+        }
+        header_size = (ptr[0] & 0x0f) * 4;
+        protocol = ptr[9];
+        if (header_size < 20 || size < header_size) {
+            return false;
+        }
+    }
+    const uint8_t* transport = ptr + header_size;
+    size -= header_size;
+    // Only the first 8 bytes of the transport layer are guaranteed to be quoted
+    if (size < 8) {
+        return false;
+    }
+    KeyKind kind = NO_KEY;
+    const uint16_t dport = Memory::read_be_value<uint16_t>(transport + 2);
+    if (protocol == Constants::IP::PROTO_TCP) {
+        kind = TCP_KEY;
+    }
+    else if (protocol == Constants::IP::PROTO_UDP) {
+        kind = (dport == DNS_PORT && size >= 10) ? DNS_KEY : UDP_KEY;
+    }
+    else if (!is_ipv6 && protocol == Constants::IP::PROTO_ICMP && 
+             transport[0] == ICMP::ECHO_REQUEST) {
+        kind = ICMP_KEY;
+    }
+    else if (is_ipv6 && protocol == Constants::IP::PROTO_ICMPV6 && 
+             transport[0] == ICMPv6::ECHO_REQUEST) {
+        kind = ICMP_KEY;
+    }
+    else {
+        return false;
+    }
+    KeyBuilder<Key> builder(key, kind);
+    if (is_ipv6) {
+        builder.add(ptr + 24, IPv6Address::address_size);
+    }
+    else {
+        builder.add(ptr + 16, sizeof(uint32_t));
+    }
+    if (kind == ICMP_KEY) {
+        // Identifier and sequence number
+        builder.add(transport + 4, 4);
+    }
+    else {
+        // Destination and source ports
+        builder.add(transport + 2, 2);
+        builder.add(transport, 2);
+        if (kind == TCP_KEY) {
+            builder.add(transport + 4, 4);
+        }
+        else if (kind == DNS_KEY) {
+            builder.add(transport + 8, 2);
+        }
+    }
+    return true;
+}
+
+template <typename Key>
+bool make_key(Key& key, const PDU& pdu, bool is_response) {
+    if (const ARP* arp = pdu.find_pdu<ARP>()) {
+        const ARP::Flags opcode = is_response ? ARP::REPLY : ARP::REQUEST;
+        if (arp->opcode() != opcode) {
+            return false;
+        }
+        KeyBuilder<Key> builder(key, ARP_KEY);
+        builder.add(is_response ? arp->sender_ip_addr() : arp->target_ip_addr());
+        return true;
+    }
+    if (const IP* ip = pdu.find_pdu<IP>()) {
+        const IPv4Address remote = is_response ? ip->src_addr() : ip->dst_addr();
+        const PDU* inner = ip->inner_pdu();
+        if (!inner) {
+            return false;
+        }
+        if (const ICMP* icmp = tins_cast<const ICMP*>(inner)) {
+            switch (icmp->type()) {
+                case ICMP::ECHO_REQUEST:
+                case ICMP::ECHO_REPLY:
+                    if ((icmp->type() == ICMP::ECHO_REPLY) != is_response) {
+                        return false;
+                    }
+                    make_echo_key(key, remote, icmp->id(), icmp->sequence());
+                    return true;
+                case ICMP::DEST_UNREACHABLE:
+                case ICMP::SOURCE_QUENCH:
+                case ICMP::TIME_EXCEEDED:
+                case ICMP::PARAM_PROBLEM:
+                    return is_response && make_quoted_key(key, *icmp, false);
+                default:
+                    return false;
+            }
+        }
+        return make_transport_key(key, remote, *inner, is_response);
+    }
+    if (const IPv6* ipv6 = pdu.find_pdu<IPv6>()) {
+        const IPv6Address remote = is_response ? ipv6->src_addr() : ipv6->dst_addr();
+        if (const ICMPv6* icmp = ipv6->find_pdu<ICMPv6>()) {
+            switch (icmp->type()) {
+                case ICMPv6::ECHO_REQUEST:
+                case ICMPv6::ECHO_REPLY:
+                    if ((icmp->type() == ICMPv6::ECHO_REPLY) != is_response) {
+                        return false;
+                    }
+                    make_echo_key(key, remote, icmp->identifier(), icmp->sequence());
+                    return true;
+                case ICMPv6::DEST_UNREACHABLE:
+                case ICMPv6::PACKET_TOOBIG:
+                case ICMPv6::TIME_EXCEEDED:
+                case ICMPv6::PARAM_PROBLEM:
+                    return is_response && make_quoted_key(key, *icmp, true);
+                default:
+                    return false;
+            }
+        }
+        if (const TCP* tcp = ipv6->find_pdu<TCP>()) {
+            return make_transport_key(key, remote, *tcp, is_response);
+        }
+        if (const UDP* udp = ipv6->find_pdu<UDP>()) {
+            return make_transport_key(key, remote, *udp, is_response);
+        }
+    }
+    return false;
+}
+
+// std::function requires copyable functors, hence the shared promise
+Prober::callback_type make_promise_callback(const shared_ptr<promise<unique_ptr<PDU>>>& result) {
+    return [result](const PDU* response) {
+        result->set_value(unique_ptr<PDU>(response ? response->clone() : 0));
+    };
+}
+
+} // anonymous namespace
+
+const Prober::duration_type Prober::DEFAULT_TIMEOUT = duration_type(2000);
+const Prober::duration_type Prober::DEFAULT_RESOLUTION = duration_type(10);
+const size_t Prober::WHEEL_SIZE = 512;
+
+bool Prober::key_type::operator==(const key_type& rhs) const {
+    return kind == rhs.kind && size == rhs.size && memcmp(data, rhs.data, size) == 0;
+}
+
+size_t Prober::key_hash::operator()(const key_type& key) const {
+    // FNV-1a
+    uint64_t hash = 14695981039346656037ULL;
+    hash = (hash ^ key.kind) * 1099511628211ULL;
+    for (uint8_t i = 0; i < key.size; ++i) {
+        hash = (hash ^ key.data[i]) * 1099511628211ULL;
+    }
+    return static_cast<size_t>(hash);
+}
+
+Prober::Prober(PacketSender& sender, duration_type timeout, duration_type resolution)
+: sender_(sender), timeout_(timeout), resolution_(resolution), start_(clock_type::now()),
+  wheel_(WHEEL_SIZE), current_tick_(0), next_id_(0) {
+    if (resolution_.count() <= 0) {
+        throw runtime_error("The timer resolution must be positive");
+    }
+}
+
+void Prober::send(PDU& probe, callback_type callback) {
+    send_probe(probe, 0, std::move(callback), timeout_);
+}
+
+void Prober::send(PDU& probe, callback_type callback, duration_type timeout) {
+    send_probe(probe, 0, std::move(callback), timeout);
+}
+
+void Prober::send(PDU& probe, const NetworkInterface& iface, callback_type callback,
+                  duration_type timeout) {
+    send_probe(probe, &iface, std::move(callback), timeout);
+}
+
+Prober::future_type Prober::send(PDU& probe) {
+    return send(probe, timeout_);
+}
+
+Prober::future_type Prober::send(PDU& probe, duration_type timeout) {
+    shared_ptr<promise<unique_ptr<PDU>>> result = std::make_shared<promise<unique_ptr<PDU>>>();
+    future_type future = result->get_future();
+    send(probe, make_promise_callback(result), timeout);
+    return future;
+}
+
+void Prober::add(const PDU& probe, callback_type callback, duration_type timeout) {
+    key_type key;
+    if (!make_key(key, probe, false)) {
+        throw runtime_error("Unsupported probe");
+    }
+    add_probe(key, std::move(callback), timeout);
+}
+
+Prober::future_type Prober::add(const PDU& probe, duration_type timeout) {
+    shared_ptr<promise<unique_ptr<PDU>>> result = std::make_shared<promise<unique_ptr<PDU>>>();
+    future_type future = result->get_future();
+    add(probe, make_promise_callback(result), timeout);
+    return future;
+}
+
+void Prober::add_probe(const key_type& key, callback_type callback, duration_type timeout) {
+    const clock_type::time_point deadline = clock_type::now() + timeout;
+    lock_guard<mutex> _(mutex_);
+    probe_entry entry;
+    entry.callback = std::move(callback);
+    entry.id = next_id_++;
+    if (!probes_.insert(std::make_pair(key, entry)).second) {
+        throw runtime_error("A probe with the same key is already pending");
+    }
+    timer_entry timer;
+    timer.key = key;
+    timer.id = entry.id;
+    // Timeouts never expire before the next tick
+    timer.deadline = std::max(tick(deadline) + 1, current_tick_ + 1);
+    wheel_[timer.deadline % WHEEL_SIZE].push_back(timer);
+}
+
+bool Prober::process(const PDU& packet) {
+    key_type key;
+    if (!make_key(key, packet, true)) {
+        return false;
+    }
+    callback_type callback;
+    {
+        lock_guard<mutex> _(mutex_);
+        probes_type::iterator iter = probes_.find(key);
+        if (iter == probes_.end()) {
+            return false;
+        }
+        callback = std::move(iter->second.callback);
+        probes_.erase(iter);
+    }
+    if (callback) {
+        callback(&packet);
+    }
+    return true;
+}
+
+size_t Prober::expire() {
+    return expire(clock_type::now());
+}
+
+size_t Prober::expire(clock_type::time_point now) {
+    vector<callback_type> expired;
+    {
+        lock_guard<mutex> _(mutex_);
+        const uint64_t target = tick(now);
+        // Every slot is visited at most once
+        const uint64_t steps = std::min<uint64_t>(target > current_tick_ ? 
+                                                  target - current_tick_ : 0, WHEEL_SIZE);
+        for (uint64_t i = 1; i <= steps; ++i) {
+            vector<timer_entry>& slot = wheel_[(current_tick_ + i) % WHEEL_SIZE];
+            size_t kept = 0;
+            for (size_t j = 0; j < slot.size(); ++j) {
+                const timer_entry& timer = slot[j];
+                if (timer.deadline > target) {
+                    slot[kept++] = timer;
+                    continue;
+                }
+                // Probes that already got a response are still in the wheel
+                probes_type::iterator iter = probes_.find(timer.key);
+                if (iter != probes_.end() && iter->second.id == timer.id) {
+                    expired.push_back(std::move(iter->second.callback));
+                    probes_.erase(iter);
+                }
+            }
+            slot.resize(kept);
+        }
+        current_tick_ = std::max(current_tick_, target);
+    }
+    for (size_t i = 0; i < expired.size(); ++i) {
+        if (expired[i]) {
+            expired[i](0);
+        }
+    }
+    return expired.size();
+}
+
+size_t Prober::pending() const {
+    lock_guard<mutex> _(mutex_);
+    return probes_.size();
+}
+
+#ifdef TINS_HAVE_PCAP
+void Prober::run(BaseSniffer& sniffer) {
+    // pcap_loop doesn't return when the read timeout expires
+    sniffer.set_pcap_sniffing_method(pcap_dispatch);
+    #ifndef _WIN32
+        const int fd = sniffer.get_fd();
+    #endif // _WIN32
+    while (pending() > 0) {
+        #ifndef _WIN32
+        if (fd != -1) {
+            // Wait for packets until the next probe is due
+            struct pollfd descriptor = { fd, POLLIN, 0 };
+            const int result = poll(&descriptor, 1, poll_timeout(clock_type::now()));
+            if (result < 0 && errno != EINTR) {
+                throw pcap_error(strerror(errno));
+            }
+            if (result <= 0) {
+                expire();
+                continue;
+            }
+        }
+        #endif // _WIN32
+        Packet packet = sniffer.next_packet();
+        if (packet) {
+            process(*packet.pdu());
+        }
+        expire();
+    }
+}
+#endif // TINS_HAVE_PCAP
+
+void Prober::send_probe(PDU& probe, const NetworkInterface* iface, callback_type callback,
+                        duration_type timeout) {
+    key_type key;
+    if (!make_key(key, probe, false)) {
+        throw runtime_error("Unsupported probe");
+    }
+    // The probe is registered first, so its response can't be missed
+    add_probe(key, std::move(callback), timeout);
+    try {
+        if (iface) {
+            sender_.send(probe, *iface);
+        }
+        else {
+            sender_.send(probe);
+        }
+    }
+    catch (...) {
+        lock_guard<mutex> _(mutex_);
+        probes_.erase(key);
+        throw;
+    }
+}
+
+int Prober::poll_timeout(clock_type::time_point now) const {
+    uint64_t deadline = std::numeric_limits<uint64_t>::max();
+    {
+        lock_guard<mutex> _(mutex_);
+        // Slots are visited in order, so the search stops at the first 
+        // timer that's due within the current turn of the wheel
+        for (uint64_t i = 1; i <= WHEEL_SIZE; ++i) {
+            const vector<timer_entry>& slot = wheel_[(current_tick_ + i) % WHEEL_SIZE];
+            for (size_t j = 0; j < slot.size(); ++j) {
+                deadline = std::min(deadline, slot[j].deadline);
+            }
+            if (deadline <= current_tick_ + i) {
+                break;
+            }
+        }
+    }
+    if (deadline == std::numeric_limits<uint64_t>::max()) {
+        return -1;
+    }
+    const clock_type::time_point time_point = start_ + resolution_ * deadline;
+    if (time_point <= now) {
+        return 0;
+    }
+    // Round up, otherwise we'd wake up right before the deadline
+    const int64_t remaining = std::chrono::duration_cast<std::chrono::milliseconds>(
+        time_point - now + std::chrono::milliseconds(1) - clock_type::duration(1)
+    ).count();
+    return static_cast<int>(std::min<int64_t>(remaining, std::numeric_limits<int>::max()));
+}
+
+uint64_t Prober::tick(clock_type::time_point time_point) const {
+    if (time_point <= start_) {
+        return 0;
+    }
+    return static_cast<uint64_t>((time_point - start_) / resolution_);
+}
+
+} // Tins
+
+#endif // TINS_IS_CXX11
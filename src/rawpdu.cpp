@@ -28,18 +28,17 @@
  */
 
 #include <tins/rawpdu.h>
-#include <tins/memory_helpers.h>
-
-using Tins::Memory::OutputMemoryStream;
+#include <tins/exceptions.h>
+#include <tins/utils/checksum_utils.h>
 
 namespace Tins {
 RawPDU::RawPDU(const uint8_t* pload, uint32_t size) 
-: payload_(pload, pload + size) {
+: payload_(pload, pload + size), payload_sum_(0) {
     
 }
 
 RawPDU::RawPDU(const std::string& data) 
-: payload_(data.begin(), data.end()) {
+: payload_(data.begin(), data.end()), payload_sum_(0) {
     
 }
 
@@ -48,8 +47,13 @@ uint32_t RawPDU::header_size() const {
 }
 
 void RawPDU::write_serialization(uint8_t* buffer, uint32_t total_sz) {
-    OutputMemoryStream stream(buffer, total_sz);
-    stream.write(payload_.begin(), payload_.end());
+    if (total_sz < payload_.size()) {
+        throw serialization_error();
+    }
+    // Sum the payload while copying it, so TCP and UDP don't have to read
+    // it again when computing their checksums
+    const uint8_t* payload = payload_.data();
+    payload_sum_ = Utils::copy_and_sum_range(payload, payload + payload_.size(), buffer);
 }
 
 void RawPDU::payload(const payload_type& pload) {
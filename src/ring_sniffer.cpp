@@ -0,0 +1,570 @@
+/*
+ * Copyright (c) 2017, Matias Fontanini
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are
+ * met:
+ * 
+ * * Redistributions of source code must retain the above copyright
+ *   notice, this list of conditions and the following disclaimer.
+ * * Redistributions in binary form must reproduce the above
+ *   copyright notice, this list of conditions and the following disclaimer
+ *   in the documentation and/or other materials provided with the
+ *   distribution.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+
+#include <tins/ring_sniffer.h>
+
+#ifdef TINS_HAVE_PACKET_RING
+
+#include <sys/socket.h>
+#include <sys/mman.h>
+#include <sys/eventfd.h>
+#include <poll.h>
+#include <unistd.h>
+#include <time.h>
+#include <errno.h>
+#include <arpa/inet.h>
+#include <net/if_arp.h>
+#include <linux/if_ether.h>
+#include <linux/if_packet.h>
+#include <cstring>
+#include <stdexcept>
+#include <tins/network_interface.h>
+#include <tins/rawpdu.h>
+#include <tins/lazy_decoding.h>
+#include <tins/detail/pdu_helpers.h>
+
+using std::string;
+using std::vector;
+
+namespace Tins {
+
+namespace {
+
+string error_string() {
+    return strerror(errno);
+}
+
+uint32_t to_fanout_type(RingSnifferConfiguration::FanoutMode mode) {
+    switch (mode) {
+        case RingSnifferConfiguration::FANOUT_LOAD_BALANCE:
+            return PACKET_FANOUT_LB;
+        case RingSnifferConfiguration::FANOUT_CPU:
+            return PACKET_FANOUT_CPU;
+        case RingSnifferConfiguration::FANOUT_QUEUE_MAPPING:
+            return PACKET_FANOUT_QM;
+        default:
+            // Defragment so every fragment of a datagram hashes the same way
+            return PACKET_FANOUT_HASH | PACKET_FANOUT_FLAG_DEFRAG;
+    }
+}
+
+// The amount of random identifiers tried when creating a fanout group
+const unsigned MAX_FANOUT_ATTEMPTS = 32;
+
+bool set_fanout_option(int fd, uint16_t group_id, uint32_t type) {
+    const uint32_t fanout = group_id | (type << 16);
+    return setsockopt(fd, SOL_PACKET, PACKET_FANOUT, &fanout, sizeof(fanout)) == 0;
+}
+
+uint16_t random_group_id() {
+    static uint32_t counter = 0;
+    timespec now;
+    clock_gettime(CLOCK_REALTIME, &now);
+    // Sniffers created at the same time, in this or another process, still
+    // get different values
+    uint32_t value = static_cast<uint32_t>(now.tv_nsec) ^ 
+                     (static_cast<uint32_t>(getpid()) << 12) ^
+                     __atomic_fetch_add(&counter, 0x9e3779b9U, __ATOMIC_RELAXED);
+    value = (value ^ (value >> 16)) * 0x45d9f3bU;
+    value = (value ^ (value >> 16)) * 0x45d9f3bU;
+    return static_cast<uint16_t>(value ^ (value >> 16));
+}
+
+const tpacket_block_desc* as_block(const uint8_t* ptr) {
+    return reinterpret_cast<const tpacket_block_desc*>(ptr);
+}
+
+const tpacket3_hdr* as_packet(const uint8_t* ptr) {
+    return reinterpret_cast<const tpacket3_hdr*>(ptr);
+}
+
+} // anonymous namespace
+
+// RingSnifferConfiguration
+
+const unsigned RingSnifferConfiguration::DEFAULT_BLOCK_SIZE = 1 << 20;
+const unsigned RingSnifferConfiguration::DEFAULT_BLOCK_COUNT = 64;
+const unsigned RingSnifferConfiguration::DEFAULT_FRAME_SIZE = 2048;
+const unsigned RingSnifferConfiguration::DEFAULT_BLOCK_TIMEOUT = 64;
+
+RingSnifferConfiguration::RingSnifferConfiguration()
+: block_size_(DEFAULT_BLOCK_SIZE), block_count_(DEFAULT_BLOCK_COUNT),
+  frame_size_(DEFAULT_FRAME_SIZE), block_timeout_(DEFAULT_BLOCK_TIMEOUT),
+  timeout_(0), fanout_mode_(FANOUT_HASH), fanout_group_id_(0), promisc_(false),
+  has_fanout_(false), unique_fanout_(false) {
+
+}
+
+void RingSnifferConfiguration::set_block_size(unsigned size) {
+    block_size_ = size;
+}
+
+void RingSnifferConfiguration::set_block_count(unsigned count) {
+    block_count_ = count;
+}
+
+void RingSnifferConfiguration::set_frame_size(unsigned size) {
+    frame_size_ = size;
+}
+
+void RingSnifferConfiguration::set_block_timeout(unsigned timeout) {
+    block_timeout_ = timeout;
+}
+
+void RingSnifferConfiguration::set_timeout(unsigned timeout) {
+    timeout_ = timeout;
+}
+
+void RingSnifferConfiguration::set_promisc_mode(bool enabled) {
+    promisc_ = enabled;
+}
+
+unsigned RingSnifferConfiguration::block_size() const {
+    return block_size_;
+}
+
+unsigned RingSnifferConfiguration::block_count() const {
+    return block_count_;
+}
+
+unsigned RingSnifferConfiguration::frame_size() const {
+    return frame_size_;
+}
+
+unsigned RingSnifferConfiguration::block_timeout() const {
+    return block_timeout_;
+}
+
+unsigned RingSnifferConfiguration::timeout() const {
+    return timeout_;
+}
+
+void RingSnifferConfiguration::set_fanout(uint16_t group_id, FanoutMode mode) {
+    fanout_group_id_ = group_id;
+    fanout_mode_ = mode;
+    has_fanout_ = true;
+    unique_fanout_ = false;
+}
+
+void RingSnifferConfiguration::set_unique_fanout(FanoutMode mode) {
+    fanout_group_id_ = 0;
+    fanout_mode_ = mode;
+    has_fanout_ = true;
+    unique_fanout_ = true;
+}
+
+bool RingSnifferConfiguration::promisc_mode() const {
+    return promisc_;
+}
+
+bool RingSnifferConfiguration::has_fanout() const {
+    return has_fanout_;
+}
+
+uint16_t RingSnifferConfiguration::fanout_group_id() const {
+    return fanout_group_id_;
+}
+
+bool RingSnifferConfiguration::unique_fanout() const {
+    return unique_fanout_;
+}
+
+RingSnifferConfiguration::FanoutMode RingSnifferConfiguration::fanout_mode() const {
+    return fanout_mode_;
+}
+
+// RingSniffer
+
+RingSniffer::RingSniffer(const string& device,
+                         const RingSnifferConfiguration& configuration)
+: ring_(0), ring_size_(0), fd_(-1), stop_fd_(-1), stop_requested_(0),
+  block_size_(configuration.block_size()), 
+  block_count_(configuration.block_count()), current_block_(0), 
+  current_packet_(0), packets_left_(0), timeout_(-1), extract_raw_(false),
+  lazy_decoding_(false) {
+    if (block_size_ == 0 || block_count_ == 0 || configuration.frame_size() == 0 ||
+        block_size_ % configuration.frame_size() != 0) {
+        throw std::runtime_error("Invalid ring geometry");
+    }
+    if (configuration.timeout() > 0) {
+        timeout_ = static_cast<int>(configuration.timeout());
+    }
+    const NetworkInterface iface(device);
+    try {
+        fd_ = socket(AF_PACKET, SOCK_RAW, htons(ETH_P_ALL));
+        if (fd_ < 0) {
+            throw socket_open_error(error_string());
+        }
+        stop_fd_ = eventfd(0, EFD_NONBLOCK);
+        if (stop_fd_ < 0) {
+            throw socket_open_error(error_string());
+        }
+        int version = TPACKET_V3;
+        if (setsockopt(fd_, SOL_PACKET, PACKET_VERSION, &version, sizeof(version)) < 0) {
+            throw socket_open_error(error_string());
+        }
+
+        tpacket_req3 request;
+        memset(&request, 0, sizeof(request));
+        request.tp_block_size = block_size_;
+        request.tp_block_nr = block_count_;
+        request.tp_frame_size = configuration.frame_size();
+        request.tp_frame_nr = (block_size_ / configuration.frame_size()) * block_count_;
+        request.tp_retire_blk_tov = configuration.block_timeout();
+        if (setsockopt(fd_, SOL_PACKET, PACKET_RX_RING, &request, sizeof(request)) < 0) {
+            throw socket_open_error(error_string());
+        }
+        ring_size_ = block_size_ * block_count_;
+        void* ring = mmap(0, ring_size_, PROT_READ | PROT_WRITE, MAP_SHARED, fd_, 0);
+        if (ring == MAP_FAILED) {
+            ring_size_ = 0;
+            throw socket_open_error(error_string());
+        }
+        ring_ = static_cast<uint8_t*>(ring);
+
+        if (configuration.promisc_mode()) {
+            packet_mreq membership;
+            memset(&membership, 0, sizeof(membership));
+            membership.mr_ifindex = iface.id();
+            membership.mr_type = PACKET_MR_PROMISC;
+            if (setsockopt(fd_, SOL_PACKET, PACKET_ADD_MEMBERSHIP, &membership,
+                           sizeof(membership)) < 0) {
+                throw socket_open_error(error_string());
+            }
+        }
+
+        sockaddr_ll address;
+        memset(&address, 0, sizeof(address));
+        address.sll_family = AF_PACKET;
+        address.sll_protocol = htons(ETH_P_ALL);
+        address.sll_ifindex = iface.id();
+        if (bind(fd_, (const sockaddr*)&address, sizeof(address)) < 0) {
+            throw socket_open_error(error_string());
+        }
+
+        // Fanout groups can only be joined by bound sockets
+        if (configuration.has_fanout()) {
+            join_fanout(configuration);
+        }
+    }
+    catch (...) {
+        cleanup();
+        throw;
+    }
+}
+
+#if TINS_IS_CXX11
+RingSniffer::RingSniffer(RingSniffer&& rhs) TINS_NOEXCEPT
+: ring_(0), ring_size_(0), fd_(-1), stop_fd_(-1), stop_requested_(0),
+  block_size_(0), block_count_(0),
+  current_block_(0), current_packet_(0), packets_left_(0), timeout_(-1),
+  extract_raw_(false), lazy_decoding_(false) {
+    *this = std::move(rhs);
+}
+
+RingSniffer& RingSniffer::operator=(RingSniffer&& rhs) TINS_NOEXCEPT {
+    using std::swap;
+    swap(ring_, rhs.ring_);
+    swap(ring_size_, rhs.ring_size_);
+    swap(fd_, rhs.fd_);
+    swap(stop_fd_, rhs.stop_fd_);
+    stop_requested_ = __atomic_exchange_n(&rhs.stop_requested_, stop_requested_,
+                                          __ATOMIC_ACQ_REL);
+    swap(block_size_, rhs.block_size_);
+    swap(block_count_, rhs.block_count_);
+    swap(current_block_, rhs.current_block_);
+    swap(current_packet_, rhs.current_packet_);
+    swap(packets_left_, rhs.packets_left_);
+    swap(timeout_, rhs.timeout_);
+    swap(stats_, rhs.stats_);
+    swap(extract_raw_, rhs.extract_raw_);
+    swap(lazy_decoding_, rhs.lazy_decoding_);
+    return *this;
+}
+#endif // TINS_IS_CXX11
+
+RingSniffer::~RingSniffer() {
+    cleanup();
+}
+
+void RingSniffer::join_fanout(const RingSnifferConfiguration& configuration) {
+    const uint32_t type = to_fanout_type(configuration.fanout_mode());
+    if (!configuration.unique_fanout()) {
+        if (!set_fanout_option(fd_, configuration.fanout_group_id(), type)) {
+            throw socket_open_error(error_string());
+        }
+        return;
+    }
+    #ifdef PACKET_FANOUT_FLAG_UNIQUEID
+    // The kernel assigns an unused identifier
+    if (set_fanout_option(fd_, 0, type | PACKET_FANOUT_FLAG_UNIQUEID)) {
+        return;
+    }
+    if (errno != EINVAL) {
+        throw socket_open_error(error_string());
+    }
+    #endif // PACKET_FANOUT_FLAG_UNIQUEID
+    // This kernel doesn't know about the flag. Groups using a different 
+    // mode can be detected, as joining them fails, but an existing group 
+    // that uses the same mode would be joined silently. Random identifiers
+    // make that unlikely
+    for (unsigned i = 0; i < MAX_FANOUT_ATTEMPTS; ++i) {
+        if (set_fanout_option(fd_, random_group_id(), type)) {
+            return;
+        }
+        if (errno != EINVAL && errno != EEXIST) {
+            throw socket_open_error(error_string());
+        }
+    }
+    throw socket_open_error("Couldn't find an unused fanout group identifier");
+}
+
+void RingSniffer::cleanup() {
+    if (ring_) {
+        munmap(ring_, ring_size_);
+        ring_ = 0;
+    }
+    if (fd_ >= 0) {
+        ::close(fd_);
+        fd_ = -1;
+    }
+    if (stop_fd_ >= 0) {
+        ::close(stop_fd_);
+        stop_fd_ = -1;
+    }
+}
+
+const uint8_t* RingSniffer::block_at(unsigned index) const {
+    return ring_ + index * block_size_;
+}
+
+bool RingSniffer::current_block_ready() const {
+    const tpacket_block_desc* block = as_block(block_at(current_block_));
+    const uint32_t status = __atomic_load_n(&block->hdr.bh1.block_status, __ATOMIC_ACQUIRE);
+    return (status & TP_STATUS_USER) != 0;
+}
+
+void RingSniffer::release_current_block() {
+    tpacket_block_desc* block = (tpacket_block_desc*)block_at(current_block_);
+    __atomic_store_n(&block->hdr.bh1.block_status, TP_STATUS_KERNEL, __ATOMIC_RELEASE);
+    current_block_ = (current_block_ + 1) % block_count_;
+    current_packet_ = 0;
+}
+
+bool RingSniffer::consume_stop_request() {
+    if (!__atomic_exchange_n(&stop_requested_, 0, __ATOMIC_ACQ_REL)) {
+        return false;
+    }
+    // Drain the wakeup so poll doesn't keep reporting it
+    uint64_t value;
+    if (read(stop_fd_, &value, sizeof(value)) < 0) { }
+    return true;
+}
+
+bool RingSniffer::wait_for_block() {
+    // Checked on every call so a stop request isn't starved by traffic that
+    // always keeps a block ready
+    if (consume_stop_request()) {
+        return false;
+    }
+    while (packets_left_ == 0) {
+        while (!current_block_ready()) {
+            pollfd fds[2];
+            fds[0].fd = fd_;
+            fds[0].events = POLLIN | POLLERR;
+            fds[0].revents = 0;
+            fds[1].fd = stop_fd_;
+            fds[1].events = POLLIN;
+            fds[1].revents = 0;
+            const int result = poll(fds, 2, timeout_);
+            if (result < 0) {
+                if (errno == EINTR) {
+                    continue;
+                }
+                return false;
+            }
+            // Timed out
+            if (result == 0) {
+                return false;
+            }
+            if ((fds[1].revents & POLLIN) != 0) {
+                if (consume_stop_request()) {
+                    return false;
+                }
+                // The request was already consumed, drop the stale wakeup
+                uint64_t value;
+                if (read(stop_fd_, &value, sizeof(value)) < 0) { }
+            }
+        }
+        const tpacket_block_desc* block = as_block(block_at(current_block_));
+        packets_left_ = block->hdr.bh1.num_pkts;
+        if (packets_left_ == 0) {
+            release_current_block();
+        }
+        else {
+            current_packet_ = block_at(current_block_) + block->hdr.bh1.offset_to_first_pkt;
+        }
+    }
+    return true;
+}
+
+void RingSniffer::advance_packet() {
+    packets_left_--;
+    if (packets_left_ > 0) {
+        current_packet_ += as_packet(current_packet_)->tp_next_offset;
+    }
+    else {
+        // Packets are decoded into their own buffers, so we're done with it
+        release_current_block();
+    }
+}
+
+RingSniffer::PacketDecoder RingSniffer::packet_decoder(uint16_t hardware_type) {
+    if (extract_raw_) {
+        return &Internals::decode_raw_frame;
+    }
+    switch (hardware_type) {
+        case ARPHRD_ETHER:
+        case ARPHRD_LOOPBACK:
+            return Internals::frame_decoder_from_link_type(Internals::LINKTYPE_ETHERNET);
+        case ARPHRD_NONE:
+        case ARPHRD_PPP:
+        case ARPHRD_TUNNEL:
+        case ARPHRD_TUNNEL6:
+        case ARPHRD_IPGRE:
+            return Internals::frame_decoder_from_link_type(Internals::LINKTYPE_RAW);
+        default:
+            return &Internals::decode_raw_frame;
+    }
+}
+
+PDU* RingSniffer::decode_current_packet(Timestamp& timestamp) {
+    const tpacket3_hdr* header = as_packet(current_packet_);
+    const sockaddr_ll* address = reinterpret_cast<const sockaddr_ll*>(
+        current_packet_ + TPACKET_ALIGN(sizeof(tpacket3_hdr))
+    );
+    timeval tv;
+    tv.tv_sec = header->tp_sec;
+    tv.tv_usec = header->tp_nsec / 1000;
+    timestamp = tv;
+    return packet_decoder(address->sll_hatype)(current_packet_ + header->tp_mac, 
+                                               header->tp_snaplen);
+}
+
+PtrPacket RingSniffer::next_packet() {
+    LazyDecodingGuard lazy_guard(lazy_decoding_);
+    while (wait_for_block()) {
+        Timestamp timestamp;
+        PDU* pdu = decode_current_packet(timestamp);
+        advance_packet();
+        if (pdu) {
+            return PtrPacket(pdu, timestamp);
+        }
+    }
+    return PtrPacket(0, Timestamp());
+}
+
+uint32_t RingSniffer::next_block(vector<Packet>& packets) {
+    packets.clear();
+    if (!wait_for_block()) {
+        return 0;
+    }
+    LazyDecodingGuard lazy_guard(lazy_decoding_);
+    const uint32_t packets_read = packets_left_;
+    packets.reserve(packets_read);
+    while (packets_left_ > 0) {
+        Timestamp timestamp;
+        PDU* pdu = decode_current_packet(timestamp);
+        advance_packet();
+        if (pdu) {
+            #if TINS_IS_CXX11
+            packets.emplace_back(pdu, timestamp, Packet::own_pdu());
+            #else
+            packets.push_back(Packet(pdu, timestamp, Packet::own_pdu()));
+            #endif
+        }
+    }
+    return packets_read;
+}
+
+void RingSniffer::stop_sniff() {
+    __atomic_store_n(&stop_requested_, 1, __ATOMIC_RELEASE);
+    // Wake up any call blocked in poll
+    const uint64_t value = 1;
+    if (write(stop_fd_, &value, sizeof(value)) < 0) { }
+}
+
+RingSniffer::statistics RingSniffer::stats() {
+    // Reading the statistics resets them, so keep the accumulated values
+    tpacket_stats_v3 kernel_stats;
+    memset(&kernel_stats, 0, sizeof(kernel_stats));
+    socklen_t length = sizeof(kernel_stats);
+    if (getsockopt(fd_, SOL_PACKET, PACKET_STATISTICS, &kernel_stats, &length) == 0) {
+        // tp_packets includes the dropped packets
+        stats_.packets += kernel_stats.tp_packets;
+        stats_.drops += kernel_stats.tp_drops;
+        stats_.freeze_count += kernel_stats.tp_freeze_q_cnt;
+    }
+    return stats_;
+}
+
+void RingSniffer::set_extract_raw_pdus(bool value) {
+    extract_raw_ = value;
+}
+
+void RingSniffer::set_lazy_decoding(bool value) {
+    lazy_decoding_ = value;
+}
+
+uint16_t RingSniffer::fanout_group_id() const {
+    uint32_t fanout = 0;
+    socklen_t length = sizeof(fanout);
+    if (getsockopt(fd_, SOL_PACKET, PACKET_FANOUT, &fanout, &length) < 0) {
+        throw socket_open_error(error_string());
+    }
+    // The identifier is stored in the lower 16 bits
+    return static_cast<uint16_t>(fanout & 0xffff);
+}
+
+int RingSniffer::get_fd() const {
+    return fd_;
+}
+
+RingSniffer::iterator RingSniffer::begin() {
+    return iterator(this);
+}
+
+RingSniffer::iterator RingSniffer::end() {
+    return iterator(0);
+}
+
+} // Tins
+
+#endif // TINS_HAVE_PACKET_RING
@@ -34,25 +34,18 @@
 #endif // _WIN32
 
 #include <tins/sniffer.h>
-#include <tins/dot11/dot11_base.h>
-#include <tins/ethernetII.h>
-#include <tins/radiotap.h>
-#include <tins/loopback.h>
 #include <tins/rawpdu.h>
-#include <tins/dot3.h>
-#include <tins/pktap.h>
-#include <tins/sll.h>
-#include <tins/ppi.h>
-#include <tins/ip.h>
-#include <tins/ipv6.h>
+#include <tins/lazy_decoding.h>
 #include <tins/detail/pdu_helpers.h>
+#include <tins/detail/compressed_file.h>
 
 using std::string;
 
 namespace Tins {
 
 BaseSniffer::BaseSniffer() 
-: handle_(0), mask_(0), extract_raw_(false) {
+: handle_(0), mask_(0), extract_raw_(false), lazy_decoding_(false),
+  pcap_sniffing_method_(pcap_loop), packet_decoder_(0) {
     
 }
     
@@ -64,6 +57,7 @@ BaseSniffer::~BaseSniffer() {
 
 void BaseSniffer::set_pcap_handle(pcap_t* pcap_handle) {
     handle_ = pcap_handle;
+    packet_decoder_ = 0;
 }
 
 pcap_t* BaseSniffer::get_pcap_handle() {
@@ -86,141 +80,122 @@ struct sniff_data {
     struct timeval tv;
     PDU* pdu;
     bool packet_processed;
+    PDU* (*decoder)(const uint8_t*, uint32_t);
 
-sniff_data() : tv(), pdu(0), packet_processed(true) { }
+sniff_data() : tv(), pdu(0), packet_processed(true), decoder(0) { }
 };
 
-template<typename T>
-T* safe_alloc(const u_char* bytes, bpf_u_int32 len) {
-    try {
-        return new T((const uint8_t*)bytes, len);
-    }
-    catch (malformed_packet&) {
-        return 0;
-    }
-}
+struct sniff_batch_data {
+    std::vector<Packet>* packets;
+    PDU* (*decoder)(const uint8_t*, uint32_t);
+    uint32_t packets_read;
+
+sniff_batch_data() : packets(0), decoder(0), packets_read(0) { }
+};
 
-template<typename T>
 void sniff_loop_handler(u_char* user, const struct pcap_pkthdr* h, const u_char* bytes) {
     sniff_data* data = (sniff_data*)user;
     data->packet_processed = true;
     data->tv = h->ts;
-    data->pdu = safe_alloc<T>(bytes, h->caplen);
+    data->pdu = data->decoder((const uint8_t*)bytes, h->caplen);
+}
+
+void sniff_batch_handler(u_char* user, const struct pcap_pkthdr* h, const u_char* bytes) {
+    sniff_batch_data* data = (sniff_batch_data*)user;
+    data->packets_read++;
+    PDU* pdu = data->decoder((const uint8_t*)bytes, h->caplen);
+    if (pdu) {
+        #if TINS_IS_CXX11
+        data->packets->emplace_back(pdu, h->ts, Packet::own_pdu());
+        #else
+        data->packets->push_back(Packet(pdu, h->ts, Packet::own_pdu()));
+        #endif
+    }
 }
 
-void sniff_loop_eth_handler(u_char* user, const struct pcap_pkthdr* h, const u_char* bytes) {
-    sniff_data* data = (sniff_data*)user;
-    data->packet_processed = true;
-    data->tv = h->ts;
-    if (Internals::is_dot3((const uint8_t*)bytes, h->caplen)) {
-        data->pdu = safe_alloc<Dot3>((const uint8_t*)bytes, h->caplen);
+BaseSniffer::PacketDecoder BaseSniffer::packet_decoder() {
+    if (packet_decoder_) {
+        return packet_decoder_;
     }
-    else {
-        data->pdu = safe_alloc<EthernetII>((const uint8_t*)bytes, h->caplen);
+    if (extract_raw_) {
+        packet_decoder_ = &Internals::decode_raw_frame;
     }
-}
-
-void sniff_loop_raw_handler(u_char* user, const struct pcap_pkthdr* h, const u_char* bytes) {
-    TINS_BEGIN_PACK
-    struct base_ip_header {
-    #if TINS_IS_LITTLE_ENDIAN
-        uint8_t ihl:4,
-                version:4;
-    #else
-        uint8_t version:4,
-                ihl:4;
-    #endif
-    } TINS_END_PACK;
-
-    sniff_data* data = (sniff_data*)user;
-    const base_ip_header* header = (const base_ip_header*)bytes;
-    data->packet_processed = true;
-    data->tv = h->ts;
-    switch (header->version) {
-        case 4:
-            data->pdu = safe_alloc<IP>((const uint8_t*)bytes, h->caplen);
-            break;
-        case 6:
-            data->pdu = safe_alloc<IPv6>((const uint8_t*)bytes, h->caplen);
-            break;
-    };
-}
-
-#ifdef TINS_HAVE_DOT11
-void sniff_loop_dot11_handler(u_char* user, const struct pcap_pkthdr* h, const u_char* bytes) {
-    sniff_data* data = (sniff_data*)user;
-    data->packet_processed = true;
-    data->tv = h->ts;
-    try {
-        data->pdu = Dot11::from_bytes(bytes, h->caplen);
+    else {
+        uint32_t link_type;
+        if (!Internals::dlt_to_link_type(pcap_datalink(handle_), link_type)) {
+            throw unknown_link_type();
+        }
+        packet_decoder_ = Internals::frame_decoder_from_link_type(link_type);
+        if (!packet_decoder_) {
+            throw unknown_link_type();
+        }
     }
-    catch(malformed_packet&) {
-        
+    return packet_decoder_;
+}
+
+PDU::PDUType BaseSniffer::view_link_type() const {
+    switch (pcap_datalink(handle_)) {
+        case DLT_EN10MB:
+            return PDU::ETHERNET_II;
+        case DLT_RAW:
+            return PDU::IP;
+        case DLT_NULL:
+        case DLT_LOOP:
+            return PDU::LOOPBACK;
+        case DLT_LINUX_SLL:
+            return PDU::SLL;
+        default:
+            throw unknown_link_type();
     }
 }
-#endif
 
 PtrPacket BaseSniffer::next_packet() {
     sniff_data data;
-    const int iface_type = pcap_datalink(handle_);
-    pcap_handler handler = 0;
-    if (extract_raw_) {
-        handler = &sniff_loop_handler<RawPDU>;
-    }
-    else {
-        switch (iface_type) {
-            case DLT_EN10MB:
-                handler = &sniff_loop_eth_handler;
-                break;
-            case DLT_NULL:
-                handler = &sniff_loop_handler<Tins::Loopback>;
-                break;
-            case DLT_LINUX_SLL:
-                handler = &sniff_loop_handler<SLL>;
-                break; 
-            case DLT_PPI:
-                handler = &sniff_loop_handler<PPI>;
-                break;
-            case DLT_RAW:
-                handler = &sniff_loop_raw_handler;
-                break;
-
-            // Dot11 related protocols
-            #ifdef TINS_HAVE_DOT11
-            case DLT_IEEE802_11_RADIO:
-                handler = &sniff_loop_handler<RadioTap>;
-                break;
-            case DLT_IEEE802_11:
-                handler = &sniff_loop_dot11_handler;
-                break;
-            #else
-            case DLT_IEEE802_11_RADIO:
-            case DLT_IEEE802_11:
-                throw protocol_disabled();
-            #endif // TINS_HAVE_DOT11
-
-            #ifdef DLT_PKTAP
-            case DLT_PKTAP:
-                handler = &sniff_loop_handler<PKTAP>;
-                break;
-            #endif // DLT_PKTAP
-
-            default:
-                throw unknown_link_type();
-        }
-    }
+    data.decoder = packet_decoder();
+    LazyDecodingGuard lazy_guard(lazy_decoding_);
     // keep calling pcap_loop until a well-formed packet is found.
     while (data.pdu == 0 && data.packet_processed) {
         data.packet_processed = false;
-        if (pcap_sniffing_method_(handle_, 1, handler, (u_char*)&data) < 0) {
-            return PtrPacket(0, Timestamp());
+        if (pcap_sniffing_method_(handle_, 1, &sniff_loop_handler, (u_char*)&data) < 0) {
+            break;
         }
     }
+    if (!data.pdu) {
+        check_read_error();
+        return PtrPacket(0, Timestamp());
+    }
     return PtrPacket(data.pdu, data.tv);
 }
 
+uint32_t BaseSniffer::next_packets(std::vector<Packet>& packets, uint32_t max_packets) {
+    packets.clear();
+    if (max_packets == 0) {
+        return 0;
+    }
+    sniff_batch_data data;
+    data.packets = &packets;
+    data.decoder = packet_decoder();
+    LazyDecodingGuard lazy_guard(lazy_decoding_);
+    const int result = pcap_sniffing_method_(handle_, static_cast<int>(max_packets),
+                                             &sniff_batch_handler, (u_char*)&data);
+    // Errors are only reported if nothing was read, otherwise we'd lose
+    // the packets that were already processed.
+    if (result == -1 && data.packets_read == 0) {
+        throw pcap_error(pcap_geterr(handle_));
+    }
+    if (data.packets_read == 0) {
+        check_read_error();
+    }
+    return data.packets_read;
+}
+
 void BaseSniffer::set_extract_raw_pdus(bool value) {
     extract_raw_ = value;
+    packet_decoder_ = 0;
+}
+
+void BaseSniffer::set_lazy_decoding(bool value) {
+    lazy_decoding_ = value;
 }
 
 void BaseSniffer::set_pcap_sniffing_method(PcapSniffingMethod method) {
@@ -234,6 +209,10 @@ void BaseSniffer::stop_sniff() {
     pcap_breakloop(handle_);
 }
 
+void BaseSniffer::check_read_error() {
+
+}
+
 int BaseSniffer::get_fd() {
     #ifndef _WIN32
         return pcap_get_selectable_fd(handle_);
@@ -392,32 +371,83 @@ void Sniffer::set_rfmon(bool rfmon_enabled) {
 // **************************** FileSniffer ****************************
 
 FileSniffer::FileSniffer(const string& file_name, 
-                         const SnifferConfiguration& configuration) {
-    char error[PCAP_ERRBUF_SIZE];
-    pcap_t* phandle = pcap_open_offline(file_name.c_str(), error);
-    if (!phandle) {
-        throw pcap_error(error);
-    }
-    set_pcap_handle(phandle);
+                         const SnifferConfiguration& configuration)
+: decompressor_(0) {
+    open_file(file_name);
 
     // Configure the sniffer
-    configuration.configure_sniffer_pre_activation(*this);
-    
+    try {
+        configuration.configure_sniffer_pre_activation(*this);
+    }
+    catch (...) {
+        // The destructor won't run, so stop decompressing here
+        close_decompressor();
+        throw;
+    }
 }
 
-FileSniffer::FileSniffer(const string& file_name, const string& filter) {
+FileSniffer::FileSniffer(const string& file_name, const string& filter)
+: decompressor_(0) {
     SnifferConfiguration config;
     config.set_filter(filter);
 
+    open_file(file_name);
+
+    // Configure the sniffer
+    try {
+        config.configure_sniffer_pre_activation(*this);
+    }
+    catch (...) {
+        close_decompressor();
+        throw;
+    }
+}
+
+FileSniffer::~FileSniffer() {
+    close_decompressor();
+}
+
+void FileSniffer::close_decompressor() {
+    #ifdef TINS_HAVE_COMPRESSION
+    // The pcap handle, which owns the decompressed stream, is still open here
+    delete decompressor_;
+    decompressor_ = 0;
+    #endif // TINS_HAVE_COMPRESSION
+}
+
+void FileSniffer::check_read_error() {
+    #ifdef TINS_HAVE_COMPRESSION
+    // A corrupt compressed file looks like a regular end of file to libpcap
+    if (decompressor_) {
+        decompressor_->check_error();
+    }
+    #endif // TINS_HAVE_COMPRESSION
+}
+
+void FileSniffer::open_file(const string& file_name) {
     char error[PCAP_ERRBUF_SIZE];
-    pcap_t* phandle = pcap_open_offline(file_name.c_str(), error);
+    pcap_t* phandle = 0;
+    #ifdef TINS_HAVE_COMPRESSION
+    const Internals::CompressionFormat format = Internals::detect_compression(file_name);
+    if (format != Internals::NO_COMPRESSION && Internals::is_compression_supported(format)) {
+        decompressor_ = new Internals::DecompressionThread(file_name, format);
+        phandle = pcap_fopen_offline(decompressor_->stream(), error);
+        if (!phandle) {
+            FILE* stream = decompressor_->stream();
+            delete decompressor_;
+            decompressor_ = 0;
+            fclose(stream);
+            throw pcap_error(error);
+        }
+        set_pcap_handle(phandle);
+        return;
+    }
+    #endif // TINS_HAVE_COMPRESSION
+    phandle = pcap_open_offline(file_name.c_str(), error);
     if (!phandle) {
         throw pcap_error(error);
     }
     set_pcap_handle(phandle);
-
-    // Configure the sniffer
-    config.configure_sniffer_pre_activation(*this);
 }
 
 // ************************ SnifferConfiguration ************************
@@ -428,7 +458,7 @@ const unsigned SnifferConfiguration::DEFAULT_TIMEOUT = 1000;
 SnifferConfiguration::SnifferConfiguration()
 : flags_(0), snap_len_(DEFAULT_SNAP_LEN), buffer_size_(0),
   pcap_sniffing_method_(pcap_loop), timeout_(DEFAULT_TIMEOUT), promisc_(false),
-  rfmon_(false), immediate_mode_(false), direction_(PCAP_D_INOUT),
+  rfmon_(false), immediate_mode_(false), lazy_decoding_(false), direction_(PCAP_D_INOUT),
   timestamp_precision_(0) {
 
 }
@@ -452,6 +482,9 @@ void SnifferConfiguration::configure_sniffer_pre_activation(Sniffer& sniffer) co
     if ((flags_ & TIMESTAMP_PRECISION) != 0) {
         sniffer.set_timestamp_precision(timestamp_precision_);
     }
+    if ((flags_ & LAZY_DECODING) != 0) {
+        sniffer.set_lazy_decoding(lazy_decoding_);
+    }
 }
 
 void SnifferConfiguration::configure_sniffer_pre_activation(FileSniffer& sniffer) const {
@@ -461,6 +494,9 @@ void SnifferConfiguration::configure_sniffer_pre_activation(FileSniffer& sniffer
         }
     }
     sniffer.set_pcap_sniffing_method(pcap_sniffing_method_);
+    if ((flags_ & LAZY_DECODING) != 0) {
+        sniffer.set_lazy_decoding(lazy_decoding_);
+    }
 }
 
 void SnifferConfiguration::configure_sniffer_post_activation(Sniffer& sniffer) const {
@@ -527,4 +563,9 @@ void SnifferConfiguration::set_direction(pcap_direction_t direction) {
     flags_ |= DIRECTION;
 }
 
+void SnifferConfiguration::set_lazy_decoding(bool enabled) {
+    flags_ |= LAZY_DECODING;
+    lazy_decoding_ = enabled;
+}
+
 } // Tins
@@ -36,6 +36,7 @@
 #include <tins/exceptions.h>
 #include <tins/pdu_allocator.h>
 #include <tins/memory_helpers.h>
+#include <tins/detail/pdu_helpers.h>
 #include <tins/utils/checksum_utils.h>
 
 using std::vector;
@@ -57,14 +58,15 @@ PDU::metadata TCP::extract_metadata(const uint8_t *buffer, uint32_t total_sz) {
 }
 
 TCP::TCP(uint16_t dport, uint16_t sport) 
-: header_() {
+: header_(), auto_set_checksum_(true) {
     this->dport(dport);
     this->sport(sport);
     data_offset(sizeof(tcp_header) / sizeof(uint32_t));
     window(DEFAULT_WINDOW);
 }
 
-TCP::TCP(const uint8_t* buffer, uint32_t total_sz) {
+TCP::TCP(const uint8_t* buffer, uint32_t total_sz) 
+: auto_set_checksum_(true) {
     PduInputMemoryStream stream(this, buffer, total_sz);
     stream.read(header_);
 
@@ -132,7 +134,7 @@ TCP::TCP(const uint8_t* buffer, uint32_t total_sz) {
                       {Allocators::DST_PORT, dport()}, stream.pointer(), stream.size()))) {
         }
         else {
-            new_pdu = new RawPDU(stream.pointer(), stream.size());
+            new_pdu = Internals::raw_pdu_from_buffer(stream.pointer(), stream.size());
         }
         
         inner_pdu(new_pdu);
@@ -160,6 +162,7 @@ void TCP::window(uint16_t new_window) {
 }
 
 void TCP::checksum(uint16_t new_check) {
+    auto_set_checksum_ = false;
     header_.check = Endian::host_to_be(new_check);
 }
 
@@ -178,7 +181,12 @@ uint16_t TCP::calculate_checksum() const {
         buffer_vec.insert(buffer_vec.end(), payload.begin(), payload.end());
     }
 
-    return calculate_checksum(buffer_vec.data(), buffer_vec.size(), header_.check);
+    const uint8_t* buffer = buffer_vec.data();
+    return calculate_checksum(
+        Utils::sum_range(buffer, buffer + buffer_vec.size()),
+        static_cast<uint32_t>(buffer_vec.size()),
+        header_.check
+    );
 }
 
 void TCP::urg_ptr(uint16_t new_urg_ptr) {
@@ -334,36 +342,45 @@ uint32_t TCP::header_size() const {
     return sizeof(header_) + pad_options_size(calculate_options_size());
 }
 
-uint16_t TCP::calculate_checksum(const uint8_t* buffer,
-                                 const uint32_t total_sz,
-                                 const uint16_t old_checksum) const {
-    uint32_t check = 0;
+uint16_t TCP::calculate_checksum(uint32_t segment_sum, uint32_t segment_size,
+                                 uint16_t old_checksum) const {
+    // No pseudo-header available unless there's an IP parent, so treat its 
+    // checksum as 0 in that case.
+    uint32_t check = segment_sum;
     const PDU* parent = parent_pdu();
     if (const Tins::IP* ip_packet = tins_cast<const Tins::IP*>(parent)) {
-        check = Utils::pseudoheader_checksum(
+        check += Utils::pseudoheader_checksum(
             ip_packet->src_addr(),  
             ip_packet->dst_addr(), 
-            size(), 
+            segment_size, 
             Constants::IP::PROTO_TCP
-        ) + Utils::sum_range(buffer, buffer + total_sz);
+        );
     }
     else if (const Tins::IPv6* ipv6_packet = tins_cast<const Tins::IPv6*>(parent)) {
-        check = Utils::pseudoheader_checksum(
+        check += Utils::pseudoheader_checksum(
             ipv6_packet->src_addr(),  
             ipv6_packet->dst_addr(), 
-            size(), 
+            segment_size, 
             Constants::IP::PROTO_TCP
-        ) + Utils::sum_range(buffer, buffer + total_sz);
-    }
-    else {
-        // No pseudo-header available, so treat its checksum as 0.
-        check = Utils::sum_range(buffer, buffer + total_sz);
+        );
     }
 
-    check -= old_checksum;
+    // One's complement subtraction, so it holds even if the sum wrapped around
+    check += static_cast<uint16_t>(~old_checksum);
     return Endian::host_to_be<uint16_t>(~Utils::fold_sum(check));
 }
 
+uint32_t TCP::sum_serialization(const uint8_t* buffer, uint32_t total_sz) {
+    // A trailing RawPDU summed its payload while copying it, so only the 
+    // header has to be read here
+    const RawPDU* raw = tins_cast<const RawPDU*>(inner_pdu());
+    if (raw && !raw->inner_pdu()) {
+        const uint32_t header_sz = total_sz - raw->header_size();
+        return Utils::sum_range(buffer, buffer + header_sz) + raw->payload_sum_;
+    }
+    return Utils::sum_range(buffer, buffer + total_sz);
+}
+
 void TCP::write_serialization(uint8_t* buffer, uint32_t total_sz) {
     OutputMemoryStream stream(buffer, total_sz);
 
@@ -385,7 +402,11 @@ void TCP::write_serialization(uint8_t* buffer, uint32_t total_sz) {
     stream.write(header_);
     stream_options(stream, (padded_options_size - options_size));
 
-    checksum(calculate_checksum(buffer, total_sz, header_.check));
+    if (auto_set_checksum_) {
+        header_.check = Endian::host_to_be(
+            calculate_checksum(sum_serialization(buffer, total_sz), total_sz, header_.check)
+        );
+    }
     ((tcp_header*)buffer)->check = header_.check;
 }
 
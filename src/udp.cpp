@@ -36,6 +36,7 @@
 #include <tins/exceptions.h>
 #include <tins/pdu_allocator.h>
 #include <tins/memory_helpers.h>
+#include <tins/detail/pdu_helpers.h>
 #include <tins/utils/checksum_utils.h>
 
 using Tins::Memory::PduInputMemoryStream;
@@ -69,7 +70,7 @@ UDP::UDP(const uint8_t* buffer, uint32_t total_sz)
                       {Allocators::DST_PORT, dport()}, stream.pointer(), stream.size()))) {
         }
         else {
-            new_pdu = new RawPDU(stream.pointer(), stream.size());
+            new_pdu = Internals::raw_pdu_from_buffer(stream.pointer(), stream.size());
         }
 
         inner_pdu(new_pdu);
@@ -97,50 +98,14 @@ uint32_t UDP::header_size() const {
     return sizeof(udp_header);
 }
 
-uint32_t sum_range(const uint8_t* start, const uint8_t* end) {
-    uint32_t checksum(0);
-    const uint8_t* last = end;
-    uint16_t buffer = 0;
-    uint16_t padding = 0;
-    const uint8_t* ptr = start;
-
-    if (((end - start) & 1) == 1) {
-        last = end - 1;
-        padding = Endian::host_to_le<uint16_t>(*(end - 1));
-    }
-
-    while (ptr < last) {
-        memcpy(&buffer, ptr, sizeof(uint16_t));
-        checksum += buffer;
-        ptr += sizeof(uint16_t);
-    }
-
-    checksum += padding;
-    return checksum;  
-}
-
-uint32_t pseudoheader_checksum(IPv4Address source_ip, IPv4Address dest_ip, uint32_t len, uint32_t flag) {
-    uint32_t checksum(0);
-    uint8_t buffer[sizeof(uint32_t) * 3];
-    OutputMemoryStream stream(buffer, sizeof(buffer));
-    stream.write(source_ip);
-    stream.write(dest_ip);
-    stream.write(Endian::host_to_be<uint16_t>(flag));
-    stream.write(Endian::host_to_be<uint16_t>(len));
-    uint16_t* ptr = (uint16_t*)buffer, *end = (uint16_t*)(buffer + sizeof(buffer));
-    while (ptr < end) {
-        checksum += *ptr++;
-    }
-    return checksum;
-}
-
 void UDP::write_serialization(uint8_t* buffer, uint32_t total_sz) {
     OutputMemoryStream stream(buffer, total_sz);
     // Set checksum to 0, we'll calculate it at the end
     if (auto_set_checksum_)
         header_.check = 0;
+    // total_sz already accounts for the inner PDUs
+    length(static_cast<uint16_t>(total_sz));
     if (inner_pdu()) {
-        length(static_cast<uint16_t>(sizeof(udp_header) + inner_pdu()->size()));
         if (Internals::pdu_type_registered<UDP>(inner_pdu()->pdu_type())) {
             auto pdu_id = Internals::pdu_type_to_id<UDP>(inner_pdu()->pdu_type());
             if (pdu_id.dir == Allocators::SRC_PORT) {
@@ -150,9 +115,6 @@ void UDP::write_serialization(uint8_t* buffer, uint32_t total_sz) {
             }
         }
     }
-    else {
-        length(static_cast<uint16_t>(sizeof(udp_header)));
-    }
     stream.write(header_);
     uint32_t checksum = 0;
     const PDU* parent = parent_pdu();
@@ -160,17 +122,17 @@ void UDP::write_serialization(uint8_t* buffer, uint32_t total_sz) {
         checksum = Utils::pseudoheader_checksum(
             ip_packet->src_addr(), 
             ip_packet->dst_addr(), 
-            size(), 
+            total_sz, 
             Constants::IP::PROTO_UDP
-        ) + Utils::sum_range(buffer, buffer + total_sz);
+        ) + sum_serialization(buffer, total_sz);
     }
     else if (const Tins::IPv6* ip6_packet = tins_cast<const Tins::IPv6*>(parent)) {
         checksum = Utils::pseudoheader_checksum(
             ip6_packet->src_addr(), 
             ip6_packet->dst_addr(), 
-            size(), 
+            total_sz, 
             Constants::IP::PROTO_UDP
-        ) + Utils::sum_range(buffer, buffer + total_sz);
+        ) + sum_serialization(buffer, total_sz);
     }
     else {
         return;
@@ -186,6 +148,17 @@ void UDP::write_serialization(uint8_t* buffer, uint32_t total_sz) {
     ((udp_header*)buffer)->check = header_.check;
 }
 
+uint32_t UDP::sum_serialization(const uint8_t* buffer, uint32_t total_sz) {
+    // A trailing RawPDU summed its payload while copying it, so only the 
+    // header has to be read here
+    const RawPDU* raw = tins_cast<const RawPDU*>(inner_pdu());
+    if (raw && !raw->inner_pdu()) {
+        const uint32_t header_sz = total_sz - raw->header_size();
+        return Utils::sum_range(buffer, buffer + header_sz) + raw->payload_sum_;
+    }
+    return Utils::sum_range(buffer, buffer + total_sz);
+}
+
 bool UDP::matches_response(const uint8_t* ptr, uint32_t total_sz) const {
     if (total_sz < sizeof(udp_header)) {
         return false;
@@ -32,12 +32,26 @@
 #include <tins/ip_address.h>
 #include <tins/ipv6_address.h>
 #include <tins/endianness.h>
-#include <tins/memory_helpers.h>
 
-using std::memcpy;
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+    #include <immintrin.h>
+    #define TINS_CHECKSUM_HAVE_SSE2
+    #define TINS_CHECKSUM_HAVE_AVX2
+    #define TINS_CHECKSUM_TARGET(name) __attribute__((target(name)))
+    #ifndef __x86_64__
+        // SSE2 is only guaranteed to be available on x86-64
+        #define TINS_CHECKSUM_DETECT_SSE2
+    #endif // __x86_64__
+#elif defined(_MSC_VER) && defined(_M_X64)
+    #include <emmintrin.h>
+    #define TINS_CHECKSUM_HAVE_SSE2
+    #define TINS_CHECKSUM_TARGET(name)
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+    #include <arm_neon.h>
+    #define TINS_CHECKSUM_HAVE_NEON
+#endif
 
-using Tins::Memory::InputMemoryStream;
-using Tins::Memory::OutputMemoryStream;
+using std::memcpy;
 
 namespace Tins {
 namespace Utils {
@@ -46,73 +60,271 @@ uint32_t do_checksum(const uint8_t* start, const uint8_t* end) {
     return Endian::host_to_be<uint32_t>(sum_range(start, end));
 }
 
-uint16_t sum_range(const uint8_t* start, const uint8_t* end) {
-    uint32_t checksum(0);
-    const uint8_t* last = end;
-    uint16_t buffer = 0;
-    uint16_t padding = 0;
-    const uint8_t* ptr = start;
-
-    if (((end - start) & 1) == 1) {
-        last = end - 1;
-        padding = Endian::host_to_le<uint16_t>(*(end - 1));
+namespace {
+
+/*
+ * All kernels below add up the buffer in native endian words wider than
+ * 16 bits. Since the one's complement sum is endian independent and adding
+ * the halves of a wide word is the same as adding each of its 16 bit 
+ * words, folding the result gives the same value as adding the buffer 16
+ * bits at a time. Each kernel consumes as many whole vectors as possible
+ * and returns how many bytes it processed, the rest is done by the 
+ * scalar kernel.
+ */
+
+// Sums the remaining bytes, padding an odd trailing byte with a zero byte
+template <bool copy>
+uint64_t scalar_sum(const uint8_t* ptr, size_t size, uint8_t* output) {
+    uint64_t sum = 0;
+    uint64_t word;
+    while (size >= sizeof(word)) {
+        memcpy(&word, ptr, sizeof(word));
+        if (copy) {
+            memcpy(output, &word, sizeof(word));
+            output += sizeof(word);
+        }
+        sum += (word & 0xffffffff) + (word >> 32);
+        ptr += sizeof(word);
+        size -= sizeof(word);
+    }
+    uint16_t half_word;
+    while (size >= sizeof(half_word)) {
+        memcpy(&half_word, ptr, sizeof(half_word));
+        if (copy) {
+            memcpy(output, &half_word, sizeof(half_word));
+            output += sizeof(half_word);
+        }
+        sum += half_word;
+        ptr += sizeof(half_word);
+        size -= sizeof(half_word);
     }
+    if (size) {
+        const uint8_t padded[2] = { *ptr, 0 };
+        memcpy(&half_word, padded, sizeof(half_word));
+        if (copy) {
+            *output = *ptr;
+        }
+        sum += half_word;
+    }
+    return sum;
+}
 
-    while (ptr < last) {
-        memcpy(&buffer, ptr, sizeof(uint16_t));
-        checksum += buffer;
-        ptr += sizeof(uint16_t);
+#ifdef TINS_CHECKSUM_HAVE_SSE2
+
+template <bool copy>
+TINS_CHECKSUM_TARGET("sse2")
+size_t sse2_sum(const uint8_t* ptr, size_t size, uint8_t* output, uint64_t& sum) {
+    const __m128i zero = _mm_setzero_si128();
+    __m128i low = zero;
+    __m128i high = zero;
+    size_t processed = 0;
+    for (; size - processed >= 16; processed += 16) {
+        const __m128i value = _mm_loadu_si128((const __m128i*)(ptr + processed));
+        if (copy) {
+            _mm_storeu_si128((__m128i*)(output + processed), value);
+        }
+        low = _mm_add_epi64(low, _mm_unpacklo_epi32(value, zero));
+        high = _mm_add_epi64(high, _mm_unpackhi_epi32(value, zero));
     }
+    uint64_t lanes[2];
+    _mm_storeu_si128((__m128i*)lanes, _mm_add_epi64(low, high));
+    sum += lanes[0] + lanes[1];
+    return processed;
+}
 
-    checksum += padding;
-    
-    return fold_sum(checksum);
+#endif // TINS_CHECKSUM_HAVE_SSE2
+
+#ifdef TINS_CHECKSUM_HAVE_AVX2
+
+template <bool copy>
+TINS_CHECKSUM_TARGET("avx2")
+size_t avx2_sum(const uint8_t* ptr, size_t size, uint8_t* output, uint64_t& sum) {
+    const __m256i zero = _mm256_setzero_si256();
+    __m256i low = zero;
+    __m256i high = zero;
+    size_t processed = 0;
+    for (; size - processed >= 32; processed += 32) {
+        const __m256i value = _mm256_loadu_si256((const __m256i*)(ptr + processed));
+        if (copy) {
+            _mm256_storeu_si256((__m256i*)(output + processed), value);
+        }
+        low = _mm256_add_epi64(low, _mm256_unpacklo_epi32(value, zero));
+        high = _mm256_add_epi64(high, _mm256_unpackhi_epi32(value, zero));
+    }
+    uint64_t lanes[4];
+    _mm256_storeu_si256((__m256i*)lanes, _mm256_add_epi64(low, high));
+    sum += lanes[0] + lanes[1] + lanes[2] + lanes[3];
+    return processed;
 }
 
-uint16_t fold_sum(uint32_t sum) {
+#endif // TINS_CHECKSUM_HAVE_AVX2
+
+#ifdef TINS_CHECKSUM_HAVE_NEON
+
+template <bool copy>
+size_t neon_sum(const uint8_t* ptr, size_t size, uint8_t* output, uint64_t& sum) {
+    uint64x2_t total = vdupq_n_u64(0);
+    size_t processed = 0;
+    while (size - processed >= 16) {
+        // Each lane grows by at most 2 * 0xffff per iteration, so flush 
+        // the 32 bit accumulators before they can overflow
+        uint32x4_t partial = vdupq_n_u32(0);
+        for (size_t i = 0; i < 16384 && size - processed >= 16; ++i, processed += 16) {
+            const uint16x8_t value = vreinterpretq_u16_u8(vld1q_u8(ptr + processed));
+            if (copy) {
+                vst1q_u8(output + processed, vreinterpretq_u8_u16(value));
+            }
+            partial = vpadalq_u16(partial, value);
+        }
+        total = vpadalq_u32(total, partial);
+    }
+    sum += vgetq_lane_u64(total, 0) + vgetq_lane_u64(total, 1);
+    return processed;
+}
+
+#endif // TINS_CHECKSUM_HAVE_NEON
+
+typedef uint64_t (*sum_kernel_type)(const uint8_t*, size_t, uint8_t*);
+
+template <bool copy>
+uint64_t scalar_kernel(const uint8_t* ptr, size_t size, uint8_t* output) {
+    return scalar_sum<copy>(ptr, size, output);
+}
+
+#ifdef TINS_CHECKSUM_HAVE_SSE2
+template <bool copy>
+uint64_t sse2_kernel(const uint8_t* ptr, size_t size, uint8_t* output) {
+    uint64_t sum = 0;
+    const size_t processed = sse2_sum<copy>(ptr, size, output, sum);
+    return sum + scalar_sum<copy>(ptr + processed, size - processed, output + processed);
+}
+#endif // TINS_CHECKSUM_HAVE_SSE2
+
+#ifdef TINS_CHECKSUM_HAVE_AVX2
+template <bool copy>
+uint64_t avx2_kernel(const uint8_t* ptr, size_t size, uint8_t* output) {
+    uint64_t sum = 0;
+    size_t processed = avx2_sum<copy>(ptr, size, output, sum);
+    processed += sse2_sum<copy>(ptr + processed, size - processed, output + processed, sum);
+    return sum + scalar_sum<copy>(ptr + processed, size - processed, output + processed);
+}
+#endif // TINS_CHECKSUM_HAVE_AVX2
+
+#ifdef TINS_CHECKSUM_HAVE_NEON
+template <bool copy>
+uint64_t neon_kernel(const uint8_t* ptr, size_t size, uint8_t* output) {
+    uint64_t sum = 0;
+    const size_t processed = neon_sum<copy>(ptr, size, output, sum);
+    return sum + scalar_sum<copy>(ptr + processed, size - processed, output + processed);
+}
+#endif // TINS_CHECKSUM_HAVE_NEON
+
+// Picks the widest kernel supported by the CPU we're running on
+template <bool copy>
+sum_kernel_type select_kernel() {
+    #if defined(TINS_CHECKSUM_HAVE_AVX2) || defined(TINS_CHECKSUM_DETECT_SSE2)
+        __builtin_cpu_init();
+    #endif
+    #ifdef TINS_CHECKSUM_HAVE_AVX2
+        if (__builtin_cpu_supports("avx2")) {
+            return &avx2_kernel<copy>;
+        }
+    #endif // TINS_CHECKSUM_HAVE_AVX2
+    #ifdef TINS_CHECKSUM_HAVE_SSE2
+        #ifdef TINS_CHECKSUM_DETECT_SSE2
+        if (__builtin_cpu_supports("sse2")) {
+            return &sse2_kernel<copy>;
+        }
+        #else
+        return &sse2_kernel<copy>;
+        #endif // TINS_CHECKSUM_DETECT_SSE2
+    #endif // TINS_CHECKSUM_HAVE_SSE2
+    #ifdef TINS_CHECKSUM_HAVE_NEON
+        return &neon_kernel<copy>;
+    #endif // TINS_CHECKSUM_HAVE_NEON
+    return &scalar_kernel<copy>;
+}
+
+// Vector kernels don't pay off for headers
+const size_t min_vector_size = 64;
+
+template <bool copy>
+uint64_t generic_sum(const uint8_t* ptr, size_t size, uint8_t* output) {
+    if (size < min_vector_size) {
+        return scalar_sum<copy>(ptr, size, output);
+    }
+    static const sum_kernel_type kernel = select_kernel<copy>();
+    return kernel(ptr, size, output);
+}
+
+uint16_t fold_wide_sum(uint64_t sum) {
     while (sum >> 16) {
         sum = (sum & 0xffff) + (sum >> 16);
     }
-    
     return static_cast<uint16_t>(sum);
 }
 
-template <size_t buffer_size, typename AddressType>
-uint32_t generic_pseudoheader_checksum(const AddressType& source_ip, 
-                                       const AddressType& dest_ip,
-                                       uint16_t len,
-                                       uint16_t flag) {
-    uint8_t buffer[buffer_size];
-    OutputMemoryStream stream(buffer, sizeof(buffer));
-    stream.write(source_ip);
-    stream.write(dest_ip);
-    stream.write(Endian::host_to_be(flag));
-    stream.write(Endian::host_to_be(len));
-
-    InputMemoryStream input_stream(buffer, sizeof(buffer));
-    uint32_t checksum = 0;
-    while (input_stream) {
-        checksum += input_stream.read<uint16_t>();
+} // anonymous namespace
+
+uint16_t sum_range(const uint8_t* start, const uint8_t* end) {
+    return fold_wide_sum(generic_sum<false>(start, end - start, 0));
+}
+
+uint16_t copy_and_sum_range(const uint8_t* start, const uint8_t* end, uint8_t* output) {
+    return fold_wide_sum(generic_sum<true>(start, end - start, output));
+}
+
+uint16_t fold_sum(uint32_t sum) {
+    while (sum >> 16) {
+        sum = (sum & 0xffff) + (sum >> 16);
     }
-    return checksum;
+    
+    return static_cast<uint16_t>(sum);
 }
 
+// Adds up the 16 bit words in the pseudo header, in network endian
 uint32_t pseudoheader_checksum(IPv4Address source_ip, 
                                IPv4Address dest_ip,
                                uint16_t len,
                                uint16_t flag) {
-    return generic_pseudoheader_checksum<sizeof(uint32_t) * 3>(
-        source_ip, dest_ip, len, flag
-    );
+    // These are already in network endian
+    const uint32_t source = source_ip;
+    const uint32_t dest = dest_ip;
+    return (source & 0xffff) + (source >> 16) + (dest & 0xffff) + (dest >> 16) +
+           Endian::host_to_be(flag) + Endian::host_to_be(len);
 }
 
 uint32_t pseudoheader_checksum(IPv6Address source_ip,
                                IPv6Address dest_ip,
                                uint16_t len,
                                uint16_t flag) {
-    return generic_pseudoheader_checksum<IPv6Address::address_size * 2 + sizeof(uint16_t) * 2>(
-        source_ip, dest_ip, len, flag
-    );
+    uint32_t checksum = Endian::host_to_be(flag) + Endian::host_to_be(len);
+    uint16_t word;
+    for (size_t i = 0; i < IPv6Address::address_size; i += sizeof(word)) {
+        memcpy(&word, source_ip.begin() + i, sizeof(word));
+        checksum += word;
+        memcpy(&word, dest_ip.begin() + i, sizeof(word));
+        checksum += word;
+    }
+    return checksum;
+}
+
+// HC' = ~(~HC + ~m + m'), as in equation 3 of RFC 1624
+uint16_t update_checksum(uint16_t checksum, uint16_t old_value, uint16_t new_value) {
+    uint32_t sum = static_cast<uint16_t>(~checksum);
+    sum += static_cast<uint16_t>(~old_value);
+    sum += new_value;
+    return static_cast<uint16_t>(~fold_sum(sum));
+}
+
+uint16_t update_checksum(uint16_t checksum, const uint8_t* old_data,
+                         const uint8_t* new_data, uint32_t data_size) {
+    uint32_t sum = static_cast<uint16_t>(~checksum);
+    for (uint32_t i = 0; i + 1 < data_size; i += 2) {
+        sum += static_cast<uint16_t>(~((old_data[i] << 8) | old_data[i + 1]));
+        sum += (new_data[i] << 8) | new_data[i + 1];
+    }
+    return static_cast<uint16_t>(~fold_sum(sum));
 }
 
 uint32_t crc32(const uint8_t* data, uint32_t data_size) {
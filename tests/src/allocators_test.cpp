@@ -9,6 +9,7 @@
 #include <tins/dot1q.h>
 #include <tins/ip.h>
 #include <tins/ipv6.h>
+#include <tins/rawpdu.h>
 
 
 using namespace Tins;
@@ -120,3 +121,55 @@ TEST_F(AllocatorsTest, IPv6) {
         EXPECT_EQ(pkt.serialize(), ipv6_data);
     }
 }
+
+PDU* decode_dummy_if_long(const uint8_t* data, uint32_t sz) {
+    if (sz < 100) {
+        return 0;
+    }
+    return new DummyPDU<5>(data, sz);
+}
+
+PDU* decode_dummy(const uint8_t* data, uint32_t sz) {
+    return new DummyPDU<6>(data, sz);
+}
+
+TEST_F(AllocatorsTest, Decoders) {
+    std::vector<uint8_t> ipv4_data(
+        ipv4_data_buffer,
+        ipv4_data_buffer + sizeof(ipv4_data_buffer)
+    );
+    // Protocol 254, which has no allocator
+    ipv4_data[23] = 254;
+    {
+        // The decoder refuses to decode it
+        Allocators::register_decoder<IP>(254, &decode_dummy_if_long);
+        EthernetII pkt(&ipv4_data[0], (uint32_t)ipv4_data.size());
+        EXPECT_TRUE(pkt.find_pdu<DummyPDU<5> >() == NULL);
+        EXPECT_TRUE(pkt.find_pdu<RawPDU>() != NULL);
+    }
+    {
+        // Replacing a decoder
+        Allocators::register_decoder<IP>(254, &decode_dummy);
+        EthernetII pkt(&ipv4_data[0], (uint32_t)ipv4_data.size());
+        EXPECT_TRUE(pkt.find_pdu<DummyPDU<6> >() != NULL);
+    }
+    // Decoders don't map PDU types to identifiers
+    EXPECT_FALSE(Internals::pdu_type_registered<IP>(DummyPDU<6>::pdu_flag));
+}
+
+TEST_F(AllocatorsTest, SharedPages) {
+    // Identifiers in the same page don't override each other
+    Allocators::register_allocator<EthernetII, DummyPDU<7> >(0x1234);
+    Allocators::register_allocator<EthernetII, DummyPDU<8> >(0x1235);
+    const uint8_t data[] = { 1, 2, 3 };
+    PDU* first = Internals::allocate<EthernetII>(0x1234, data, sizeof(data));
+    PDU* second = Internals::allocate<EthernetII>(0x1235, data, sizeof(data));
+    ASSERT_TRUE(first != NULL);
+    ASSERT_TRUE(second != NULL);
+    EXPECT_EQ(DummyPDU<7>::pdu_flag, first->pdu_type());
+    EXPECT_EQ(DummyPDU<8>::pdu_flag, second->pdu_type());
+    EXPECT_TRUE(Internals::allocate<EthernetII>(0x1236, data, sizeof(data)) == NULL);
+    EXPECT_EQ(0x1235, Internals::pdu_type_to_id<EthernetII>(DummyPDU<8>::pdu_flag));
+    delete first;
+    delete second;
+}
@@ -0,0 +1,176 @@
+#include <gtest/gtest.h>
+#include <tins/config.h>
+
+#ifdef TINS_HAVE_COMPRESSION
+
+#include <string>
+#include <vector>
+#include <cstdio>
+#include <stdint.h>
+#include <tins/sniffer.h>
+#include <tins/packet_writer.h>
+#include <tins/ethernetII.h>
+#include <tins/ip.h>
+#include <tins/udp.h>
+#include <tins/rawpdu.h>
+
+using namespace std;
+using namespace Tins;
+
+class CompressedFileTest : public testing::Test {
+public:
+    static const char* file_name;
+
+    void TearDown();
+
+    static void write_packets(PacketWriter::Compression compression, uint16_t count);
+    static void check_packets(uint16_t count);
+    static vector<uint8_t> read_magic();
+    static void truncate_file();
+    static void check_read_fails();
+};
+
+const char* CompressedFileTest::file_name = "compressed_file_test.pcap";
+
+void CompressedFileTest::TearDown() {
+    remove(file_name);
+}
+
+void CompressedFileTest::write_packets(PacketWriter::Compression compression,
+                                       uint16_t count) {
+    PacketWriter writer(file_name, DataLinkType<EthernetII>(), compression);
+    for (uint16_t i = 0; i < count; ++i) {
+        EthernetII eth = EthernetII() / IP("1.2.3.4", "4.3.2.1") / UDP(i, 1000) / 
+                         RawPDU(string(100, 'a'));
+        writer.write(eth);
+    }
+    writer.close();
+}
+
+void CompressedFileTest::check_packets(uint16_t count) {
+    FileSniffer sniffer(file_name);
+    uint16_t expected = 0;
+    sniffer.sniff_loop([&](PDU& pdu) {
+        EXPECT_EQ(expected++, pdu.rfind_pdu<UDP>().dport());
+        return true;
+    });
+    EXPECT_EQ(count, expected);
+}
+
+vector<uint8_t> CompressedFileTest::read_magic() {
+    vector<uint8_t> output(4);
+    FILE* fp = fopen(file_name, "rb");
+    EXPECT_TRUE(fp != 0);
+    if (fp) {
+        output.resize(fread(&output[0], 1, output.size(), fp));
+        fclose(fp);
+    }
+    return output;
+}
+
+// Drops the second half of the file
+void CompressedFileTest::truncate_file() {
+    FILE* fp = fopen(file_name, "rb");
+    ASSERT_TRUE(fp != 0);
+    vector<uint8_t> contents(1 << 20);
+    contents.resize(fread(&contents[0], 1, contents.size(), fp));
+    fclose(fp);
+    fp = fopen(file_name, "wb");
+    ASSERT_TRUE(fp != 0);
+    fwrite(&contents[0], 1, contents.size() / 2, fp);
+    fclose(fp);
+}
+
+void CompressedFileTest::check_read_fails() {
+    FileSniffer sniffer(file_name);
+    size_t count = 0;
+    EXPECT_THROW(
+        sniffer.sniff_loop([&](PDU&) {
+            count++;
+            return true;
+        }),
+        pcap_error
+    );
+    // Everything before the cut is still read
+    EXPECT_GT(count, 0U);
+}
+
+TEST_F(CompressedFileTest, Uncompressed) {
+    write_packets(PacketWriter::NO_COMPRESSION, 100);
+    EXPECT_EQ(0xd4, read_magic()[0]);
+    check_packets(100);
+}
+
+#ifdef TINS_HAVE_ZLIB
+
+TEST_F(CompressedFileTest, Gzip) {
+    write_packets(PacketWriter::GZIP, 5000);
+    vector<uint8_t> magic = read_magic();
+    ASSERT_EQ(4U, magic.size());
+    EXPECT_EQ(0x1f, magic[0]);
+    EXPECT_EQ(0x8b, magic[1]);
+    check_packets(5000);
+}
+
+TEST_F(CompressedFileTest, TruncatedGzip) {
+    write_packets(PacketWriter::GZIP, 5000);
+    truncate_file();
+    check_read_fails();
+}
+
+TEST_F(CompressedFileTest, InvalidFilter) {
+    write_packets(PacketWriter::GZIP, 5000);
+    // The decompressing thread is stopped when the constructor throws
+    EXPECT_THROW(FileSniffer(file_name, "not a valid filter"), invalid_pcap_filter);
+}
+
+TEST_F(CompressedFileTest, StopReadingEarly) {
+    write_packets(PacketWriter::GZIP, 20000);
+    FileSniffer sniffer(file_name);
+    int count = 0;
+    sniffer.sniff_loop([&](PDU&) {
+        return ++count < 10;
+    });
+    EXPECT_EQ(10, count);
+    // Destroying the sniffer must not wait for the whole file to be read
+}
+
+TEST_F(CompressedFileTest, WriteErrorsAreReported) {
+    // Writing to this device always fails with ENOSPC
+    if (FILE* fp = fopen("/dev/full", "wb")) {
+        fclose(fp);
+        PacketWriter writer("/dev/full", DataLinkType<EthernetII>(), PacketWriter::GZIP);
+        EthernetII eth = EthernetII() / IP("1.2.3.4", "4.3.2.1") / UDP(1, 1000);
+        writer.write(eth);
+        EXPECT_THROW(writer.close(), pcap_error);
+    }
+}
+
+#endif // TINS_HAVE_ZLIB
+
+#ifdef TINS_HAVE_ZSTD
+
+TEST_F(CompressedFileTest, Zstd) {
+    write_packets(PacketWriter::ZSTD, 5000);
+    vector<uint8_t> magic = read_magic();
+    ASSERT_EQ(4U, magic.size());
+    EXPECT_EQ(0x28, magic[0]);
+    EXPECT_EQ(0xb5, magic[1]);
+    check_packets(5000);
+}
+
+TEST_F(CompressedFileTest, TruncatedZstd) {
+    write_packets(PacketWriter::ZSTD, 5000);
+    truncate_file();
+    check_read_fails();
+}
+
+#else
+
+TEST_F(CompressedFileTest, ZstdDisabled) {
+    EXPECT_THROW(write_packets(PacketWriter::ZSTD, 1), feature_disabled);
+}
+
+#endif // TINS_HAVE_ZSTD
+
+#endif // TINS_HAVE_COMPRESSION
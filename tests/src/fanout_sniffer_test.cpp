@@ -0,0 +1,192 @@
+#include <gtest/gtest.h>
+#include <set>
+#include <map>
+#include <mutex>
+#include <atomic>
+#include <tins/fanout_sniffer.h>
+#include <tins/packet_sender.h>
+#include <tins/ethernetII.h>
+#include <tins/ip.h>
+#include <tins/udp.h>
+#include <tins/rawpdu.h>
+
+#if defined(TINS_HAVE_PACKET_RING) && TINS_IS_CXX11
+
+using namespace std;
+using namespace Tins;
+
+class FanoutSnifferTest : public testing::Test {
+public:
+    static const uint16_t dport;
+    static const size_t flow_count;
+    static const size_t packets_per_flow;
+
+    static RingSnifferConfiguration make_configuration();
+    static void send_packets();
+};
+
+const uint16_t FanoutSnifferTest::dport = 49153;
+const size_t FanoutSnifferTest::flow_count = 8;
+const size_t FanoutSnifferTest::packets_per_flow = 4;
+
+RingSnifferConfiguration FanoutSnifferTest::make_configuration() {
+    RingSnifferConfiguration config;
+    config.set_block_size(1 << 16);
+    config.set_block_count(4);
+    config.set_block_timeout(10);
+    config.set_timeout(1000);
+    return config;
+}
+
+void FanoutSnifferTest::send_packets() {
+    PacketSender sender;
+    for (size_t i = 0; i < packets_per_flow; ++i) {
+        for (size_t flow = 0; flow < flow_count; ++flow) {
+            EthernetII pkt = EthernetII() / IP("127.0.0.1", "127.0.0.1") / 
+                             UDP(dport, static_cast<uint16_t>(1000 + flow)) / RawPDU("fanout");
+            sender.send(pkt, "lo");
+        }
+    }
+}
+
+struct FlowRecorder {
+    typedef map<uint16_t, set<std::thread::id> > flows_type;
+
+    FlowRecorder(mutex* lock, flows_type* flows, atomic<size_t>* total)
+    : lock(lock), flows(flows), total(total) { }
+
+    bool operator()(const PDU& pdu) {
+        const UDP* udp = pdu.find_pdu<UDP>();
+        if (udp && udp->dport() == FanoutSnifferTest::dport) {
+            lock_guard<mutex> _(*lock);
+            (*flows)[udp->sport()].insert(this_thread::get_id());
+            // Loopback packets are captured twice
+            return ++*total < FanoutSnifferTest::flow_count * 
+                              FanoutSnifferTest::packets_per_flow * 2;
+        }
+        return true;
+    }
+
+    mutex* lock;
+    flows_type* flows;
+    atomic<size_t>* total;
+};
+
+TEST_F(FanoutSnifferTest, WorkerCount) {
+    EXPECT_THROW(FanoutSniffer("lo", 0), std::runtime_error);
+    try {
+        FanoutSniffer sniffer("lo", 3, RingSnifferConfiguration::FANOUT_HASH, 
+                              make_configuration());
+        EXPECT_EQ(3U, sniffer.worker_count());
+        sniffer.stats();
+    }
+    catch (socket_open_error&) {
+        // No privileges to open packet sockets
+    }
+}
+
+TEST_F(FanoutSnifferTest, FlowAffinity) {
+    try {
+        FanoutSniffer sniffer("lo", 4, RingSnifferConfiguration::FANOUT_HASH, 
+                              make_configuration());
+        mutex lock;
+        FlowRecorder::flows_type flows;
+        atomic<size_t> total(0);
+        std::thread sender(&FanoutSnifferTest::send_packets);
+        sniffer.sniff_loop(FlowRecorder(&lock, &flows, &total));
+        sender.join();
+        EXPECT_EQ(flow_count, flows.size());
+        for (FlowRecorder::flows_type::const_iterator it = flows.begin(); it != flows.end(); ++it) {
+            EXPECT_EQ(1U, it->second.size());
+        }
+    }
+    catch (socket_open_error&) {
+        // No privileges to open packet sockets
+    }
+}
+
+TEST_F(FanoutSnifferTest, UniqueGroups) {
+    try {
+        FanoutSniffer first("lo", 2, RingSnifferConfiguration::FANOUT_HASH, 
+                            make_configuration());
+        FanoutSniffer second("lo", 2, RingSnifferConfiguration::FANOUT_HASH, 
+                             make_configuration());
+        EXPECT_NE(first.group_id(), second.group_id());
+        // Every worker is in the group
+        EXPECT_EQ(first.group_id(), first.sniffer(1).fanout_group_id());
+
+        // An explicit identifier is used as is
+        RingSnifferConfiguration configuration = make_configuration();
+        configuration.set_fanout(first.group_id() ^ 1);
+        FanoutSniffer third("lo", 2, RingSnifferConfiguration::FANOUT_HASH, 
+                            configuration);
+        EXPECT_EQ(first.group_id() ^ 1, third.group_id());
+    }
+    catch (socket_open_error&) {
+        // No privileges to open packet sockets
+    }
+}
+
+TEST_F(FanoutSnifferTest, StopSniff) {
+    try {
+        FanoutSniffer sniffer("lo", 2, RingSnifferConfiguration::FANOUT_LOAD_BALANCE);
+        std::thread stopper([&]() {
+            this_thread::sleep_for(chrono::milliseconds(50));
+            sniffer.stop_sniff();
+        });
+        sniffer.sniff_loop([](const PDU&) { return true; });
+        stopper.join();
+    }
+    catch (socket_open_error&) {
+        // No privileges to open packet sockets
+    }
+}
+
+TEST_F(FanoutSnifferTest, ExceptionIsPropagated) {
+    try {
+        FanoutSniffer sniffer("lo", 2, RingSnifferConfiguration::FANOUT_HASH, 
+                              make_configuration());
+        std::thread sender(&FanoutSnifferTest::send_packets);
+        EXPECT_THROW(
+            sniffer.sniff_loop([](const PDU&) -> bool { throw std::logic_error("error"); }),
+            std::logic_error
+        );
+        sender.join();
+    }
+    catch (socket_open_error&) {
+        // No privileges to open packet sockets
+    }
+}
+
+struct ThrowingCopy {
+    ThrowingCopy(atomic<int>* copies_left)
+    : copies_left(copies_left) { }
+
+    ThrowingCopy(const ThrowingCopy& rhs)
+    : copies_left(rhs.copies_left) {
+        if (--*copies_left < 0) {
+            throw std::length_error("no more copies");
+        }
+    }
+
+    bool operator()(const PDU&) {
+        return true;
+    }
+
+    atomic<int>* copies_left;
+};
+
+TEST_F(FanoutSnifferTest, StartupFailureStopsWorkers) {
+    try {
+        FanoutSniffer sniffer("lo", 4, RingSnifferConfiguration::FANOUT_HASH, 
+                              make_configuration());
+        // Enough copies for the first workers to start, but not all of them
+        atomic<int> copies_left(6);
+        EXPECT_THROW(sniffer.sniff_loop(ThrowingCopy(&copies_left)), std::length_error);
+    }
+    catch (socket_open_error&) {
+        // No privileges to open packet sockets
+    }
+}
+
+#endif // TINS_HAVE_PACKET_RING && TINS_IS_CXX11
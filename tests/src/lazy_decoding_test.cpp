@@ -0,0 +1,185 @@
+#include <gtest/gtest.h>
+#include <string>
+#include <thread>
+#include <vector>
+#include <stdint.h>
+#include <tins/lazy_decoding.h>
+#include <tins/ethernetII.h>
+#include <tins/dot1q.h>
+#include <tins/ip.h>
+#include <tins/ipv6.h>
+#include <tins/tcp.h>
+#include <tins/udp.h>
+#include <tins/rawpdu.h>
+
+using namespace std;
+using namespace Tins;
+
+class LazyDecodingTest : public testing::Test {
+public:
+    static PDU::serialization_type build_packet();
+};
+
+PDU::serialization_type LazyDecodingTest::build_packet() {
+    EthernetII eth = EthernetII("00:01:02:03:04:05", "06:07:08:09:0a:0b") /
+                     Dot1Q(10) / IP("192.168.0.1", "10.0.0.1") / 
+                     TCP(80, 12345) / RawPDU("hello world");
+    return eth.serialize();
+}
+
+TEST_F(LazyDecodingTest, GuardState) {
+    EXPECT_FALSE(LazyDecodingGuard::is_enabled());
+    {
+        LazyDecodingGuard guard;
+        EXPECT_TRUE(LazyDecodingGuard::is_enabled());
+        {
+            LazyDecodingGuard inner_guard(false);
+            EXPECT_FALSE(LazyDecodingGuard::is_enabled());
+        }
+        EXPECT_TRUE(LazyDecodingGuard::is_enabled());
+    }
+    EXPECT_FALSE(LazyDecodingGuard::is_enabled());
+}
+
+TEST_F(LazyDecodingTest, DecodeOnAccess) {
+    const PDU::serialization_type buffer = build_packet();
+    LazyDecodingGuard guard;
+    EthernetII eth(&buffer[0], buffer.size());
+    ASSERT_TRUE(eth.inner_pdu() != 0);
+    EXPECT_EQ(PDU::DOT1Q, eth.inner_pdu()->pdu_type());
+    EXPECT_EQ(10, eth.rfind_pdu<Dot1Q>().id());
+    const IP& ip = eth.rfind_pdu<IP>();
+    EXPECT_EQ(IPv4Address("192.168.0.1"), ip.dst_addr());
+    const TCP& tcp = eth.rfind_pdu<TCP>();
+    EXPECT_EQ(80, tcp.dport());
+    EXPECT_EQ(12345, tcp.sport());
+    const RawPDU& raw = eth.rfind_pdu<RawPDU>();
+    EXPECT_EQ("hello world", string(raw.payload().begin(), raw.payload().end()));
+    EXPECT_EQ(&ip, eth.find_pdu<IP>());
+    EXPECT_EQ(&eth, ip.parent_pdu()->parent_pdu());
+}
+
+TEST_F(LazyDecodingTest, DecodeAfterGuardIsGone) {
+    const PDU::serialization_type buffer = build_packet();
+    EthernetII* eth = 0;
+    {
+        LazyDecodingGuard guard;
+        eth = new EthernetII(&buffer[0], buffer.size());
+    }
+    EXPECT_EQ(12345, eth->rfind_pdu<TCP>().sport());
+    EXPECT_TRUE(eth->find_pdu<RawPDU>() != 0);
+    delete eth;
+}
+
+TEST_F(LazyDecodingTest, Size) {
+    const PDU::serialization_type buffer = build_packet();
+    LazyDecodingGuard guard;
+    EthernetII eth(&buffer[0], buffer.size());
+    EXPECT_EQ(buffer.size(), eth.size());
+}
+
+TEST_F(LazyDecodingTest, Serialize) {
+    const PDU::serialization_type buffer = build_packet();
+    LazyDecodingGuard guard;
+    EthernetII eth(&buffer[0], buffer.size());
+    EXPECT_EQ(buffer, eth.serialize());
+}
+
+TEST_F(LazyDecodingTest, Clone) {
+    const PDU::serialization_type buffer = build_packet();
+    EthernetII* eth = 0;
+    {
+        LazyDecodingGuard guard;
+        EthernetII original(&buffer[0], buffer.size());
+        eth = original.clone();
+    }
+    EXPECT_EQ(IPv4Address("10.0.0.1"), eth->rfind_pdu<IP>().src_addr());
+    EXPECT_EQ(buffer, eth->serialize());
+    delete eth;
+}
+
+TEST_F(LazyDecodingTest, ReleaseInnerPDU) {
+    const PDU::serialization_type buffer = build_packet();
+    LazyDecodingGuard guard;
+    EthernetII eth(&buffer[0], buffer.size());
+    PDU* inner = eth.release_inner_pdu();
+    ASSERT_TRUE(inner != 0);
+    EXPECT_EQ(PDU::DOT1Q, inner->pdu_type());
+    EXPECT_EQ(0, inner->parent_pdu());
+    EXPECT_TRUE(inner->find_pdu<UDP>() == 0);
+    EXPECT_TRUE(inner->find_pdu<TCP>() != 0);
+    delete inner;
+}
+
+TEST_F(LazyDecodingTest, IPv6UDP) {
+    EthernetII eth = EthernetII() / IPv6("::1", "::2") / UDP(53, 1024) / RawPDU("abc");
+    const PDU::serialization_type buffer = eth.serialize();
+    LazyDecodingGuard guard;
+    EthernetII parsed(&buffer[0], buffer.size());
+    EXPECT_EQ(IPv6Address("::1"), parsed.rfind_pdu<IPv6>().dst_addr());
+    EXPECT_EQ(53, parsed.rfind_pdu<UDP>().dport());
+    EXPECT_EQ(3U, parsed.rfind_pdu<RawPDU>().payload_size());
+    EXPECT_EQ(buffer, parsed.serialize());
+}
+
+TEST_F(LazyDecodingTest, ConstAccessDecodes) {
+    const PDU::serialization_type buffer = build_packet();
+    LazyDecodingGuard guard;
+    EthernetII eth(&buffer[0], buffer.size());
+    const EthernetII& const_eth = eth;
+    ASSERT_TRUE(const_eth.inner_pdu() != 0);
+    EXPECT_EQ(PDU::DOT1Q, const_eth.inner_pdu()->pdu_type());
+    EXPECT_TRUE(const_eth.has_pdu<TCP>());
+    EXPECT_FALSE(const_eth.has_pdu<UDP>());
+    const IP* ip = const_eth.find_pdu<IP>();
+    ASSERT_TRUE(ip != 0);
+    EXPECT_EQ(IPv4Address("192.168.0.1"), ip->dst_addr());
+    const TCP* tcp = const_eth.find_pdu<TCP>();
+    ASSERT_TRUE(tcp != 0);
+    EXPECT_EQ(80, tcp->dport());
+    EXPECT_EQ(const_eth.inner_pdu(), tcp->parent_pdu()->parent_pdu());
+    EXPECT_EQ(buffer.size(), const_eth.size());
+
+    // The non const accessors take the PDUs decoded above
+    EXPECT_EQ(ip, eth.find_pdu<IP>());
+    EXPECT_EQ(tcp, eth.find_pdu<TCP>());
+    EXPECT_EQ(&eth, eth.inner_pdu()->parent_pdu());
+    EXPECT_EQ(buffer, eth.serialize());
+}
+
+TEST_F(LazyDecodingTest, ConcurrentConstAccess) {
+    const PDU::serialization_type buffer = build_packet();
+    LazyDecodingGuard guard;
+    const EthernetII eth(&buffer[0], buffer.size());
+    vector<const TCP*> found(4);
+    vector<thread> threads;
+    for (size_t i = 0; i < found.size(); ++i) {
+        threads.push_back(thread([&, i]() {
+            found[i] = eth.find_pdu<TCP>();
+        }));
+    }
+    for (size_t i = 0; i < threads.size(); ++i) {
+        threads[i].join();
+    }
+    ASSERT_TRUE(found[0] != 0);
+    for (size_t i = 1; i < found.size(); ++i) {
+        EXPECT_EQ(found[0], found[i]);
+    }
+    EXPECT_EQ(80, found[0]->dport());
+}
+
+TEST_F(LazyDecodingTest, MalformedInnerPDU) {
+    PDU::serialization_type buffer = build_packet();
+    // Truncate the packet in the middle of the IP header
+    buffer.resize(EthernetII::address_type::address_size * 2 + 2 + 4 + 10);
+    LazyDecodingGuard guard;
+    EthernetII eth(&buffer[0], buffer.size());
+    // Getters don't throw, the contents are kept as raw data
+    ASSERT_TRUE(eth.inner_pdu() != 0);
+    EXPECT_TRUE(eth.find_pdu<IP>() == 0);
+    EXPECT_TRUE(eth.find_pdu<RawPDU>() != 0);
+
+    EthernetII other(&buffer[0], buffer.size());
+    EXPECT_THROW(other.decode(), malformed_packet);
+    EXPECT_TRUE(other.find_pdu<RawPDU>() != 0);
+}
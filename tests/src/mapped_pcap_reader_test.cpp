@@ -0,0 +1,278 @@
+#include <gtest/gtest.h>
+#include <string>
+#include <vector>
+#include <cstdio>
+#include <stdint.h>
+#include <tins/mapped_pcap_reader.h>
+#include <tins/ethernetII.h>
+#include <tins/ip.h>
+#include <tins/udp.h>
+#include <tins/rawpdu.h>
+#include <tins/endianness.h>
+
+#ifndef _WIN32
+
+using namespace std;
+using namespace Tins;
+
+class MappedPcapReaderTest : public testing::Test {
+public:
+    typedef vector<uint8_t> buffer_type;
+
+    static const char* file_name;
+
+    void TearDown();
+
+    static void append(buffer_type& buffer, uint32_t value, bool swapped);
+    static void append16(buffer_type& buffer, uint16_t value, bool swapped);
+    static buffer_type file_header(uint32_t magic, bool swapped, uint32_t link_type = 1);
+    static void add_record(buffer_type& buffer, const PDU::serialization_type& data,
+                           uint32_t seconds, uint32_t fraction, bool swapped);
+    static void write_file(const buffer_type& buffer);
+    static PDU::serialization_type make_packet(uint16_t dport);
+};
+
+const char* MappedPcapReaderTest::file_name = "mapped_pcap_reader_test.pcap";
+
+void MappedPcapReaderTest::TearDown() {
+    remove(file_name);
+}
+
+void MappedPcapReaderTest::append(buffer_type& buffer, uint32_t value, bool swapped) {
+    if (swapped) {
+        value = Endian::change_endian(value);
+    }
+    const uint8_t* ptr = (const uint8_t*)&value;
+    buffer.insert(buffer.end(), ptr, ptr + sizeof(value));
+}
+
+void MappedPcapReaderTest::append16(buffer_type& buffer, uint16_t value, bool swapped) {
+    if (swapped) {
+        value = Endian::change_endian(value);
+    }
+    const uint8_t* ptr = (const uint8_t*)&value;
+    buffer.insert(buffer.end(), ptr, ptr + sizeof(value));
+}
+
+MappedPcapReaderTest::buffer_type MappedPcapReaderTest::file_header(uint32_t magic,
+                                                                    bool swapped,
+                                                                    uint32_t link_type) {
+    buffer_type buffer;
+    append(buffer, magic, swapped);
+    // Version 2.4
+    append16(buffer, 2, swapped);
+    append16(buffer, 4, swapped);
+    append(buffer, 0, swapped);
+    append(buffer, 0, swapped);
+    append(buffer, 65535, swapped);
+    append(buffer, link_type, swapped);
+    return buffer;
+}
+
+void MappedPcapReaderTest::add_record(buffer_type& buffer, 
+                                      const PDU::serialization_type& data,
+                                      uint32_t seconds, uint32_t fraction,
+                                      bool swapped) {
+    append(buffer, seconds, swapped);
+    append(buffer, fraction, swapped);
+    append(buffer, static_cast<uint32_t>(data.size()), swapped);
+    append(buffer, static_cast<uint32_t>(data.size() + 10), swapped);
+    buffer.insert(buffer.end(), data.begin(), data.end());
+}
+
+void MappedPcapReaderTest::write_file(const buffer_type& buffer) {
+    FILE* fp = fopen(file_name, "wb");
+    ASSERT_TRUE(fp != 0);
+    fwrite(&buffer[0], 1, buffer.size(), fp);
+    fclose(fp);
+}
+
+PDU::serialization_type MappedPcapReaderTest::make_packet(uint16_t dport) {
+    EthernetII eth = EthernetII() / IP("1.2.3.4", "4.3.2.1") / UDP(dport, 1000) / 
+                     RawPDU("payload");
+    return eth.serialize();
+}
+
+TEST_F(MappedPcapReaderTest, Microseconds) {
+    buffer_type buffer = file_header(0xa1b2c3d4, false);
+    add_record(buffer, make_packet(1), 100, 250, false);
+    add_record(buffer, make_packet(2), 101, 999999, false);
+    write_file(buffer);
+
+    MappedPcapReader reader(file_name);
+    EXPECT_EQ(1U, reader.link_type());
+    EXPECT_EQ(65535U, reader.snap_len());
+    EXPECT_FALSE(reader.nanosecond_resolution());
+    EXPECT_FALSE(reader.is_swapped());
+    EXPECT_EQ(buffer.size(), reader.file_size());
+
+    MappedPcapReader::record record;
+    ASSERT_TRUE(reader.next_record(record));
+    EXPECT_EQ(make_packet(1), PDU::serialization_type(record.data, record.data + record.size));
+    EXPECT_EQ(record.size + 10, record.wire_size);
+    EXPECT_EQ(100U, record.seconds);
+    EXPECT_EQ(250000U, record.nanoseconds);
+    EXPECT_EQ(100, record.timestamp().seconds());
+    EXPECT_EQ(250, record.timestamp().microseconds());
+    EXPECT_EQ(24U, record.offset);
+    // Records point straight into the mapping
+    EXPECT_EQ(reader.file_data() + 24 + 16, record.data);
+
+    ASSERT_TRUE(reader.next_record(record));
+    EXPECT_EQ(101U, record.seconds);
+    EXPECT_EQ(999999000U, record.nanoseconds);
+    EXPECT_FALSE(reader.next_record(record));
+}
+
+TEST_F(MappedPcapReaderTest, NanosecondsSwapped) {
+    buffer_type buffer = file_header(0xa1b23c4d, true);
+    add_record(buffer, make_packet(1), 5, 123456789, true);
+    write_file(buffer);
+
+    MappedPcapReader reader(file_name, true);
+    EXPECT_TRUE(reader.nanosecond_resolution());
+    EXPECT_TRUE(reader.is_swapped());
+    EXPECT_EQ(1U, reader.link_type());
+    MappedPcapReader::record record;
+    ASSERT_TRUE(reader.next_record(record));
+    EXPECT_EQ(5U, record.seconds);
+    EXPECT_EQ(123456789U, record.nanoseconds);
+    EXPECT_EQ(123456, record.timestamp().microseconds());
+    EXPECT_EQ(make_packet(1), PDU::serialization_type(record.data, record.data + record.size));
+}
+
+TEST_F(MappedPcapReaderTest, TruncatedRecord) {
+    buffer_type buffer = file_header(0xa1b2c3d4, false);
+    add_record(buffer, make_packet(1), 1, 0, false);
+    add_record(buffer, make_packet(2), 2, 0, false);
+    buffer.resize(buffer.size() - 5);
+    write_file(buffer);
+
+    MappedPcapReader reader(file_name);
+    MappedPcapReader::const_iterator it = reader.begin();
+    EXPECT_EQ(1U, it->seconds);
+    EXPECT_THROW(++it, capture_file_error);
+
+    // The records before the truncated one are still read
+    Packet packet(reader.next_packet());
+    EXPECT_EQ(1, packet.pdu()->rfind_pdu<UDP>().dport());
+    EXPECT_THROW(reader.next_packet(), capture_file_error);
+}
+
+TEST_F(MappedPcapReaderTest, TruncatedRecordHeader) {
+    buffer_type buffer = file_header(0xa1b2c3d4, false);
+    add_record(buffer, make_packet(1), 1, 0, false);
+    append(buffer, 2, false);
+    write_file(buffer);
+
+    MappedPcapReader reader(file_name);
+    MappedPcapReader::record record;
+    EXPECT_TRUE(reader.next_record(record));
+    EXPECT_THROW(reader.next_record(record), capture_file_error);
+}
+
+TEST_F(MappedPcapReaderTest, InvalidCapturedSize) {
+    buffer_type buffer = file_header(0xa1b2c3d4, false);
+    add_record(buffer, make_packet(1), 1, 0, false);
+    append(buffer, 2, false);
+    append(buffer, 0, false);
+    append(buffer, 0xffffffff, false);
+    append(buffer, 0xffffffff, false);
+    write_file(buffer);
+
+    MappedPcapReader reader(file_name);
+    Packet packet(reader.next_packet());
+    EXPECT_TRUE(packet.pdu() != 0);
+    EXPECT_THROW(reader.next_packet(), capture_file_error);
+}
+
+TEST_F(MappedPcapReaderTest, SniffLoop) {
+    buffer_type buffer = file_header(0xa1b2c3d4, false);
+    for (uint16_t i = 0; i < 10; ++i) {
+        add_record(buffer, make_packet(i), i, 0, false);
+    }
+    write_file(buffer);
+
+    MappedPcapReader reader(file_name);
+    vector<uint16_t> ports;
+    reader.sniff_loop([&](const PDU& pdu) {
+        ports.push_back(pdu.rfind_pdu<UDP>().dport());
+        return true;
+    });
+    ASSERT_EQ(10U, ports.size());
+    for (uint16_t i = 0; i < 10; ++i) {
+        EXPECT_EQ(i, ports[i]);
+    }
+
+    reader.rewind();
+    size_t count = 0;
+    reader.sniff_loop([&](Packet& packet) {
+        EXPECT_EQ(count, static_cast<size_t>(packet.timestamp().seconds()));
+        count++;
+        return true;
+    }, 4);
+    EXPECT_EQ(4U, count);
+}
+
+TEST_F(MappedPcapReaderTest, SniffViewLoop) {
+    buffer_type buffer = file_header(0xa1b2c3d4, false);
+    for (uint16_t i = 0; i < 5; ++i) {
+        add_record(buffer, make_packet(i), i, 0, false);
+    }
+    write_file(buffer);
+
+    MappedPcapReader reader(file_name);
+    vector<uint16_t> ports;
+    reader.sniff_view_loop([&](const PacketView& view) {
+        ports.push_back(view.udp().dport());
+        EXPECT_EQ(view.size() + 10, view.wire_size());
+        return ports.size() < 3;
+    });
+    ASSERT_EQ(3U, ports.size());
+    EXPECT_EQ(2, ports[2]);
+}
+
+TEST_F(MappedPcapReaderTest, SeekAndTell) {
+    buffer_type buffer = file_header(0xa1b2c3d4, false);
+    for (uint16_t i = 0; i < 3; ++i) {
+        add_record(buffer, make_packet(i), i, 0, false);
+    }
+    write_file(buffer);
+
+    MappedPcapReader reader(file_name);
+    EXPECT_EQ(24U, reader.tell());
+    MappedPcapReader::record record;
+    ASSERT_TRUE(reader.next_record(record));
+    const uint64_t second_offset = reader.tell();
+    ASSERT_TRUE(reader.next_record(record));
+    EXPECT_EQ(second_offset, record.offset);
+    reader.seek(second_offset);
+    ASSERT_TRUE(reader.next_record(record));
+    EXPECT_EQ(1U, record.seconds);
+    EXPECT_THROW(reader.seek(3), capture_file_error);
+}
+
+TEST_F(MappedPcapReaderTest, RawLinkType) {
+    buffer_type buffer = file_header(0xa1b2c3d4, false, 101);
+    IP ip = IP("1.2.3.4", "4.3.2.1") / UDP(53, 1000);
+    add_record(buffer, ip.serialize(), 1, 0, false);
+    write_file(buffer);
+
+    MappedPcapReader reader(file_name);
+    Packet packet = reader.next_packet();
+    ASSERT_TRUE(packet.pdu() != 0);
+    EXPECT_EQ(PDU::IP, packet.pdu()->pdu_type());
+    EXPECT_EQ(53, packet.pdu()->rfind_pdu<UDP>().dport());
+}
+
+TEST_F(MappedPcapReaderTest, InvalidFiles) {
+    EXPECT_THROW(MappedPcapReader("/this/file/does/not/exist"), capture_file_error);
+    buffer_type buffer = file_header(0xdeadbeef, false);
+    write_file(buffer);
+    EXPECT_THROW(MappedPcapReader reader(file_name), capture_file_error);
+    buffer.resize(10);
+    write_file(buffer);
+    EXPECT_THROW(MappedPcapReader reader(file_name), capture_file_error);
+}
+
+#endif // _WIN32
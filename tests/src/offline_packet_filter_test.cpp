@@ -75,3 +75,61 @@ TEST_F(OfflinePacketFilterTest, MatchesFilterSLLTcp) {
         EXPECT_FALSE(filter.matches_filter(pkt));
     }
 }
+
+TEST_F(OfflinePacketFilterTest, MatchesFilterTcpFlags) {
+    OfflinePacketFilter filter("tcp[tcpflags] & tcp-syn != 0", DataLinkType<EthernetII>());
+    {
+        EthernetII pkt = EthernetII() / IP() / TCP(55, 11);
+        pkt.rfind_pdu<TCP>().set_flag(TCP::SYN, 1);
+        EXPECT_TRUE(filter.matches_filter(pkt));
+    }
+    {
+        EthernetII pkt = EthernetII() / IP() / TCP(55, 11);
+        pkt.rfind_pdu<TCP>().set_flag(TCP::ACK, 1);
+        EXPECT_FALSE(filter.matches_filter(pkt));
+    }
+}
+
+TEST_F(OfflinePacketFilterTest, MatchesFilterLength) {
+    OfflinePacketFilter filter("greater 100", DataLinkType<EthernetII>());
+    {
+        EthernetII pkt = EthernetII() / IP() / UDP(111, 11) / RawPDU(std::string(100, 'A'));
+        EXPECT_TRUE(filter.matches_filter(pkt));
+    }
+    {
+        EthernetII pkt = EthernetII() / IP() / UDP(111, 11) / RawPDU("test");
+        EXPECT_FALSE(filter.matches_filter(pkt));
+    }
+}
+
+TEST_F(OfflinePacketFilterTest, MatchesFilterTruncated) {
+    OfflinePacketFilter filter("ip and port 55", DataLinkType<EthernetII>());
+    EthernetII pkt = EthernetII() / IP() / TCP(55, 11) / RawPDU("test");
+    PDU::serialization_type buffer = pkt.serialize();
+    EXPECT_TRUE(filter.matches_filter(&buffer[0], static_cast<uint32_t>(buffer.size())));
+    // Cut right before the TCP ports
+    EXPECT_FALSE(filter.matches_filter(&buffer[0], 14 + 20 + 1));
+}
+
+TEST_F(OfflinePacketFilterTest, MatchesFilterBatch) {
+    OfflinePacketFilter filter("tcp and dst port 80", DataLinkType<EthernetII>());
+    PDU::serialization_type packets[] = {
+        (EthernetII() / IP() / TCP(80, 11)).serialize(),
+        (EthernetII() / IP() / TCP(11, 80)).serialize(),
+        (EthernetII() / IP() / UDP(80, 11)).serialize(),
+        (EthernetII() / IP() / TCP(80, 12) / RawPDU("test")).serialize()
+    };
+    const size_t count = sizeof(packets) / sizeof(packets[0]);
+    const uint8_t* buffers[count];
+    uint32_t sizes[count];
+    bool results[count];
+    for (size_t i = 0; i < count; ++i) {
+        buffers[i] = &packets[i][0];
+        sizes[i] = static_cast<uint32_t>(packets[i].size());
+    }
+    EXPECT_EQ(2U, filter.matches_filter(buffers, sizes, count, results));
+    EXPECT_TRUE(results[0]);
+    EXPECT_FALSE(results[1]);
+    EXPECT_FALSE(results[2]);
+    EXPECT_TRUE(results[3]);
+}
@@ -0,0 +1,424 @@
+#include <tins/packet_classifier.h>
+
+#if defined(TINS_HAVE_PCAP) && TINS_IS_CXX11
+
+#include <gtest/gtest.h>
+#include <vector>
+#include <string>
+#include <stdint.h>
+#include <tins/ethernetII.h>
+#include <tins/dot1q.h>
+#include <tins/ip.h>
+#include <tins/ipv6.h>
+#include <tins/tcp.h>
+#include <tins/udp.h>
+#include <tins/arp.h>
+#include <tins/rawpdu.h>
+#include <tins/constants.h>
+#include <tins/exceptions.h>
+
+using std::vector;
+
+using namespace Tins;
+
+class PacketClassifierTest : public testing::Test {
+public:
+    typedef PacketClassifier::Rule Rule;
+    typedef PacketClassifier::MatchSet MatchSet;
+
+    PacketClassifierTest() 
+    : classifier(DataLinkType<EthernetII>()) {
+
+    }
+
+    MatchSet classify(PDU& pdu) {
+        PDU::serialization_type buffer = pdu.serialize();
+        return classifier.classify(&buffer[0], buffer.size());
+    }
+
+    PacketClassifier classifier;
+};
+
+TEST_F(PacketClassifierTest, NoRules) {
+    EthernetII pkt = EthernetII() / IP("1.2.3.4") / TCP(80, 1234);
+    MatchSet matches = classify(pkt);
+    EXPECT_FALSE(matches.any());
+    EXPECT_EQ(0U, matches.count());
+    EXPECT_EQ(0U, classifier.rule_count());
+}
+
+TEST_F(PacketClassifierTest, EmptyRuleMatchesEverything) {
+    PacketClassifier::rule_id id = classifier.add_rule(Rule());
+    EthernetII pkt1 = EthernetII() / IP("1.2.3.4") / TCP(80, 1234);
+    EthernetII pkt2 = EthernetII() / ARP();
+    EXPECT_TRUE(classify(pkt1).test(id));
+    EXPECT_TRUE(classify(pkt2).test(id));
+}
+
+TEST_F(PacketClassifierTest, Ports) {
+    Rule web;
+    web.set_protocol(Constants::IP::PROTO_TCP);
+    web.set_dport(80);
+    Rule dns;
+    dns.set_protocol(Constants::IP::PROTO_UDP);
+    dns.set_dport(53);
+    Rule high_ports;
+    high_ports.set_sport(1024, 65535);
+    PacketClassifier::rule_id web_id = classifier.add_rule(web);
+    PacketClassifier::rule_id dns_id = classifier.add_rule(dns);
+    PacketClassifier::rule_id high_id = classifier.add_rule(high_ports);
+    EXPECT_EQ(3U, classifier.rule_count());
+
+    {
+        EthernetII pkt = EthernetII() / IP("1.2.3.4") / TCP(80, 1234);
+        MatchSet matches = classify(pkt);
+        EXPECT_TRUE(matches.test(web_id));
+        EXPECT_FALSE(matches.test(dns_id));
+        EXPECT_TRUE(matches.test(high_id));
+        EXPECT_EQ(2U, matches.count());
+    }
+    {
+        EthernetII pkt = EthernetII() / IP("1.2.3.4") / UDP(53, 53);
+        MatchSet matches = classify(pkt);
+        EXPECT_FALSE(matches.test(web_id));
+        EXPECT_TRUE(matches.test(dns_id));
+        EXPECT_FALSE(matches.test(high_id));
+    }
+    {
+        EthernetII pkt = EthernetII() / IP("1.2.3.4") / UDP(80, 1023);
+        EXPECT_FALSE(classify(pkt).any());
+    }
+    {
+        // No ports at all
+        EthernetII pkt = EthernetII() / ARP();
+        EXPECT_FALSE(classify(pkt).any());
+    }
+}
+
+TEST_F(PacketClassifierTest, AddressRanges) {
+    Rule internal;
+    internal.set_src_addr(IPv4Address("10.0.0.0") / 8);
+    Rule host;
+    host.set_dst_addr(IPv4Range::from_mask("192.168.1.7", "255.255.255.255"));
+    Rule range;
+    range.set_src_addr(IPv4Range("10.1.0.0", "10.1.0.255"));
+    range.set_dst_addr(IPv4Address("192.168.0.0") / 16);
+    vector<Rule> rules;
+    rules.push_back(internal);
+    rules.push_back(host);
+    rules.push_back(range);
+    EXPECT_EQ(0U, classifier.add_rules(rules));
+
+    {
+        EthernetII pkt = EthernetII() / IP("192.168.1.7", "10.1.0.3") / TCP();
+        vector<PacketClassifier::rule_id> expected;
+        expected.push_back(0);
+        expected.push_back(1);
+        expected.push_back(2);
+        EXPECT_EQ(expected, classify(pkt).ids());
+    }
+    {
+        EthernetII pkt = EthernetII() / IP("192.168.1.8", "10.2.0.3") / TCP();
+        vector<PacketClassifier::rule_id> expected(1, 0);
+        EXPECT_EQ(expected, classify(pkt).ids());
+    }
+    {
+        EthernetII pkt = EthernetII() / IP("192.168.1.7", "11.0.0.0") / TCP();
+        vector<PacketClassifier::rule_id> expected(1, 1);
+        EXPECT_EQ(expected, classify(pkt).ids());
+    }
+    {
+        EthernetII pkt = EthernetII() / IP("255.255.255.255", "0.0.0.0") / TCP();
+        EXPECT_FALSE(classify(pkt).any());
+    }
+}
+
+TEST_F(PacketClassifierTest, IPv6) {
+    Rule v6_net;
+    v6_net.set_src_addr(IPv6Address("2001:db8::") / 32);
+    Rule v4_net;
+    v4_net.set_src_addr(IPv4Address("10.0.0.0") / 8);
+    Rule v6_only;
+    v6_only.set_ether_type(Constants::Ethernet::IPV6);
+    PacketClassifier::rule_id v6_id = classifier.add_rule(v6_net);
+    PacketClassifier::rule_id v4_id = classifier.add_rule(v4_net);
+    PacketClassifier::rule_id ether_id = classifier.add_rule(v6_only);
+
+    {
+        EthernetII pkt = EthernetII() / IPv6("::1", "2001:db8::1") / UDP(1, 2);
+        MatchSet matches = classify(pkt);
+        EXPECT_TRUE(matches.test(v6_id));
+        EXPECT_FALSE(matches.test(v4_id));
+        EXPECT_TRUE(matches.test(ether_id));
+    }
+    {
+        EthernetII pkt = EthernetII() / IPv6("::1", "2001:db9::1") / UDP(1, 2);
+        MatchSet matches = classify(pkt);
+        EXPECT_FALSE(matches.test(v6_id));
+        EXPECT_TRUE(matches.test(ether_id));
+    }
+    {
+        EthernetII pkt = EthernetII() / IP("1.1.1.1", "10.0.0.1") / UDP(1, 2);
+        MatchSet matches = classify(pkt);
+        EXPECT_FALSE(matches.test(v6_id));
+        EXPECT_TRUE(matches.test(v4_id));
+        EXPECT_FALSE(matches.test(ether_id));
+    }
+}
+
+TEST_F(PacketClassifierTest, VLANTagged) {
+    Rule rule;
+    rule.set_ether_type(Constants::Ethernet::IP);
+    rule.set_dport(443);
+    PacketClassifier::rule_id id = classifier.add_rule(rule);
+    EthernetII pkt = EthernetII() / Dot1Q(10) / IP("1.1.1.1") / TCP(443, 1000);
+    EXPECT_TRUE(classify(pkt).test(id));
+}
+
+TEST_F(PacketClassifierTest, VLANTaggedNonIP) {
+    Rule arp;
+    arp.set_ether_type(Constants::Ethernet::ARP);
+    Rule vlan;
+    vlan.set_ether_type(Constants::Ethernet::VLAN);
+    PacketClassifier::rule_id arp_id = classifier.add_rule(arp);
+    PacketClassifier::rule_id vlan_id = classifier.add_rule(vlan);
+
+    EthernetII single = EthernetII() / Dot1Q(10) / ARP();
+    EthernetII stacked = EthernetII() / Dot1Q(10) / Dot1Q(20) / ARP();
+    EthernetII* packets[] = { &single, &stacked };
+    for (size_t i = 0; i < 2; ++i) {
+        PDU::serialization_type buffer = packets[i]->serialize();
+        EthernetII parsed(&buffer[0], buffer.size());
+        MatchSet from_buffer = classifier.classify(&buffer[0], buffer.size());
+        MatchSet from_pdu;
+        classifier.classify(parsed, from_pdu);
+        EXPECT_TRUE(from_buffer.test(arp_id));
+        EXPECT_FALSE(from_buffer.test(vlan_id));
+        EXPECT_EQ(from_buffer.words(), from_pdu.words());
+    }
+}
+
+TEST_F(PacketClassifierTest, InvalidPortRange) {
+    Rule rule;
+    EXPECT_THROW(rule.set_dport(100, 99), exception_base);
+}
+
+TEST_F(PacketClassifierTest, FilterExpression) {
+    Rule rule;
+    rule.set_protocol(Constants::IP::PROTO_TCP);
+    rule.set_filter("tcp and dst port 80");
+    Rule big;
+    big.set_filter("greater 100");
+    PacketClassifier::rule_id id = classifier.add_rule(rule);
+    PacketClassifier::rule_id big_id = classifier.add_rule(big);
+
+    {
+        EthernetII pkt = EthernetII() / IP("1.1.1.1") / TCP(80, 1000);
+        MatchSet matches = classify(pkt);
+        EXPECT_TRUE(matches.test(id));
+        EXPECT_FALSE(matches.test(big_id));
+    }
+    {
+        EthernetII pkt = EthernetII() / IP("1.1.1.1") / TCP(81, 1000) / 
+                         RawPDU(vector<uint8_t>(100));
+        MatchSet matches = classify(pkt);
+        EXPECT_FALSE(matches.test(id));
+        EXPECT_TRUE(matches.test(big_id));
+    }
+}
+
+TEST_F(PacketClassifierTest, SharedFilterExpression) {
+    Rule web;
+    web.set_dport(80);
+    web.set_filter("greater 100");
+    Rule any_port;
+    any_port.set_filter("greater 100");
+    PacketClassifier::rule_id web_id = classifier.add_rule(web);
+    PacketClassifier::rule_id any_id = classifier.add_rule(any_port);
+
+    EthernetII big = EthernetII() / IP("1.1.1.1") / TCP(80, 1000) / 
+                     RawPDU(vector<uint8_t>(100));
+    MatchSet matches = classify(big);
+    EXPECT_TRUE(matches.test(web_id));
+    EXPECT_TRUE(matches.test(any_id));
+
+    EthernetII small = EthernetII() / IP("1.1.1.1") / TCP(80, 1000);
+    EXPECT_FALSE(classify(small).any());
+}
+
+TEST_F(PacketClassifierTest, AddRuleAfterClassifying) {
+    Rule web;
+    web.set_dport(80);
+    PacketClassifier::rule_id web_id = classifier.add_rule(web);
+    EthernetII pkt = EthernetII() / IP("1.1.1.1") / TCP(80, 1000);
+    EXPECT_EQ(vector<PacketClassifier::rule_id>(1, web_id), classify(pkt).ids());
+
+    Rule source;
+    source.set_sport(1000);
+    PacketClassifier::rule_id source_id = classifier.add_rule(source);
+    MatchSet matches = classify(pkt);
+    EXPECT_EQ(2U, matches.count());
+    EXPECT_TRUE(matches.test(source_id));
+}
+
+TEST_F(PacketClassifierTest, InvalidFilterExpression) {
+    Rule rule;
+    rule.set_filter("not a valid filter");
+    EXPECT_THROW(classifier.add_rule(rule), invalid_pcap_filter);
+}
+
+TEST_F(PacketClassifierTest, ClassifyPDU) {
+    Rule web;
+    web.set_protocol(Constants::IP::PROTO_TCP);
+    web.set_dport(80);
+    web.set_dst_addr(IPv4Address("192.168.0.0") / 16);
+    Rule filtered;
+    filtered.set_filter("tcp and dst port 80");
+    PacketClassifier::rule_id web_id = classifier.add_rule(web);
+    PacketClassifier::rule_id filtered_id = classifier.add_rule(filtered);
+
+    MatchSet matches;
+    {
+        EthernetII pkt = EthernetII() / IP("192.168.3.4") / TCP(80, 1000);
+        classifier.classify(pkt, matches);
+        EXPECT_TRUE(matches.test(web_id));
+        EXPECT_TRUE(matches.test(filtered_id));
+    }
+    {
+        EthernetII pkt = EthernetII() / IP("192.169.3.4") / UDP(80, 1000);
+        classifier.classify(pkt, matches);
+        EXPECT_FALSE(matches.any());
+    }
+}
+
+TEST_F(PacketClassifierTest, ManyRules) {
+    // One rule per destination port, spread over several bitset words
+    vector<Rule> rules;
+    for (uint16_t port = 1000; port < 1200; ++port) {
+        Rule rule;
+        rule.set_dport(port);
+        rules.push_back(rule);
+    }
+    Rule range;
+    range.set_dport(1100, 1149);
+    rules.push_back(range);
+    classifier.add_rules(rules);
+    EXPECT_EQ(201U, classifier.rule_count());
+
+    MatchSet matches;
+    for (uint16_t port = 990; port < 1210; ++port) {
+        EthernetII pkt = EthernetII() / IP("1.1.1.1") / UDP(port, 5);
+        PDU::serialization_type buffer = pkt.serialize();
+        classifier.classify(&buffer[0], buffer.size(), matches);
+        vector<PacketClassifier::rule_id> expected;
+        if (port >= 1000 && port < 1200) {
+            expected.push_back(port - 1000);
+        }
+        if (port >= 1100 && port < 1150) {
+            expected.push_back(200);
+        }
+        EXPECT_EQ(expected, matches.ids());
+    }
+}
+
+TEST_F(PacketClassifierTest, TranslatedFilterExpression) {
+    Rule web;
+    web.set_filter("tcp and dst port 80");
+    Rule dns;
+    dns.set_filter("port 53 and udp");
+    Rule local;
+    local.set_filter("ip and net 10.0.0.0/8");
+    Rule arp;
+    arp.set_filter("ether proto 0x0806");
+    PacketClassifier::rule_id web_id = classifier.add_rule(web);
+    PacketClassifier::rule_id dns_id = classifier.add_rule(dns);
+    PacketClassifier::rule_id local_id = classifier.add_rule(local);
+    PacketClassifier::rule_id arp_id = classifier.add_rule(arp);
+
+    {
+        EthernetII pkt = EthernetII() / IP("1.1.1.1") / TCP(80, 1000);
+        EXPECT_EQ(vector<PacketClassifier::rule_id>(1, web_id), classify(pkt).ids());
+    }
+    {
+        EthernetII pkt = EthernetII() / IP("1.1.1.1") / TCP(1000, 80);
+        EXPECT_FALSE(classify(pkt).any());
+    }
+    // Either direction matches "port" and "net"
+    {
+        EthernetII pkt = EthernetII() / IP("1.1.1.1", "10.1.2.3") / UDP(5000, 53);
+        MatchSet matches = classify(pkt);
+        EXPECT_TRUE(matches.test(dns_id));
+        EXPECT_TRUE(matches.test(local_id));
+        EXPECT_FALSE(matches.test(web_id));
+    }
+    {
+        EthernetII pkt = EthernetII() / IP("10.1.2.3", "1.1.1.1") / UDP(53, 5000);
+        MatchSet matches = classify(pkt);
+        EXPECT_TRUE(matches.test(dns_id));
+        EXPECT_TRUE(matches.test(local_id));
+    }
+    {
+        EthernetII pkt = EthernetII() / IPv6("::1", "::2") / UDP(53, 5000);
+        EXPECT_EQ(vector<PacketClassifier::rule_id>(1, dns_id), classify(pkt).ids());
+    }
+    {
+        EthernetII pkt = EthernetII() / ARP();
+        EXPECT_EQ(vector<PacketClassifier::rule_id>(1, arp_id), classify(pkt).ids());
+    }
+}
+
+TEST_F(PacketClassifierTest, TranslatedFilterExpressionVLANTagged) {
+    // pcap doesn't look past the VLAN tag, so neither should the classifier
+    Rule web;
+    web.set_filter("tcp port 80");
+    PacketClassifier::rule_id web_id = classifier.add_rule(web);
+    EthernetII tagged = EthernetII() / Dot1Q(10) / IP("1.1.1.1") / TCP(80, 1000);
+    EXPECT_FALSE(classify(tagged).test(web_id));
+    EthernetII untagged = EthernetII() / IP("1.1.1.1") / TCP(80, 1000);
+    EXPECT_TRUE(classify(untagged).test(web_id));
+}
+
+TEST_F(PacketClassifierTest, TranslatedFilterExpressionClassifyPDU) {
+    Rule web;
+    web.set_filter("tcp port 80");
+    Rule big;
+    big.set_filter("greater 100");
+    classifier.add_rule(web);
+    classifier.add_rule(big);
+
+    EthernetII packets[] = {
+        EthernetII() / IP("1.1.1.1") / TCP(80, 1000),
+        EthernetII() / Dot1Q(10) / IP("1.1.1.1") / TCP(80, 1000),
+        EthernetII() / IPv6("::1", "::2") / TCP(1000, 80) / RawPDU(vector<uint8_t>(100)),
+        EthernetII() / IP("1.1.1.1") / UDP(80, 1000)
+    };
+    MatchSet from_pdu;
+    for (size_t i = 0; i < sizeof(packets) / sizeof(packets[0]); ++i) {
+        classifier.classify(packets[i], from_pdu);
+        EXPECT_EQ(classify(packets[i]).words(), from_pdu.words());
+    }
+}
+
+TEST_F(PacketClassifierTest, ManyTranslatedPortRules) {
+    vector<Rule> rules;
+    for (uint16_t port = 1000; port < 1200; ++port) {
+        Rule rule;
+        rule.set_filter("udp and dst port " + std::to_string(port));
+        rules.push_back(rule);
+    }
+    classifier.add_rules(rules);
+
+    MatchSet matches;
+    for (uint16_t port = 990; port < 1210; ++port) {
+        EthernetII pkt = EthernetII() / IP("1.1.1.1") / UDP(port, 5);
+        PDU::serialization_type buffer = pkt.serialize();
+        classifier.classify(&buffer[0], buffer.size(), matches);
+        vector<PacketClassifier::rule_id> expected;
+        if (port >= 1000 && port < 1200) {
+            expected.push_back(port - 1000);
+        }
+        EXPECT_EQ(expected, matches.ids());
+    }
+}
+
+#endif // TINS_HAVE_PCAP && TINS_IS_CXX11
@@ -0,0 +1,147 @@
+#include <gtest/gtest.h>
+#include <vector>
+#include <stdint.h>
+#include <tins/packet_rewriter.h>
+#include <tins/ethernetII.h>
+#include <tins/ip.h>
+#include <tins/ipv6.h>
+#include <tins/tcp.h>
+#include <tins/udp.h>
+#include <tins/rawpdu.h>
+#include <tins/exceptions.h>
+#include <tins/endianness.h>
+#include <tins/utils/checksum_utils.h>
+
+using namespace Tins;
+
+class PacketRewriterTest : public testing::Test {
+public:
+    typedef PDU::serialization_type buffer_type;
+
+    static RawPDU payload(size_t size) {
+        std::vector<uint8_t> data(size);
+        for (size_t i = 0; i < data.size(); ++i) {
+            data[i] = static_cast<uint8_t>(i * 7 + 3);
+        }
+        return RawPDU(data.begin(), data.end());
+    }
+};
+
+TEST_F(PacketRewriterTest, UpdateChecksum) {
+    uint8_t data[] = { 0x45, 0x00, 0x12, 0x34, 0xab, 0xcd, 0x00, 0x01 };
+    const uint16_t checksum = ~Endian::be_to_host(Utils::sum_range(data, data + sizeof(data)));
+    const uint8_t new_value[] = { 0xde, 0xad, 0xbe, 0xef };
+    const uint16_t updated = Utils::update_checksum(checksum, data + 2, new_value, 4);
+    std::copy(new_value, new_value + 4, data + 2);
+    EXPECT_EQ(
+        static_cast<uint16_t>(~Endian::be_to_host(Utils::sum_range(data, data + sizeof(data)))),
+        updated
+    );
+}
+
+TEST_F(PacketRewriterTest, RewriteBufferTCP) {
+    EthernetII original = EthernetII() / IP("192.168.0.1", "10.0.0.1") / 
+                          TCP(80, 1234) / payload(1001);
+    EthernetII expected = EthernetII() / IP("172.16.5.4", "10.9.8.7") / 
+                          TCP(8080, 4321) / payload(1001);
+    original.rfind_pdu<IP>().ttl(64);
+    expected.rfind_pdu<IP>().ttl(12);
+    buffer_type buffer = original.serialize();
+    const buffer_type expected_buffer = expected.serialize();
+
+    PacketRewriter rewriter(&buffer[0], buffer.size());
+    rewriter.src_addr(IPv4Address("10.9.8.7"));
+    rewriter.dst_addr(IPv4Address("172.16.5.4"));
+    rewriter.sport(4321);
+    rewriter.dport(8080);
+    rewriter.ttl(12);
+    EXPECT_EQ(expected_buffer, buffer);
+}
+
+TEST_F(PacketRewriterTest, RewriteBufferUDP) {
+    IP original = IP("192.168.0.1", "10.0.0.1") / UDP(53, 1234) / payload(100);
+    IP expected = IP("192.168.0.1", "10.0.0.2") / UDP(53, 1000) / payload(100);
+    buffer_type buffer = original.serialize();
+    const buffer_type expected_buffer = expected.serialize();
+
+    PacketRewriter rewriter(&buffer[0], buffer.size(), PDU::IP);
+    rewriter.src_addr(IPv4Address("10.0.0.2"));
+    rewriter.sport(1000);
+    EXPECT_EQ(expected_buffer, buffer);
+}
+
+TEST_F(PacketRewriterTest, RewriteBufferUDPWithoutChecksum) {
+    IP packet = IP("192.168.0.1", "10.0.0.1") / UDP(53, 1234) / payload(10);
+    buffer_type buffer = packet.serialize();
+    // Clear the UDP checksum
+    buffer[20 + 6] = buffer[20 + 7] = 0;
+    PacketRewriter rewriter(&buffer[0], buffer.size(), PDU::IP);
+    rewriter.src_addr(IPv4Address("10.0.0.2"));
+    EXPECT_EQ(0, buffer[20 + 6]);
+    EXPECT_EQ(0, buffer[20 + 7]);
+    EXPECT_EQ(IPv4Address("10.0.0.2"), IP(&buffer[0], buffer.size()).src_addr());
+}
+
+TEST_F(PacketRewriterTest, RewriteBufferIPv6) {
+    EthernetII original = EthernetII() / IPv6("2001:db8::1", "fe80::1") / 
+                          TCP(80, 1234) / payload(77);
+    EthernetII expected = EthernetII() / IPv6("2001:db8::99", "fe80::abcd:1") / 
+                          TCP(80, 1234) / payload(77);
+    original.rfind_pdu<IPv6>().hop_limit(10);
+    expected.rfind_pdu<IPv6>().hop_limit(9);
+    buffer_type buffer = original.serialize();
+    const buffer_type expected_buffer = expected.serialize();
+
+    PacketRewriter rewriter(&buffer[0], buffer.size());
+    rewriter.src_addr(IPv6Address("fe80::abcd:1"));
+    rewriter.dst_addr(IPv6Address("2001:db8::99"));
+    rewriter.ttl(9);
+    EXPECT_EQ(expected_buffer, buffer);
+}
+
+TEST_F(PacketRewriterTest, RewritePDU) {
+    EthernetII original = EthernetII() / IP("192.168.0.1", "10.0.0.1") / 
+                          TCP(80, 1234) / payload(500);
+    EthernetII expected = EthernetII() / IP("192.168.0.1", "10.2.3.4") / 
+                          TCP(80, 9999) / payload(500);
+    original.rfind_pdu<IP>().ttl(64);
+    expected.rfind_pdu<IP>().ttl(63);
+    const buffer_type buffer = original.serialize();
+    const buffer_type expected_buffer = expected.serialize();
+
+    EthernetII packet(&buffer[0], buffer.size());
+    PacketRewriter rewriter(packet);
+    rewriter.src_addr(IPv4Address("10.2.3.4"));
+    rewriter.sport(9999);
+    rewriter.ttl(63);
+    EXPECT_EQ(expected.rfind_pdu<TCP>().checksum(), packet.rfind_pdu<TCP>().checksum());
+    EXPECT_EQ(expected.rfind_pdu<IP>().checksum(), packet.rfind_pdu<IP>().checksum());
+    EXPECT_EQ(expected_buffer, packet.serialize());
+}
+
+TEST_F(PacketRewriterTest, RewritePDUUDP) {
+    EthernetII original = EthernetII() / IPv6("2001:db8::1", "fe80::1") / 
+                          UDP(53, 1234) / payload(33);
+    EthernetII expected = EthernetII() / IPv6("2001:db8::2", "fe80::1") / 
+                          UDP(5353, 1234) / payload(33);
+    const buffer_type buffer = original.serialize();
+    const buffer_type expected_buffer = expected.serialize();
+
+    EthernetII packet(&buffer[0], buffer.size());
+    PacketRewriter rewriter(packet);
+    rewriter.dst_addr(IPv6Address("2001:db8::2"));
+    rewriter.dport(5353);
+    EXPECT_EQ(expected_buffer, packet.serialize());
+}
+
+TEST_F(PacketRewriterTest, MissingLayers) {
+    EthernetII packet = EthernetII() / IP() / payload(10);
+    PacketRewriter rewriter(packet);
+    EXPECT_THROW(rewriter.sport(1), pdu_not_found);
+    EXPECT_THROW(rewriter.src_addr(IPv6Address("::1")), pdu_not_found);
+
+    buffer_type buffer = EthernetII().serialize();
+    PacketRewriter buffer_rewriter(&buffer[0], buffer.size());
+    EXPECT_THROW(buffer_rewriter.ttl(1), pdu_not_found);
+    EXPECT_THROW(buffer_rewriter.dst_addr(IPv4Address("1.2.3.4")), pdu_not_found);
+}
@@ -0,0 +1,430 @@
+#include <gtest/gtest.h>
+#include <vector>
+#include <memory>
+#include <stdexcept>
+#include <sstream>
+#include <string>
+#include <algorithm>
+#include <cerrno>
+#include <tins/packet_sender.h>
+#include <tins/ethernetII.h>
+#include <tins/ip.h>
+#include <tins/udp.h>
+#include <tins/icmp.h>
+#include <tins/rawpdu.h>
+#include <tins/exceptions.h>
+
+#ifdef TINS_HAVE_SENDMMSG
+
+#include <unistd.h>
+#include <net/if.h>
+#include <sys/time.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <linux/if_packet.h>
+#include <linux/if_ether.h>
+
+using std::vector;
+
+using namespace Tins;
+
+class PacketSenderTest : public testing::Test {
+public:
+    PacketSenderTest();
+    ~PacketSenderTest();
+
+    size_t receive_all();
+
+    EthernetII make_packet(size_t payload_size) const;
+
+    int receiver;
+    // Every test uses its own port, as other tests send through the 
+    // loopback device concurrently
+    uint16_t dport;
+    vector<uint8_t> marker;
+};
+
+// Frames sent through the loopback device are seen by packet sockets bound
+// to it, so they're used to count the packets that were actually sent
+PacketSenderTest::PacketSenderTest()
+: receiver(socket(AF_PACKET, SOCK_RAW, htons(ETH_P_ALL))), dport(0) {
+    // Payloads start with the test's name and our pid, so only frames sent 
+    // by this test are counted
+    std::ostringstream oss;
+    oss << "packet_sender:" 
+        << testing::UnitTest::GetInstance()->current_test_info()->name()
+        << ":" << getpid();
+    const std::string marker_string = oss.str();
+    marker.assign(marker_string.begin(), marker_string.end());
+    if (receiver == -1) {
+        return;
+    }
+    struct sockaddr_ll address = sockaddr_ll();
+    address.sll_family = AF_PACKET;
+    address.sll_protocol = htons(ETH_P_ALL);
+    address.sll_ifindex = if_nametoindex("lo");
+    if (bind(receiver, (struct sockaddr*)&address, sizeof(address)) != 0) {
+        close(receiver);
+        receiver = -1;
+        return;
+    }
+    struct timeval timeout = { 0, 200000 };
+    setsockopt(receiver, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+}
+
+PacketSenderTest::~PacketSenderTest() {
+    if (receiver != -1) {
+        close(receiver);
+    }
+}
+
+size_t PacketSenderTest::receive_all() {
+    size_t count = 0;
+    vector<uint8_t> buffer(2048);
+    struct sockaddr_ll address;
+    socklen_t address_size = sizeof(address);
+    ssize_t size;
+    while ((size = recvfrom(receiver, &buffer[0], buffer.size(), 0, 
+                            (struct sockaddr*)&address, &address_size)) >= 0) {
+        address_size = sizeof(address);
+        // Looped back frames are seen again as incoming ones
+        if (address.sll_pkttype != PACKET_OUTGOING) {
+            continue;
+        }
+        try {
+            EthernetII packet(&buffer[0], static_cast<uint32_t>(size));
+            const UDP* udp = packet.find_pdu<UDP>();
+            const RawPDU* raw = packet.find_pdu<RawPDU>();
+            if (!udp || udp->dport() != dport || !raw) {
+                continue;
+            }
+            const RawPDU::payload_type& payload = raw->payload();
+            if (payload.size() >= marker.size() &&
+                std::equal(marker.begin(), marker.end(), payload.begin())) {
+                count++;
+            }
+        }
+        catch (malformed_packet&) {
+        }
+    }
+    return count;
+}
+
+EthernetII PacketSenderTest::make_packet(size_t payload_size) const {
+    vector<uint8_t> payload(marker);
+    payload.resize(std::max(payload_size, marker.size()), 0x2a);
+    return EthernetII() / IP("127.0.0.1", "127.0.0.1") / UDP(dport, 1234) /
+           RawPDU(payload);
+}
+
+TEST_F(PacketSenderTest, SendBatch) {
+    dport = 49201;
+    if (receiver == -1) {
+        // No privileges to open packet sockets
+        return;
+    }
+    vector<EthernetII> packets(5, make_packet(100));
+    try {
+        PacketSender sender("lo");
+        vector<int> errors;
+        EXPECT_EQ(5U, sender.send_batch(packets.begin(), packets.end(), errors));
+        EXPECT_EQ(vector<int>(5, 0), errors);
+        EXPECT_EQ(5U, receive_all());
+
+        // Buffers are reused by the following batch
+        EXPECT_EQ(2U, sender.send_batch(packets.begin(), packets.begin() + 2));
+        EXPECT_EQ(2U, receive_all());
+    }
+    catch (socket_open_error&) {
+        // No privileges to open packet sockets
+    }
+}
+
+TEST_F(PacketSenderTest, PartialSend) {
+    dport = 49202;
+    if (receiver == -1) {
+        // No privileges to open packet sockets
+        return;
+    }
+    vector<EthernetII> packets;
+    packets.push_back(make_packet(100));
+    // Larger than the loopback device's MTU
+    packets.push_back(make_packet(66000));
+    packets.push_back(make_packet(100));
+    packets.push_back(make_packet(100));
+    try {
+        PacketSender sender("lo");
+        vector<int> errors;
+        // The oversized packet fails while the rest are still sent
+        EXPECT_EQ(3U, sender.send_batch(packets.begin(), packets.end(), errors));
+        ASSERT_EQ(4U, errors.size());
+        EXPECT_EQ(0, errors[0]);
+        EXPECT_EQ(EMSGSIZE, errors[1]);
+        EXPECT_EQ(0, errors[2]);
+        EXPECT_EQ(0, errors[3]);
+        EXPECT_EQ(3U, receive_all());
+    }
+    catch (socket_open_error&) {
+        // No privileges to open packet sockets
+    }
+}
+
+// A PDU that always fails to be sent
+class UnsendablePDU : public RawPDU {
+public:
+    UnsendablePDU() : RawPDU("unsendable") { }
+
+    UnsendablePDU* clone() const {
+        return new UnsendablePDU(*this);
+    }
+
+    void send(PacketSender&, const NetworkInterface&) {
+        throw serialization_error();
+    }
+};
+
+TEST_F(PacketSenderTest, SendBatchThrowingPDU) {
+    dport = 49207;
+    if (receiver == -1) {
+        // No privileges to open packet sockets
+        return;
+    }
+    EthernetII first = make_packet(100);
+    EthernetII last = make_packet(100);
+    UnsendablePDU unsendable;
+    vector<PDU*> packets;
+    packets.push_back(&first);
+    packets.push_back(&unsendable);
+    packets.push_back(&last);
+    try {
+        PacketSender sender("lo");
+        vector<int> errors;
+        // The packet that throws is reported while the rest are still sent
+        EXPECT_EQ(2U, sender.send_batch(packets.begin(), packets.end(), errors));
+        ASSERT_EQ(3U, errors.size());
+        EXPECT_EQ(0, errors[0]);
+        EXPECT_EQ(EINVAL, errors[1]);
+        EXPECT_EQ(0, errors[2]);
+        EXPECT_EQ(2U, receive_all());
+    }
+    catch (socket_open_error&) {
+        // No privileges to open packet sockets
+    }
+}
+
+#ifdef TINS_HAVE_PACKET_RING
+
+TEST_F(PacketSenderTest, TxRingSetupAndTeardown) {
+    dport = 49203;
+    if (receiver == -1) {
+        // No privileges to open packet sockets
+        return;
+    }
+    EthernetII packet = make_packet(100);
+    try {
+        PacketSender sender("lo");
+        sender.enable_tx_ring();
+        EXPECT_TRUE(sender.tx_ring_enabled());
+        sender.send(packet);
+        sender.send(packet);
+        EXPECT_EQ(2U, receive_all());
+
+        // Packets go through the raw socket again
+        sender.disable_tx_ring();
+        EXPECT_FALSE(sender.tx_ring_enabled());
+        sender.send(packet);
+        EXPECT_EQ(1U, receive_all());
+
+        // Rings can be set up again after being closed
+        sender.enable_tx_ring();
+        sender.send(packet);
+        EXPECT_EQ(1U, receive_all());
+    }
+    catch (socket_open_error&) {
+        // No privileges to open packet sockets
+    }
+}
+
+TEST_F(PacketSenderTest, TxRingInvalidGeometry) {
+    TxRingConfiguration configuration;
+    configuration.set_frame_size(100);
+    PacketSender sender("lo");
+    // Reported when enabling the rings, before anything is sent
+    EXPECT_THROW(sender.enable_tx_ring(configuration), invalid_ring_configuration);
+    EXPECT_FALSE(sender.tx_ring_enabled());
+    configuration.set_frame_size(2048);
+    configuration.set_frame_count(0);
+    EXPECT_THROW(sender.enable_tx_ring(configuration), invalid_ring_configuration);
+}
+
+TEST_F(PacketSenderTest, TxRingBatch) {
+    dport = 49205;
+    if (receiver == -1) {
+        // No privileges to open packet sockets
+        return;
+    }
+    vector<EthernetII> packets;
+    packets.push_back(make_packet(100));
+    // Larger than the ring's frames
+    packets.push_back(make_packet(4000));
+    packets.push_back(make_packet(100));
+    try {
+        PacketSender sender("lo");
+        TxRingConfiguration configuration;
+        configuration.set_frame_count(8);
+        sender.enable_tx_ring(configuration);
+        vector<int> errors;
+        EXPECT_EQ(2U, sender.send_batch(packets.begin(), packets.end(), errors));
+        ASSERT_EQ(3U, errors.size());
+        EXPECT_EQ(0, errors[0]);
+        EXPECT_EQ(EMSGSIZE, errors[1]);
+        EXPECT_EQ(0, errors[2]);
+        EXPECT_EQ(2U, receive_all());
+
+        // More packets than frames in the ring
+        vector<EthernetII> many(20, make_packet(100));
+        EXPECT_EQ(20U, sender.send_batch(many.begin(), many.end()));
+        EXPECT_EQ(20U, receive_all());
+
+        // A packet that throws doesn't keep the frames written before it 
+        // from being sent
+        UnsendablePDU unsendable;
+        vector<PDU*> mixed;
+        mixed.push_back(&packets[0]);
+        mixed.push_back(&unsendable);
+        mixed.push_back(&packets[2]);
+        EXPECT_EQ(2U, sender.send_batch(mixed.begin(), mixed.end(), errors));
+        EXPECT_EQ(EINVAL, errors[1]);
+        EXPECT_EQ(2U, receive_all());
+    }
+    catch (socket_open_error&) {
+        // No privileges to open packet sockets
+    }
+}
+
+TEST_F(PacketSenderTest, TxRingReceivesResponses) {
+    dport = 49206;
+    if (receiver == -1) {
+        // No privileges to open packet sockets
+        return;
+    }
+    EthernetII packet = make_packet(100);
+    try {
+        PacketSender sender("lo", 0, 100000);
+        sender.enable_tx_ring();
+        // Nothing answers, but listening for the response must not fail
+        std::unique_ptr<PDU> response(sender.send_recv(packet));
+        EXPECT_TRUE(response.get() == 0);
+        EXPECT_EQ(1U, receive_all());
+    }
+    catch (socket_open_error&) {
+        // No privileges to open packet sockets
+    }
+}
+
+#endif // TINS_HAVE_PACKET_RING
+
+#endif // TINS_HAVE_SENDMMSG
+
+#ifdef TINS_HAVE_EPOLL
+
+#include <unistd.h>
+#include <sys/resource.h>
+
+using std::vector;
+
+using namespace Tins;
+
+class PacketSenderRecvTest : public testing::Test {
+public:
+    static IP make_echo_request(uint16_t id);
+};
+
+IP PacketSenderRecvTest::make_echo_request(uint16_t id) {
+    ICMP icmp(ICMP::ECHO_REQUEST);
+    icmp.id(id);
+    return IP("127.0.0.1", "127.0.0.1") / icmp;
+}
+
+TEST_F(PacketSenderRecvTest, EchoResponse) {
+    IP request = make_echo_request(1234);
+    try {
+        PacketSender sender("lo", 1);
+        // The second call reuses the epoll set created by the first one
+        for (int i = 0; i < 2; ++i) {
+            std::unique_ptr<PDU> response(sender.send_recv(request));
+            ASSERT_TRUE(response.get() != 0);
+            const ICMP& icmp = response->rfind_pdu<ICMP>();
+            EXPECT_EQ(ICMP::ECHO_REPLY, icmp.type());
+            EXPECT_EQ(1234, icmp.id());
+        }
+    }
+    catch (socket_open_error&) {
+        // No privileges to open raw sockets
+    }
+}
+
+TEST_F(PacketSenderRecvTest, ICMPErrorResponse) {
+    // Nothing listens on this port, so an ICMP error is sent back. Its 
+    // source address is ours, so it has to bypass the address check
+    IP request = IP("127.0.0.1", "127.0.0.1") / UDP(9, 4321) / RawPDU("foo");
+    try {
+        PacketSender sender("lo", 1);
+        // The ICMP socket is otherwise only opened after the request is sent
+        IP echo = make_echo_request(1);
+        sender.send(echo);
+        std::unique_ptr<PDU> response(sender.send_recv(request));
+        ASSERT_TRUE(response.get() != 0);
+        const ICMP* icmp = response->find_pdu<ICMP>();
+        ASSERT_TRUE(icmp != 0);
+        EXPECT_EQ(ICMP::DEST_UNREACHABLE, icmp->type());
+    }
+    catch (socket_open_error&) {
+        // No privileges to open raw sockets
+    }
+}
+
+TEST_F(PacketSenderRecvTest, NoResponse) {
+    ICMP icmp(ICMP::ECHO_REPLY);
+    IP request = IP("127.0.0.1", "127.0.0.1") / icmp;
+    try {
+        PacketSender sender("lo", 0, 200000);
+        std::unique_ptr<PDU> response(sender.send_recv(request));
+        EXPECT_TRUE(response.get() == 0);
+    }
+    catch (socket_open_error&) {
+        // No privileges to open raw sockets
+    }
+}
+
+TEST_F(PacketSenderRecvTest, SelectFallback) {
+    IP request = make_echo_request(4321);
+    try {
+        PacketSender sender("lo", 1);
+        // Open the sockets used to receive the response beforehand
+        sender.send(request);
+        // Use up every descriptor, so the epoll set can't be created
+        struct rlimit original;
+        ASSERT_EQ(0, getrlimit(RLIMIT_NOFILE, &original));
+        struct rlimit limit = original;
+        limit.rlim_cur = 64;
+        ASSERT_EQ(0, setrlimit(RLIMIT_NOFILE, &limit));
+        vector<int> descriptors;
+        int descriptor;
+        while ((descriptor = dup(0)) != -1) {
+            descriptors.push_back(descriptor);
+        }
+        std::unique_ptr<PDU> response(sender.send_recv(request));
+        for (size_t i = 0; i < descriptors.size(); ++i) {
+            close(descriptors[i]);
+        }
+        setrlimit(RLIMIT_NOFILE, &original);
+        ASSERT_TRUE(response.get() != 0);
+        EXPECT_EQ(4321, response->rfind_pdu<ICMP>().id());
+    }
+    catch (socket_open_error&) {
+        // No privileges to open raw sockets
+    }
+}
+
+#endif // TINS_HAVE_EPOLL
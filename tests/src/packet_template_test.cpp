@@ -0,0 +1,165 @@
+#include <gtest/gtest.h>
+#include <vector>
+#include <stdexcept>
+#include <stdint.h>
+#include <tins/packet_template.h>
+#include <tins/ethernetII.h>
+#include <tins/ip.h>
+#include <tins/ipv6.h>
+#include <tins/tcp.h>
+#include <tins/udp.h>
+#include <tins/rawpdu.h>
+#include <tins/exceptions.h>
+#include <tins/endianness.h>
+
+using namespace Tins;
+
+class PacketTemplateTest : public testing::Test {
+public:
+    typedef PDU::serialization_type buffer_type;
+
+    static buffer_type payload(size_t size) {
+        buffer_type data(size);
+        for (size_t i = 0; i < data.size(); ++i) {
+            data[i] = static_cast<uint8_t>(i * 7 + 3);
+        }
+        return data;
+    }
+
+    static buffer_type template_buffer(const PacketTemplate& packet_template) {
+        return buffer_type(packet_template.data(), 
+                           packet_template.data() + packet_template.size());
+    }
+};
+
+TEST_F(PacketTemplateTest, Unmodified) {
+    const buffer_type data = payload(100);
+    EthernetII packet = EthernetII() / IP("10.0.0.2", "10.0.0.1") / TCP(80, 1234) /
+                        RawPDU(data.begin(), data.end());
+    PacketTemplate packet_template(packet);
+    EXPECT_EQ(packet.serialize(), template_buffer(packet_template));
+}
+
+TEST_F(PacketTemplateTest, IPv4TCPFields) {
+    const buffer_type data = payload(333);
+    EthernetII packet = EthernetII() / IP("10.0.0.2", "10.0.0.1") / TCP(80, 1234) /
+                        RawPDU(data.begin(), data.end());
+    PacketTemplate packet_template(packet);
+    const PacketTemplate::field_id src_addr = packet_template.add_field(PacketTemplate::SRC_ADDR);
+    const PacketTemplate::field_id dst_addr = packet_template.add_field(PacketTemplate::DST_ADDR);
+    const PacketTemplate::field_id id = packet_template.add_field(PacketTemplate::IP_ID);
+    const PacketTemplate::field_id sport = packet_template.add_field(PacketTemplate::SPORT);
+    const PacketTemplate::field_id dport = packet_template.add_field(PacketTemplate::DPORT);
+    const PacketTemplate::field_id seq = packet_template.add_field(PacketTemplate::SEQ);
+    const PacketTemplate::field_id ack_seq = packet_template.add_field(PacketTemplate::ACK_SEQ);
+    EXPECT_EQ(4U, packet_template.field_size(src_addr));
+    EXPECT_EQ(2U, packet_template.field_size(sport));
+    EXPECT_EQ(4U, packet_template.field_size(seq));
+
+    for (uint32_t i = 0; i < 16; ++i) {
+        // 192.168.1.x and 172.16.200.x
+        const IPv4Address src(Endian::host_to_be<uint32_t>(0xc0a80100 + i * 13));
+        const IPv4Address dst(Endian::host_to_be<uint32_t>(0xac10c8ff - i));
+        packet_template.set(src_addr, src);
+        packet_template.set(dst_addr, dst);
+        packet_template.set(id, 0xfff0 + i);
+        packet_template.set(sport, 1024 + i * 4099);
+        packet_template.set(dport, 65535 - i);
+        packet_template.set(seq, 0xfffffff0 + i * 3);
+        packet_template.set(ack_seq, i * 0x01010101);
+
+        EthernetII expected = EthernetII() / IP(dst, src) / TCP(65535 - i, 1024 + i * 4099) /
+                              RawPDU(data.begin(), data.end());
+        expected.rfind_pdu<IP>().id(0xfff0 + i);
+        expected.rfind_pdu<TCP>().seq(0xfffffff0 + i * 3);
+        expected.rfind_pdu<TCP>().ack_seq(i * 0x01010101);
+        EXPECT_EQ(expected.serialize(), template_buffer(packet_template));
+    }
+}
+
+TEST_F(PacketTemplateTest, IPv6UDPFields) {
+    const buffer_type data = payload(101);
+    IPv6 packet = IPv6("2001:db8::2", "2001:db8::1") / UDP(53, 4000) / 
+                  RawPDU(data.begin(), data.end());
+    PacketTemplate packet_template(packet);
+    const PacketTemplate::field_id src_addr = packet_template.add_field(PacketTemplate::SRC_ADDR);
+    const PacketTemplate::field_id dport = packet_template.add_field(PacketTemplate::DPORT);
+    EXPECT_EQ(16U, packet_template.field_size(src_addr));
+
+    const IPv6Address src("fe80::1234:5678:9abc:def0");
+    packet_template.set(src_addr, src);
+    packet_template.set(dport, 5353);
+
+    IPv6 expected = IPv6("2001:db8::2", src) / UDP(5353, 4000) / 
+                    RawPDU(data.begin(), data.end());
+    EXPECT_EQ(expected.serialize(), template_buffer(packet_template));
+}
+
+TEST_F(PacketTemplateTest, PayloadFields) {
+    buffer_type data = payload(101);
+    EthernetII packet = EthernetII() / IP("10.0.0.2", "10.0.0.1") / UDP(53, 4000) /
+                        RawPDU(data.begin(), data.end());
+    PacketTemplate packet_template(packet);
+    // Odd offsets and sizes, including one that ends the payload
+    const PacketTemplate::field_id first = packet_template.add_payload_field(3, 5);
+    const PacketTemplate::field_id second = packet_template.add_payload_field(90, 11);
+    EXPECT_EQ(5U, packet_template.field_size(first));
+
+    const uint8_t first_value[] = { 0xff, 0xfe, 0xfd, 0xfc, 0xfb };
+    const buffer_type second_value(11, 0xee);
+    packet_template.set(first, first_value);
+    packet_template.set(second, &second_value[0]);
+    std::copy(first_value, first_value + sizeof(first_value), data.begin() + 3);
+    std::copy(second_value.begin(), second_value.end(), data.begin() + 90);
+
+    EthernetII expected = EthernetII() / IP("10.0.0.2", "10.0.0.1") / UDP(53, 4000) /
+                          RawPDU(data.begin(), data.end());
+    EXPECT_EQ(expected.serialize(), template_buffer(packet_template));
+}
+
+TEST_F(PacketTemplateTest, PayloadFieldBeforeLinkPadding) {
+    buffer_type data = payload(3);
+    EthernetII packet = EthernetII() / IP("10.0.0.2", "10.0.0.1") / TCP(80, 1234) /
+                        RawPDU(data.begin(), data.end());
+    PacketTemplate packet_template(packet);
+    // The frame is padded, the padding isn't part of the TCP checksum
+    EXPECT_EQ(60U, packet_template.size());
+    const PacketTemplate::field_id last = packet_template.add_payload_field(2, 1);
+    const uint8_t value = 0x99;
+    packet_template.set(last, &value);
+    data[2] = value;
+
+    EthernetII expected = EthernetII() / IP("10.0.0.2", "10.0.0.1") / TCP(80, 1234) /
+                          RawPDU(data.begin(), data.end());
+    EXPECT_EQ(expected.serialize(), template_buffer(packet_template));
+}
+
+TEST_F(PacketTemplateTest, MissingLayers) {
+    IP packet = IP("10.0.0.2", "10.0.0.1") / UDP(53, 4000) / RawPDU("hello");
+    PacketTemplate packet_template(packet);
+    EXPECT_THROW(packet_template.add_field(PacketTemplate::SEQ), pdu_not_found);
+    EXPECT_THROW(packet_template.add_payload_field(3, 3), std::runtime_error);
+
+    IPv6 ipv6_packet = IPv6("2001:db8::2") / RawPDU("hello");
+    PacketTemplate ipv6_template(ipv6_packet);
+    EXPECT_THROW(ipv6_template.add_field(PacketTemplate::IP_ID), pdu_not_found);
+    EXPECT_THROW(ipv6_template.add_field(PacketTemplate::SPORT), pdu_not_found);
+    EXPECT_THROW(ipv6_template.add_payload_field(0, 1), pdu_not_found);
+}
+
+TEST_F(PacketTemplateTest, InvalidFieldType) {
+    IP packet = IP("10.0.0.2", "10.0.0.1") / UDP(53, 4000);
+    PacketTemplate packet_template(packet);
+    const PacketTemplate::field_id src_addr = packet_template.add_field(PacketTemplate::SRC_ADDR);
+    EXPECT_THROW(packet_template.set(src_addr, 1234U), std::runtime_error);
+    EXPECT_THROW(packet_template.set(src_addr, IPv6Address("::1")), std::runtime_error);
+    EXPECT_THROW(packet_template.set(src_addr + 1, 1234U), std::runtime_error);
+}
+
+TEST_F(PacketTemplateTest, EmptyPacket) {
+    RawPDU raw((buffer_type()));
+    PacketTemplate packet_template(raw);
+    EXPECT_EQ(0U, packet_template.size());
+    EXPECT_TRUE(packet_template.data() == 0);
+    EXPECT_THROW(packet_template.add_field(PacketTemplate::SPORT), pdu_not_found);
+}
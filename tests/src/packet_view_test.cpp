@@ -0,0 +1,173 @@
+#include <gtest/gtest.h>
+#include <string>
+#include <stdint.h>
+#include <tins/packet_view.h>
+#include <tins/ethernetII.h>
+#include <tins/dot1q.h>
+#include <tins/ip.h>
+#include <tins/ipv6.h>
+#include <tins/tcp.h>
+#include <tins/udp.h>
+#include <tins/sll.h>
+#include <tins/rawpdu.h>
+#include <tins/exceptions.h>
+#include <tins/constants.h>
+
+using namespace std;
+using namespace Tins;
+
+class PacketViewTest : public testing::Test {
+public:
+    
+};
+
+TEST_F(PacketViewTest, DefaultConstructor) {
+    PacketView view;
+    EXPECT_EQ(0U, view.size());
+    EXPECT_FALSE(view.has_ethernet());
+    EXPECT_FALSE(view.has_ip());
+    EXPECT_THROW(view.ip(), pdu_not_found);
+}
+
+TEST_F(PacketViewTest, EthernetIPTCP) {
+    EthernetII eth = EthernetII("00:01:02:03:04:05", "06:07:08:09:0a:0b") / 
+                     IP("192.168.0.1", "10.0.0.1") / TCP(80, 12345) / RawPDU("hello");
+    eth.rfind_pdu<IP>().ttl(32);
+    eth.rfind_pdu<IP>().id(0x1234);
+    eth.rfind_pdu<TCP>().seq(0x01020304);
+    eth.rfind_pdu<TCP>().set_flag(TCP::SYN, 1);
+    PDU::serialization_type buffer = eth.serialize();
+    PacketView view(&buffer[0], static_cast<uint32_t>(buffer.size()));
+
+    ASSERT_TRUE(view.has_ethernet());
+    EXPECT_EQ(HWAddress<6>("00:01:02:03:04:05"), view.ethernet().dst_addr());
+    EXPECT_EQ(HWAddress<6>("06:07:08:09:0a:0b"), view.ethernet().src_addr());
+    EXPECT_EQ(0x0800, view.ethernet().payload_type());
+    EXPECT_FALSE(view.has_dot1q());
+    EXPECT_EQ(0U, view.vlan_count());
+
+    ASSERT_TRUE(view.has_ip());
+    EXPECT_FALSE(view.has_ipv6());
+    EXPECT_EQ(14U, view.network_offset());
+    EXPECT_EQ(IPv4Address("192.168.0.1"), view.ip().dst_addr());
+    EXPECT_EQ(IPv4Address("10.0.0.1"), view.ip().src_addr());
+    EXPECT_EQ(32, view.ip().ttl());
+    EXPECT_EQ(0x1234, view.ip().id());
+    EXPECT_EQ(5, view.ip().head_len());
+    EXPECT_EQ(Constants::IP::PROTO_TCP, view.transport_protocol());
+    EXPECT_FALSE(view.is_fragment());
+
+    ASSERT_TRUE(view.has_tcp());
+    EXPECT_FALSE(view.has_udp());
+    EXPECT_EQ(34U, view.transport_offset());
+    EXPECT_EQ(80, view.tcp().dport());
+    EXPECT_EQ(12345, view.tcp().sport());
+    EXPECT_EQ(0x01020304U, view.tcp().seq());
+    EXPECT_EQ(TCP::SYN, view.tcp().flags());
+
+    ASSERT_EQ(5U, view.payload_size());
+    EXPECT_EQ("hello", string(view.payload(), view.payload() + view.payload_size()));
+}
+
+TEST_F(PacketViewTest, EthernetPaddingIsTrimmed) {
+    EthernetII eth = EthernetII() / IP("1.2.3.4", "4.3.2.1") / UDP(53, 1024);
+    PDU::serialization_type buffer = eth.serialize();
+    // EthernetII pads frames up to 60 bytes
+    ASSERT_EQ(60U, buffer.size());
+    PacketView view(&buffer[0], static_cast<uint32_t>(buffer.size()));
+    ASSERT_TRUE(view.has_udp());
+    EXPECT_EQ(53, view.udp().dport());
+    EXPECT_EQ(1024, view.udp().sport());
+    EXPECT_EQ(8, view.udp().length());
+    EXPECT_EQ(28U, view.network_size());
+    EXPECT_EQ(0U, view.payload_size());
+}
+
+TEST_F(PacketViewTest, StackedDot1Q) {
+    Dot1Q outer(100), inner(200);
+    outer.priority(5);
+    EthernetII eth = EthernetII() / outer / inner / IPv6("::1", "fe80::1") / 
+                     UDP(9000, 9001) / RawPDU("abc");
+    PDU::serialization_type buffer = eth.serialize();
+    PacketView view(&buffer[0], static_cast<uint32_t>(buffer.size()));
+
+    ASSERT_TRUE(view.has_dot1q());
+    EXPECT_EQ(2U, view.vlan_count());
+    EXPECT_EQ(14U, view.dot1q_offset());
+    EXPECT_EQ(100, view.dot1q().id());
+    EXPECT_EQ(5, view.dot1q().priority());
+
+    ASSERT_TRUE(view.has_ipv6());
+    EXPECT_FALSE(view.has_ip());
+    EXPECT_THROW(view.ip(), pdu_not_found);
+    EXPECT_EQ(22U, view.network_offset());
+    EXPECT_EQ(IPv6Address("::1"), view.ipv6().dst_addr());
+    EXPECT_EQ(IPv6Address("fe80::1"), view.ipv6().src_addr());
+
+    ASSERT_TRUE(view.has_udp());
+    EXPECT_EQ(9000, view.udp().dport());
+    EXPECT_EQ(3U, view.payload_size());
+}
+
+TEST_F(PacketViewTest, IPv6ExtensionHeaders) {
+    const uint8_t buffer[] = {
+        // IPv6, payload length 28, next header hop-by-hop
+        96, 0, 0, 0, 0, 28, 0, 64, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+        0, 1, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 2,
+        // Hop-by-hop, next header TCP
+        6, 0, 1, 4, 0, 0, 0, 0,
+        // TCP, sport 5000, dport 443
+        19, 136, 1, 187, 0, 0, 0, 0, 0, 0, 0, 0, 80, 2, 0, 0, 0, 0, 0, 0
+    };
+    PacketView view(buffer, sizeof(buffer), PDU::IPv6);
+    ASSERT_TRUE(view.has_ipv6());
+    EXPECT_EQ(0U, view.network_offset());
+    EXPECT_EQ(Constants::IP::PROTO_HOPOPTS, view.ipv6().next_header());
+    EXPECT_EQ(28, view.ipv6().payload_length());
+    EXPECT_EQ(Constants::IP::PROTO_TCP, view.transport_protocol());
+    ASSERT_TRUE(view.has_tcp());
+    EXPECT_EQ(48U, view.transport_offset());
+    EXPECT_EQ(443, view.tcp().dport());
+    EXPECT_EQ(5000, view.tcp().sport());
+}
+
+TEST_F(PacketViewTest, IPFragment) {
+    IP ip = IP("1.2.3.4", "5.6.7.8") / RawPDU("abcdefgh");
+    ip.protocol(Constants::IP::PROTO_TCP);
+    ip.fragment_offset(8);
+    PDU::serialization_type buffer = ip.serialize();
+    PacketView view(&buffer[0], static_cast<uint32_t>(buffer.size()), PDU::IP);
+    ASSERT_TRUE(view.has_ip());
+    EXPECT_TRUE(view.is_fragment());
+    EXPECT_FALSE(view.has_tcp());
+    EXPECT_EQ(Constants::IP::PROTO_TCP, view.transport_protocol());
+    EXPECT_EQ(8U, view.payload_size());
+}
+
+TEST_F(PacketViewTest, SLL) {
+    SLL sll = SLL() / IP("1.2.3.4", "5.6.7.8") / TCP(22, 1022);
+    PDU::serialization_type buffer = sll.serialize();
+    PacketView view(&buffer[0], static_cast<uint32_t>(buffer.size()), PDU::SLL);
+    EXPECT_FALSE(view.has_ethernet());
+    ASSERT_TRUE(view.has_ip());
+    EXPECT_EQ(16U, view.network_offset());
+    ASSERT_TRUE(view.has_tcp());
+    EXPECT_EQ(22, view.tcp().dport());
+}
+
+TEST_F(PacketViewTest, TruncatedTransportHeader) {
+    EthernetII eth = EthernetII() / IP("1.2.3.4", "5.6.7.8") / TCP(22, 1022);
+    PDU::serialization_type buffer = eth.serialize();
+    PacketView view(&buffer[0], 14 + 20 + 10);
+    EXPECT_TRUE(view.has_ip());
+    EXPECT_FALSE(view.has_tcp());
+    EXPECT_THROW(view.tcp(), pdu_not_found);
+    EXPECT_EQ(10U, view.payload_size());
+}
+
+TEST_F(PacketViewTest, TruncatedEthernetHeader) {
+    const uint8_t buffer[] = { 1, 2, 3, 4, 5, 6, 7, 8, 9, 10 };
+    PacketView view(buffer, sizeof(buffer));
+    EXPECT_FALSE(view.has_ethernet());
+    EXPECT_FALSE(view.has_ip());
+}
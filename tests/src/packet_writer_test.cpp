@@ -0,0 +1,202 @@
+#include <gtest/gtest.h>
+#include <tins/cxxstd.h>
+
+#if TINS_IS_CXX11 && !defined(_WIN32)
+
+#include <string>
+#include <vector>
+#include <cstdio>
+#include <cstring>
+#include <stdexcept>
+#include <stdint.h>
+#include <tins/sniffer.h>
+#include <tins/packet_writer.h>
+#include <tins/ethernetII.h>
+#include <tins/ip.h>
+#include <tins/udp.h>
+#include <tins/rawpdu.h>
+#include <tins/exceptions.h>
+
+// Link layers whose DLT_ values aren't covered by libtins' own types
+struct RawLinkLayer { };
+struct UnknownLinkLayer { };
+
+namespace Tins {
+
+template<>
+struct DataLinkType<RawLinkLayer> {
+    int get_type() const {
+        return DLT_RAW;
+    }
+};
+
+template<>
+struct DataLinkType<UnknownLinkLayer> {
+    int get_type() const {
+        // Not assigned on every platform, so it has no LINKTYPE_ value
+        return 50;
+    }
+};
+
+} // Tins
+
+using namespace std;
+using namespace Tins;
+
+class PacketWriterTest : public testing::Test {
+public:
+    static const char* file_name;
+
+    void TearDown();
+
+    static EthernetII make_packet(uint16_t index, size_t payload_size);
+    static vector<uint16_t> read_packets();
+    static long file_size();
+};
+
+const char* PacketWriterTest::file_name = "packet_writer_test.pcap";
+
+void PacketWriterTest::TearDown() {
+    remove(file_name);
+}
+
+EthernetII PacketWriterTest::make_packet(uint16_t index, size_t payload_size) {
+    return EthernetII() / IP("1.2.3.4", "4.3.2.1") / UDP(index, 1000) / 
+           RawPDU(string(payload_size, 'a'));
+}
+
+vector<uint16_t> PacketWriterTest::read_packets() {
+    vector<uint16_t> output;
+    FileSniffer sniffer(file_name);
+    sniffer.sniff_loop([&](PDU& pdu) {
+        output.push_back(pdu.rfind_pdu<UDP>().dport());
+        return true;
+    });
+    return output;
+}
+
+long PacketWriterTest::file_size() {
+    FILE* fp = fopen(file_name, "rb");
+    EXPECT_TRUE(fp != 0);
+    long output = -1;
+    if (fp) {
+        fseek(fp, 0, SEEK_END);
+        output = ftell(fp);
+        fclose(fp);
+    }
+    return output;
+}
+
+TEST_F(PacketWriterTest, AsyncMatchesSynchronous) {
+    {
+        PacketWriter writer(file_name, DataLinkType<EthernetII>());
+        for (uint16_t i = 0; i < 100; ++i) {
+            EthernetII packet = make_packet(i, i * 10);
+            writer.write(packet);
+        }
+    }
+    const long expected_size = file_size();
+    {
+        PacketWriter writer(file_name, DataLinkType<EthernetII>(), 
+                            AsyncWriterConfiguration());
+        for (uint16_t i = 0; i < 100; ++i) {
+            EthernetII packet = make_packet(i, i * 10);
+            writer.write(packet);
+        }
+    }
+    EXPECT_EQ(expected_size, file_size());
+    vector<uint16_t> packets = read_packets();
+    ASSERT_EQ(100U, packets.size());
+    for (uint16_t i = 0; i < 100; ++i) {
+        EXPECT_EQ(i, packets[i]);
+    }
+}
+
+TEST_F(PacketWriterTest, AsyncFlush) {
+    PacketWriter writer(file_name, DataLinkType<EthernetII>(), AsyncWriterConfiguration());
+    EthernetII packet = make_packet(1, 100);
+    writer.write(packet);
+    writer.flush();
+    EXPECT_EQ(file_size(), static_cast<long>(writer.written_bytes()));
+    EXPECT_EQ(1U, read_packets().size());
+
+    packet = make_packet(2, 100);
+    writer.write(packet);
+    writer.flush();
+    EXPECT_EQ(2U, read_packets().size());
+    EXPECT_EQ(0U, writer.dropped_bytes());
+}
+
+TEST_F(PacketWriterTest, AsyncBlockingDoesntDrop) {
+    AsyncWriterConfiguration config;
+    config.set_buffer_size(128 * 1024);
+    {
+        PacketWriter writer(file_name, DataLinkType<EthernetII>(), config);
+        for (uint16_t i = 0; i < 5000; ++i) {
+            EthernetII packet = make_packet(i, 1000);
+            writer.write(packet);
+        }
+        EXPECT_EQ(0U, writer.dropped_packets());
+    }
+    EXPECT_EQ(5000U, read_packets().size());
+}
+
+TEST_F(PacketWriterTest, AsyncDropPolicies) {
+    const AsyncWriterConfiguration::BackpressurePolicy policies[] = {
+        AsyncWriterConfiguration::DROP_NEWEST,
+        AsyncWriterConfiguration::DROP_OLDEST
+    };
+    for (size_t i = 0; i < 2; ++i) {
+        AsyncWriterConfiguration config;
+        config.set_buffer_size(128 * 1024);
+        config.set_backpressure_policy(policies[i]);
+        uint64_t dropped_packets;
+        uint64_t dropped_bytes;
+        {
+            PacketWriter writer(file_name, DataLinkType<EthernetII>(), config);
+            for (uint16_t j = 0; j < 20000; ++j) {
+                EthernetII packet = make_packet(j, 1000);
+                writer.write(packet);
+            }
+            dropped_packets = writer.dropped_packets();
+            dropped_bytes = writer.dropped_bytes();
+        }
+        // Whatever wasn't dropped is written, in order
+        vector<uint16_t> packets = read_packets();
+        EXPECT_EQ(20000U, packets.size() + dropped_packets);
+        EXPECT_EQ(dropped_packets * (16 + make_packet(0, 1000).size()), dropped_bytes);
+        for (size_t j = 1; j < packets.size(); ++j) {
+            EXPECT_LT(packets[j - 1], packets[j]);
+        }
+    }
+}
+
+TEST_F(PacketWriterTest, AsyncBufferTooSmall) {
+    AsyncWriterConfiguration config;
+    config.set_buffer_size(1024);
+    EXPECT_THROW(PacketWriter(file_name, DataLinkType<EthernetII>(), config), 
+                 runtime_error);
+}
+
+TEST_F(PacketWriterTest, AsyncLinkType) {
+    {
+        PacketWriter writer(file_name, DataLinkType<RawLinkLayer>(), 
+                            AsyncWriterConfiguration());
+    }
+    FILE* fp = fopen(file_name, "rb");
+    ASSERT_TRUE(fp != 0);
+    uint8_t header[24];
+    const size_t size = fread(header, 1, sizeof(header), fp);
+    fclose(fp);
+    ASSERT_EQ(sizeof(header), size);
+    uint32_t link_type;
+    memcpy(&link_type, header + 20, sizeof(link_type));
+    // Files store LINKTYPE_RAW, regardless of DLT_RAW's value
+    EXPECT_EQ(101U, link_type);
+
+    EXPECT_THROW(PacketWriter(file_name, DataLinkType<UnknownLinkLayer>(), 
+                              AsyncWriterConfiguration()),
+                 unknown_link_type);
+}
+
+#endif // TINS_IS_CXX11 && !_WIN32
@@ -0,0 +1,262 @@
+#include <gtest/gtest.h>
+#include <tins/cxxstd.h>
+
+#if TINS_IS_CXX11 && !defined(_WIN32)
+
+#include <string>
+#include <vector>
+#include <atomic>
+#include <cstdio>
+#include <stdexcept>
+#include <stdint.h>
+#include <tins/parallel_pcap_reader.h>
+#include <tins/ethernetII.h>
+#include <tins/ip.h>
+#include <tins/udp.h>
+#include <tins/rawpdu.h>
+#include <tins/exceptions.h>
+#include <unistd.h>
+
+using namespace std;
+using namespace Tins;
+
+class ParallelPcapReaderTest : public testing::Test {
+public:
+    typedef vector<uint8_t> buffer_type;
+
+    static const char* first_file_name;
+    static const char* second_file_name;
+
+    void TearDown();
+
+    static void append(buffer_type& buffer, uint32_t value);
+    static void write_file(const char* file_name, uint16_t first_port, 
+                           uint16_t count, uint32_t first_second,
+                           uint32_t second_step);
+};
+
+const char* ParallelPcapReaderTest::first_file_name = "parallel_pcap_reader_test1.pcap";
+const char* ParallelPcapReaderTest::second_file_name = "parallel_pcap_reader_test2.pcap";
+
+void ParallelPcapReaderTest::TearDown() {
+    remove(first_file_name);
+    remove(second_file_name);
+}
+
+void ParallelPcapReaderTest::append(buffer_type& buffer, uint32_t value) {
+    const uint8_t* ptr = (const uint8_t*)&value;
+    buffer.insert(buffer.end(), ptr, ptr + sizeof(value));
+}
+
+void ParallelPcapReaderTest::write_file(const char* file_name, uint16_t first_port,
+                                        uint16_t count, uint32_t first_second,
+                                        uint32_t second_step) {
+    buffer_type buffer;
+    append(buffer, 0xa1b2c3d4);
+    // Version 2.4
+    append(buffer, 0x00040002);
+    append(buffer, 0);
+    append(buffer, 0);
+    append(buffer, 65535);
+    append(buffer, 1);
+    for (uint16_t i = 0; i < count; ++i) {
+        // Use a different payload size on each packet
+        EthernetII eth = EthernetII() / IP("1.2.3.4", "4.3.2.1") / 
+                         UDP(first_port + i, 1000) / RawPDU(string(i % 50, 'a'));
+        const PDU::serialization_type data = eth.serialize();
+        append(buffer, first_second + i * second_step);
+        append(buffer, 0);
+        append(buffer, static_cast<uint32_t>(data.size()));
+        append(buffer, static_cast<uint32_t>(data.size()));
+        buffer.insert(buffer.end(), data.begin(), data.end());
+    }
+    FILE* fp = fopen(file_name, "wb");
+    ASSERT_TRUE(fp != 0);
+    fwrite(&buffer[0], 1, buffer.size(), fp);
+    fclose(fp);
+}
+
+TEST_F(ParallelPcapReaderTest, SniffLoop) {
+    write_file(first_file_name, 0, 1000, 1, 1);
+    ParallelPcapReader reader(first_file_name, 4);
+    reader.set_chunk_size(4096);
+    EXPECT_GT(reader.chunk_count(), 10U);
+
+    atomic<size_t> count(0);
+    atomic<uint64_t> port_sum(0);
+    reader.sniff_loop([&](Packet& packet) {
+        count++;
+        port_sum += packet.pdu()->rfind_pdu<UDP>().dport();
+        return true;
+    });
+    EXPECT_EQ(1000U, count);
+    EXPECT_EQ(999U * 1000 / 2, port_sum);
+}
+
+TEST_F(ParallelPcapReaderTest, SniffLoopStops) {
+    write_file(first_file_name, 0, 1000, 1, 1);
+    ParallelPcapReader reader(first_file_name, 4);
+    reader.set_chunk_size(1024);
+
+    atomic<size_t> count(0);
+    reader.sniff_loop([&](PDU&) {
+        return ++count < 10;
+    });
+    // Other workers may be in the middle of a packet when the first one stops
+    EXPECT_GE(count, 10U);
+    EXPECT_LT(count, 1000U);
+}
+
+TEST_F(ParallelPcapReaderTest, SniffLoopRethrows) {
+    write_file(first_file_name, 0, 100, 1, 1);
+    ParallelPcapReader reader(first_file_name, 2);
+    reader.set_chunk_size(1024);
+    EXPECT_THROW(
+        reader.sniff_loop([&](PDU&) -> bool {
+            throw runtime_error("error");
+        }),
+        runtime_error
+    );
+}
+
+TEST_F(ParallelPcapReaderTest, MapReduceKeepsFileOrder) {
+    write_file(first_file_name, 0, 500, 1, 1);
+    write_file(second_file_name, 500, 500, 1, 1);
+    vector<string> files;
+    files.push_back(first_file_name);
+    files.push_back(second_file_name);
+    ParallelPcapReader reader(files, 3);
+    reader.set_chunk_size(2048);
+
+    vector<uint16_t> ports = reader.map_reduce(
+        vector<uint16_t>(),
+        [](vector<uint16_t>& partial, Packet& packet) {
+            partial.push_back(packet.pdu()->rfind_pdu<UDP>().dport());
+        },
+        [](vector<uint16_t>& total, const vector<uint16_t>& partial) {
+            total.insert(total.end(), partial.begin(), partial.end());
+        }
+    );
+    ASSERT_EQ(1000U, ports.size());
+    for (size_t i = 0; i < ports.size(); ++i) {
+        EXPECT_EQ(i, ports[i]);
+    }
+}
+
+TEST_F(ParallelPcapReaderTest, SniffOrderedMergesFiles) {
+    // Even and odd seconds, respectively
+    write_file(first_file_name, 0, 400, 0, 2);
+    write_file(second_file_name, 1000, 400, 1, 2);
+    vector<string> files;
+    files.push_back(first_file_name);
+    files.push_back(second_file_name);
+    ParallelPcapReader reader(files, 4);
+    reader.set_chunk_size(1024);
+
+    vector<int64_t> seconds;
+    reader.sniff_ordered([&](Packet& packet) {
+        seconds.push_back(packet.timestamp().seconds());
+        return true;
+    });
+    ASSERT_EQ(800U, seconds.size());
+    for (size_t i = 0; i < seconds.size(); ++i) {
+        EXPECT_EQ(static_cast<int64_t>(i), seconds[i]);
+    }
+}
+
+TEST_F(ParallelPcapReaderTest, SniffOrderedStops) {
+    write_file(first_file_name, 0, 1000, 1, 1);
+    ParallelPcapReader reader(first_file_name, 4);
+    reader.set_chunk_size(1024);
+
+    vector<uint16_t> ports;
+    reader.sniff_ordered([&](Packet& packet) {
+        ports.push_back(packet.pdu()->rfind_pdu<UDP>().dport());
+        return ports.size() < 10;
+    });
+    ASSERT_EQ(10U, ports.size());
+    EXPECT_EQ(9, ports[9]);
+}
+
+TEST_F(ParallelPcapReaderTest, RecordsWithinPackets) {
+    // A packet whose payload is itself a valid sequence of pcap records
+    buffer_type embedded;
+    for (uint16_t i = 0; i < 10; ++i) {
+        EthernetII eth = EthernetII() / IP("1.2.3.4", "4.3.2.1") / 
+                         UDP(9999, 1000) / RawPDU(string(10, 'b'));
+        const PDU::serialization_type data = eth.serialize();
+        append(embedded, 1);
+        append(embedded, 0);
+        append(embedded, static_cast<uint32_t>(data.size()));
+        append(embedded, static_cast<uint32_t>(data.size()));
+        embedded.insert(embedded.end(), data.begin(), data.end());
+    }
+    buffer_type buffer;
+    append(buffer, 0xa1b2c3d4);
+    append(buffer, 0x00040002);
+    append(buffer, 0);
+    append(buffer, 0);
+    append(buffer, 65535);
+    append(buffer, 1);
+    for (uint16_t i = 0; i < 4; ++i) {
+        EthernetII eth = EthernetII() / IP("1.2.3.4", "4.3.2.1") / 
+                         UDP(i, 1000) / RawPDU(embedded);
+        const PDU::serialization_type data = eth.serialize();
+        append(buffer, 1);
+        append(buffer, 0);
+        append(buffer, static_cast<uint32_t>(data.size()));
+        append(buffer, static_cast<uint32_t>(data.size()));
+        buffer.insert(buffer.end(), data.begin(), data.end());
+    }
+    FILE* fp = fopen(first_file_name, "wb");
+    ASSERT_TRUE(fp != 0);
+    fwrite(&buffer[0], 1, buffer.size(), fp);
+    fclose(fp);
+
+    ParallelPcapReader reader(first_file_name, 2);
+    // Most chunks start within a packet, so their first record is guessed
+    // using the embedded ones
+    reader.set_chunk_size(64);
+    EXPECT_GT(reader.chunk_count(), 40U);
+    atomic<size_t> count(0);
+    reader.sniff_loop([&](Packet& packet) {
+        EXPECT_NE(9999, packet.pdu()->rfind_pdu<UDP>().dport());
+        count++;
+        return true;
+    });
+    EXPECT_EQ(4U, count);
+}
+
+TEST_F(ParallelPcapReaderTest, TruncatedRecord) {
+    write_file(first_file_name, 0, 1000, 1, 1);
+    // Cut the last record in half
+    FILE* fp = fopen(first_file_name, "rb");
+    ASSERT_TRUE(fp != 0);
+    fseek(fp, 0, SEEK_END);
+    const long size = ftell(fp);
+    fclose(fp);
+    ASSERT_EQ(0, truncate(first_file_name, size - 20));
+
+    ParallelPcapReader reader(first_file_name, 4);
+    reader.set_chunk_size(1024);
+    EXPECT_THROW(
+        reader.sniff_loop([&](PDU&) { return true; }),
+        capture_file_error
+    );
+    EXPECT_THROW(
+        reader.sniff_ordered([&](PDU&) { return true; }),
+        capture_file_error
+    );
+}
+
+TEST_F(ParallelPcapReaderTest, ExtractRawPDUs) {
+    write_file(first_file_name, 0, 10, 1, 1);
+    ParallelPcapReader reader(first_file_name, 2);
+    reader.set_extract_raw_pdus(true);
+    reader.sniff_ordered([&](PDU& pdu) {
+        EXPECT_EQ(PDU::RAW, pdu.pdu_type());
+        return true;
+    });
+}
+
+#endif // TINS_IS_CXX11 && !_WIN32
@@ -0,0 +1,200 @@
+#include <gtest/gtest.h>
+#include <set>
+#include <map>
+#include <mutex>
+#include <atomic>
+#include <string>
+#include <cstdio>
+#include <stdexcept>
+#include <tins/parallel_sniffer.h>
+#include <tins/packet_writer.h>
+#include <tins/ethernetII.h>
+#include <tins/ip.h>
+#include <tins/tcp.h>
+#include <tins/udp.h>
+#include <tins/rawpdu.h>
+#include <tins/arp.h>
+
+#if TINS_IS_CXX11
+
+using namespace std;
+using namespace Tins;
+
+class ParallelSnifferTest : public testing::Test {
+public:
+    static const char* file_name;
+    static const size_t flow_count;
+    static const size_t packets_per_flow;
+
+    static void SetUpTestCase();
+    static void TearDownTestCase();
+};
+
+const char* ParallelSnifferTest::file_name = "parallel_sniffer_test.pcap";
+const size_t ParallelSnifferTest::flow_count = 16;
+const size_t ParallelSnifferTest::packets_per_flow = 32;
+
+void ParallelSnifferTest::SetUpTestCase() {
+    PacketWriter writer(file_name, DataLinkType<EthernetII>());
+    for (size_t i = 0; i < packets_per_flow; ++i) {
+        for (size_t flow = 0; flow < flow_count; ++flow) {
+            const uint16_t port = static_cast<uint16_t>(1000 + flow);
+            // Alternate directions, which should end up in the same worker
+            EthernetII pkt;
+            if (i % 2 == 0) {
+                pkt = EthernetII() / IP("10.0.0.1", "10.0.0.2") / TCP(80, port);
+            }
+            else {
+                pkt = EthernetII() / IP("10.0.0.2", "10.0.0.1") / TCP(port, 80);
+            }
+            pkt /= RawPDU(string(i * 8, 'a'));
+            writer.write(pkt);
+        }
+    }
+}
+
+void ParallelSnifferTest::TearDownTestCase() {
+    remove(file_name);
+}
+
+struct FlowRecorder {
+    typedef map<uint16_t, set<std::thread::id> > flows_type;
+
+    FlowRecorder(mutex* lock, flows_type* flows, atomic<size_t>* total)
+    : lock(lock), flows(flows), total(total) { }
+
+    bool operator()(Packet& packet) {
+        const TCP& tcp = packet.pdu()->rfind_pdu<TCP>();
+        const uint16_t port = tcp.sport() == 80 ? tcp.dport() : tcp.sport();
+        lock_guard<mutex> _(*lock);
+        (*flows)[port].insert(this_thread::get_id());
+        ++*total;
+        return true;
+    }
+
+    mutex* lock;
+    flows_type* flows;
+    atomic<size_t>* total;
+};
+
+TEST_F(ParallelSnifferTest, ProcessesEveryPacket) {
+    FileSniffer sniffer(file_name);
+    ParallelSniffer parallel_sniffer(sniffer, 4);
+    EXPECT_EQ(4U, parallel_sniffer.worker_count());
+    atomic<size_t> total(0);
+    parallel_sniffer.sniff_loop([&](const PDU& pdu) {
+        EXPECT_TRUE(pdu.find_pdu<TCP>() != 0);
+        total++;
+        return true;
+    });
+    EXPECT_EQ(flow_count * packets_per_flow, total);
+    EXPECT_EQ(flow_count * packets_per_flow, parallel_sniffer.packets_captured());
+    EXPECT_EQ(0U, parallel_sniffer.packets_dropped());
+}
+
+TEST_F(ParallelSnifferTest, SmallQueues) {
+    FileSniffer sniffer(file_name);
+    ParallelSniffer parallel_sniffer(sniffer, 2, 1024);
+    atomic<size_t> total(0);
+    parallel_sniffer.sniff_loop([&](Packet&) {
+        total++;
+        return true;
+    });
+    EXPECT_EQ(flow_count * packets_per_flow, total);
+}
+
+TEST_F(ParallelSnifferTest, OversizedFramesAreDropped) {
+    FileSniffer sniffer(file_name);
+    // Records can take up to half of the queue, so the larger frames, which
+    // are up to 302 bytes long, never fit
+    ParallelSniffer parallel_sniffer(sniffer, 2, 400);
+    atomic<size_t> total(0);
+    parallel_sniffer.sniff_loop([&](Packet& packet) {
+        EXPECT_LT(packet.pdu()->size(), 200U);
+        total++;
+        return true;
+    });
+    EXPECT_GT(total, 0U);
+    EXPECT_GT(parallel_sniffer.packets_dropped(), 0U);
+    EXPECT_EQ(flow_count * packets_per_flow, total + parallel_sniffer.packets_dropped());
+}
+
+TEST_F(ParallelSnifferTest, FlowAffinity) {
+    FileSniffer sniffer(file_name);
+    ParallelSniffer parallel_sniffer(sniffer, 4);
+    parallel_sniffer.set_flow_affinity(true);
+    mutex lock;
+    FlowRecorder::flows_type flows;
+    atomic<size_t> total(0);
+    parallel_sniffer.sniff_loop(FlowRecorder(&lock, &flows, &total));
+    EXPECT_EQ(flow_count * packets_per_flow, total);
+    EXPECT_EQ(flow_count, flows.size());
+    for (FlowRecorder::flows_type::const_iterator it = flows.begin(); it != flows.end(); ++it) {
+        EXPECT_EQ(1U, it->second.size());
+    }
+}
+
+TEST_F(ParallelSnifferTest, FlowAffinityNonIP) {
+    const char* arp_file_name = "parallel_sniffer_arp_test.pcap";
+    {
+        PacketWriter writer(arp_file_name, DataLinkType<EthernetII>());
+        for (size_t i = 0; i < 64; ++i) {
+            EthernetII pkt = EthernetII() / ARP("10.0.0.1", "10.0.0.2");
+            writer.write(pkt);
+        }
+    }
+    FileSniffer sniffer(arp_file_name);
+    ParallelSniffer parallel_sniffer(sniffer, 4);
+    parallel_sniffer.set_flow_affinity(true);
+    mutex lock;
+    set<std::thread::id> threads;
+    atomic<size_t> total(0);
+    parallel_sniffer.sniff_loop([&](Packet&) {
+        lock_guard<mutex> _(lock);
+        threads.insert(this_thread::get_id());
+        ++total;
+        return true;
+    });
+    remove(arp_file_name);
+    // Frames without a flow are distributed using round robin
+    EXPECT_EQ(64U, total);
+    EXPECT_EQ(4U, threads.size());
+}
+
+TEST_F(ParallelSnifferTest, MaxPackets) {
+    FileSniffer sniffer(file_name);
+    ParallelSniffer parallel_sniffer(sniffer, 3);
+    atomic<size_t> total(0);
+    parallel_sniffer.sniff_loop([&](Packet&) {
+        total++;
+        return true;
+    }, 10);
+    EXPECT_EQ(10U, total);
+}
+
+TEST_F(ParallelSnifferTest, StopFromFunctor) {
+    FileSniffer sniffer(file_name);
+    ParallelSniffer parallel_sniffer(sniffer, 2);
+    atomic<size_t> total(0);
+    parallel_sniffer.sniff_loop([&](Packet&) {
+        return ++total < 5;
+    });
+    EXPECT_GE(total, 5U);
+    EXPECT_LT(total, flow_count * packets_per_flow);
+}
+
+TEST_F(ParallelSnifferTest, ExceptionIsPropagated) {
+    FileSniffer sniffer(file_name);
+    ParallelSniffer parallel_sniffer(sniffer, 2);
+    EXPECT_THROW(
+        parallel_sniffer.sniff_loop([](Packet&) -> bool { throw std::logic_error("error"); }),
+        std::logic_error
+    );
+}
+
+TEST_F(ParallelSnifferTest, InvalidWorkerCount) {
+    FileSniffer sniffer(file_name);
+    EXPECT_THROW(ParallelSniffer(sniffer, 0), std::runtime_error);
+}
+
+#endif // TINS_IS_CXX11
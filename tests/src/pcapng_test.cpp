@@ -0,0 +1,319 @@
+#include <gtest/gtest.h>
+#include <string>
+#include <vector>
+#include <cstdio>
+#include <stdint.h>
+#include <tins/pcapng_writer.h>
+#include <tins/pcapng_reader.h>
+#include <tins/ethernetII.h>
+#include <tins/ip.h>
+#include <tins/udp.h>
+#include <tins/rawpdu.h>
+#include <tins/packet.h>
+#include <tins/endianness.h>
+#include <tins/exceptions.h>
+#include <tins/config.h>
+
+#ifdef TINS_HAVE_PCAP
+#include <tins/data_link_type.h>
+
+// Link layers whose DLT_ values aren't covered by libtins' own types
+struct RawLinkLayer { };
+struct UnknownLinkLayer { };
+
+namespace Tins {
+
+template<>
+struct DataLinkType<RawLinkLayer> {
+    int get_type() const {
+        return DLT_RAW;
+    }
+};
+
+template<>
+struct DataLinkType<UnknownLinkLayer> {
+    int get_type() const {
+        // Not assigned on every platform, so it has no LINKTYPE_ value
+        return 50;
+    }
+};
+
+} // Tins
+
+#endif // TINS_HAVE_PCAP
+
+using namespace std;
+using namespace Tins;
+
+class PcapngTest : public testing::Test {
+public:
+    typedef vector<uint8_t> buffer_type;
+
+    static const char* file_name;
+
+    void TearDown();
+
+    static EthernetII make_packet(uint16_t dport, size_t payload_size = 7);
+    static void append32(buffer_type& buffer, uint32_t value);
+    static void append16(buffer_type& buffer, uint16_t value);
+};
+
+const char* PcapngTest::file_name = "pcapng_test.pcapng";
+
+void PcapngTest::TearDown() {
+    remove(file_name);
+}
+
+EthernetII PcapngTest::make_packet(uint16_t dport, size_t payload_size) {
+    return EthernetII() / IP("1.2.3.4", "4.3.2.1") / UDP(dport, 1000) / 
+           RawPDU(string(payload_size, 'a'));
+}
+
+// Appends values in big endian, so the file is swapped on little endian hosts
+void PcapngTest::append32(buffer_type& buffer, uint32_t value) {
+    value = Endian::host_to_be(value);
+    const uint8_t* ptr = (const uint8_t*)&value;
+    buffer.insert(buffer.end(), ptr, ptr + sizeof(value));
+}
+
+void PcapngTest::append16(buffer_type& buffer, uint16_t value) {
+    value = Endian::host_to_be(value);
+    const uint8_t* ptr = (const uint8_t*)&value;
+    buffer.insert(buffer.end(), ptr, ptr + sizeof(value));
+}
+
+TEST_F(PcapngTest, WriteAndRead) {
+    IP ip = IP("1.2.3.4", "4.3.2.1") / UDP(53, 1000);
+    {
+        PcapngWriter writer(file_name);
+        EXPECT_EQ(0U, writer.add_interface(1, "eth0"));
+        EXPECT_EQ(1U, writer.add_interface(101, "", 1500, PcapngWriter::MICROSECONDS));
+        EXPECT_EQ(2U, writer.interface_count());
+
+        EthernetII eth = make_packet(1);
+        const PDU::serialization_type data = eth.serialize();
+        writer.write(&data[0], static_cast<uint32_t>(data.size()), 
+                     static_cast<uint32_t>(data.size() + 10), 100, 123456789, 0);
+        Packet packet(ip, Timestamp());
+        writer.write(packet, 1);
+        writer.write_statistics(0, Timestamp(), 10, 2);
+        EXPECT_THROW(writer.write(ip, 2), invalid_interface);
+    }
+
+    PcapngReader reader(file_name);
+    EXPECT_EQ(1U, reader.section_count());
+    PcapngReader::record record;
+    ASSERT_TRUE(reader.next_record(record));
+    EXPECT_EQ(2U, reader.interface_count());
+    EXPECT_EQ(1, reader.interface(0).link_type);
+    EXPECT_EQ("eth0", reader.interface(0).name);
+    EXPECT_EQ(1000000000ULL, reader.interface(0).units_per_second);
+    EXPECT_EQ(101, reader.interface(1).link_type);
+    EXPECT_EQ(1500U, reader.interface(1).snap_len);
+    EXPECT_EQ(1000000ULL, reader.interface(1).units_per_second);
+
+    EXPECT_EQ(0U, record.interface_id);
+    EXPECT_EQ(make_packet(1).serialize(), 
+              PDU::serialization_type(record.data, record.data + record.size));
+    EXPECT_EQ(record.size + 10, record.wire_size);
+    EXPECT_EQ(100U, record.seconds);
+    EXPECT_EQ(123456789U, record.nanoseconds);
+    EXPECT_EQ(123456, record.timestamp().microseconds());
+
+    ASSERT_TRUE(reader.next_record(record));
+    EXPECT_EQ(1U, record.interface_id);
+    EXPECT_EQ(ip.serialize(), PDU::serialization_type(record.data, record.data + record.size));
+    EXPECT_FALSE(reader.next_record(record));
+    EXPECT_EQ(10U, reader.interface(0).packets_received);
+    EXPECT_EQ(2U, reader.interface(0).packets_dropped);
+    EXPECT_THROW(reader.interface(2), invalid_interface);
+}
+
+TEST_F(PcapngTest, SniffLoopUsesInterfaceLinkTypes) {
+    {
+        PcapngWriter writer(file_name);
+        writer.add_interface(1, "eth0");
+        writer.add_interface(101, "tun0");
+        for (uint16_t i = 0; i < 10; ++i) {
+            EthernetII eth = make_packet(i);
+            if (i % 2 == 0) {
+                writer.write(eth, 0);
+            }
+            else {
+                writer.write(*eth.inner_pdu(), 1);
+            }
+        }
+    }
+
+    PcapngReader reader(file_name);
+    vector<PDU::PDUType> types;
+    vector<uint16_t> ports;
+    reader.sniff_loop([&](const PDU& pdu) {
+        types.push_back(pdu.pdu_type());
+        ports.push_back(pdu.rfind_pdu<UDP>().dport());
+        return true;
+    });
+    ASSERT_EQ(10U, types.size());
+    for (uint16_t i = 0; i < 10; ++i) {
+        EXPECT_EQ(i % 2 == 0 ? PDU::ETHERNET_II : PDU::IP, types[i]);
+        EXPECT_EQ(i, ports[i]);
+    }
+}
+
+TEST_F(PcapngTest, SimplePacketBlocks) {
+    {
+        PcapngWriter writer(file_name);
+        writer.add_interface(1, "eth0", 40);
+        EthernetII eth = make_packet(5, 1);
+        writer.write_simple(eth);
+    }
+
+    PcapngReader reader(file_name);
+    PcapngReader::record record;
+    ASSERT_TRUE(reader.next_record(record));
+    EXPECT_EQ(0U, record.interface_id);
+    EXPECT_EQ(make_packet(5, 1).size(), record.wire_size);
+    // Truncated to the snapshot length
+    EXPECT_EQ(40U, record.size);
+    EXPECT_EQ(0U, record.seconds);
+}
+
+TEST_F(PcapngTest, SmallBuffers) {
+    {
+        PcapngWriter writer(file_name, 64);
+        writer.add_interface(1, "a very long interface name that won't fit");
+        for (uint16_t i = 0; i < 50; ++i) {
+            EthernetII eth = make_packet(i, i * 10 + 1);
+            writer.write(eth, 0);
+        }
+    }
+
+    PcapngReader reader(file_name, 64);
+    uint16_t expected = 0;
+    reader.sniff_loop([&](const PDU& pdu) {
+        EXPECT_EQ(expected, pdu.rfind_pdu<UDP>().dport());
+        EXPECT_EQ(expected * 10U + 1, pdu.rfind_pdu<RawPDU>().payload_size());
+        expected++;
+        return true;
+    });
+    EXPECT_EQ(50, expected);
+    EXPECT_EQ("a very long interface name that won't fit", reader.interface(0).name);
+}
+
+TEST_F(PcapngTest, SwappedMultipleSections) {
+    buffer_type buffer;
+    const PDU::serialization_type data = make_packet(7).serialize();
+    for (int section = 0; section < 2; ++section) {
+        // Section header
+        append32(buffer, 0x0a0d0d0a);
+        append32(buffer, 28);
+        append32(buffer, 0x1a2b3c4d);
+        append16(buffer, 1);
+        append16(buffer, 0);
+        append32(buffer, 0xffffffff);
+        append32(buffer, 0xffffffff);
+        append32(buffer, 28);
+        // Interface description, with a 2^-10 resolution
+        append32(buffer, 1);
+        append32(buffer, 28);
+        append16(buffer, 1);
+        append16(buffer, 0);
+        append32(buffer, 0);
+        append16(buffer, 9);
+        append16(buffer, 1);
+        buffer.push_back(0x8a);
+        buffer.insert(buffer.end(), 3, 0);
+        append32(buffer, 28);
+        // Some unknown block
+        append32(buffer, 0x0bad);
+        append32(buffer, 16);
+        append32(buffer, 0);
+        append32(buffer, 16);
+        // Enhanced packet
+        const uint32_t padded_size = (data.size() + 3) & ~3;
+        append32(buffer, 6);
+        append32(buffer, 32 + padded_size);
+        append32(buffer, 0);
+        append32(buffer, 0);
+        append32(buffer, 5 * 1024 + 512);
+        append32(buffer, static_cast<uint32_t>(data.size()));
+        append32(buffer, static_cast<uint32_t>(data.size()));
+        buffer.insert(buffer.end(), data.begin(), data.end());
+        buffer.insert(buffer.end(), padded_size - data.size(), 0);
+        append32(buffer, 32 + padded_size);
+    }
+    FILE* fp = fopen(file_name, "wb");
+    ASSERT_TRUE(fp != 0);
+    fwrite(&buffer[0], 1, buffer.size(), fp);
+    fclose(fp);
+
+    PcapngReader reader(file_name);
+    for (int section = 0; section < 2; ++section) {
+        PcapngReader::record record;
+        ASSERT_TRUE(reader.next_record(record));
+        EXPECT_EQ(section + 1U, reader.section_count());
+        EXPECT_EQ(1U, reader.interface_count());
+        EXPECT_EQ(1024U, reader.interface(0).units_per_second);
+        EXPECT_EQ(5U, record.seconds);
+        EXPECT_EQ(500000000U, record.nanoseconds);
+        EXPECT_EQ(data, PDU::serialization_type(record.data, record.data + record.size));
+    }
+    Packet packet = reader.next_packet();
+    EXPECT_FALSE(packet);
+}
+
+TEST_F(PcapngTest, InvalidFiles) {
+    EXPECT_THROW(PcapngReader("/this/file/does/not/exist"), capture_file_error);
+    FILE* fp = fopen(file_name, "wb");
+    ASSERT_TRUE(fp != 0);
+    const uint8_t data[] = { 0xd4, 0xc3, 0xb2, 0xa1, 2, 0, 4, 0, 0, 0, 0, 0 };
+    fwrite(data, 1, sizeof(data), fp);
+    fclose(fp);
+    EXPECT_THROW(PcapngReader reader(file_name), capture_file_error);
+}
+
+TEST_F(PcapngTest, OversizedBlock) {
+    {
+        PcapngWriter writer(file_name);
+        writer.add_interface(1);
+    }
+    FILE* fp = fopen(file_name, "ab");
+    ASSERT_TRUE(fp != 0);
+    // An enhanced packet block claiming to be almost 4GB long
+    const uint32_t header[] = { 6, 0xfffffff0 };
+    fwrite(header, 1, sizeof(header), fp);
+    fclose(fp);
+    PcapngReader reader(file_name);
+    PcapngReader::record record;
+    EXPECT_THROW(reader.next_record(record), capture_file_error);
+}
+
+TEST_F(PcapngTest, LongInterfaceName) {
+    PcapngWriter writer(file_name);
+    EXPECT_THROW(writer.add_interface(1, string(70000, 'a')), option_payload_too_large);
+    EXPECT_EQ(0U, writer.interface_count());
+}
+
+#ifdef TINS_HAVE_PCAP
+
+TEST_F(PcapngTest, DataLinkTypes) {
+    {
+        PcapngWriter writer(file_name);
+        EXPECT_EQ(0U, writer.add_interface(DataLinkType<EthernetII>()));
+        EXPECT_EQ(1U, writer.add_interface(DataLinkType<RawLinkLayer>()));
+        EXPECT_THROW(writer.add_interface(DataLinkType<UnknownLinkLayer>()), 
+                     unknown_link_type);
+        EXPECT_EQ(2U, writer.interface_count());
+        EthernetII eth = make_packet(1);
+        writer.write(eth, 0);
+    }
+    PcapngReader reader(file_name);
+    PcapngReader::record record;
+    ASSERT_TRUE(reader.next_record(record));
+    ASSERT_EQ(2U, reader.interface_count());
+    EXPECT_EQ(1, reader.interface(0).link_type);
+    // Files store LINKTYPE_RAW, regardless of DLT_RAW's value
+    EXPECT_EQ(101, reader.interface(1).link_type);
+}
+
+#endif // TINS_HAVE_PCAP
@@ -2,12 +2,15 @@
 #include <algorithm>
 #include <string>
 #include <stdint.h>
+#include <tins/ethernetII.h>
 #include <tins/ip.h>
+#include <tins/ipv6.h>
 #include <tins/tcp.h>
 #include <tins/udp.h>
 #include <tins/rawpdu.h>
 #include <tins/pdu.h>
 #include <tins/packet.h>
+#include <tins/detail/pdu_helpers.h>
 
 using namespace std;
 using namespace Tins;
@@ -28,6 +31,73 @@ TEST_F(PDUTest, FindPDU) {
     EXPECT_THROW(ip.rfind_pdu<UDP>(), pdu_not_found);
 }
 
+TEST_F(PDUTest, FindPDUAfterModification) {
+    IP ip = IP("192.168.0.1") / TCP(22, 52) / RawPDU("Test");
+    TCP* tcp = ip.find_pdu<TCP>();
+    ASSERT_TRUE(tcp != NULL);
+    EXPECT_TRUE(ip.find_pdu<UDP>() == NULL);
+
+    // Replace a layer deep in the chain
+    tcp->inner_pdu(UDP(53, 1234) / RawPDU("Other"));
+    ASSERT_TRUE(ip.find_pdu<UDP>() != NULL);
+    EXPECT_EQ(tcp, ip.find_pdu<UDP>()->parent_pdu());
+    EXPECT_EQ("Other", string(ip.rfind_pdu<RawPDU>().payload().begin(),
+                              ip.rfind_pdu<RawPDU>().payload().end()));
+
+    // Remove the rest of the chain
+    delete ip.release_inner_pdu();
+    EXPECT_TRUE(ip.find_pdu<TCP>() == NULL);
+    EXPECT_TRUE(ip.find_pdu<UDP>() == NULL);
+    EXPECT_TRUE(ip.find_pdu<RawPDU>() == NULL);
+    EXPECT_EQ(&ip, ip.find_pdu<IP>());
+
+    ip /= TCP(22, 52);
+    EXPECT_TRUE(ip.find_pdu<TCP>() != NULL);
+}
+
+TEST_F(PDUTest, FindPDUTunneled) {
+    EthernetII eth = EthernetII() / IP("1.2.3.4") / IP("5.6.7.8") / UDP(53, 1234) / 
+                     RawPDU("Test");
+    IP* outer = eth.find_pdu<IP>();
+    ASSERT_TRUE(outer != NULL);
+    EXPECT_EQ(IPv4Address("1.2.3.4"), outer->dst_addr());
+    IP* inner = outer->inner_pdu()->find_pdu<IP>();
+    ASSERT_TRUE(inner != NULL);
+    EXPECT_EQ(IPv4Address("5.6.7.8"), inner->dst_addr());
+    EXPECT_EQ(inner->inner_pdu(), eth.find_pdu<UDP>());
+    EXPECT_EQ(inner->inner_pdu()->inner_pdu(), outer->find_pdu<RawPDU>());
+
+    // Removing the inner header moves every layer below it up
+    outer->inner_pdu(inner->release_inner_pdu());
+    EXPECT_EQ(outer, eth.find_pdu<IP>());
+    EXPECT_EQ(outer->inner_pdu(), eth.find_pdu<UDP>());
+    EXPECT_EQ(outer, eth.find_pdu<UDP>()->parent_pdu());
+}
+
+TEST_F(PDUTest, HasPDU) {
+    const IP ip = IP("192.168.0.1") / TCP(22, 52) / RawPDU("Test");
+    EXPECT_TRUE(ip.has_pdu<IP>());
+    EXPECT_TRUE(ip.has_pdu<TCP>());
+    EXPECT_TRUE(ip.has_pdu<RawPDU>());
+    EXPECT_FALSE(ip.has_pdu<UDP>());
+    EXPECT_FALSE(ip.has_pdu<IPv6>());
+    EXPECT_TRUE(ip.inner_pdu()->has_pdu<RawPDU>());
+    EXPECT_FALSE(ip.inner_pdu()->has_pdu<IP>());
+}
+
+TEST_F(PDUTest, FindPDUOnCopy) {
+    IP ip = IP("192.168.0.1") / TCP(22, 52);
+    ASSERT_TRUE(ip.find_pdu<TCP>() != NULL);
+    IP copy = ip;
+    EXPECT_EQ(copy.inner_pdu(), copy.find_pdu<TCP>());
+    EXPECT_NE(ip.find_pdu<TCP>(), copy.find_pdu<TCP>());
+    #if TINS_IS_CXX11
+    IP moved = move(copy);
+    EXPECT_EQ(moved.inner_pdu(), moved.find_pdu<TCP>());
+    EXPECT_TRUE(copy.find_pdu<TCP>() == NULL);
+    #endif // TINS_IS_CXX11
+}
+
 TEST_F(PDUTest, PDURelationship) {
     IP packet = IP("192.168.0.1") / TCP(22, 52) / RawPDU("Test");
     IP* ip = packet.find_pdu<IP>();
@@ -102,3 +172,86 @@ TEST_F(PDUTest, TinsCast) {
     EXPECT_THROW(tins_cast<UDP>(*pdu), bad_tins_cast);
 }
 
+
+TEST_F(PDUTest, SerializeInto) {
+    IP packet = IP("192.168.0.1", "192.168.0.2") / TCP(22, 52) / RawPDU("hello");
+    const PDU::serialization_type expected = packet.serialize();
+
+    PDU::serialization_type buffer(1000, 0xff);
+    packet.serialize_into(buffer);
+    EXPECT_EQ(expected, buffer);
+
+    // Reusing a buffer that's too small
+    PDU::serialization_type small_buffer(10);
+    packet.serialize_into(small_buffer);
+    EXPECT_EQ(expected, small_buffer);
+}
+
+TEST_F(PDUTest, SerializeIntoRawBuffer) {
+    IP packet = IP("192.168.0.1", "192.168.0.2") / UDP(22, 52) / RawPDU("hello");
+    const PDU::serialization_type expected = packet.serialize();
+
+    uint8_t buffer[128];
+    EXPECT_EQ(expected.size(), packet.serialize_into(buffer, sizeof(buffer)));
+    EXPECT_TRUE(std::equal(expected.begin(), expected.end(), buffer));
+    EXPECT_THROW(packet.serialize_into(buffer, expected.size() - 1), serialization_error);
+}
+
+PDU::serialization_type gathered_buffer(const Internals::GatherSerialization& buffer) {
+    PDU::serialization_type output(buffer.headers(), 
+                                   buffer.headers() + buffer.headers_size());
+    output.insert(output.end(), buffer.payload(), 
+                  buffer.payload() + buffer.payload_size());
+    return output;
+}
+
+TEST_F(PDUTest, GatherSerializationInnerPayload) {
+    const PDU::serialization_type payload(300, 0x5a);
+    EthernetII packet = EthernetII() / IP("192.168.0.1", "192.168.0.2") / 
+                        TCP(22, 52) / RawPDU(payload.begin(), payload.end());
+    const PDU::serialization_type expected = packet.serialize();
+    {
+        Internals::GatherSerialization buffer(packet, 0, 0, true);
+        EXPECT_EQ(payload.size(), buffer.payload_size());
+        EXPECT_EQ(expected.size(), buffer.size());
+        EXPECT_EQ(expected, gathered_buffer(buffer));
+    }
+    // The payload is put back once we're done
+    ASSERT_TRUE(packet.find_pdu<RawPDU>() != NULL);
+    EXPECT_EQ(expected, packet.serialize());
+}
+
+TEST_F(PDUTest, GatherSerializationExternalPayload) {
+    const PDU::serialization_type payload(1000, 0xa5);
+    IPv6 packet = IPv6("::1", "::2") / UDP(22, 52);
+    IPv6 full_packet = packet / RawPDU(payload.begin(), payload.end());
+    const PDU::serialization_type expected = full_packet.serialize();
+
+    Internals::GatherSerialization buffer(packet, &payload[0], payload.size(), true);
+    EXPECT_EQ(&payload[0], buffer.payload());
+    EXPECT_EQ(expected, gathered_buffer(buffer));
+}
+
+TEST_F(PDUTest, GatherSerializationContiguous) {
+    const PDU::serialization_type payload(1000, 0xa5);
+    IP packet = IP("192.168.0.1", "192.168.0.2") / UDP(22, 52);
+    IP full_packet = packet / RawPDU(payload.begin(), payload.end());
+    const PDU::serialization_type expected = full_packet.serialize();
+
+    {
+        // Gathering is disabled, so the payload is copied after the headers
+        Internals::GatherSerialization buffer(packet, &payload[0], payload.size(), false);
+        EXPECT_EQ(0U, buffer.payload_size());
+        EXPECT_EQ(expected, gathered_buffer(buffer));
+    }
+    EXPECT_TRUE(packet.find_pdu<RawPDU>() == NULL);
+}
+
+TEST_F(PDUTest, GatherSerializationSmallPayload) {
+    IP packet = IP("192.168.0.1", "192.168.0.2") / TCP(22, 52) / RawPDU("hello");
+    const PDU::serialization_type expected = packet.serialize();
+
+    Internals::GatherSerialization buffer(packet, 0, 0, true);
+    EXPECT_EQ(0U, buffer.payload_size());
+    EXPECT_EQ(expected, gathered_buffer(buffer));
+}
@@ -0,0 +1,278 @@
+#include <gtest/gtest.h>
+#include <vector>
+#include <chrono>
+#include <stdexcept>
+#include <stdint.h>
+#include <tins/prober.h>
+#include <tins/packet_sender.h>
+#include <tins/ethernetII.h>
+#include <tins/ip.h>
+#include <tins/ipv6.h>
+#include <tins/tcp.h>
+#include <tins/udp.h>
+#include <tins/icmp.h>
+#include <tins/icmpv6.h>
+#include <tins/arp.h>
+#include <tins/rawpdu.h>
+#include <tins/sniffer.h>
+
+#if TINS_IS_CXX11
+
+using namespace std;
+using namespace Tins;
+
+class ProberTest : public testing::Test {
+public:
+    typedef vector<const PDU*> responses_type;
+
+    ProberTest() 
+    : prober(sender, Prober::duration_type(1000)) {
+
+    }
+
+    Prober::callback_type store_response() {
+        return [this](const PDU* response) {
+            responses.push_back(response);
+        };
+    }
+
+    static Prober::clock_type::time_point after(int seconds) {
+        return Prober::clock_type::now() + chrono::seconds(seconds);
+    }
+
+    PacketSender sender;
+    Prober prober;
+    responses_type responses;
+};
+
+TEST_F(ProberTest, ICMPEcho) {
+    ICMP request(ICMP::ECHO_REQUEST);
+    request.id(0x1234);
+    request.sequence(7);
+    prober.add(IP("10.0.0.2", "10.0.0.1") / request, store_response(), 
+               Prober::duration_type(1000));
+    EXPECT_EQ(1U, prober.pending());
+
+    ICMP reply(ICMP::ECHO_REPLY);
+    reply.id(0x1234);
+    reply.sequence(8);
+    IP wrong_sequence = IP("10.0.0.1", "10.0.0.2") / reply;
+    EXPECT_FALSE(prober.process(wrong_sequence));
+
+    reply.sequence(7);
+    IP response = IP("10.0.0.1", "10.0.0.2") / reply;
+    EXPECT_TRUE(prober.process(response));
+    ASSERT_EQ(1U, responses.size());
+    EXPECT_EQ(&response, responses[0]);
+    EXPECT_EQ(0U, prober.pending());
+    // Responses are only matched once
+    EXPECT_FALSE(prober.process(response));
+}
+
+TEST_F(ProberTest, ICMPv6Echo) {
+    ICMPv6 request(ICMPv6::ECHO_REQUEST);
+    request.identifier(0x4321);
+    request.sequence(3);
+    prober.add(IPv6("2001:db8::2", "2001:db8::1") / request, store_response(), 
+               Prober::duration_type(1000));
+
+    ICMPv6 reply(ICMPv6::ECHO_REPLY);
+    reply.identifier(0x4321);
+    reply.sequence(3);
+    IPv6 other_host = IPv6("2001:db8::1", "2001:db8::3") / reply;
+    EXPECT_FALSE(prober.process(other_host));
+    IPv6 response = IPv6("2001:db8::1", "2001:db8::2") / reply;
+    EXPECT_TRUE(prober.process(response));
+    EXPECT_EQ(1U, responses.size());
+}
+
+TEST_F(ProberTest, TCPHandshake) {
+    TCP syn(80, 40000);
+    syn.flags(TCP::SYN);
+    syn.seq(1000);
+    prober.add(EthernetII() / IP("10.0.0.2", "10.0.0.1") / syn, store_response(), 
+               Prober::duration_type(1000));
+
+    TCP syn_ack(40000, 80);
+    syn_ack.flags(TCP::SYN | TCP::ACK);
+    syn_ack.ack_seq(1000);
+    EthernetII wrong_ack = EthernetII() / IP("10.0.0.1", "10.0.0.2") / syn_ack;
+    EXPECT_FALSE(prober.process(wrong_ack));
+
+    syn_ack.ack_seq(1001);
+    EthernetII response = EthernetII() / IP("10.0.0.1", "10.0.0.2") / syn_ack;
+    EXPECT_TRUE(prober.process(response));
+    EXPECT_EQ(1U, responses.size());
+}
+
+TEST_F(ProberTest, DNSQuery) {
+    const uint8_t query[] = { 0xbe, 0xef, 0x01, 0x00, 0x00, 0x01 };
+    const uint8_t other_id[] = { 0xbe, 0xee, 0x81, 0x80, 0x00, 0x01 };
+    const uint8_t answer[] = { 0xbe, 0xef, 0x81, 0x80, 0x00, 0x01 };
+    prober.add(IP("8.8.8.8", "10.0.0.1") / UDP(53, 5000) / RawPDU(query, sizeof(query)), 
+               store_response(), Prober::duration_type(1000));
+
+    IP wrong_id = IP("10.0.0.1", "8.8.8.8") / UDP(5000, 53) / 
+                  RawPDU(other_id, sizeof(other_id));
+    EXPECT_FALSE(prober.process(wrong_id));
+    IP response = IP("10.0.0.1", "8.8.8.8") / UDP(5000, 53) / RawPDU(answer, sizeof(answer));
+    EXPECT_TRUE(prober.process(response));
+    EXPECT_EQ(1U, responses.size());
+}
+
+TEST_F(ProberTest, UDP) {
+    prober.add(IP("10.0.0.2", "10.0.0.1") / UDP(161, 6000), store_response(), 
+               Prober::duration_type(1000));
+    IP response = IP("10.0.0.1", "10.0.0.2") / UDP(6000, 161) / RawPDU("response");
+    EXPECT_TRUE(prober.process(response));
+    EXPECT_EQ(1U, responses.size());
+}
+
+TEST_F(ProberTest, ICMPErrorQuotingTCP) {
+    TCP syn(443, 40001);
+    syn.flags(TCP::SYN);
+    syn.seq(0xdeadbeef);
+    IP probe = IP("10.0.0.2", "10.0.0.1") / syn;
+    prober.add(probe, store_response(), Prober::duration_type(1000));
+
+    // Routers quote the IP header and the first 8 bytes of its payload
+    PDU::serialization_type quoted = probe.serialize();
+    quoted.resize(probe.header_size() + 8);
+    ICMP time_exceeded(ICMP::TIME_EXCEEDED);
+    IP response = IP("10.0.0.1", "192.168.0.1") / time_exceeded / 
+                  RawPDU(quoted.begin(), quoted.end());
+    EXPECT_TRUE(prober.process(response));
+    EXPECT_EQ(1U, responses.size());
+}
+
+TEST_F(ProberTest, ICMPv6ErrorQuotingUDP) {
+    IPv6 probe = IPv6("2001:db8::2", "2001:db8::1") / UDP(33434, 50000);
+    prober.add(probe, store_response(), Prober::duration_type(1000));
+
+    PDU::serialization_type quoted = probe.serialize();
+    IPv6 response = IPv6("2001:db8::1", "2001:db8::ff") / 
+                    ICMPv6(ICMPv6::DEST_UNREACHABLE) / RawPDU(quoted.begin(), quoted.end());
+    EXPECT_TRUE(prober.process(response));
+    EXPECT_EQ(1U, responses.size());
+}
+
+TEST_F(ProberTest, ARP) {
+    EthernetII request = ARP::make_arp_request("10.0.0.2", "10.0.0.1");
+    prober.add(request, store_response(), Prober::duration_type(1000));
+    EthernetII response = ARP::make_arp_reply("10.0.0.1", "10.0.0.2", 
+                                              "00:01:02:03:04:05", "00:01:02:03:04:06");
+    EXPECT_TRUE(prober.process(response));
+    EXPECT_EQ(1U, responses.size());
+}
+
+TEST_F(ProberTest, Timeout) {
+    ICMP request(ICMP::ECHO_REQUEST);
+    request.id(1);
+    request.sequence(1);
+    prober.add(IP("10.0.0.2", "10.0.0.1") / request, store_response(), 
+               Prober::duration_type(1000));
+    request.sequence(2);
+    prober.add(IP("10.0.0.2", "10.0.0.1") / request, store_response(), 
+               Prober::duration_type(60000));
+
+    EXPECT_EQ(0U, prober.expire(Prober::clock_type::now()));
+    EXPECT_EQ(1U, prober.expire(after(2)));
+    ASSERT_EQ(1U, responses.size());
+    EXPECT_TRUE(responses[0] == 0);
+    EXPECT_EQ(1U, prober.pending());
+
+    // The second timeout is further away than one wheel revolution
+    EXPECT_EQ(0U, prober.expire(after(30)));
+    EXPECT_EQ(1U, prober.expire(after(61)));
+    EXPECT_EQ(0U, prober.pending());
+}
+
+TEST_F(ProberTest, AnsweredProbesDontExpire) {
+    ICMP request(ICMP::ECHO_REQUEST);
+    request.id(1);
+    prober.add(IP("10.0.0.2", "10.0.0.1") / request, store_response(), 
+               Prober::duration_type(1000));
+    ICMP reply(ICMP::ECHO_REPLY);
+    reply.id(1);
+    IP response = IP("10.0.0.1", "10.0.0.2") / reply;
+    EXPECT_TRUE(prober.process(response));
+
+    // Re-registering the same key must not be expired by the stale timer
+    prober.add(IP("10.0.0.2", "10.0.0.1") / request, store_response(), 
+               Prober::duration_type(10000));
+    EXPECT_EQ(0U, prober.expire(after(2)));
+    EXPECT_EQ(1U, prober.pending());
+}
+
+TEST_F(ProberTest, Future) {
+    ICMP request(ICMP::ECHO_REQUEST);
+    request.id(5);
+    Prober::future_type answered = prober.add(IP("10.0.0.2", "10.0.0.1") / request, 
+                                              Prober::duration_type(1000));
+    request.id(6);
+    Prober::future_type timed_out = prober.add(IP("10.0.0.2", "10.0.0.1") / request, 
+                                               Prober::duration_type(1000));
+    ICMP reply(ICMP::ECHO_REPLY);
+    reply.id(5);
+    EXPECT_TRUE(prober.process(IP("10.0.0.1", "10.0.0.2") / reply));
+    EXPECT_EQ(1U, prober.expire(after(2)));
+
+    unique_ptr<PDU> response = answered.get();
+    ASSERT_TRUE(response.get() != 0);
+    EXPECT_EQ(5, response->rfind_pdu<ICMP>().id());
+    EXPECT_TRUE(timed_out.get().get() == 0);
+}
+
+TEST_F(ProberTest, DuplicateProbe) {
+    ICMP request(ICMP::ECHO_REQUEST);
+    request.id(5);
+    prober.add(IP("10.0.0.2", "10.0.0.1") / request, [](const PDU*) { }, 
+               Prober::duration_type(1000));
+    EXPECT_THROW(prober.add(IP("10.0.0.2", "10.0.0.1") / request, [](const PDU*) { }, 
+                            Prober::duration_type(1000)), 
+                 runtime_error);
+}
+
+TEST_F(ProberTest, UnsupportedProbe) {
+    EXPECT_THROW(prober.add(IP("10.0.0.2", "10.0.0.1") / RawPDU("foo"), store_response(),
+                            Prober::duration_type(1000)), 
+                 runtime_error);
+    EXPECT_THROW(prober.add(IP("10.0.0.2", "10.0.0.1") / ICMP(ICMP::ECHO_REPLY), 
+                            store_response(), Prober::duration_type(1000)), 
+                 runtime_error);
+    EXPECT_EQ(0U, prober.pending());
+}
+
+TEST_F(ProberTest, UnrelatedPackets) {
+    EXPECT_FALSE(prober.process(IP("10.0.0.1", "10.0.0.2") / TCP(1, 2)));
+    EXPECT_FALSE(prober.process(EthernetII() / RawPDU("foo")));
+    EXPECT_FALSE(prober.process(IP("10.0.0.1", "10.0.0.2") / ICMP(ICMP::ECHO_REQUEST)));
+}
+
+#ifdef TINS_HAVE_PCAP
+
+TEST_F(ProberTest, RunWithoutResponses) {
+    try {
+        SnifferConfiguration config;
+        // Nothing is ever captured
+        config.set_filter("udp port 9 and udp port 10");
+        Sniffer sniffer("lo", config);
+        ICMP request(ICMP::ECHO_REQUEST);
+        request.id(7);
+        prober.add(IP("127.0.0.1", "127.0.0.1") / request, store_response(), 
+                   Prober::duration_type(100));
+        const Prober::clock_type::time_point start = Prober::clock_type::now();
+        prober.run(sniffer);
+        // Timeouts fire even though no packets are read
+        EXPECT_LT(Prober::clock_type::now() - start, chrono::seconds(2));
+        ASSERT_EQ(1U, responses.size());
+        EXPECT_TRUE(responses[0] == 0);
+    }
+    catch (pcap_error&) {
+        // No privileges to capture packets
+    }
+}
+
+#endif // TINS_HAVE_PCAP
+
+#endif // TINS_IS_CXX11
@@ -0,0 +1,155 @@
+#include <gtest/gtest.h>
+#include <string>
+#include <vector>
+#include <tins/ring_sniffer.h>
+#include <tins/packet_sender.h>
+#include <tins/ethernetII.h>
+#include <tins/ip.h>
+#include <tins/udp.h>
+#include <tins/rawpdu.h>
+
+#ifdef TINS_HAVE_PACKET_RING
+
+using namespace std;
+using namespace Tins;
+
+class RingSnifferTest : public testing::Test {
+public:
+    static const uint16_t dport;
+
+    static RingSnifferConfiguration make_configuration();
+    static void send_packets(size_t count);
+    static bool is_test_packet(const PDU& pdu);
+};
+
+const uint16_t RingSnifferTest::dport = 49152;
+
+RingSnifferConfiguration RingSnifferTest::make_configuration() {
+    RingSnifferConfiguration config;
+    config.set_block_size(1 << 16);
+    config.set_block_count(4);
+    config.set_block_timeout(10);
+    config.set_timeout(1000);
+    return config;
+}
+
+void RingSnifferTest::send_packets(size_t count) {
+    PacketSender sender;
+    EthernetII pkt = EthernetII() / IP("127.0.0.1", "127.0.0.1") / 
+                     UDP(dport, 1234) / RawPDU("ring sniffer");
+    for (size_t i = 0; i < count; ++i) {
+        sender.send(pkt, "lo");
+    }
+}
+
+bool RingSnifferTest::is_test_packet(const PDU& pdu) {
+    const UDP* udp = pdu.find_pdu<UDP>();
+    return udp && udp->dport() == dport;
+}
+
+TEST_F(RingSnifferTest, InvalidGeometry) {
+    RingSnifferConfiguration config;
+    config.set_block_size(4096);
+    config.set_frame_size(3000);
+    EXPECT_THROW(RingSniffer("lo", config), std::runtime_error);
+}
+
+TEST_F(RingSnifferTest, NextPacket) {
+    try {
+        RingSniffer sniffer("lo", make_configuration());
+        send_packets(3);
+        size_t found = 0;
+        for (RingSniffer::iterator it = sniffer.begin(); it != sniffer.end(); ++it) {
+            if (is_test_packet(*it->pdu())) {
+                const RawPDU& raw = it->pdu()->rfind_pdu<RawPDU>();
+                EXPECT_EQ("ring sniffer", string(raw.payload().begin(), raw.payload().end()));
+                if (++found == 3) {
+                    break;
+                }
+            }
+        }
+        EXPECT_EQ(3U, found);
+        EXPECT_GE(sniffer.stats().packets, 3U);
+    }
+    catch (socket_open_error&) {
+        // No privileges to open packet sockets
+    }
+}
+
+TEST_F(RingSnifferTest, NextBlock) {
+    try {
+        RingSniffer sniffer("lo", make_configuration());
+        send_packets(5);
+        size_t found = 0;
+        vector<Packet> packets;
+        // Packets sent through the loopback device are captured twice
+        while (found < 5 && sniffer.next_block(packets) > 0) {
+            for (size_t i = 0; i < packets.size(); ++i) {
+                if (is_test_packet(*packets[i].pdu())) {
+                    found++;
+                }
+            }
+        }
+        EXPECT_GE(found, 5U);
+    }
+    catch (socket_open_error&) {
+        // No privileges to open packet sockets
+    }
+}
+
+TEST_F(RingSnifferTest, SniffLoop) {
+    try {
+        RingSniffer sniffer("lo", make_configuration());
+        sniffer.set_lazy_decoding(true);
+        send_packets(2);
+        size_t found = 0;
+        sniffer.sniff_loop([&](PDU& pdu) {
+            if (is_test_packet(pdu)) {
+                found++;
+            }
+            return found < 2;
+        });
+        EXPECT_EQ(2U, found);
+    }
+    catch (socket_open_error&) {
+        // No privileges to open packet sockets
+    }
+}
+
+TEST_F(RingSnifferTest, StopSniffWithPendingPackets) {
+    try {
+        RingSniffer sniffer("lo", make_configuration());
+        send_packets(4);
+        Packet packet = sniffer.next_packet();
+        ASSERT_TRUE(packet.pdu() != 0);
+        // Packets are still available, yet the stop request must be honored
+        sniffer.stop_sniff();
+        packet = sniffer.next_packet();
+        EXPECT_TRUE(packet.pdu() == 0);
+        // The request is consumed, so sniffing can be resumed
+        packet = sniffer.next_packet();
+        EXPECT_TRUE(packet.pdu() != 0);
+    }
+    catch (socket_open_error&) {
+        // No privileges to open packet sockets
+    }
+}
+
+TEST_F(RingSnifferTest, Timeout) {
+    try {
+        RingSnifferConfiguration config = make_configuration();
+        config.set_timeout(50);
+        RingSniffer sniffer("lo", config);
+        // Drain anything we may have captured, until the timeout expires
+        size_t packets = 0;
+        while (sniffer.next_packet() && packets < 1000) {
+            packets++;
+        }
+        EXPECT_LT(packets, 1000U);
+    }
+    catch (socket_open_error&) {
+        // No privileges to open packet sockets
+    }
+}
+
+#endif // TINS_HAVE_PACKET_RING
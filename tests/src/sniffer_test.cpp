@@ -0,0 +1,181 @@
+#include <gtest/gtest.h>
+#include <tins/cxxstd.h>
+
+#if TINS_IS_CXX11 && !defined(_WIN32)
+
+#include <string>
+#include <vector>
+#include <cstdio>
+#include <stdint.h>
+#include <tins/sniffer.h>
+#include <tins/packet_writer.h>
+#include <tins/ethernetII.h>
+#include <tins/ip.h>
+#include <tins/udp.h>
+#include <tins/rawpdu.h>
+#include <tins/exceptions.h>
+
+using namespace std;
+using namespace Tins;
+
+class SnifferTest : public testing::Test {
+public:
+    static const char* file_name;
+
+    void TearDown();
+
+    static void write_packets(uint16_t count);
+    static void append_truncated_record();
+    static vector<uint16_t> dports(const vector<Packet>& packets);
+};
+
+const char* SnifferTest::file_name = "sniffer_test.pcap";
+
+void SnifferTest::TearDown() {
+    remove(file_name);
+}
+
+// Packets are numbered using their destination port
+void SnifferTest::write_packets(uint16_t count) {
+    PacketWriter writer(file_name, DataLinkType<EthernetII>());
+    for (uint16_t i = 0; i < count; ++i) {
+        EthernetII eth = EthernetII() / IP("1.2.3.4", "4.3.2.1") / UDP(i, 1000) /
+                         RawPDU(string(100, 'a'));
+        writer.write(eth);
+    }
+    writer.close();
+}
+
+// Appends a record that claims to be longer than the data that follows it
+void SnifferTest::append_truncated_record() {
+    FILE* fp = fopen(file_name, "ab");
+    ASSERT_TRUE(fp != 0);
+    const uint32_t header[] = { 0, 0, 100, 100 };
+    const uint8_t data[10] = { };
+    fwrite(header, 1, sizeof(header), fp);
+    fwrite(data, 1, sizeof(data), fp);
+    fclose(fp);
+}
+
+vector<uint16_t> SnifferTest::dports(const vector<Packet>& packets) {
+    vector<uint16_t> output;
+    for (size_t i = 0; i < packets.size(); ++i) {
+        output.push_back(packets[i].pdu()->rfind_pdu<UDP>().dport());
+    }
+    return output;
+}
+
+TEST_F(SnifferTest, NextPackets) {
+    write_packets(10);
+    FileSniffer sniffer(file_name);
+    vector<Packet> packets;
+    const uint16_t expected_first[] = { 0, 1, 2, 3 };
+    EXPECT_EQ(4U, sniffer.next_packets(packets, 4));
+    EXPECT_EQ(vector<uint16_t>(expected_first, expected_first + 4), dports(packets));
+
+    // The container is cleared on every call
+    const uint16_t expected_second[] = { 4, 5, 6, 7 };
+    EXPECT_EQ(4U, sniffer.next_packets(packets, 4));
+    EXPECT_EQ(vector<uint16_t>(expected_second, expected_second + 4), dports(packets));
+
+    // Only the remaining packets are read, then the end of the file is reached
+    const uint16_t expected_last[] = { 8, 9 };
+    EXPECT_EQ(2U, sniffer.next_packets(packets, 4));
+    EXPECT_EQ(vector<uint16_t>(expected_last, expected_last + 2), dports(packets));
+    EXPECT_EQ(0U, sniffer.next_packets(packets, 4));
+    EXPECT_TRUE(packets.empty());
+}
+
+TEST_F(SnifferTest, NextPacketsSingleBatch) {
+    write_packets(3);
+    FileSniffer sniffer(file_name);
+    vector<Packet> packets;
+    EXPECT_EQ(3U, sniffer.next_packets(packets, 100));
+    EXPECT_EQ(3U, packets.size());
+    EXPECT_EQ(0U, sniffer.next_packets(packets, 100));
+}
+
+TEST_F(SnifferTest, NextPacketsEmptyFile) {
+    write_packets(0);
+    FileSniffer sniffer(file_name);
+    vector<Packet> packets;
+    EXPECT_EQ(0U, sniffer.next_packets(packets, 10));
+    EXPECT_TRUE(packets.empty());
+}
+
+TEST_F(SnifferTest, NextPacketsReadError) {
+    write_packets(0);
+    append_truncated_record();
+    FileSniffer sniffer(file_name);
+    vector<Packet> packets;
+    // Nothing could be read before failing
+    EXPECT_THROW(sniffer.next_packets(packets, 10), pcap_error);
+}
+
+TEST_F(SnifferTest, NextPacketsReadErrorAfterPackets) {
+    write_packets(3);
+    append_truncated_record();
+    FileSniffer sniffer(file_name);
+    vector<Packet> packets;
+    // The packets read before the error are still returned
+    EXPECT_EQ(3U, sniffer.next_packets(packets, 10));
+    EXPECT_EQ(3U, packets.size());
+}
+
+TEST_F(SnifferTest, SniffBatch) {
+    write_packets(10);
+    FileSniffer sniffer(file_name);
+    vector<size_t> sizes;
+    uint16_t expected = 0;
+    sniffer.sniff_batch([&](vector<Packet>& packets) {
+        sizes.push_back(packets.size());
+        for (size_t i = 0; i < packets.size(); ++i) {
+            EXPECT_EQ(expected++, packets[i].pdu()->rfind_pdu<UDP>().dport());
+        }
+        return true;
+    }, 3);
+    const size_t expected_sizes[] = { 3, 3, 3, 1 };
+    EXPECT_EQ(vector<size_t>(expected_sizes, expected_sizes + 4), sizes);
+    EXPECT_EQ(10, expected);
+}
+
+TEST_F(SnifferTest, SniffBatchMaxPackets) {
+    write_packets(10);
+    FileSniffer sniffer(file_name);
+    vector<size_t> sizes;
+    sniffer.sniff_batch([&](vector<Packet>& packets) {
+        sizes.push_back(packets.size());
+        return true;
+    }, 3, 5);
+    // The last batch is shortened so that max_packets isn't exceeded
+    const size_t expected_sizes[] = { 3, 2 };
+    EXPECT_EQ(vector<size_t>(expected_sizes, expected_sizes + 2), sizes);
+}
+
+TEST_F(SnifferTest, SniffBatchStop) {
+    write_packets(10);
+    FileSniffer sniffer(file_name);
+    size_t batches = 0;
+    sniffer.sniff_batch([&](vector<Packet>&) {
+        ++batches;
+        return false;
+    }, 4);
+    EXPECT_EQ(1U, batches);
+
+    // The loop can be resumed where it stopped
+    vector<Packet> packets;
+    EXPECT_EQ(4U, sniffer.next_packets(packets, 4));
+    EXPECT_EQ(4, packets[0].pdu()->rfind_pdu<UDP>().dport());
+}
+
+TEST_F(SnifferTest, SniffBatchReadError) {
+    write_packets(0);
+    append_truncated_record();
+    FileSniffer sniffer(file_name);
+    EXPECT_THROW(
+        sniffer.sniff_batch([](vector<Packet>&) { return true; }, 4),
+        pcap_error
+    );
+}
+
+#endif // TINS_IS_CXX11 && !_WIN32
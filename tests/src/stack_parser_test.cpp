@@ -0,0 +1,165 @@
+#include <gtest/gtest.h>
+#include <tins/cxxstd.h>
+
+#if TINS_IS_CXX11
+
+#include <tuple>
+#include <string>
+#include <vector>
+#include <stdint.h>
+#include <tins/stack_parser.h>
+#include <tins/ethernetII.h>
+#include <tins/dot1q.h>
+#include <tins/arp.h>
+#include <tins/ip.h>
+#include <tins/ipv6.h>
+#include <tins/tcp.h>
+#include <tins/udp.h>
+#include <tins/icmp.h>
+#include <tins/rawpdu.h>
+#include <tins/exceptions.h>
+
+using namespace std;
+using namespace Tins;
+
+class StackParserTest : public testing::Test {
+public:
+    static PDU::serialization_type tcp_packet();
+};
+
+PDU::serialization_type StackParserTest::tcp_packet() {
+    EthernetII eth = EthernetII("00:01:02:03:04:05", "06:07:08:09:0a:0b") /
+                     IP("192.168.0.1", "10.0.0.1") / TCP(80, 12345) / RawPDU("hello");
+    eth.rfind_pdu<IP>().ttl(32);
+    eth.rfind_pdu<TCP>().seq(0x01020304);
+    eth.rfind_pdu<TCP>().mss(1460);
+    return eth.serialize();
+}
+
+TEST_F(StackParserTest, EthernetIPTCP) {
+    PDU::serialization_type buffer = tcp_packet();
+    EthernetII eth;
+    IP ip;
+    TCP tcp;
+    RawPDU raw("");
+    tie(eth, ip, tcp, raw) = parse_stack<EthernetII, IP, TCP, RawPDU>(
+        &buffer[0], 
+        static_cast<uint32_t>(buffer.size())
+    );
+
+    EXPECT_EQ(HWAddress<6>("00:01:02:03:04:05"), eth.dst_addr());
+    EXPECT_EQ(HWAddress<6>("06:07:08:09:0a:0b"), eth.src_addr());
+    EXPECT_EQ(IPv4Address("192.168.0.1"), ip.dst_addr());
+    EXPECT_EQ(IPv4Address("10.0.0.1"), ip.src_addr());
+    EXPECT_EQ(32, ip.ttl());
+    EXPECT_EQ(80, tcp.dport());
+    EXPECT_EQ(12345, tcp.sport());
+    EXPECT_EQ(0x01020304U, tcp.seq());
+    EXPECT_EQ(1460, tcp.mss());
+    EXPECT_EQ("hello", string(raw.payload().begin(), raw.payload().end()));
+
+    // Layers only contain their own header
+    EXPECT_TRUE(eth.inner_pdu() == 0);
+    EXPECT_TRUE(ip.inner_pdu() == 0);
+    EXPECT_TRUE(tcp.inner_pdu() == 0);
+}
+
+TEST_F(StackParserTest, HeaderViews) {
+    PDU::serialization_type buffer = tcp_packet();
+    tuple<PacketView::EthernetHeader, PacketView::IPHeader, PacketView::TCPHeader> headers =
+        parse_stack<PacketView::EthernetHeader, PacketView::IPHeader, PacketView::TCPHeader>(
+            &buffer[0], 
+            static_cast<uint32_t>(buffer.size())
+        );
+    EXPECT_EQ(HWAddress<6>("00:01:02:03:04:05"), get<0>(headers).dst_addr());
+    EXPECT_EQ(IPv4Address("192.168.0.1"), get<1>(headers).dst_addr());
+    EXPECT_EQ(80, get<2>(headers).dport());
+    EXPECT_EQ(0x01020304U, get<2>(headers).seq());
+}
+
+TEST_F(StackParserTest, Truncated) {
+    PDU::serialization_type buffer = tcp_packet();
+    // Cut in the middle of the TCP options
+    const uint32_t size = 14 + 20 + 22;
+    EXPECT_FALSE((matches_stack<EthernetII, IP, TCP>(&buffer[0], size)));
+    EXPECT_THROW((parse_stack<EthernetII, IP, TCP>(&buffer[0], size)), malformed_packet);
+    // The ethernet and IP headers are still there
+    EXPECT_TRUE((matches_stack<EthernetII, IP>(&buffer[0], size)));
+}
+
+TEST_F(StackParserTest, Mismatch) {
+    PDU::serialization_type buffer = tcp_packet();
+    const uint32_t size = static_cast<uint32_t>(buffer.size());
+    EXPECT_TRUE((matches_stack<EthernetII, IP, TCP>(&buffer[0], size)));
+    EXPECT_FALSE((matches_stack<EthernetII, IP, UDP>(&buffer[0], size)));
+    EXPECT_FALSE((matches_stack<EthernetII, IPv6, TCP>(&buffer[0], size)));
+    EXPECT_FALSE((matches_stack<EthernetII, Dot1Q, IP>(&buffer[0], size)));
+    EXPECT_THROW((parse_stack<EthernetII, IP, UDP>(&buffer[0], size)), pdu_not_found);
+}
+
+TEST_F(StackParserTest, TrimsPadding) {
+    EthernetII eth = EthernetII() / IP("1.2.3.4") / UDP(53, 1234) / RawPDU("abcd");
+    PDU::serialization_type buffer = eth.serialize();
+    buffer.insert(buffer.end(), 8, 0xee);
+    tuple<EthernetII, IP, UDP, RawPDU> layers = parse_stack<EthernetII, IP, UDP, RawPDU>(
+        &buffer[0], 
+        static_cast<uint32_t>(buffer.size())
+    );
+    const RawPDU::payload_type& payload = get<3>(layers).payload();
+    EXPECT_EQ("abcd", string(payload.begin(), payload.end()));
+}
+
+TEST_F(StackParserTest, NonInitialFragment) {
+    EthernetII eth = EthernetII() / IP("1.2.3.4") / UDP(53, 1234) / RawPDU("abcd");
+    eth.rfind_pdu<IP>().fragment_offset(10);
+    PDU::serialization_type buffer = eth.serialize();
+    const uint32_t size = static_cast<uint32_t>(buffer.size());
+    EXPECT_FALSE((matches_stack<EthernetII, IP, UDP>(&buffer[0], size)));
+    EXPECT_TRUE((matches_stack<EthernetII, IP, RawPDU>(&buffer[0], size)));
+}
+
+TEST_F(StackParserTest, Dot1QIPv6) {
+    IPv6 ipv6("fe80::1", "fe80::2");
+    ipv6.add_header(IPv6::ext_header(IPv6::DESTINATION_OPTIONS, 6, (const uint8_t*)"\x01\x04\x00\x00\x00\x00"));
+    EthernetII eth = EthernetII() / Dot1Q(10) / ipv6 / UDP(53, 1234) / RawPDU("abcd");
+    PDU::serialization_type buffer = eth.serialize();
+    tuple<EthernetII, Dot1Q, IPv6, UDP, RawPDU> layers = 
+        parse_stack<EthernetII, Dot1Q, IPv6, UDP, RawPDU>(
+            &buffer[0], 
+            static_cast<uint32_t>(buffer.size())
+        );
+    EXPECT_EQ(10, get<1>(layers).id());
+    EXPECT_EQ(IPv6Address("fe80::1"), get<2>(layers).dst_addr());
+    EXPECT_EQ(1U, get<2>(layers).headers().size());
+    EXPECT_EQ(53, get<3>(layers).dport());
+    EXPECT_EQ(4U, get<4>(layers).payload_size());
+
+    typedef PacketView::IPv6Header ipv6_header;
+    EXPECT_EQ(IPv6Address("fe80::2"), 
+              get<2>((parse_stack<PacketView::EthernetHeader, PacketView::Dot1QHeader, 
+                                  ipv6_header, PacketView::UDPHeader>(
+                  &buffer[0], 
+                  static_cast<uint32_t>(buffer.size())
+              ))).src_addr());
+}
+
+TEST_F(StackParserTest, TerminalLayer) {
+    EthernetII eth = EthernetII() / IP("1.2.3.4") / ICMP(ICMP::ECHO_REQUEST) / RawPDU("ping");
+    PDU::serialization_type buffer = eth.serialize();
+    const uint32_t size = static_cast<uint32_t>(buffer.size());
+    EXPECT_FALSE((matches_stack<EthernetII, IP, TCP>(&buffer[0], size)));
+    tuple<EthernetII, IP, ICMP> layers = parse_stack<EthernetII, IP, ICMP>(&buffer[0], size);
+    EXPECT_EQ(ICMP::ECHO_REQUEST, get<2>(layers).type());
+    // Terminal layers decode the rest of the buffer
+    ASSERT_TRUE(get<2>(layers).find_pdu<RawPDU>() != 0);
+    EXPECT_EQ(4U, get<2>(layers).rfind_pdu<RawPDU>().payload_size());
+
+    EthernetII arp = ARP::make_arp_request("1.2.3.4", "1.2.3.5");
+    buffer = arp.serialize();
+    EXPECT_TRUE((matches_stack<EthernetII, ARP>(&buffer[0], 
+                                                static_cast<uint32_t>(buffer.size()))));
+    EXPECT_FALSE((matches_stack<EthernetII, IP>(&buffer[0], 
+                                               static_cast<uint32_t>(buffer.size()))));
+}
+
+#endif // TINS_IS_CXX11
@@ -1,11 +1,13 @@
 #include <gtest/gtest.h>
 #include <cstring>
 #include <string>
+#include <vector>
 #include <algorithm>
 #include <stdint.h>
 #include <tins/tcp.h>
 #include <tins/ip.h>
 #include <tins/ethernetII.h>
+#include <tins/rawpdu.h>
 
 using namespace std;
 using namespace Tins;
@@ -72,6 +74,23 @@ TEST_F(TCPTest, ChecksumCheck) {
     
 }
 
+TEST_F(TCPTest, ChecksumLargeRawPayload) {
+    // Odd sized, so the trailing byte is padded while copying it
+    vector<uint8_t> payload(1001);
+    for (size_t i = 0; i < payload.size(); ++i) {
+        payload[i] = static_cast<uint8_t>(i * 7);
+    }
+    EthernetII pkt = EthernetII() / IP("192.168.0.1", "10.0.0.1") / 
+                     TCP(80, 12345) / RawPDU(payload);
+    PDU::serialization_type buffer = pkt.serialize();
+    const TCP& tcp = pkt.rfind_pdu<TCP>();
+    EXPECT_EQ(tcp.calculate_checksum(), tcp.checksum());
+
+    EthernetII parsed(&buffer[0], (uint32_t)buffer.size());
+    EXPECT_EQ(tcp.checksum(), parsed.rfind_pdu<TCP>().checksum());
+    EXPECT_EQ(payload, parsed.rfind_pdu<RawPDU>().payload());
+}
+
 TEST_F(TCPTest, CopyConstructor) {
     TCP tcp1(0x6d1f, 0x78f2);
     TCP tcp2(tcp1);
@@ -269,6 +288,15 @@ TEST_F(TCPTest, Serialize) {
     EXPECT_TRUE(std::equal(buffer.begin(), buffer.end(), expected_packet));
 }
 
+TEST_F(TCPTest, FixedChecksum) {
+    TCP tcp1(expected_packet, sizeof(expected_packet));
+    tcp1.checksum(0x1234);
+    EXPECT_EQ(0x1234, tcp1.checksum());
+    PDU::serialization_type buffer = tcp1.serialize();
+    ASSERT_EQ(buffer.size(), sizeof(expected_packet));
+    EXPECT_EQ(0x1234, (buffer[16] << 8 | buffer[17]));
+}
+
 TEST_F(TCPTest, SpoofedOptions) {
     TCP pdu;
     uint8_t a[] = { 1,2,3,4,5,6 };
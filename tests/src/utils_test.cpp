@@ -1,5 +1,8 @@
 #include <iostream>
 #include <stdexcept>
+#include <vector>
+#include <algorithm>
+#include <cstring>
 #include <gtest/gtest.h>
 #include <tins/utils.h>
 #include <tins/endianness.h>
@@ -71,3 +74,70 @@ TEST_F(UtilsTest, Crc32) {
 
     EXPECT_EQ(crc, 0x78840f54U);
 }
+
+// Adds up the data 16 bits at a time, padding an odd trailing byte
+static uint16_t reference_sum(const uint8_t* start, const uint8_t* end) {
+    uint32_t sum = 0;
+    for (const uint8_t* ptr = start; ptr < end; ptr += 2) {
+        uint8_t word[2] = { ptr[0], (ptr + 1 < end) ? ptr[1] : uint8_t(0) };
+        uint16_t value;
+        memcpy(&value, word, sizeof(value));
+        sum += value;
+    }
+    return Utils::fold_sum(sum);
+}
+
+TEST_F(UtilsTest, SumRange) {
+    // Cover every alignment and the tails left by each vector width
+    for (uint32_t offset = 0; offset < 8; ++offset) {
+        for (uint32_t size = 0; size + offset <= data_len; size += 7) {
+            const uint8_t* start = data + offset;
+            EXPECT_EQ(reference_sum(start, start + size), Utils::sum_range(start, start + size));
+        }
+    }
+}
+
+TEST_F(UtilsTest, SumRangeAllOnes) {
+    std::vector<uint8_t> buffer(9000, 0xff);
+    EXPECT_EQ(
+        reference_sum(&buffer[0], &buffer[0] + buffer.size()),
+        Utils::sum_range(&buffer[0], &buffer[0] + buffer.size())
+    );
+}
+
+TEST_F(UtilsTest, CopyAndSumRange) {
+    for (uint32_t size = 0; size + 3 <= data_len; size += 13) {
+        std::vector<uint8_t> output(size + 1, 0xaa);
+        const uint8_t* start = data + 3;
+        EXPECT_EQ(
+            Utils::sum_range(start, start + size),
+            Utils::copy_and_sum_range(start, start + size, &output[0])
+        );
+        EXPECT_TRUE(std::equal(start, start + size, output.begin()));
+        EXPECT_EQ(0xaa, output[size]);
+    }
+}
+
+TEST_F(UtilsTest, PseudoHeaderChecksum) {
+    const uint8_t ipv4_header[] = {
+        192, 168, 0, 1, 10, 0, 0, 1, 0, 6, 0x05, 0xdc
+    };
+    EXPECT_EQ(
+        reference_sum(ipv4_header, ipv4_header + sizeof(ipv4_header)),
+        Utils::fold_sum(Utils::pseudoheader_checksum(
+            IPv4Address("192.168.0.1"), IPv4Address("10.0.0.1"), 1500, 6
+        ))
+    );
+
+    uint8_t ipv6_header[36] = { 0 };
+    IPv6Address source("2001:db8::1234:5678"), dest("fe80::abcd");
+    std::copy(source.begin(), source.end(), ipv6_header);
+    std::copy(dest.begin(), dest.end(), ipv6_header + 16);
+    ipv6_header[33] = 17;
+    ipv6_header[34] = 0x01;
+    ipv6_header[35] = 0x02;
+    EXPECT_EQ(
+        reference_sum(ipv6_header, ipv6_header + sizeof(ipv6_header)),
+        Utils::fold_sum(Utils::pseudoheader_checksum(source, dest, 0x0102, 17))
+    );
+}